@@ -0,0 +1,419 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <glib.h>
+#include "gclue-3g-cache.h"
+#include "gclue-cache-file.h"
+
+/**
+ * SECTION:gclue-3g-cache
+ * @short_description: Persistent LRU cache of 3GPP cell tower locations
+ * @include: gclue-glib/gclue-3g-cache.h
+ *
+ * Maps 3GPP cell towers (MCC, MNC, LAC and cell ID) to the location the web
+ * service returned for them, so that towers we have already resolved don't
+ * need another network round-trip. The least recently used towers are
+ * dropped once the cache is full. The cache is kept on disk across restarts.
+ **/
+
+#define CACHE_FILE_NAME "3g-cache"
+
+/* Bump this whenever the serialized format below changes */
+#define CACHE_VERSION 1
+#define CACHE_VARIANT_TYPE "(ua(uuttdddt))"
+
+#define CACHE_MAX_ENTRIES 1024
+/* Since the web service located the tower, as towers get moved and reused */
+#define CACHE_MAX_AGE     (30 * 24 * 60 * 60) /* seconds */
+#define CACHE_SAVE_TIMEOUT 60 /* seconds */
+
+typedef struct
+{
+        GClue3GTower tower;
+
+        gdouble latitude;
+        gdouble longitude;
+        gdouble accuracy;
+
+        guint64 located; /* Seconds since epoch */
+} CacheEntry;
+
+struct _GClue3GCachePrivate
+{
+        /* Most recently used entry at the head */
+        GQueue *entries;
+        /* CacheEntry -> its link in 'entries' */
+        GHashTable *index;
+
+        guint save_timeout;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClue3GCache,
+                         gclue_3g_cache,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClue3GCache))
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+        g_slice_free (CacheEntry, entry);
+}
+
+static guint
+cache_entry_hash (gconstpointer key)
+{
+        const GClue3GTower *tower = &((const CacheEntry *) key)->tower;
+        guint hash = 17;
+
+        hash = hash * 31 + tower->mcc;
+        hash = hash * 31 + tower->mnc;
+        hash = hash * 31 + (guint) tower->lac;
+        hash = hash * 31 + (guint) tower->cell_id;
+
+        return hash;
+}
+
+static gboolean
+cache_entry_equal (gconstpointer a,
+                   gconstpointer b)
+{
+        return gclue_3g_tower_equal (&((const CacheEntry *) a)->tower,
+                                     &((const CacheEntry *) b)->tower);
+}
+
+static guint64
+get_now (void)
+{
+        return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static void
+evict_oldest (GClue3GCache *cache)
+{
+        GClue3GCachePrivate *priv = cache->priv;
+        CacheEntry *entry;
+
+        entry = g_queue_pop_tail (priv->entries);
+        if (entry == NULL)
+                return;
+
+        g_hash_table_remove (priv->index, entry);
+        cache_entry_free (entry);
+}
+
+static void
+load_cache (GClue3GCache *cache)
+{
+        GClue3GCachePrivate *priv = cache->priv;
+        GVariant *variant, *entries;
+        GVariantIter iter;
+        guint32 version, mcc, mnc;
+        guint64 lac, cell_id, located, now;
+        gdouble latitude, longitude, accuracy;
+
+        variant = gclue_cache_file_load (CACHE_FILE_NAME,
+                                         G_VARIANT_TYPE (CACHE_VARIANT_TYPE));
+        if (variant == NULL)
+                return;
+
+        g_variant_get (variant, "(u@a(uuttdddt))", &version, &entries);
+        if (version != CACHE_VERSION) {
+                g_debug ("Ignoring 3GPP location cache of version %u",
+                         version);
+                goto out;
+        }
+
+        now = get_now ();
+        g_variant_iter_init (&iter, entries);
+        while (g_variant_iter_next (&iter,
+                                    "(uuttdddt)",
+                                    &mcc,
+                                    &mnc,
+                                    &lac,
+                                    &cell_id,
+                                    &latitude,
+                                    &longitude,
+                                    &accuracy,
+                                    &located)) {
+                CacheEntry *entry;
+
+                if (located + CACHE_MAX_AGE <= now ||
+                    g_queue_get_length (priv->entries) >= CACHE_MAX_ENTRIES)
+                        continue;
+
+                entry = g_slice_new0 (CacheEntry);
+                entry->tower.mcc = mcc;
+                entry->tower.mnc = mnc;
+                entry->tower.lac = lac;
+                entry->tower.cell_id = cell_id;
+                entry->latitude = latitude;
+                entry->longitude = longitude;
+                entry->accuracy = accuracy;
+                entry->located = located;
+
+                if (g_hash_table_contains (priv->index, entry)) {
+                        cache_entry_free (entry);
+                        continue;
+                }
+
+                /* Saved in most recently used first order */
+                g_queue_push_tail (priv->entries, entry);
+                g_hash_table_insert (priv->index,
+                                     entry,
+                                     g_queue_peek_tail_link (priv->entries));
+        }
+
+        g_debug ("Loaded %u entries from 3GPP location cache",
+                 g_queue_get_length (priv->entries));
+out:
+        g_variant_unref (entries);
+        g_variant_unref (variant);
+}
+
+static void
+save_cache (GClue3GCache *cache)
+{
+        GClue3GCachePrivate *priv = cache->priv;
+        GVariantBuilder builder;
+        GVariant *variant;
+        GList *node;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuttdddt)"));
+        for (node = priv->entries->head; node != NULL; node = node->next) {
+                CacheEntry *entry = node->data;
+
+                g_variant_builder_add (&builder,
+                                       "(uuttdddt)",
+                                       (guint32) entry->tower.mcc,
+                                       (guint32) entry->tower.mnc,
+                                       (guint64) entry->tower.lac,
+                                       (guint64) entry->tower.cell_id,
+                                       entry->latitude,
+                                       entry->longitude,
+                                       entry->accuracy,
+                                       entry->located);
+        }
+        variant = g_variant_new ("(u@a(uuttdddt))",
+                                 CACHE_VERSION,
+                                 g_variant_builder_end (&builder));
+
+        if (gclue_cache_file_save (CACHE_FILE_NAME, variant))
+                g_debug ("Saved %u entries to 3GPP location cache",
+                         g_queue_get_length (priv->entries));
+}
+
+static gboolean
+on_save_timeout (gpointer user_data)
+{
+        GClue3GCache *cache = GCLUE_3G_CACHE (user_data);
+
+        cache->priv->save_timeout = 0;
+        save_cache (cache);
+
+        return FALSE;
+}
+
+static void
+schedule_save (GClue3GCache *cache)
+{
+        GClue3GCachePrivate *priv = cache->priv;
+
+        /* Cell handovers come in bursts, batch up the writes */
+        if (priv->save_timeout != 0)
+                return;
+
+        priv->save_timeout = g_timeout_add_seconds (CACHE_SAVE_TIMEOUT,
+                                                    on_save_timeout,
+                                                    cache);
+}
+
+static void
+gclue_3g_cache_finalize (GObject *object)
+{
+        GClue3GCachePrivate *priv = GCLUE_3G_CACHE (object)->priv;
+
+        if (priv->save_timeout != 0) {
+                g_source_remove (priv->save_timeout);
+                priv->save_timeout = 0;
+
+                save_cache (GCLUE_3G_CACHE (object));
+        }
+
+        g_clear_pointer (&priv->index, g_hash_table_unref);
+        if (priv->entries != NULL) {
+                g_queue_free_full (priv->entries,
+                                   (GDestroyNotify) cache_entry_free);
+                priv->entries = NULL;
+        }
+
+        G_OBJECT_CLASS (gclue_3g_cache_parent_class)->finalize (object);
+}
+
+static void
+gclue_3g_cache_class_init (GClue3GCacheClass *klass)
+{
+        GObjectClass *object_class;
+
+        object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gclue_3g_cache_finalize;
+}
+
+static void
+gclue_3g_cache_init (GClue3GCache *cache)
+{
+        cache->priv = G_TYPE_INSTANCE_GET_PRIVATE (cache,
+                                                   GCLUE_TYPE_3G_CACHE,
+                                                   GClue3GCachePrivate);
+        cache->priv->entries = g_queue_new ();
+        cache->priv->index = g_hash_table_new (cache_entry_hash,
+                                               cache_entry_equal);
+
+        load_cache (cache);
+}
+
+static void
+on_cache_destroyed (gpointer data,
+                    GObject *where_the_object_was)
+{
+        GClue3GCache **cache = (GClue3GCache **) data;
+
+        *cache = NULL;
+}
+
+/**
+ * gclue_3g_cache_get_singleton:
+ *
+ * Get the #GClue3GCache singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClue3GCache. Use g_object_unref()
+ * when done.
+ **/
+GClue3GCache *
+gclue_3g_cache_get_singleton (void)
+{
+        static GClue3GCache *cache = NULL;
+
+        if (cache == NULL) {
+                cache = g_object_new (GCLUE_TYPE_3G_CACHE, NULL);
+                g_object_weak_ref (G_OBJECT (cache),
+                                   on_cache_destroyed,
+                                   &cache);
+        } else
+                g_object_ref (cache);
+
+        return cache;
+}
+
+/**
+ * gclue_3g_cache_lookup:
+ * @cache: a #GClue3GCache
+ * @tower: the cell tower to look up
+ *
+ * Returns: (transfer full): A new #GClueLocation, or %NULL if @tower isn't
+ * in the cache.
+ **/
+GClueLocation *
+gclue_3g_cache_lookup (GClue3GCache *cache,
+                       GClue3GTower *tower)
+{
+        GClue3GCachePrivate *priv;
+        CacheEntry key, *entry;
+        GList *link;
+        guint64 now;
+
+        g_return_val_if_fail (GCLUE_IS_3G_CACHE (cache), NULL);
+        g_return_val_if_fail (tower != NULL, NULL);
+        priv = cache->priv;
+
+        key.tower = *tower;
+        link = g_hash_table_lookup (priv->index, &key);
+        if (link == NULL) {
+                g_debug ("3GPP location cache miss");
+                return NULL;
+        }
+
+        entry = link->data;
+        now = get_now ();
+        if (entry->located + CACHE_MAX_AGE <= now) {
+                g_debug ("3GPP location cache entry expired");
+                g_queue_delete_link (priv->entries, link);
+                g_hash_table_remove (priv->index, entry);
+                cache_entry_free (entry);
+
+                return NULL;
+        }
+
+        g_debug ("3GPP location cache hit");
+        g_queue_unlink (priv->entries, link);
+        g_queue_push_head_link (priv->entries, link);
+        schedule_save (cache);
+
+        return gclue_location_new (entry->latitude,
+                                   entry->longitude,
+                                   entry->accuracy);
+}
+
+/**
+ * gclue_3g_cache_insert:
+ * @cache: a #GClue3GCache
+ * @tower: the cell tower @location was resolved from
+ * @location: the location returned for @tower
+ *
+ * Remembers @location for @tower, evicting the least recently used tower if
+ * the cache is full.
+ **/
+void
+gclue_3g_cache_insert (GClue3GCache  *cache,
+                       GClue3GTower  *tower,
+                       GClueLocation *location)
+{
+        GClue3GCachePrivate *priv;
+        CacheEntry key, *entry;
+        GList *link;
+
+        g_return_if_fail (GCLUE_IS_3G_CACHE (cache));
+        g_return_if_fail (tower != NULL);
+        g_return_if_fail (GCLUE_IS_LOCATION (location));
+        priv = cache->priv;
+
+        key.tower = *tower;
+        link = g_hash_table_lookup (priv->index, &key);
+        if (link != NULL) {
+                entry = link->data;
+                g_queue_unlink (priv->entries, link);
+                g_queue_push_head_link (priv->entries, link);
+        } else {
+                while (g_queue_get_length (priv->entries) >= CACHE_MAX_ENTRIES)
+                        evict_oldest (cache);
+
+                entry = g_slice_new0 (CacheEntry);
+                entry->tower = *tower;
+                g_queue_push_head (priv->entries, entry);
+                g_hash_table_insert (priv->index,
+                                     entry,
+                                     g_queue_peek_head_link (priv->entries));
+        }
+
+        entry->latitude = gclue_location_get_latitude (location);
+        entry->longitude = gclue_location_get_longitude (location);
+        entry->accuracy = gclue_location_get_accuracy (location);
+        entry->located = get_now ();
+
+        schedule_save (cache);
+}
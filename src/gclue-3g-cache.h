@@ -0,0 +1,65 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_3G_CACHE_H
+#define GCLUE_3G_CACHE_H
+
+#include <glib-object.h>
+#include "gclue-location.h"
+#include "gclue-3g-tower.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_3G_CACHE            (gclue_3g_cache_get_type())
+#define GCLUE_3G_CACHE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_3G_CACHE, GClue3GCache))
+#define GCLUE_3G_CACHE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_3G_CACHE, GClue3GCache const))
+#define GCLUE_3G_CACHE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_3G_CACHE, GClue3GCacheClass))
+#define GCLUE_IS_3G_CACHE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_3G_CACHE))
+#define GCLUE_IS_3G_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_3G_CACHE))
+#define GCLUE_3G_CACHE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_3G_CACHE, GClue3GCacheClass))
+
+typedef struct _GClue3GCache        GClue3GCache;
+typedef struct _GClue3GCacheClass   GClue3GCacheClass;
+typedef struct _GClue3GCachePrivate GClue3GCachePrivate;
+
+struct _GClue3GCache
+{
+        GObject parent;
+
+        /*< private >*/
+        GClue3GCachePrivate *priv;
+};
+
+struct _GClue3GCacheClass
+{
+        GObjectClass parent_class;
+};
+
+GType             gclue_3g_cache_get_type      (void) G_GNUC_CONST;
+
+GClue3GCache *    gclue_3g_cache_get_singleton (void);
+GClueLocation *   gclue_3g_cache_lookup        (GClue3GCache   *cache,
+                                                GClue3GTower   *tower);
+void              gclue_3g_cache_insert        (GClue3GCache   *cache,
+                                                GClue3GTower   *tower,
+                                                GClueLocation  *location);
+
+G_END_DECLS
+
+#endif /* GCLUE_3G_CACHE_H */
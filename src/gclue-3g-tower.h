@@ -22,6 +22,8 @@
 #ifndef GCLUE_3G_TOWER_H
 #define GCLUE_3G_TOWER_H
 
+#include <glib.h>
+
 G_BEGIN_DECLS
 
 typedef struct _GClue3GTower GClue3GTower;
@@ -33,6 +35,16 @@ struct _GClue3GTower {
         gulong  cell_id;
 };
 
+static inline gboolean
+gclue_3g_tower_equal (const GClue3GTower *a,
+                      const GClue3GTower *b)
+{
+        return a->mcc == b->mcc &&
+               a->mnc == b->mnc &&
+               a->lac == b->lac &&
+               a->cell_id == b->cell_id;
+}
+
 G_END_DECLS
 
 #endif /* GCLUE_3G_TOWER_H */
@@ -27,6 +27,10 @@
 #include "gclue-modem-manager.h"
 #include "gclue-location.h"
 #include "gclue-mozilla.h"
+#include "gclue-3g-cache.h"
+#include "gclue-query-aggregator.h"
+#include "gclue-config.h"
+#include "gclue-location-db.h"
 
 /**
  * SECTION:gclue-3g
@@ -35,6 +39,9 @@
  * Contains functions to get the geolocation based on 3GPP cell towers.
  **/
 
+/* Accuracy of a cell from the location database that has no known range */
+#define DEFAULT_CELL_RANGE 3000 /* meters */
+
 struct _GClue3GPrivate {
         GClueModem *modem;
 
@@ -43,6 +50,12 @@ struct _GClue3GPrivate {
         gulong threeg_notify_id;
 
         GClue3GTower *tower;
+
+        GClue3GCache *cache;
+        GClueQueryAggregator *aggregator;
+        gulong query_answered_id;
+
+        GClueLocationDB *location_db;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClue3G,
@@ -57,17 +70,20 @@ gclue_3g_stop (GClueLocationSource *source);
 static SoupMessage *
 gclue_3g_create_query (GClueWebSource *web,
                        GError        **error);
-static SoupMessage *
-gclue_3g_create_submit_query (GClueWebSource  *web,
-                              GClueLocation   *location,
-                              GError         **error);
+static char *
+gclue_3g_create_submit_item (GClueWebSource  *web,
+                             GClueLocation   *location,
+                             GError         **error);
 static GClueAccuracyLevel
 gclue_3g_get_available_accuracy_level (GClueWebSource *web,
                                        gboolean available);
 static GClueLocation *
 gclue_3g_parse_response (GClueWebSource *web,
-                         const char     *xml,
+                         const char     *content,
+                         gsize           length,
                          GError        **error);
+static GClueLocation *
+gclue_3g_get_cached_location (GClueWebSource *web);
 
 static void
 on_3g_enabled (GObject      *source_object,
@@ -106,9 +122,45 @@ on_is_3g_available_notify (GObject    *gobject,
 static GClueLocation *
 gclue_3g_parse_response (GClueWebSource *web,
                          const char     *content,
+                         gsize           length,
                          GError        **error)
 {
-        return gclue_mozilla_parse_response (content, error);
+        GClue3GPrivate *priv = GCLUE_3G (web)->priv;
+
+        /* Caching happens in on_query_answered() */
+        return gclue_query_aggregator_parse_response (priv->aggregator,
+                                                      G_OBJECT (web),
+                                                      content,
+                                                      length,
+                                                      error);
+}
+
+static void
+on_query_answered (GClueQueryAggregator *aggregator,
+                   GClueLocation        *location,
+                   GObject              *origin,
+                   GArray               *bssids,
+                   GClue3GTower         *tower,
+                   gpointer              user_data)
+{
+        GClue3G *source = GCLUE_3G (user_data);
+        GClue3GPrivate *priv = source->priv;
+
+        /* Only tower-only queries locate the tower itself, the rest would
+         * leak WiFi-grade locations through the cache */
+        if (tower == NULL || bssids != NULL)
+                return;
+        gclue_3g_cache_insert (priv->cache, tower, location);
+
+        /* The source that sent the query sets the location itself */
+        if (origin == G_OBJECT (source) ||
+            !gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source)) ||
+            priv->tower == NULL ||
+            !gclue_3g_tower_equal (priv->tower, tower))
+                return;
+
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source),
+                                            location);
 }
 
 static void
@@ -127,6 +179,12 @@ gclue_3g_finalize (GObject *g3g)
 
         g_clear_object (&priv->modem);
         g_clear_object (&priv->cancellable);
+        g_clear_object (&priv->cache);
+        g_signal_handler_disconnect (priv->aggregator,
+                                     priv->query_answered_id);
+        priv->query_answered_id = 0;
+        g_clear_object (&priv->aggregator);
+        g_clear_pointer (&priv->location_db, gclue_location_db_free);
 }
 
 static void
@@ -141,21 +199,44 @@ gclue_3g_class_init (GClue3GClass *klass)
         source_class->start = gclue_3g_start;
         source_class->stop = gclue_3g_stop;
         web_class->create_query = gclue_3g_create_query;
-        web_class->create_submit_query = gclue_3g_create_submit_query;
+        web_class->create_submit_item = gclue_3g_create_submit_item;
         web_class->parse_response = gclue_3g_parse_response;
         web_class->get_available_accuracy_level =
                 gclue_3g_get_available_accuracy_level;
+        web_class->get_cached_location = gclue_3g_get_cached_location;
 }
 
 static void
 gclue_3g_init (GClue3G *source)
 {
         GClue3GPrivate *priv;
+        GClueConfig *config = gclue_config_get_singleton ();
+        const char *db_path;
 
         source->priv = G_TYPE_INSTANCE_GET_PRIVATE ((source), GCLUE_TYPE_3G, GClue3GPrivate);
         priv = source->priv;
 
         priv->cancellable = g_cancellable_new ();
+        priv->cache = gclue_3g_cache_get_singleton ();
+        priv->aggregator = gclue_query_aggregator_get_singleton ();
+        priv->query_answered_id =
+                g_signal_connect (priv->aggregator,
+                                  "query-answered",
+                                  G_CALLBACK (on_query_answered),
+                                  source);
+
+        db_path = gclue_config_get_location_database (config);
+        if (db_path != NULL) {
+                GError *error = NULL;
+
+                priv->location_db = gclue_location_db_new (db_path, &error);
+                if (priv->location_db == NULL) {
+                        g_warning ("Failed to open location database '%s': %s",
+                                   db_path,
+                                   error->message);
+                        g_error_free (error);
+                }
+        }
 
         priv->modem = gclue_modem_manager_get_singleton ();
         priv->threeg_notify_id =
@@ -212,13 +293,49 @@ gclue_3g_create_query (GClueWebSource *web,
                 return NULL; /* Not initialized yet */
         }
 
-        return gclue_mozilla_create_query (NULL, priv->tower, error);
+        gclue_query_aggregator_set_tower (priv->aggregator, priv->tower);
+
+        /* Tower-only, as the WiFi source's combined queries would locate us
+         * better than neighborhood-level */
+        return gclue_query_aggregator_create_query
+                (priv->aggregator,
+                 G_OBJECT (web),
+                 GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD,
+                 error);
 }
 
-static SoupMessage *
-gclue_3g_create_submit_query (GClueWebSource  *web,
-                              GClueLocation   *location,
-                              GError         **error)
+static GClueLocation *
+gclue_3g_get_cached_location (GClueWebSource *web)
+{
+        GClue3GPrivate *priv = GCLUE_3G (web)->priv;
+        gdouble latitude, longitude, range;
+
+        if (priv->tower == NULL)
+                return NULL;
+
+        if (priv->location_db != NULL &&
+            gclue_location_db_lookup_cell (priv->location_db,
+                                           priv->tower->mcc,
+                                           priv->tower->mnc,
+                                           priv->tower->lac,
+                                           priv->tower->cell_id,
+                                           &latitude,
+                                           &longitude,
+                                           &range)) {
+                g_debug ("Located cell tower from local database");
+
+                return gclue_location_new (latitude,
+                                           longitude,
+                                           range > 0 ? range : DEFAULT_CELL_RANGE);
+        }
+
+        return gclue_3g_cache_lookup (priv->cache, priv->tower);
+}
+
+static char *
+gclue_3g_create_submit_item (GClueWebSource  *web,
+                             GClueLocation   *location,
+                             GError         **error)
 {
         GClue3GPrivate *priv = GCLUE_3G (web)->priv;
 
@@ -230,18 +347,20 @@ gclue_3g_create_submit_query (GClueWebSource  *web,
                 return NULL; /* Not initialized yet */
         }
 
-        return gclue_mozilla_create_submit_query (location,
-                                                  NULL,
-                                                  priv->tower,
-                                                  error);
+        return gclue_mozilla_create_submit_item (location,
+                                                 NULL,
+                                                 priv->tower,
+                                                 error);
 }
 
 static GClueAccuracyLevel
 gclue_3g_get_available_accuracy_level (GClueWebSource *web,
                                        gboolean        network_available)
 {
-        if (gclue_modem_get_is_3g_available (GCLUE_3G (web)->priv->modem) &&
-            network_available)
+        GClue3GPrivate *priv = GCLUE_3G (web)->priv;
+
+        if (gclue_modem_get_is_3g_available (priv->modem) &&
+            (network_available || priv->location_db != NULL))
                 return GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD;
         else
                 return GCLUE_ACCURACY_LEVEL_NONE;
@@ -263,6 +382,7 @@ on_fix_3g (GClueModem *modem,
         priv->tower->mnc = mnc;
         priv->tower->lac = lac;
         priv->tower->cell_id = cell_id;
+        gclue_query_aggregator_set_tower (priv->aggregator, priv->tower);
 
         gclue_web_source_refresh (GCLUE_WEB_SOURCE (user_data));
 }
@@ -314,6 +434,7 @@ gclue_3g_stop (GClueLocationSource *source)
         g_signal_handlers_disconnect_by_func (G_OBJECT (priv->modem),
                                               G_CALLBACK (on_fix_3g),
                                               source);
+        gclue_query_aggregator_set_tower (priv->aggregator, NULL);
 
         if (gclue_modem_get_is_3g_available (priv->modem))
                 if (!gclue_modem_disable_3g (priv->modem,
@@ -0,0 +1,44 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_BSS_RECORD_H
+#define GCLUE_BSS_RECORD_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GCLUE_BSSID_LEN     6
+#define GCLUE_BSSID_STR_LEN 18
+
+typedef struct _GClueBSSRecord GClueBSSRecord;
+
+/* Snapshot of the properties of a visible access point that go into
+ * queries, kept up to date as wpa_supplicant reports changes. */
+struct _GClueBSSRecord {
+        guint8   bssid[GCLUE_BSSID_LEN];
+        char     mac[GCLUE_BSSID_STR_LEN]; /* "xx:xx:xx:xx:xx:xx" */
+        gboolean ignore;                   /* Too weak to be sent, for now */
+        gint16   signal;                   /* dBm */
+        guint16  frequency;                /* MHz */
+};
+
+G_END_DECLS
+
+#endif /* GCLUE_BSS_RECORD_H */
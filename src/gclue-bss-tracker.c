@@ -0,0 +1,1108 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include "gclue-bss-tracker.h"
+#include "gclue-min-uint.h"
+#include "gclue-mozilla.h"
+#include "gclue-nm-wifi.h"
+#include "wpa_supplicant-interface.h"
+
+/* Scan interval for as long as no user asked for one */
+#define DEFAULT_SCAN_INTERVAL 10
+
+#define MAX_SSID_LEN 32
+
+/* Scans only look at the channels we see APs on, save for every so many,
+ * or when the last full scan is older than FULL_SCAN_MAX_AGE seconds, which
+ * look for APs on all the others too */
+#define CHANNEL_SCANS_PER_FULL_SCAN 3
+#define FULL_SCAN_MAX_AGE           600
+#define CHANNEL_WIDTH               20 /* MHz */
+
+/**
+ * SECTION:gclue-bss-tracker
+ * @short_description: Tracks the WiFi access points in sight
+ * @include: gclue-glib/gclue-bss-tracker.h
+ *
+ * Keeps a #GClueBSSRecord of each WiFi access point wpa_supplicant sees
+ * and scans for them as often as the most demanding of its users asks for.
+ * Where wpa_supplicant isn't around to talk to, the access points come from
+ * NetworkManager instead, through #GClueNMWifi.
+ * There is only one of these, shared between the #GClueWifi sources of
+ * all accuracy levels, so that they don't each keep their own copy of the
+ * same access points and scan on their own.
+ **/
+
+struct _GClueBSSTrackerPrivate {
+        WPASupplicant *supplicant;
+        WPAInterface *interface;
+        GClueNMWifi *nm_wifi; /* Only if there is no wpa_supplicant */
+        gboolean connected;
+        GArray *bss_records;     /* GClueBSSRecord of each visible AP */
+        GPtrArray *bss_paths;    /* Object path of each of bss_records */
+        GHashTable *bss_indices; /* Object path to index in bss_records */
+        GCancellable *bss_cancellable;
+
+        gulong bss_added_id;
+        gulong bss_removed_id;
+        guint bss_changed_id;
+        gulong scan_done_id;
+
+        guint scan_timeout;
+        gboolean channel_scan;   /* Whether the current scan is targeted */
+        guint num_channel_scans; /* Since the last full scan */
+        gint64 last_full_scan;   /* Monotonic time, 0 if none yet */
+        GClueMinUINT *scan_intervals; /* Asked for by each user */
+        guint num_users;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueBSSTracker,
+                         gclue_bss_tracker,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueBSSTracker))
+
+enum {
+        DEVICE_CHANGED,
+        SCAN_DONE,
+        LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+static void
+disconnect_bss_signals (GClueBSSTracker *tracker);
+static void
+on_scan_done (WPAInterface *object,
+              gboolean      success,
+              gpointer      user_data);
+static gboolean
+on_scan_timeout (gpointer user_data);
+
+static gboolean
+has_device (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        return priv->interface != NULL ||
+               (priv->nm_wifi != NULL &&
+                gclue_nm_wifi_has_device (priv->nm_wifi));
+}
+
+static guint
+get_scan_interval (GClueBSSTracker *tracker)
+{
+        guint interval;
+
+        interval = gclue_min_uint_get_value (tracker->priv->scan_intervals);
+
+        return interval != 0 ? interval : DEFAULT_SCAN_INTERVAL;
+}
+
+static gboolean
+fill_bss_record (GClueBSSRecord *record,
+                 GVariant       *properties,
+                 char           *ssid)
+{
+        static const char hex[] = "0123456789abcdef";
+        GVariant *variant;
+        const guint8 *raw;
+        gsize raw_len, i;
+        gint16 signal;
+        guint16 frequency;
+
+        variant = g_variant_lookup_value (properties,
+                                          "BSSID",
+                                          G_VARIANT_TYPE_BYTESTRING);
+        if (variant == NULL)
+                return FALSE;
+
+        raw = g_variant_get_fixed_array (variant, &raw_len, sizeof (guint8));
+        if (raw_len != GCLUE_BSSID_LEN) {
+                g_variant_unref (variant);
+                return FALSE;
+        }
+
+        memcpy (record->bssid, raw, GCLUE_BSSID_LEN);
+        for (i = 0; i < GCLUE_BSSID_LEN; i++) {
+                record->mac[i * 3] = hex[raw[i] >> 4];
+                record->mac[i * 3 + 1] = hex[raw[i] & 0xf];
+                record->mac[i * 3 + 2] =
+                        (i == GCLUE_BSSID_LEN - 1) ? '\0' : ':';
+        }
+        g_variant_unref (variant);
+
+        ssid[0] = '\0';
+        variant = g_variant_lookup_value (properties,
+                                          "SSID",
+                                          G_VARIANT_TYPE_BYTESTRING);
+        if (variant != NULL) {
+                raw = g_variant_get_fixed_array (variant,
+                                                 &raw_len,
+                                                 sizeof (guint8));
+                raw_len = MIN (raw_len, MAX_SSID_LEN);
+                memcpy (ssid, raw, raw_len);
+                ssid[raw_len] = '\0';
+                g_variant_unref (variant);
+        }
+
+        if (g_variant_lookup (properties, "Signal", "n", &signal))
+                record->signal = signal;
+        if (g_variant_lookup (properties, "Frequency", "q", &frequency))
+                record->frequency = frequency;
+
+        return TRUE;
+}
+
+static GClueBSSRecord *
+find_bss_record (GClueBSSTracker *tracker,
+                 const char      *path,
+                 guint           *index)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        gpointer value;
+
+        if (!g_hash_table_lookup_extended (priv->bss_indices,
+                                           path,
+                                           NULL,
+                                           &value))
+                return NULL;
+
+        if (index != NULL)
+                *index = GPOINTER_TO_UINT (value);
+
+        return &g_array_index (priv->bss_records,
+                               GClueBSSRecord,
+                               GPOINTER_TO_UINT (value));
+}
+
+static void
+remove_bss (GClueBSSTracker *tracker,
+            const char      *path)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        GClueBSSRecord *record;
+        guint index;
+
+        record = find_bss_record (tracker, path, &index);
+        if (record == NULL)
+                return;
+
+        g_debug ("WiFi AP '%s' removed.", record->mac);
+
+        /* The last record takes the place of the removed one */
+        g_hash_table_remove (priv->bss_indices, path);
+        g_array_remove_index_fast (priv->bss_records, index);
+        g_ptr_array_remove_index_fast (priv->bss_paths, index);
+        if (index < priv->bss_paths->len)
+                g_hash_table_insert (priv->bss_indices,
+                                     g_ptr_array_index (priv->bss_paths, index),
+                                     GUINT_TO_POINTER (index));
+}
+
+static void
+add_bss (GClueBSSTracker *tracker,
+         const char      *path,
+         GVariant        *properties)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        GClueBSSRecord record = { 0 };
+        char ssid[MAX_SSID_LEN + 1];
+        char *owned_path;
+
+        if (!fill_bss_record (&record, properties, ssid)) {
+                g_debug ("Ignoring WiFi AP with unknown BSSID..");
+                return;
+        }
+
+        if (gclue_mozilla_should_ignore_bss (record.mac, ssid))
+                return;
+
+        remove_bss (tracker, path);
+        g_debug ("WiFi AP '%s' added.", ssid);
+
+        if (record.signal <= -90) {
+                g_debug ("WiFi AP '%s' has very low strength (%d dBm)"
+                         ", ignoring for now..",
+                         record.mac,
+                         record.signal);
+                record.ignore = TRUE;
+        }
+
+        owned_path = g_strdup (path);
+        g_hash_table_insert (priv->bss_indices,
+                             owned_path,
+                             GUINT_TO_POINTER (priv->bss_records->len));
+        g_ptr_array_add (priv->bss_paths, owned_path);
+        g_array_append_val (priv->bss_records, record);
+}
+
+static void
+update_bss (GClueBSSTracker *tracker,
+            const char      *path,
+            GVariant        *changed)
+{
+        GClueBSSRecord *record;
+        gint16 signal;
+
+        record = find_bss_record (tracker, path, NULL);
+        if (record == NULL)
+                return;
+
+        g_variant_lookup (changed, "Frequency", "q", &record->frequency);
+        if (!g_variant_lookup (changed, "Signal", "n", &signal))
+                return;
+
+        record->signal = signal;
+        if (!record->ignore)
+                return;
+
+        if (record->signal <= -90) {
+                g_debug ("WiFi AP '%s' still has very low strength (%d dBm)"
+                         ", ignoring again..",
+                         record->mac,
+                         record->signal);
+                return;
+        }
+
+        record->ignore = FALSE;
+        g_debug ("WiFi AP '%s' added.", record->mac);
+}
+
+static void
+on_bss_properties_changed (GDBusConnection *connection,
+                           const char      *sender_name,
+                           const char      *object_path,
+                           const char      *interface_name,
+                           const char      *signal_name,
+                           GVariant        *parameters,
+                           gpointer         user_data)
+{
+        GVariant *changed;
+
+        changed = g_variant_get_child_value (parameters, 1);
+        update_bss (GCLUE_BSS_TRACKER (user_data), object_path, changed);
+        g_variant_unref (changed);
+}
+
+typedef struct {
+        GClueBSSTracker *tracker;
+        GCancellable *cancellable;
+        char *path;
+} GetAllData;
+
+static void
+on_bss_get_all_ready (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        GetAllData *data = user_data;
+        GVariant *result, *properties;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                                res,
+                                                &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_debug ("Failed to get properties of '%s': %s",
+                                 data->path,
+                                 error->message);
+                g_error_free (error);
+                goto out;
+        }
+
+        /* The records may be gone by now if cancelled, even if the reply
+         * made it */
+        if (!g_cancellable_is_cancelled (data->cancellable)) {
+                properties = g_variant_get_child_value (result, 0);
+                add_bss (data->tracker, data->path, properties);
+                g_variant_unref (properties);
+        }
+        g_variant_unref (result);
+out:
+        g_object_unref (data->cancellable);
+        g_free (data->path);
+        g_slice_free (GetAllData, data);
+}
+
+static void
+on_bss_added (WPAInterface *object,
+              const gchar  *path,
+              GVariant     *properties,
+              gpointer      user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+        GetAllData *data;
+
+        /* wpa_supplicant sends all the properties along with the signal */
+        if (properties != NULL) {
+                add_bss (tracker, path, properties);
+                return;
+        }
+
+        /* Otherwise fetch them in one go, without a proxy per AP. These
+         * calls all go out at once, so this costs one round-trip overall. */
+        data = g_slice_new (GetAllData);
+        data->tracker = tracker;
+        data->cancellable = g_object_ref (tracker->priv->bss_cancellable);
+        data->path = g_strdup (path);
+        g_dbus_connection_call (g_dbus_proxy_get_connection
+                                        (G_DBUS_PROXY (object)),
+                                "fi.w1.wpa_supplicant1",
+                                path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)",
+                                               "fi.w1.wpa_supplicant1.BSS"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                tracker->priv->bss_cancellable,
+                                on_bss_get_all_ready,
+                                data);
+}
+
+static void
+on_bss_removed (WPAInterface *object,
+                const gchar  *path,
+                gpointer      user_data)
+{
+        remove_bss (GCLUE_BSS_TRACKER (user_data), path);
+}
+
+static void
+cancel_wifi_scan (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        if (priv->scan_timeout != 0) {
+                g_source_remove (priv->scan_timeout);
+                priv->scan_timeout = 0;
+        }
+
+        if (priv->scan_done_id != 0) {
+                g_signal_handler_disconnect (priv->interface,
+                                             priv->scan_done_id);
+                priv->scan_done_id = 0;
+        }
+}
+
+static void
+on_scan_call_done (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        GError *error = NULL;
+
+        if (!wpa_interface_call_scan_finish
+                (WPA_INTERFACE (source_object),
+                 res,
+                 &error)) {
+                if (priv->channel_scan && priv->interface != NULL) {
+                        /* Not all drivers can be told which channels
+                         * to scan, but they can all scan them all */
+                        g_debug ("Targeted WiFi scan failed: %s",
+                                 error->message);
+                        g_error_free (error);
+                        priv->num_channel_scans = CHANNEL_SCANS_PER_FULL_SCAN;
+                        on_scan_timeout (tracker);
+
+                        return;
+                }
+
+                g_warning ("Scanning of WiFi networks failed: %s",
+                           error->message);
+                g_error_free (error);
+
+                cancel_wifi_scan (tracker);
+
+                return;
+        }
+}
+
+/* Adds the channels of the APs we see to @builder, in the "a(uu)" format
+ * of the "Channels" scan argument: center frequency and width, in MHz */
+static gboolean
+add_scan_channels (GClueBSSTracker *tracker,
+                   GVariantBuilder *builder)
+{
+        GArray *records = tracker->priv->bss_records;
+        GArray *frequencies;
+        guint i, j;
+
+        frequencies = g_array_new (FALSE, FALSE, sizeof (guint16));
+        for (i = 0; i < records->len; i++) {
+                guint16 frequency =
+                        g_array_index (records, GClueBSSRecord, i).frequency;
+
+                if (frequency == 0)
+                        continue;
+
+                for (j = 0; j < frequencies->len; j++)
+                        if (g_array_index (frequencies, guint16, j) ==
+                            frequency)
+                                break;
+                if (j < frequencies->len)
+                        continue;
+
+                g_array_append_val (frequencies, frequency);
+                g_variant_builder_add (builder,
+                                       "(uu)",
+                                       (guint32) frequency,
+                                       (guint32) CHANNEL_WIDTH);
+        }
+        i = frequencies->len;
+        g_array_unref (frequencies);
+
+        return i > 0;
+}
+
+/* Scanning just the channels we already see APs on takes a fraction of the
+ * time of a full scan, but never finds those on the others */
+static gboolean
+should_scan_all_channels (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        return priv->last_full_scan == 0 ||
+               priv->num_channel_scans >= CHANNEL_SCANS_PER_FULL_SCAN ||
+               g_get_monotonic_time () - priv->last_full_scan >
+               FULL_SCAN_MAX_AGE * G_USEC_PER_SEC;
+}
+
+static gboolean
+on_scan_timeout (gpointer user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        GVariantBuilder builder, channels;
+        GVariant *args;
+
+        if (!has_device (tracker))
+                return FALSE;
+
+        g_debug ("WiFi scan timeout. Restarting-scan..");
+        priv->scan_timeout = 0;
+
+        if (priv->nm_wifi != NULL) {
+                /* Whatever it found since our last scan is as good */
+                gclue_nm_wifi_scan (priv->nm_wifi,
+                                    get_scan_interval (tracker));
+                return FALSE;
+        }
+
+        if (priv->scan_done_id == 0)
+                priv->scan_done_id = g_signal_connect
+                                        (priv->interface,
+                                         "scan-done",
+                                         G_CALLBACK (on_scan_done),
+                                         tracker);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
+        g_variant_builder_add (&builder,
+                               "{sv}",
+                               "Type", g_variant_new ("s", "passive"));
+
+        g_variant_builder_init (&channels, G_VARIANT_TYPE ("a(uu)"));
+        priv->channel_scan = !should_scan_all_channels (tracker) &&
+                             add_scan_channels (tracker, &channels);
+        if (priv->channel_scan) {
+                g_variant_builder_add (&builder,
+                                       "{sv}",
+                                       "Channels",
+                                       g_variant_builder_end (&channels));
+                priv->num_channel_scans++;
+        } else {
+                g_variant_builder_clear (&channels);
+                priv->num_channel_scans = 0;
+                priv->last_full_scan = g_get_monotonic_time ();
+        }
+        g_debug ("Scanning %s WiFi channels",
+                 priv->channel_scan ? "known" : "all");
+        args = g_variant_builder_end (&builder);
+
+        wpa_interface_call_scan (WPA_INTERFACE (priv->interface),
+                                 args,
+                                 NULL,
+                                 on_scan_call_done,
+                                 tracker);
+
+        return FALSE;
+}
+
+static void
+scan_now (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        if (priv->scan_timeout != 0) {
+                g_source_remove (priv->scan_timeout);
+                priv->scan_timeout = 0;
+        }
+        on_scan_timeout (tracker);
+}
+
+static void
+scan_completed (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        guint timeout;
+
+        if (!has_device (tracker))
+                return;
+
+        /* Users get to adjust their scan intervals from here */
+        g_signal_emit (tracker, signals[SCAN_DONE], 0);
+
+        if (priv->num_users == 0 || priv->scan_timeout != 0)
+                return;
+
+        timeout = get_scan_interval (tracker);
+        priv->scan_timeout = g_timeout_add_seconds (timeout,
+                                                    on_scan_timeout,
+                                                    tracker);
+        g_debug ("Next scan scheduled in %u seconds", timeout);
+}
+
+static void
+on_scan_done (WPAInterface *object,
+              gboolean      success,
+              gpointer      user_data)
+{
+        if (!success) {
+                g_warning ("WiFi scan failed");
+
+                return;
+        }
+        g_debug ("WiFi scan completed");
+
+        scan_completed (GCLUE_BSS_TRACKER (user_data));
+}
+
+static void
+on_nm_scan_done (GClueNMWifi *nm_wifi,
+                 gpointer     user_data)
+{
+        scan_completed (GCLUE_BSS_TRACKER (user_data));
+}
+
+static void
+connect_bss_signals (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        const gchar *const *bss_list;
+        guint i;
+
+        if (priv->connected || !has_device (tracker))
+                return;
+        priv->connected = TRUE;
+
+        if (priv->nm_wifi != NULL) {
+                gclue_nm_wifi_start (priv->nm_wifi);
+                on_scan_timeout (tracker);
+
+                return;
+        }
+
+        on_scan_timeout (tracker);
+
+        priv->bss_added_id = g_signal_connect (priv->interface,
+                                               "bss-added",
+                                               G_CALLBACK (on_bss_added),
+                                               tracker);
+        priv->bss_removed_id = g_signal_connect (priv->interface,
+                                                "bss-removed",
+                                                G_CALLBACK (on_bss_removed),
+                                                tracker);
+        /* One subscription for the changes of all the APs */
+        priv->bss_changed_id = g_dbus_connection_signal_subscribe
+                (g_dbus_proxy_get_connection (G_DBUS_PROXY (priv->interface)),
+                 "fi.w1.wpa_supplicant1",
+                 "org.freedesktop.DBus.Properties",
+                 "PropertiesChanged",
+                 NULL,
+                 "fi.w1.wpa_supplicant1.BSS",
+                 G_DBUS_SIGNAL_FLAGS_NONE,
+                 on_bss_properties_changed,
+                 tracker,
+                 NULL);
+        priv->bss_cancellable = g_cancellable_new ();
+
+        bss_list = wpa_interface_get_bsss (WPA_INTERFACE (priv->interface));
+        if (bss_list == NULL)
+                return;
+
+        for (i = 0; bss_list[i] != NULL; i++)
+                on_bss_added (WPA_INTERFACE (priv->interface),
+                              bss_list[i],
+                              NULL,
+                              tracker);
+}
+
+static void
+disconnect_bss_signals (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        cancel_wifi_scan (tracker);
+        priv->connected = FALSE;
+
+        if (priv->nm_wifi != NULL)
+                gclue_nm_wifi_stop (priv->nm_wifi);
+        if (priv->bss_added_id != 0) {
+                g_signal_handler_disconnect (priv->interface,
+                                             priv->bss_added_id);
+                priv->bss_added_id = 0;
+        }
+        if (priv->bss_removed_id != 0) {
+                g_signal_handler_disconnect (priv->interface,
+                                             priv->bss_removed_id);
+                priv->bss_removed_id = 0;
+        }
+        if (priv->bss_changed_id != 0) {
+                g_dbus_connection_signal_unsubscribe
+                        (g_dbus_proxy_get_connection
+                                (G_DBUS_PROXY (priv->interface)),
+                         priv->bss_changed_id);
+                priv->bss_changed_id = 0;
+        }
+        if (priv->bss_cancellable != NULL) {
+                g_cancellable_cancel (priv->bss_cancellable);
+                g_clear_object (&priv->bss_cancellable);
+        }
+
+        g_hash_table_remove_all (priv->bss_indices);
+        g_ptr_array_set_size (priv->bss_paths, 0);
+        g_array_set_size (priv->bss_records, 0);
+        priv->last_full_scan = 0;
+}
+
+static void
+on_interface_proxy_ready (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+        WPAInterface *interface;
+        GError *error = NULL;
+
+        interface = wpa_interface_proxy_new_for_bus_finish (res, &error);
+        if (interface == NULL) {
+                g_debug ("%s", error->message);
+                g_error_free (error);
+
+                return;
+        }
+
+        if (tracker->priv->interface != NULL) {
+                g_object_unref (interface);
+                return;
+        }
+
+        tracker->priv->interface = interface;
+        g_debug ("WiFi device '%s' added.",
+                 wpa_interface_get_ifname (interface));
+
+        if (tracker->priv->num_users > 0)
+                connect_bss_signals (tracker);
+        g_signal_emit (tracker, signals[DEVICE_CHANGED], 0);
+}
+
+static void
+on_interface_added (WPASupplicant *supplicant,
+                    const gchar   *path,
+                    GVariant      *properties,
+                    gpointer       user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+
+        if (tracker->priv->interface != NULL)
+                return;
+
+        wpa_interface_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                         G_DBUS_PROXY_FLAGS_NONE,
+                                         "fi.w1.wpa_supplicant1",
+                                         path,
+                                         NULL,
+                                         on_interface_proxy_ready,
+                                         tracker);
+}
+
+static void
+on_interface_removed (WPASupplicant *supplicant,
+                      const gchar   *path,
+                      gpointer       user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        const char *object_path;
+
+        if (priv->interface == NULL)
+                return;
+
+        object_path = g_dbus_proxy_get_object_path
+                        (G_DBUS_PROXY (priv->interface));
+        if (g_strcmp0 (object_path, path) != 0)
+                return;
+
+        g_debug ("WiFi device '%s' removed.",
+                 wpa_interface_get_ifname (priv->interface));
+
+        disconnect_bss_signals (tracker);
+        g_clear_object (&priv->interface);
+
+        g_signal_emit (tracker, signals[DEVICE_CHANGED], 0);
+}
+
+static void
+on_nm_device_changed (GClueNMWifi *nm_wifi,
+                      gpointer     user_data)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (user_data);
+
+        if (!gclue_nm_wifi_has_device (nm_wifi))
+                disconnect_bss_signals (tracker);
+        else if (tracker->priv->num_users > 0)
+                connect_bss_signals (tracker);
+
+        g_signal_emit (tracker, signals[DEVICE_CHANGED], 0);
+}
+
+static void
+on_nm_bss_added (GClueNMWifi *nm_wifi,
+                 const char  *path,
+                 GVariant    *properties,
+                 gpointer     user_data)
+{
+        add_bss (GCLUE_BSS_TRACKER (user_data), path, properties);
+}
+
+static void
+on_nm_bss_changed (GClueNMWifi *nm_wifi,
+                   const char  *path,
+                   GVariant    *properties,
+                   gpointer     user_data)
+{
+        update_bss (GCLUE_BSS_TRACKER (user_data), path, properties);
+}
+
+static void
+on_nm_bss_removed (GClueNMWifi *nm_wifi,
+                   const char  *path,
+                   gpointer     user_data)
+{
+        remove_bss (GCLUE_BSS_TRACKER (user_data), path);
+}
+
+/* For systems with iwd, or anything else NetworkManager can drive */
+static void
+use_network_manager (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+
+        g_debug ("Getting WiFi access points from NetworkManager");
+        priv->nm_wifi = gclue_nm_wifi_new ();
+        g_signal_connect (priv->nm_wifi,
+                          "device-changed",
+                          G_CALLBACK (on_nm_device_changed),
+                          tracker);
+        g_signal_connect (priv->nm_wifi,
+                          "bss-added",
+                          G_CALLBACK (on_nm_bss_added),
+                          tracker);
+        g_signal_connect (priv->nm_wifi,
+                          "bss-changed",
+                          G_CALLBACK (on_nm_bss_changed),
+                          tracker);
+        g_signal_connect (priv->nm_wifi,
+                          "bss-removed",
+                          G_CALLBACK (on_nm_bss_removed),
+                          tracker);
+        g_signal_connect (priv->nm_wifi,
+                          "scan-done",
+                          G_CALLBACK (on_nm_scan_done),
+                          tracker);
+}
+
+static void
+gclue_bss_tracker_finalize (GObject *object)
+{
+        GClueBSSTrackerPrivate *priv = GCLUE_BSS_TRACKER (object)->priv;
+
+        disconnect_bss_signals (GCLUE_BSS_TRACKER (object));
+        g_clear_object (&priv->supplicant);
+        g_clear_object (&priv->interface);
+        g_clear_object (&priv->nm_wifi);
+        g_clear_pointer (&priv->bss_indices, g_hash_table_unref);
+        g_clear_pointer (&priv->bss_paths, g_ptr_array_unref);
+        g_clear_pointer (&priv->bss_records, g_array_unref);
+        g_clear_object (&priv->scan_intervals);
+
+        G_OBJECT_CLASS (gclue_bss_tracker_parent_class)->finalize (object);
+}
+
+static void
+gclue_bss_tracker_constructed (GObject *object)
+{
+        GClueBSSTracker *tracker = GCLUE_BSS_TRACKER (object);
+        GClueBSSTrackerPrivate *priv = tracker->priv;
+        const gchar *const *interfaces;
+        char *owner;
+        GError *error = NULL;
+
+        G_OBJECT_CLASS (gclue_bss_tracker_parent_class)->constructed (object);
+
+        /* FIXME: We should be using async variant */
+        priv->supplicant = wpa_supplicant_proxy_new_for_bus_sync
+                        (G_BUS_TYPE_SYSTEM,
+                         G_DBUS_PROXY_FLAGS_NONE,
+                         "fi.w1.wpa_supplicant1",
+                         "/fi/w1/wpa_supplicant1",
+                         NULL,
+                         &error);
+        if (priv->supplicant == NULL) {
+                g_warning ("Failed to connect to wpa_supplicant service: %s",
+                           error->message);
+                g_error_free (error);
+                use_network_manager (tracker);
+                return;
+        }
+
+        owner = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (priv->supplicant));
+        if (owner == NULL) {
+                g_debug ("wpa_supplicant is not running");
+                g_clear_object (&priv->supplicant);
+                use_network_manager (tracker);
+                return;
+        }
+        g_free (owner);
+
+        g_signal_connect (priv->supplicant,
+                          "interface-added",
+                          G_CALLBACK (on_interface_added),
+                          tracker);
+        g_signal_connect (priv->supplicant,
+                          "interface-removed",
+                          G_CALLBACK (on_interface_removed),
+                          tracker);
+
+        interfaces = wpa_supplicant_get_interfaces (priv->supplicant);
+        if (interfaces != NULL && interfaces[0] != NULL)
+                on_interface_added (priv->supplicant,
+                                    interfaces[0],
+                                    NULL,
+                                    tracker);
+}
+
+static void
+gclue_bss_tracker_class_init (GClueBSSTrackerClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_bss_tracker_finalize;
+        object_class->constructed = gclue_bss_tracker_constructed;
+
+        /**
+         * GClueBSSTracker::device-changed:
+         * @tracker: a #GClueBSSTracker
+         *
+         * Emitted when a WiFi device appears or goes away.
+         **/
+        signals[DEVICE_CHANGED] = g_signal_new ("device-changed",
+                                                GCLUE_TYPE_BSS_TRACKER,
+                                                G_SIGNAL_RUN_LAST,
+                                                0,
+                                                NULL,
+                                                NULL,
+                                                NULL,
+                                                G_TYPE_NONE,
+                                                0);
+
+        /**
+         * GClueBSSTracker::scan-done:
+         * @tracker: a #GClueBSSTracker
+         *
+         * Emitted after each scan, once the records are up to date, and
+         * before the next scan is scheduled.
+         **/
+        signals[SCAN_DONE] = g_signal_new ("scan-done",
+                                           GCLUE_TYPE_BSS_TRACKER,
+                                           G_SIGNAL_RUN_LAST,
+                                           0,
+                                           NULL,
+                                           NULL,
+                                           NULL,
+                                           G_TYPE_NONE,
+                                           0);
+}
+
+static void
+gclue_bss_tracker_init (GClueBSSTracker *tracker)
+{
+        GClueBSSTrackerPrivate *priv;
+
+        tracker->priv = G_TYPE_INSTANCE_GET_PRIVATE (tracker,
+                                                     GCLUE_TYPE_BSS_TRACKER,
+                                                     GClueBSSTrackerPrivate);
+        priv = tracker->priv;
+
+        /* Keys are owned by bss_paths */
+        priv->bss_indices = g_hash_table_new (g_str_hash, g_str_equal);
+        priv->bss_paths = g_ptr_array_new_with_free_func (g_free);
+        priv->bss_records = g_array_new (FALSE,
+                                         FALSE,
+                                         sizeof (GClueBSSRecord));
+        priv->scan_intervals = gclue_min_uint_new ();
+}
+
+static void
+on_tracker_destroyed (gpointer data,
+                      GObject *where_the_object_was)
+{
+        GClueBSSTracker **tracker = (GClueBSSTracker **) data;
+
+        *tracker = NULL;
+}
+
+/**
+ * gclue_bss_tracker_get_singleton:
+ *
+ * Get the #GClueBSSTracker singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClueBSSTracker. Use
+ * g_object_unref() when done.
+ **/
+GClueBSSTracker *
+gclue_bss_tracker_get_singleton (void)
+{
+        static GClueBSSTracker *tracker = NULL;
+
+        if (tracker == NULL) {
+                tracker = g_object_new (GCLUE_TYPE_BSS_TRACKER, NULL);
+                g_object_weak_ref (G_OBJECT (tracker),
+                                   on_tracker_destroyed,
+                                   &tracker);
+        } else
+                g_object_ref (tracker);
+
+        return tracker;
+}
+
+/**
+ * gclue_bss_tracker_has_device:
+ * @tracker: a #GClueBSSTracker
+ *
+ * Returns: %TRUE if there is a WiFi device to scan with.
+ **/
+gboolean
+gclue_bss_tracker_has_device (GClueBSSTracker *tracker)
+{
+        g_return_val_if_fail (GCLUE_IS_BSS_TRACKER (tracker), FALSE);
+
+        return has_device (tracker);
+}
+
+/**
+ * gclue_bss_tracker_get_records:
+ * @tracker: a #GClueBSSTracker
+ *
+ * Returns: (transfer none) (element-type GClueBSSRecord): the records of
+ * the access points in sight, including the ignored ones. They are only
+ * kept up to date while @tracker is started.
+ **/
+GArray *
+gclue_bss_tracker_get_records (GClueBSSTracker *tracker)
+{
+        g_return_val_if_fail (GCLUE_IS_BSS_TRACKER (tracker), NULL);
+
+        return tracker->priv->bss_records;
+}
+
+/**
+ * gclue_bss_tracker_start:
+ * @tracker: a #GClueBSSTracker
+ * @owner: the object that wants the access points tracked
+ * @scan_interval: seconds @owner wants between scans
+ *
+ * Starts tracking the access points in sight for @owner, with a scan
+ * right away. Each call has to be matched by gclue_bss_tracker_stop().
+ **/
+void
+gclue_bss_tracker_start (GClueBSSTracker *tracker,
+                         GObject         *owner,
+                         guint            scan_interval)
+{
+        GClueBSSTrackerPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_BSS_TRACKER (tracker));
+        priv = tracker->priv;
+
+        gclue_min_uint_add_value (priv->scan_intervals, scan_interval, owner);
+        if (priv->num_users++ == 0)
+                connect_bss_signals (tracker);
+        else if (priv->scan_timeout != 0)
+                /* Get the newcomer up to date, unless a scan is on already */
+                scan_now (tracker);
+}
+
+/**
+ * gclue_bss_tracker_set_scan_interval:
+ * @tracker: a #GClueBSSTracker
+ * @owner: an object that started @tracker
+ * @scan_interval: seconds @owner wants between scans from now on
+ *
+ * Scans happen as often as the most demanding owner wants them to.
+ **/
+void
+gclue_bss_tracker_set_scan_interval (GClueBSSTracker *tracker,
+                                     GObject         *owner,
+                                     guint            scan_interval)
+{
+        g_return_if_fail (GCLUE_IS_BSS_TRACKER (tracker));
+
+        gclue_min_uint_add_value (tracker->priv->scan_intervals,
+                                  scan_interval,
+                                  owner);
+}
+
+/**
+ * gclue_bss_tracker_stop:
+ * @tracker: a #GClueBSSTracker
+ * @owner: an object that started @tracker
+ *
+ * Stops tracking access points for @owner, and altogether if there is no
+ * other owner left.
+ **/
+void
+gclue_bss_tracker_stop (GClueBSSTracker *tracker,
+                        GObject         *owner)
+{
+        GClueBSSTrackerPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_BSS_TRACKER (tracker));
+        priv = tracker->priv;
+        g_return_if_fail (priv->num_users > 0);
+
+        gclue_min_uint_drop_value (priv->scan_intervals, owner);
+        if (--priv->num_users == 0)
+                disconnect_bss_signals (tracker);
+}
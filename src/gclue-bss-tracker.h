@@ -0,0 +1,69 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_BSS_TRACKER_H
+#define GCLUE_BSS_TRACKER_H
+
+#include <glib-object.h>
+#include "gclue-bss-record.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_BSS_TRACKER            (gclue_bss_tracker_get_type())
+#define GCLUE_BSS_TRACKER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_BSS_TRACKER, GClueBSSTracker))
+#define GCLUE_BSS_TRACKER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_BSS_TRACKER, GClueBSSTracker const))
+#define GCLUE_BSS_TRACKER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_BSS_TRACKER, GClueBSSTrackerClass))
+#define GCLUE_IS_BSS_TRACKER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_BSS_TRACKER))
+#define GCLUE_IS_BSS_TRACKER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_BSS_TRACKER))
+#define GCLUE_BSS_TRACKER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_BSS_TRACKER, GClueBSSTrackerClass))
+
+typedef struct _GClueBSSTracker        GClueBSSTracker;
+typedef struct _GClueBSSTrackerClass   GClueBSSTrackerClass;
+typedef struct _GClueBSSTrackerPrivate GClueBSSTrackerPrivate;
+
+struct _GClueBSSTracker
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueBSSTrackerPrivate *priv;
+};
+
+struct _GClueBSSTrackerClass
+{
+        GObjectClass parent_class;
+};
+
+GType             gclue_bss_tracker_get_type          (void) G_GNUC_CONST;
+
+GClueBSSTracker * gclue_bss_tracker_get_singleton     (void);
+gboolean          gclue_bss_tracker_has_device        (GClueBSSTracker *tracker);
+GArray *          gclue_bss_tracker_get_records       (GClueBSSTracker *tracker);
+void              gclue_bss_tracker_start             (GClueBSSTracker *tracker,
+                                                       GObject         *owner,
+                                                       guint            scan_interval);
+void              gclue_bss_tracker_set_scan_interval (GClueBSSTracker *tracker,
+                                                       GObject         *owner,
+                                                       guint            scan_interval);
+void              gclue_bss_tracker_stop              (GClueBSSTracker *tracker,
+                                                       GObject         *owner);
+
+G_END_DECLS
+
+#endif /* GCLUE_BSS_TRACKER_H */
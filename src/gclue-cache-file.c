@@ -0,0 +1,233 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <config.h>
+#include "gclue-cache-file.h"
+
+/**
+ * SECTION:gclue-cache-file
+ * @short_description: Helpers to persist caches across restarts
+ *
+ * Caches are stored one file per cache in the service's cache directory,
+ * usually as a serialized #GVariant. Append-only logs can use the raw
+ * contents helpers instead. Caches tell where the user has been, so only the
+ * service itself gets to read them.
+ **/
+
+#ifndef CACHE_DIR
+#define CACHE_DIR LOCALSTATEDIR "/cache/geoclue"
+#endif
+
+static char *
+get_path (const char *name)
+{
+        return g_build_filename (CACHE_DIR, name, NULL);
+}
+
+static void
+ensure_cache_dir (void)
+{
+        /* Also for a directory created before we made it private */
+        if (g_mkdir_with_parents (CACHE_DIR, 0700) == 0)
+                g_chmod (CACHE_DIR, 0700);
+}
+
+/**
+ * gclue_cache_file_load_contents:
+ * @name: file name of the cache, relative to the cache directory
+ * @length: (out): return location for the length of the contents
+ *
+ * Returns: (transfer full): The raw contents of cache @name, or %NULL if
+ * there is no cache file yet or it couldn't be read. Free with g_free().
+ **/
+char *
+gclue_cache_file_load_contents (const char *name,
+                                gsize      *length)
+{
+        GError *error = NULL;
+        char *path, *contents;
+
+        path = get_path (name);
+        if (!g_file_get_contents (path, &contents, length, &error)) {
+                g_debug ("Failed to load cache '%s': %s",
+                         path,
+                         error->message);
+                g_error_free (error);
+                contents = NULL;
+        }
+        g_free (path);
+
+        return contents;
+}
+
+/**
+ * gclue_cache_file_save_contents:
+ * @name: file name of the cache, relative to the cache directory
+ * @contents: the raw cache contents
+ * @length: length of @contents
+ *
+ * Atomically replaces cache @name with @contents.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ **/
+gboolean
+gclue_cache_file_save_contents (const char *name,
+                                const char *contents,
+                                gsize       length)
+{
+        GError *error = NULL;
+        gboolean ret;
+        GFile *file;
+        char *path;
+
+        ensure_cache_dir ();
+        path = get_path (name);
+        file = g_file_new_for_path (path);
+        /* Replacing the destination rather than the contents, so that files
+         * created before we made them private don't keep their mode */
+        ret = g_file_replace_contents (file,
+                                       contents,
+                                       length,
+                                       NULL,
+                                       FALSE,
+                                       G_FILE_CREATE_PRIVATE |
+                                       G_FILE_CREATE_REPLACE_DESTINATION,
+                                       NULL,
+                                       NULL,
+                                       &error);
+        g_object_unref (file);
+        if (!ret) {
+                g_warning ("Failed to save cache '%s': %s",
+                           path,
+                           error->message);
+                g_error_free (error);
+        }
+        g_free (path);
+
+        return ret;
+}
+
+/**
+ * gclue_cache_file_append:
+ * @name: file name of the cache, relative to the cache directory
+ * @contents: data to append
+ * @length: length of @contents
+ *
+ * Appends @contents to cache @name, creating it if needed.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ **/
+gboolean
+gclue_cache_file_append (const char *name,
+                         const char *contents,
+                         gsize       length)
+{
+        GError *error = NULL;
+        GFileOutputStream *stream;
+        GFile *file;
+        char *path;
+        gboolean ret = FALSE;
+
+        ensure_cache_dir ();
+        path = get_path (name);
+        file = g_file_new_for_path (path);
+
+        stream = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+        if (stream == NULL)
+                goto out;
+
+        ret = g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                         contents,
+                                         length,
+                                         NULL,
+                                         NULL,
+                                         &error) &&
+              g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+        g_object_unref (stream);
+
+out:
+        if (!ret) {
+                g_warning ("Failed to append to cache '%s': %s",
+                           path,
+                           error->message);
+                g_error_free (error);
+        }
+        g_object_unref (file);
+        g_free (path);
+
+        return ret;
+}
+
+/**
+ * gclue_cache_file_load:
+ * @name: file name of the cache, relative to the cache directory
+ * @type: expected type of the cache contents
+ *
+ * Returns: (transfer full): The cache contents of type @type, or %NULL if
+ * there is no cache file yet or it couldn't be read.
+ **/
+GVariant *
+gclue_cache_file_load (const char         *name,
+                       const GVariantType *type)
+{
+        GVariant *variant;
+        char *contents;
+        gsize length;
+
+        contents = gclue_cache_file_load_contents (name, &length);
+        if (contents == NULL)
+                return NULL;
+
+        variant = g_variant_new_from_data (type,
+                                           contents,
+                                           length,
+                                           FALSE,
+                                           g_free,
+                                           contents);
+
+        return g_variant_ref_sink (variant);
+}
+
+/**
+ * gclue_cache_file_save:
+ * @name: file name of the cache, relative to the cache directory
+ * @variant: the cache contents
+ *
+ * Atomically replaces cache @name with @variant. If @variant is floating, it
+ * is consumed.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ **/
+gboolean
+gclue_cache_file_save (const char *name,
+                       GVariant   *variant)
+{
+        gboolean ret;
+
+        g_variant_ref_sink (variant);
+        ret = gclue_cache_file_save_contents (name,
+                                              g_variant_get_data (variant),
+                                              g_variant_get_size (variant));
+        g_variant_unref (variant);
+
+        return ret;
+}
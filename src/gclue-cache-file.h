@@ -0,0 +1,47 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_CACHE_FILE_H
+#define GCLUE_CACHE_FILE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+GVariant *
+gclue_cache_file_load (const char         *name,
+                       const GVariantType *type);
+gboolean
+gclue_cache_file_save (const char         *name,
+                       GVariant           *variant);
+char *
+gclue_cache_file_load_contents (const char *name,
+                                gsize      *length);
+gboolean
+gclue_cache_file_save_contents (const char *name,
+                                const char *contents,
+                                gsize       length);
+gboolean
+gclue_cache_file_append        (const char *name,
+                                const char *contents,
+                                gsize       length);
+
+G_END_DECLS
+
+#endif /* GCLUE_CACHE_FILE_H */
@@ -25,7 +25,10 @@
 
 #include "gclue-config.h"
 
+/* Overridable for builds that must not touch the system, e.g. benchmarks */
+#ifndef CONFIG_FILE_PATH
 #define CONFIG_FILE_PATH SYSCONFDIR "/geoclue/geoclue.conf"
+#endif
 
 /* This class will be responsible for fetching configuration. */
 
@@ -36,7 +39,11 @@ struct _GClueConfigPrivate
         char **agents;
         gsize num_agents;
 
-        char *wifi_url;
+        char **wifi_urls;
+        char *location_database;
+        char *geoip_database;
+        gdouble wifi_refresh_threshold;
+        guint wifi_query_max_aps;
         gboolean wifi_submit;
         gboolean enable_nmea_source;
         gboolean enable_3g_source;
@@ -81,7 +88,9 @@ gclue_config_finalize (GObject *object)
 
         g_clear_pointer (&priv->key_file, g_key_file_unref);
         g_clear_pointer (&priv->agents, g_strfreev);
-        g_clear_pointer (&priv->wifi_url, g_free);
+        g_clear_pointer (&priv->wifi_urls, g_strfreev);
+        g_clear_pointer (&priv->location_database, g_free);
+        g_clear_pointer (&priv->geoip_database, g_free);
         g_clear_pointer (&priv->wifi_submit_url, g_free);
         g_clear_pointer (&priv->wifi_submit_nick, g_free);
 
@@ -218,6 +227,8 @@ load_enable_source_config (GClueConfig *config,
 }
 
 #define DEFAULT_WIFI_URL "https://location.services.mozilla.com/v1/geolocate?key=geoclue"
+#define DEFAULT_WIFI_REFRESH_THRESHOLD 0.2
+#define DEFAULT_WIFI_QUERY_MAX_APS 20
 #define DEFAULT_WIFI_SUBMIT_URL "https://location.services.mozilla.com/v1/submit?key=geoclue"
 
 static void
@@ -225,19 +236,70 @@ load_wifi_config (GClueConfig *config)
 {
         GClueConfigPrivate *priv = config->priv;
         GError *error = NULL;
+        gint max_aps;
 
         priv->enable_wifi_source = load_enable_source_config (config, "wifi");
 
-        priv->wifi_url = g_key_file_get_string (priv->key_file,
-                                                "wifi",
-                                                "url",
-                                                &error);
+        /* Several URLs, in order of preference, are tried in turn */
+        priv->wifi_urls = g_key_file_get_string_list (priv->key_file,
+                                                      "wifi",
+                                                      "url",
+                                                      NULL,
+                                                      &error);
         if (error != NULL) {
                 g_debug ("Failed to get config \"wifi/url\": %s",
                          error->message);
                 g_clear_error (&error);
-                priv->wifi_url = g_strdup (DEFAULT_WIFI_URL);
         }
+        if (priv->wifi_urls == NULL || priv->wifi_urls[0] == NULL) {
+                g_strfreev (priv->wifi_urls);
+                priv->wifi_urls = g_new0 (char *, 2);
+                priv->wifi_urls[0] = g_strdup (DEFAULT_WIFI_URL);
+        }
+
+        priv->location_database = g_key_file_get_string (priv->key_file,
+                                                         "wifi",
+                                                         "location-database",
+                                                         &error);
+        if (error != NULL) {
+                g_debug ("Failed to get config \"wifi/location-database\": %s",
+                         error->message);
+                g_clear_error (&error);
+        }
+
+        priv->geoip_database = g_key_file_get_string (priv->key_file,
+                                                      "wifi",
+                                                      "geoip-database",
+                                                      &error);
+        if (error != NULL) {
+                g_debug ("Failed to get config \"wifi/geoip-database\": %s",
+                         error->message);
+                g_clear_error (&error);
+        }
+
+        priv->wifi_refresh_threshold =
+                g_key_file_get_double (priv->key_file,
+                                       "wifi",
+                                       "refresh-threshold",
+                                       &error);
+        if (error != NULL) {
+                g_debug ("Failed to get config \"wifi/refresh-threshold\": %s",
+                         error->message);
+                g_clear_error (&error);
+                priv->wifi_refresh_threshold = DEFAULT_WIFI_REFRESH_THRESHOLD;
+        }
+
+        max_aps = g_key_file_get_integer (priv->key_file,
+                                          "wifi",
+                                          "query-max-aps",
+                                          &error);
+        if (error != NULL) {
+                g_debug ("Failed to get config \"wifi/query-max-aps\": %s",
+                         error->message);
+                g_clear_error (&error);
+                max_aps = DEFAULT_WIFI_QUERY_MAX_APS;
+        }
+        priv->wifi_query_max_aps = MAX (max_aps, 0);
 
         priv->wifi_submit = g_key_file_get_boolean (priv->key_file,
                                                     "wifi",
@@ -442,7 +504,37 @@ gclue_config_is_system_component (GClueConfig *config,
 const char *
 gclue_config_get_wifi_url (GClueConfig *config)
 {
-        return config->priv->wifi_url;
+        return config->priv->wifi_urls[0];
+}
+
+const char *const *
+gclue_config_get_wifi_urls (GClueConfig *config)
+{
+        return (const char *const *) config->priv->wifi_urls;
+}
+
+const char *
+gclue_config_get_location_database (GClueConfig *config)
+{
+        return config->priv->location_database;
+}
+
+const char *
+gclue_config_get_geoip_database (GClueConfig *config)
+{
+        return config->priv->geoip_database;
+}
+
+gdouble
+gclue_config_get_wifi_refresh_threshold (GClueConfig *config)
+{
+        return config->priv->wifi_refresh_threshold;
+}
+
+guint
+gclue_config_get_wifi_query_max_aps (GClueConfig *config)
+{
+        return config->priv->wifi_query_max_aps;
 }
 
 const char *
@@ -74,6 +74,12 @@ GClueAppPerm        gclue_config_get_app_perm           (GClueConfig     *config
 gboolean            gclue_config_is_system_component    (GClueConfig     *config,
                                                          const char      *desktop_id);
 const char *        gclue_config_get_wifi_url           (GClueConfig     *config);
+const char *const * gclue_config_get_wifi_urls          (GClueConfig     *config);
+const char *        gclue_config_get_location_database  (GClueConfig     *config);
+const char *        gclue_config_get_geoip_database     (GClueConfig     *config);
+gdouble             gclue_config_get_wifi_refresh_threshold
+                                                        (GClueConfig     *config);
+guint               gclue_config_get_wifi_query_max_aps (GClueConfig     *config);
 const char *        gclue_config_get_wifi_submit_url    (GClueConfig     *config);
 const char *        gclue_config_get_wifi_submit_nick   (GClueConfig     *config);
 void                gclue_config_set_wifi_submit_nick   (GClueConfig     *config,
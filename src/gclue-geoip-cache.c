@@ -0,0 +1,483 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "gclue-geoip-cache.h"
+#include "gclue-cache-file.h"
+
+/**
+ * SECTION:gclue-geoip-cache
+ * @short_description: Persistent cache of GeoIP locations per network
+ * @include: gclue-glib/gclue-geoip-cache.h
+ *
+ * Maps the network we are connected to onto the location the web service
+ * returned for its public IP address, so that reconnecting to a known network
+ * gives a city-level location right away and without a request. Networks are
+ * told apart by the MAC address of their default gateway. Unlike a cell
+ * tower, the location of an IP address can change at any time, so entries
+ * expire a fixed time after the query whether they are used or not. The cache
+ * is kept on disk across restarts.
+ **/
+
+#define CACHE_FILE_NAME "geoip-cache"
+
+/* Bump this whenever the serialized format below changes */
+#define CACHE_VERSION 1
+#define CACHE_VARIANT_TYPE "(ua(sdddt))"
+
+#define CACHE_MAX_ENTRIES 64
+#define CACHE_TTL         (24 * 60 * 60) /* seconds */
+#define CACHE_SAVE_TIMEOUT 60 /* seconds */
+
+#define ROUTE_FILE "/proc/net/route"
+#define ARP_FILE   "/proc/net/arp"
+
+/* From linux/route.h and linux/if_arp.h */
+#define RTF_UP      0x0001
+#define RTF_GATEWAY 0x0002
+#define ATF_COM     0x02
+
+typedef struct
+{
+        char *network_id;
+
+        gdouble latitude;
+        gdouble longitude;
+        gdouble accuracy;
+
+        guint64 time; /* Of the query, in seconds since epoch */
+} CacheEntry;
+
+struct _GClueGeoipCachePrivate
+{
+        /* Network ID -> CacheEntry */
+        GHashTable *entries;
+
+        guint save_timeout;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueGeoipCache,
+                         gclue_geoip_cache,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueGeoipCache))
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+        g_free (entry->network_id);
+        g_slice_free (CacheEntry, entry);
+}
+
+static guint64
+get_now (void)
+{
+        return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static void
+evict_oldest (GClueGeoipCache *cache)
+{
+        GHashTableIter iter;
+        CacheEntry *entry, *oldest = NULL;
+
+        g_hash_table_iter_init (&iter, cache->priv->entries);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+                if (oldest == NULL || entry->time < oldest->time)
+                        oldest = entry;
+
+        if (oldest != NULL)
+                g_hash_table_remove (cache->priv->entries, oldest->network_id);
+}
+
+static void
+load_cache (GClueGeoipCache *cache)
+{
+        GClueGeoipCachePrivate *priv = cache->priv;
+        GVariant *variant, *entries, *child;
+        GVariantIter iter;
+        guint32 version;
+        guint64 now;
+
+        variant = gclue_cache_file_load (CACHE_FILE_NAME,
+                                         G_VARIANT_TYPE (CACHE_VARIANT_TYPE));
+        if (variant == NULL)
+                return;
+
+        g_variant_get (variant, "(u@a(sdddt))", &version, &entries);
+        if (version != CACHE_VERSION) {
+                g_debug ("Ignoring GeoIP location cache of version %u",
+                         version);
+                goto out;
+        }
+
+        now = get_now ();
+        g_variant_iter_init (&iter, entries);
+        while ((child = g_variant_iter_next_value (&iter)) != NULL) {
+                CacheEntry *entry;
+
+                entry = g_slice_new0 (CacheEntry);
+                g_variant_get (child,
+                               "(sdddt)",
+                               &entry->network_id,
+                               &entry->latitude,
+                               &entry->longitude,
+                               &entry->accuracy,
+                               &entry->time);
+                if (entry->time + CACHE_TTL > now &&
+                    g_hash_table_size (priv->entries) < CACHE_MAX_ENTRIES)
+                        g_hash_table_replace (priv->entries,
+                                              entry->network_id,
+                                              entry);
+                else
+                        cache_entry_free (entry);
+
+                g_variant_unref (child);
+        }
+
+        g_debug ("Loaded %u entries from GeoIP location cache",
+                 g_hash_table_size (priv->entries));
+out:
+        g_variant_unref (entries);
+        g_variant_unref (variant);
+}
+
+static void
+save_cache (GClueGeoipCache *cache)
+{
+        GClueGeoipCachePrivate *priv = cache->priv;
+        GVariantBuilder builder;
+        GVariant *variant;
+        GHashTableIter iter;
+        CacheEntry *entry;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sdddt)"));
+        g_hash_table_iter_init (&iter, priv->entries);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+                g_variant_builder_add (&builder,
+                                       "(sdddt)",
+                                       entry->network_id,
+                                       entry->latitude,
+                                       entry->longitude,
+                                       entry->accuracy,
+                                       entry->time);
+        variant = g_variant_new ("(u@a(sdddt))",
+                                 CACHE_VERSION,
+                                 g_variant_builder_end (&builder));
+
+        if (gclue_cache_file_save (CACHE_FILE_NAME, variant))
+                g_debug ("Saved %u entries to GeoIP location cache",
+                         g_hash_table_size (priv->entries));
+}
+
+static gboolean
+on_save_timeout (gpointer user_data)
+{
+        GClueGeoipCache *cache = GCLUE_GEOIP_CACHE (user_data);
+
+        cache->priv->save_timeout = 0;
+        save_cache (cache);
+
+        return FALSE;
+}
+
+static void
+schedule_save (GClueGeoipCache *cache)
+{
+        GClueGeoipCachePrivate *priv = cache->priv;
+
+        if (priv->save_timeout != 0)
+                return;
+
+        priv->save_timeout = g_timeout_add_seconds (CACHE_SAVE_TIMEOUT,
+                                                    on_save_timeout,
+                                                    cache);
+}
+
+static void
+gclue_geoip_cache_finalize (GObject *object)
+{
+        GClueGeoipCachePrivate *priv = GCLUE_GEOIP_CACHE (object)->priv;
+
+        if (priv->save_timeout != 0) {
+                g_source_remove (priv->save_timeout);
+                priv->save_timeout = 0;
+
+                save_cache (GCLUE_GEOIP_CACHE (object));
+        }
+
+        g_clear_pointer (&priv->entries, g_hash_table_unref);
+
+        G_OBJECT_CLASS (gclue_geoip_cache_parent_class)->finalize (object);
+}
+
+static void
+gclue_geoip_cache_class_init (GClueGeoipCacheClass *klass)
+{
+        GObjectClass *object_class;
+
+        object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gclue_geoip_cache_finalize;
+}
+
+static void
+gclue_geoip_cache_init (GClueGeoipCache *cache)
+{
+        cache->priv = G_TYPE_INSTANCE_GET_PRIVATE (cache,
+                                                   GCLUE_TYPE_GEOIP_CACHE,
+                                                   GClueGeoipCachePrivate);
+        cache->priv->entries = g_hash_table_new_full
+                        (g_str_hash,
+                         g_str_equal,
+                         NULL,
+                         (GDestroyNotify) cache_entry_free);
+
+        load_cache (cache);
+}
+
+static void
+on_cache_destroyed (gpointer data,
+                    GObject *where_the_object_was)
+{
+        GClueGeoipCache **cache = (GClueGeoipCache **) data;
+
+        *cache = NULL;
+}
+
+/**
+ * gclue_geoip_cache_get_singleton:
+ *
+ * Get the #GClueGeoipCache singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClueGeoipCache. Use
+ * g_object_unref() when done.
+ **/
+GClueGeoipCache *
+gclue_geoip_cache_get_singleton (void)
+{
+        static GClueGeoipCache *cache = NULL;
+
+        if (cache == NULL) {
+                cache = g_object_new (GCLUE_TYPE_GEOIP_CACHE, NULL);
+                g_object_weak_ref (G_OBJECT (cache),
+                                   on_cache_destroyed,
+                                   &cache);
+        } else
+                g_object_ref (cache);
+
+        return cache;
+}
+
+/* The IPv4 default gateway with the lowest metric, in dotted notation, and
+ * the interface it is reached through */
+static gboolean
+get_default_gateway (char **address,
+                     char **iface)
+{
+        char *contents, **lines;
+        gulong best_metric = G_MAXULONG;
+        guint i;
+
+        if (!g_file_get_contents (ROUTE_FILE, &contents, NULL, NULL))
+                return FALSE;
+        lines = g_strsplit (contents, "\n", -1);
+        g_free (contents);
+
+        *address = *iface = NULL;
+        /* First line is the header */
+        for (i = 1; lines[i] != NULL; i++) {
+                char name[32];
+                guint32 destination, gateway;
+                guint flags;
+                gulong metric;
+                guint8 bytes[4];
+
+                if (sscanf (lines[i],
+                            "%31s %x %x %x %*d %*d %lu",
+                            name,
+                            &destination,
+                            &gateway,
+                            &flags,
+                            &metric) != 5)
+                        continue;
+                if (destination != 0 ||
+                    (flags & (RTF_UP | RTF_GATEWAY)) != (RTF_UP | RTF_GATEWAY) ||
+                    metric >= best_metric)
+                        continue;
+
+                /* Printed as a host integer holding network byte order */
+                memcpy (bytes, &gateway, sizeof (bytes));
+                g_free (*address);
+                g_free (*iface);
+                *address = g_strdup_printf ("%u.%u.%u.%u",
+                                            bytes[0],
+                                            bytes[1],
+                                            bytes[2],
+                                            bytes[3]);
+                *iface = g_strdup (name);
+                best_metric = metric;
+        }
+        g_strfreev (lines);
+
+        return *address != NULL;
+}
+
+/* The hardware address @address resolves to on @iface, if known yet */
+static char *
+get_neighbour_hwaddr (const char *address,
+                      const char *iface)
+{
+        char *contents, **lines, *hwaddr = NULL;
+        guint i;
+
+        if (!g_file_get_contents (ARP_FILE, &contents, NULL, NULL))
+                return NULL;
+        lines = g_strsplit (contents, "\n", -1);
+        g_free (contents);
+
+        for (i = 1; lines[i] != NULL && hwaddr == NULL; i++) {
+                char ip[64], mac[32], device[32];
+                guint flags;
+
+                if (sscanf (lines[i],
+                            "%63s %*x %x %31s %*s %31s",
+                            ip,
+                            &flags,
+                            mac,
+                            device) != 4)
+                        continue;
+                if ((flags & ATF_COM) == 0 ||
+                    strcmp (ip, address) != 0 ||
+                    strcmp (device, iface) != 0 ||
+                    strcmp (mac, "00:00:00:00:00:00") == 0)
+                        continue;
+
+                hwaddr = g_ascii_strdown (mac, -1);
+        }
+        g_strfreev (lines);
+
+        return hwaddr;
+}
+
+/**
+ * gclue_geoip_cache_get_network_id:
+ *
+ * Identifies the network we are currently connected to.
+ *
+ * Returns: (transfer full): the network ID, or %NULL if it can't be told,
+ * e.g. while the default gateway hasn't been resolved yet.
+ **/
+char *
+gclue_geoip_cache_get_network_id (void)
+{
+        char *address, *iface, *hwaddr, *network_id = NULL;
+
+        if (!get_default_gateway (&address, &iface))
+                return NULL;
+
+        hwaddr = get_neighbour_hwaddr (address, iface);
+        if (hwaddr != NULL)
+                network_id = g_strconcat ("gateway:", hwaddr, NULL);
+
+        g_free (hwaddr);
+        g_free (address);
+        g_free (iface);
+
+        return network_id;
+}
+
+/**
+ * gclue_geoip_cache_lookup:
+ * @cache: a #GClueGeoipCache
+ * @network_id: (nullable): the network to look up, as returned by
+ * gclue_geoip_cache_get_network_id()
+ *
+ * Returns: (transfer full): A new #GClueLocation, or %NULL if there is no
+ * fresh entry for @network_id.
+ **/
+GClueLocation *
+gclue_geoip_cache_lookup (GClueGeoipCache *cache,
+                          const char      *network_id)
+{
+        GClueGeoipCachePrivate *priv;
+        CacheEntry *entry;
+
+        g_return_val_if_fail (GCLUE_IS_GEOIP_CACHE (cache), NULL);
+        priv = cache->priv;
+
+        if (network_id == NULL)
+                return NULL;
+
+        entry = g_hash_table_lookup (priv->entries, network_id);
+        if (entry == NULL) {
+                g_debug ("GeoIP location cache miss");
+                return NULL;
+        }
+
+        if (entry->time + CACHE_TTL <= get_now ()) {
+                g_debug ("GeoIP location cache entry expired");
+                g_hash_table_remove (priv->entries, network_id);
+                schedule_save (cache);
+
+                return NULL;
+        }
+
+        g_debug ("GeoIP location cache hit");
+        return gclue_location_new (entry->latitude,
+                                   entry->longitude,
+                                   entry->accuracy);
+}
+
+/**
+ * gclue_geoip_cache_insert:
+ * @cache: a #GClueGeoipCache
+ * @network_id: the network @location was resolved on
+ * @location: the location returned for the public IP of @network_id
+ *
+ * Remembers @location for @network_id, evicting the oldest entry if the cache
+ * is full.
+ **/
+void
+gclue_geoip_cache_insert (GClueGeoipCache *cache,
+                          const char      *network_id,
+                          GClueLocation   *location)
+{
+        GClueGeoipCachePrivate *priv;
+        CacheEntry *entry;
+
+        g_return_if_fail (GCLUE_IS_GEOIP_CACHE (cache));
+        g_return_if_fail (network_id != NULL);
+        g_return_if_fail (GCLUE_IS_LOCATION (location));
+        priv = cache->priv;
+
+        if (!g_hash_table_contains (priv->entries, network_id))
+                while (g_hash_table_size (priv->entries) >= CACHE_MAX_ENTRIES)
+                        evict_oldest (cache);
+
+        entry = g_slice_new0 (CacheEntry);
+        entry->network_id = g_strdup (network_id);
+        entry->latitude = gclue_location_get_latitude (location);
+        entry->longitude = gclue_location_get_longitude (location);
+        entry->accuracy = gclue_location_get_accuracy (location);
+        entry->time = get_now ();
+        g_hash_table_replace (priv->entries, entry->network_id, entry);
+
+        schedule_save (cache);
+}
@@ -0,0 +1,65 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_GEOIP_CACHE_H
+#define GCLUE_GEOIP_CACHE_H
+
+#include <glib-object.h>
+#include "gclue-location.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_GEOIP_CACHE            (gclue_geoip_cache_get_type())
+#define GCLUE_GEOIP_CACHE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_GEOIP_CACHE, GClueGeoipCache))
+#define GCLUE_GEOIP_CACHE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_GEOIP_CACHE, GClueGeoipCache const))
+#define GCLUE_GEOIP_CACHE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_GEOIP_CACHE, GClueGeoipCacheClass))
+#define GCLUE_IS_GEOIP_CACHE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_GEOIP_CACHE))
+#define GCLUE_IS_GEOIP_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_GEOIP_CACHE))
+#define GCLUE_GEOIP_CACHE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_GEOIP_CACHE, GClueGeoipCacheClass))
+
+typedef struct _GClueGeoipCache        GClueGeoipCache;
+typedef struct _GClueGeoipCacheClass   GClueGeoipCacheClass;
+typedef struct _GClueGeoipCachePrivate GClueGeoipCachePrivate;
+
+struct _GClueGeoipCache
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueGeoipCachePrivate *priv;
+};
+
+struct _GClueGeoipCacheClass
+{
+        GObjectClass parent_class;
+};
+
+GType             gclue_geoip_cache_get_type       (void) G_GNUC_CONST;
+
+GClueGeoipCache * gclue_geoip_cache_get_singleton  (void);
+char *            gclue_geoip_cache_get_network_id (void);
+GClueLocation *   gclue_geoip_cache_lookup         (GClueGeoipCache *cache,
+                                                    const char      *network_id);
+void              gclue_geoip_cache_insert         (GClueGeoipCache *cache,
+                                                    const char      *network_id,
+                                                    GClueLocation   *location);
+
+G_END_DECLS
+
+#endif /* GCLUE_GEOIP_CACHE_H */
@@ -0,0 +1,218 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <math.h>
+#include "gclue-json-writer.h"
+
+/**
+ * SECTION:gclue-json-writer
+ * @short_description: Append-only JSON writer
+ *
+ * Writes JSON text straight into a single growing buffer, for request bodies
+ * whose schema is known up front. Unlike #JsonBuilder and #JsonGenerator, no
+ * tree is built, so producing a body costs one allocation when the size hint
+ * is right. Members are written in call order and nesting is up to the
+ * caller.
+ **/
+
+/**
+ * gclue_json_writer_init:
+ * @writer: an uninitialized #GClueJsonWriter
+ * @size_hint: expected length of the output
+ **/
+void
+gclue_json_writer_init (GClueJsonWriter *writer,
+                        gsize            size_hint)
+{
+        writer->str = g_string_sized_new (size_hint);
+        writer->need_comma = FALSE;
+}
+
+/**
+ * gclue_json_writer_steal:
+ * @writer: a #GClueJsonWriter
+ * @length: (out) (optional): return location for the length of the output
+ *
+ * Finishes @writer. It needs to be initialized again before reuse.
+ *
+ * Returns: (transfer full): The JSON text. Free with g_free().
+ **/
+char *
+gclue_json_writer_steal (GClueJsonWriter *writer,
+                         gsize           *length)
+{
+        if (length != NULL)
+                *length = writer->str->len;
+
+        return g_string_free (g_steal_pointer (&writer->str), FALSE);
+}
+
+static void
+append_string (GString    *str,
+               const char *value)
+{
+        const char *p;
+
+        g_string_append_c (str, '"');
+        for (p = value; *p != '\0'; p++) {
+                unsigned char c = (unsigned char) *p;
+
+                switch (c) {
+                case '"':
+                        g_string_append (str, "\\\"");
+                        break;
+                case '\\':
+                        g_string_append (str, "\\\\");
+                        break;
+                case '\n':
+                        g_string_append (str, "\\n");
+                        break;
+                case '\r':
+                        g_string_append (str, "\\r");
+                        break;
+                case '\t':
+                        g_string_append (str, "\\t");
+                        break;
+                default:
+                        if (c < 0x20)
+                                g_string_append_printf (str, "\\u%04x", c);
+                        else
+                                g_string_append_c (str, c);
+                }
+        }
+        g_string_append_c (str, '"');
+}
+
+static void
+begin_value (GClueJsonWriter *writer,
+             const char      *name)
+{
+        if (writer->need_comma)
+                g_string_append_c (writer->str, ',');
+        writer->need_comma = TRUE;
+
+        if (name != NULL) {
+                append_string (writer->str, name);
+                g_string_append_c (writer->str, ':');
+        }
+}
+
+/**
+ * gclue_json_writer_begin_object:
+ * @writer: a #GClueJsonWriter
+ * @name: (nullable): member name, or %NULL inside an array or at the top
+ **/
+void
+gclue_json_writer_begin_object (GClueJsonWriter *writer,
+                                const char      *name)
+{
+        begin_value (writer, name);
+        g_string_append_c (writer->str, '{');
+        writer->need_comma = FALSE;
+}
+
+/**
+ * gclue_json_writer_end_object:
+ * @writer: a #GClueJsonWriter
+ **/
+void
+gclue_json_writer_end_object (GClueJsonWriter *writer)
+{
+        g_string_append_c (writer->str, '}');
+        writer->need_comma = TRUE;
+}
+
+/**
+ * gclue_json_writer_begin_array:
+ * @writer: a #GClueJsonWriter
+ * @name: (nullable): member name, or %NULL inside an array or at the top
+ **/
+void
+gclue_json_writer_begin_array (GClueJsonWriter *writer,
+                               const char      *name)
+{
+        begin_value (writer, name);
+        g_string_append_c (writer->str, '[');
+        writer->need_comma = FALSE;
+}
+
+/**
+ * gclue_json_writer_end_array:
+ * @writer: a #GClueJsonWriter
+ **/
+void
+gclue_json_writer_end_array (GClueJsonWriter *writer)
+{
+        g_string_append_c (writer->str, ']');
+        writer->need_comma = TRUE;
+}
+
+/**
+ * gclue_json_writer_add_string:
+ * @writer: a #GClueJsonWriter
+ * @name: (nullable): member name, or %NULL inside an array
+ * @value: UTF-8 string value
+ **/
+void
+gclue_json_writer_add_string (GClueJsonWriter *writer,
+                              const char      *name,
+                              const char      *value)
+{
+        begin_value (writer, name);
+        append_string (writer->str, value);
+}
+
+/**
+ * gclue_json_writer_add_int:
+ * @writer: a #GClueJsonWriter
+ * @name: (nullable): member name, or %NULL inside an array
+ * @value: integer value
+ **/
+void
+gclue_json_writer_add_int (GClueJsonWriter *writer,
+                           const char      *name,
+                           gint64           value)
+{
+        begin_value (writer, name);
+        g_string_append_printf (writer->str, "%" G_GINT64_FORMAT, value);
+}
+
+/**
+ * gclue_json_writer_add_double:
+ * @writer: a #GClueJsonWriter
+ * @name: (nullable): member name, or %NULL inside an array
+ * @value: floating point value. JSON has no representation for infinity and
+ * NaN, so those are written as null.
+ **/
+void
+gclue_json_writer_add_double (GClueJsonWriter *writer,
+                              const char      *name,
+                              gdouble          value)
+{
+        char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+        begin_value (writer, name);
+        if (!isfinite (value)) {
+                g_string_append (writer->str, "null");
+                return;
+        }
+
+        g_string_append (writer->str,
+                         g_ascii_dtostr (buf, sizeof (buf), value));
+}
@@ -0,0 +1,59 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_JSON_WRITER_H
+#define GCLUE_JSON_WRITER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GClueJsonWriter GClueJsonWriter;
+
+struct _GClueJsonWriter {
+        /*< private >*/
+        GString *str;
+        gboolean need_comma;
+};
+
+void    gclue_json_writer_init         (GClueJsonWriter *writer,
+                                        gsize            size_hint);
+char *  gclue_json_writer_steal        (GClueJsonWriter *writer,
+                                        gsize           *length);
+
+void    gclue_json_writer_begin_object (GClueJsonWriter *writer,
+                                        const char      *name);
+void    gclue_json_writer_end_object   (GClueJsonWriter *writer);
+void    gclue_json_writer_begin_array  (GClueJsonWriter *writer,
+                                        const char      *name);
+void    gclue_json_writer_end_array    (GClueJsonWriter *writer);
+
+void    gclue_json_writer_add_string   (GClueJsonWriter *writer,
+                                        const char      *name,
+                                        const char      *value);
+void    gclue_json_writer_add_int      (GClueJsonWriter *writer,
+                                        const char      *name,
+                                        gint64           value);
+void    gclue_json_writer_add_double   (GClueJsonWriter *writer,
+                                        const char      *name,
+                                        gdouble          value);
+
+G_END_DECLS
+
+#endif /* GCLUE_JSON_WRITER_H */
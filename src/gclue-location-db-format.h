@@ -0,0 +1,117 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_LOCATION_DB_FORMAT_H
+#define GCLUE_LOCATION_DB_FORMAT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * On-disk layout of location databases, shared by the reader in the daemon
+ * and geoclue-db-compile. All integers are little-endian.
+ *
+ * The file starts with a #DBHeader, padded to a full page, followed by one
+ * section per table (WiFi access points, then cell towers). A section is
+ * made of:
+ *
+ *   records : #DBRecord sorted by key, packed DB_RECORDS_PER_PAGE to a
+ *             DB_PAGE_SIZE page with the tail of each page zero-filled
+ *   index   : one #DBIndexEntry per record page holding the last key of the
+ *             page, stored in Eytzinger (breadth-first binary tree) order
+ *             and padded to a full page
+ *
+ * A lookup walks the index, whose top levels are shared by every lookup and
+ * stay in cache, to find the only page that can hold a key, then searches
+ * that single page. No lookup touches more than one page of records.
+ */
+
+#define DB_MAGIC "GCLUELDB"
+#define DB_VERSION 2
+#define DB_PAGE_SIZE 4096
+
+typedef enum {
+        DB_TABLE_WIFI,
+        DB_TABLE_CELL,
+        DB_N_TABLES
+} DBTable;
+
+typedef struct
+{
+        guint32 n_records;
+        guint32 n_pages;
+        guint64 records_offset;
+        guint64 index_offset;
+} DBSection;
+
+typedef struct
+{
+        char magic[8];
+        guint32 version;
+        guint32 page_size;
+        DBSection sections[DB_N_TABLES];
+} DBHeader;
+
+typedef struct
+{
+        guint64 key;
+        gint32  latitude;  /* Degrees * 1e7 */
+        gint32  longitude; /* Degrees * 1e7 */
+        guint32 range;     /* Meters */
+        guint32 reserved;
+} DBRecord;
+
+typedef struct
+{
+        guint64 last_key;
+        guint64 page;
+} DBIndexEntry;
+
+G_STATIC_ASSERT (sizeof (DBSection) == 24);
+G_STATIC_ASSERT (sizeof (DBHeader) == 64);
+G_STATIC_ASSERT (sizeof (DBRecord) == 24);
+G_STATIC_ASSERT (sizeof (DBIndexEntry) == 16);
+
+#define DB_RECORDS_PER_PAGE (DB_PAGE_SIZE / sizeof (DBRecord))
+
+/* Cell keys: MCC (10 bits), MNC (10 bits), LAC/TAC (16 bits), cell ID (28
+ * bits). Returns FALSE if the cell doesn't fit. */
+static inline gboolean
+db_cell_key (guint    mcc,
+             guint    mnc,
+             gulong   lac,
+             gulong   cell_id,
+             guint64 *key)
+{
+        if (mcc >= 1 << 10 || mnc >= 1 << 10 ||
+            lac >= 1 << 16 || cell_id >= 1 << 28)
+                return FALSE;
+
+        *key = ((guint64) mcc << 54) |
+               ((guint64) mnc << 44) |
+               ((guint64) lac << 28) |
+               (guint64) cell_id;
+
+        return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* GCLUE_LOCATION_DB_FORMAT_H */
@@ -0,0 +1,287 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "gclue-location-db.h"
+#include "gclue-location-db-format.h"
+
+/**
+ * SECTION:gclue-location-db
+ * @short_description: Local database of WiFi access point and cell positions
+ *
+ * Read-only access to a database file, as written by geoclue-db-compile,
+ * mapping WiFi BSSIDs and cell tower identities to their position and range.
+ * The file is memory-mapped rather than loaded, so that databases of millions
+ * of entries cost no more than the pages a lookup touches. See
+ * gclue-location-db-format.h for the layout.
+ **/
+
+typedef struct
+{
+        const DBRecord *records;
+        const DBIndexEntry *index; /* 1-based, Eytzinger order */
+        guint32 n_records;
+        guint32 n_pages;
+} Table;
+
+struct _GClueLocationDB
+{
+        GMappedFile *file;
+
+        Table tables[DB_N_TABLES];
+};
+
+static gboolean
+load_table (GClueLocationDB *db,
+            DBTable          table_id,
+            const DBHeader  *header,
+            const char      *path,
+            GError         **error)
+{
+        const DBSection *section = &header->sections[table_id];
+        const char *contents = g_mapped_file_get_contents (db->file);
+        guint64 length = g_mapped_file_get_length (db->file);
+        Table *table = &db->tables[table_id];
+        guint64 records_offset, index_offset;
+        guint32 n_records, n_pages;
+
+        n_records = GUINT32_FROM_LE (section->n_records);
+        n_pages = GUINT32_FROM_LE (section->n_pages);
+        records_offset = GUINT64_FROM_LE (section->records_offset);
+        index_offset = GUINT64_FROM_LE (section->index_offset);
+
+        if (n_pages != (n_records + DB_RECORDS_PER_PAGE - 1) /
+                       DB_RECORDS_PER_PAGE ||
+            records_offset % DB_PAGE_SIZE != 0 ||
+            index_offset % DB_PAGE_SIZE != 0 ||
+            records_offset > length ||
+            (length - records_offset) / DB_PAGE_SIZE < n_pages ||
+            index_offset > length ||
+            (length - index_offset) / sizeof (DBIndexEntry) <
+            (guint64) n_pages + 1) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "Location database '%s' is corrupt or truncated",
+                             path);
+                return FALSE;
+        }
+
+        table->records = (const DBRecord *) (contents + records_offset);
+        table->index = (const DBIndexEntry *) (contents + index_offset);
+        table->n_records = n_records;
+        table->n_pages = n_pages;
+
+        return TRUE;
+}
+
+/**
+ * gclue_location_db_new:
+ * @path: path to the database file
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: (transfer full): A new #GClueLocationDB, or %NULL on error. Free
+ * with gclue_location_db_free().
+ **/
+GClueLocationDB *
+gclue_location_db_new (const char *path,
+                       GError    **error)
+{
+        GClueLocationDB *db;
+        GMappedFile *file;
+        const DBHeader *header;
+        gsize length;
+        guint i;
+
+        file = g_mapped_file_new (path, FALSE, error);
+        if (file == NULL)
+                return NULL;
+
+        db = g_slice_new0 (GClueLocationDB);
+        db->file = file;
+
+        header = (const DBHeader *) g_mapped_file_get_contents (file);
+        length = g_mapped_file_get_length (file);
+
+        if (length < DB_PAGE_SIZE ||
+            memcmp (header->magic, DB_MAGIC, sizeof (header->magic)) != 0) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "'%s' is not a location database",
+                             path);
+                goto error_out;
+        }
+
+        if (GUINT32_FROM_LE (header->version) != DB_VERSION ||
+            GUINT32_FROM_LE (header->page_size) != DB_PAGE_SIZE) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported version %u of location database '%s'",
+                             GUINT32_FROM_LE (header->version),
+                             path);
+                goto error_out;
+        }
+
+        for (i = 0; i < DB_N_TABLES; i++)
+                if (!load_table (db, i, header, path, error))
+                        goto error_out;
+
+        g_debug ("Opened location database '%s' with %u APs and %u cells",
+                 path,
+                 db->tables[DB_TABLE_WIFI].n_records,
+                 db->tables[DB_TABLE_CELL].n_records);
+
+        return db;
+
+error_out:
+        gclue_location_db_free (db);
+
+        return NULL;
+}
+
+/**
+ * gclue_location_db_free:
+ * @db: a #GClueLocationDB
+ **/
+void
+gclue_location_db_free (GClueLocationDB *db)
+{
+        if (db == NULL)
+                return;
+
+        g_mapped_file_unref (db->file);
+        g_slice_free (GClueLocationDB, db);
+}
+
+static gboolean
+lookup (const Table *table,
+        guint64      key,
+        gdouble     *latitude,
+        gdouble     *longitude,
+        gdouble     *range)
+{
+        const DBRecord *records;
+        guint64 k = 1;
+        guint32 low = 0, high;
+        guint64 page;
+
+        /* Find the first page whose last key is not below @key: descend the
+         * implicit tree, then undo the right turns taken past the answer. */
+        while (k <= table->n_pages)
+                k = 2 * k + (GUINT64_FROM_LE (table->index[k].last_key) < key);
+        while (k & 1)
+                k >>= 1;
+        k >>= 1;
+        if (k == 0)
+                return FALSE;
+
+        page = GUINT64_FROM_LE (table->index[k].page);
+        if (page >= table->n_pages)
+                return FALSE;
+
+        records = (const DBRecord *) ((const char *) table->records +
+                                      page * DB_PAGE_SIZE);
+        high = MIN (DB_RECORDS_PER_PAGE,
+                    table->n_records - page * DB_RECORDS_PER_PAGE);
+        while (low < high) {
+                guint32 mid = low + (high - low) / 2;
+                guint64 record_key = GUINT64_FROM_LE (records[mid].key);
+
+                if (record_key < key) {
+                        low = mid + 1;
+                } else if (record_key > key) {
+                        high = mid;
+                } else {
+                        *latitude = GINT32_FROM_LE (records[mid].latitude) / 1e7;
+                        *longitude = GINT32_FROM_LE (records[mid].longitude) / 1e7;
+                        *range = GUINT32_FROM_LE (records[mid].range);
+
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * gclue_location_db_lookup_bssid:
+ * @db: a #GClueLocationDB
+ * @bssid: BSSID of the AP in the lower 48 bits
+ * @latitude: (out): latitude of the AP
+ * @longitude: (out): longitude of the AP
+ * @range: (out): range of the AP in meters
+ *
+ * Returns: %TRUE if @bssid is in @db, %FALSE otherwise.
+ **/
+gboolean
+gclue_location_db_lookup_bssid (GClueLocationDB *db,
+                                guint64          bssid,
+                                gdouble         *latitude,
+                                gdouble         *longitude,
+                                gdouble         *range)
+{
+        g_return_val_if_fail (db != NULL, FALSE);
+
+        return lookup (&db->tables[DB_TABLE_WIFI],
+                       bssid,
+                       latitude,
+                       longitude,
+                       range);
+}
+
+/**
+ * gclue_location_db_lookup_cell:
+ * @db: a #GClueLocationDB
+ * @mcc: mobile country code
+ * @mnc: mobile network code
+ * @lac: location or tracking area code
+ * @cell_id: cell ID
+ * @latitude: (out): latitude of the cell
+ * @longitude: (out): longitude of the cell
+ * @range: (out): range of the cell in meters
+ *
+ * Returns: %TRUE if the cell is in @db, %FALSE otherwise.
+ **/
+gboolean
+gclue_location_db_lookup_cell (GClueLocationDB *db,
+                               guint            mcc,
+                               guint            mnc,
+                               gulong           lac,
+                               gulong           cell_id,
+                               gdouble         *latitude,
+                               gdouble         *longitude,
+                               gdouble         *range)
+{
+        guint64 key;
+
+        g_return_val_if_fail (db != NULL, FALSE);
+
+        if (!db_cell_key (mcc, mnc, lac, cell_id, &key))
+                return FALSE;
+
+        return lookup (&db->tables[DB_TABLE_CELL],
+                       key,
+                       latitude,
+                       longitude,
+                       range);
+}
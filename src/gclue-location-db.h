@@ -0,0 +1,52 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_LOCATION_DB_H
+#define GCLUE_LOCATION_DB_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GClueLocationDB GClueLocationDB;
+
+GClueLocationDB *
+gclue_location_db_new         (const char      *path,
+                               GError         **error);
+void
+gclue_location_db_free        (GClueLocationDB *db);
+gboolean
+gclue_location_db_lookup_bssid (GClueLocationDB *db,
+                                guint64          bssid,
+                                gdouble         *latitude,
+                                gdouble         *longitude,
+                                gdouble         *range);
+gboolean
+gclue_location_db_lookup_cell (GClueLocationDB *db,
+                               guint            mcc,
+                               guint            mnc,
+                               gulong           lac,
+                               gulong           cell_id,
+                               gdouble         *latitude,
+                               gdouble         *longitude,
+                               gdouble         *range);
+
+G_END_DECLS
+
+#endif /* GCLUE_LOCATION_DB_H */
@@ -0,0 +1,317 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <math.h>
+#include "gclue-location-filter.h"
+
+/**
+ * SECTION:gclue-location-filter
+ * @short_description: Fuses location fixes from all sources
+ *
+ * A constant velocity Kalman filter, taking each fix as a measurement of
+ * the position with its accuracy as standard deviation, whichever source
+ * it comes from. Fixes thereby add up, each weighed by how accurate it is
+ * compared to what we already know, instead of the most accurate recent one
+ * winning outright.
+ *
+ * The accuracy of a fix being a circle, the error is the same along both
+ * axes, and so is the covariance of the estimate: we only keep one for both.
+ * The state is kept in degrees, with fixes projected onto the plane around
+ * the current estimate for each update.
+ **/
+
+#define EARTH_RADIUS 6372795.0 /* meters */
+
+/* How hard, in m/s², we expect to be accelerating or turning */
+#define ACCELERATION_NOISE 2.0
+/* How fast, in m/s, we might be moving when we know nothing yet */
+#define INITIAL_SPEED_ERROR 10.0
+/* Seconds between two fixes after which we rather start over */
+#define MAX_GAP 3600
+/* Fixes further off than this, in squared standard deviations of how far
+ * off we expect them to be, are taken as outliers. Only 0.1% of the fixes
+ * that are right should be. */
+#define OUTLIER_GATE 13.8
+/* After so many outliers in a row, we take it we are the ones off */
+#define MAX_OUTLIERS 3
+/* Best accuracy, in meters, we believe any fix to have. GPS fixes with a
+ * good HDOP claim to be spot on, which would make us trust them blindly. */
+#define MIN_ACCURACY 5.0
+
+/* The last fix of a source, to tell repeats */
+typedef struct
+{
+        gboolean known;
+        gdouble latitude;
+        gdouble longitude;
+        gdouble accuracy;
+} LastFix;
+
+struct _GClueLocationFilter
+{
+        gboolean initialized;
+
+        gdouble latitude;
+        gdouble longitude;
+        gdouble velocity_east;  /* m/s */
+        gdouble velocity_north; /* m/s */
+        guint64 timestamp;
+
+        /* Covariance of position and velocity along each axis */
+        gdouble position_variance;
+        gdouble covariance;
+        gdouble velocity_variance;
+
+        guint n_outliers;
+
+        /* Sources re-emit cached fixes in between those of others */
+        LastFix last_fixes[GCLUE_LOCATION_FILTER_MAX_SOURCES];
+};
+
+static gdouble
+normalize_longitude (gdouble longitude)
+{
+        while (longitude > 180.0)
+                longitude -= 360.0;
+        while (longitude < -180.0)
+                longitude += 360.0;
+
+        return longitude;
+}
+
+static gdouble
+get_meters_per_degree_longitude (GClueLocationFilter *filter)
+{
+        gdouble scale = cos (filter->latitude * M_PI / 180.0);
+
+        return MAX (scale, 1e-6) * EARTH_RADIUS * M_PI / 180.0;
+}
+
+static void
+move (GClueLocationFilter *filter,
+      gdouble              east,
+      gdouble              north)
+{
+        filter->longitude = normalize_longitude
+                (filter->longitude +
+                 east / get_meters_per_degree_longitude (filter));
+        filter->latitude = CLAMP (filter->latitude +
+                                  north / (EARTH_RADIUS * M_PI / 180.0),
+                                  -90.0,
+                                  90.0);
+}
+
+static gdouble
+get_accuracy (GClueLocation *location)
+{
+        return MAX (gclue_location_get_accuracy (location), MIN_ACCURACY);
+}
+
+static gboolean
+is_repeat (LastFix       *last_fix,
+           GClueLocation *location)
+{
+        return last_fix->known &&
+               gclue_location_get_latitude (location) == last_fix->latitude &&
+               gclue_location_get_longitude (location) == last_fix->longitude &&
+               get_accuracy (location) == last_fix->accuracy;
+}
+
+static void
+start_over (GClueLocationFilter *filter,
+            GClueLocation       *location)
+{
+        gdouble accuracy = get_accuracy (location);
+
+        filter->initialized = TRUE;
+        filter->latitude = gclue_location_get_latitude (location);
+        filter->longitude = gclue_location_get_longitude (location);
+        filter->velocity_east = 0.0;
+        filter->velocity_north = 0.0;
+        filter->timestamp = gclue_location_get_timestamp (location);
+        filter->position_variance = accuracy * accuracy;
+        filter->covariance = 0.0;
+        filter->velocity_variance = INITIAL_SPEED_ERROR * INITIAL_SPEED_ERROR;
+        filter->n_outliers = 0;
+}
+
+static void
+predict (GClueLocationFilter *filter,
+         gdouble              dt)
+{
+        gdouble noise = ACCELERATION_NOISE * ACCELERATION_NOISE;
+
+        move (filter, filter->velocity_east * dt, filter->velocity_north * dt);
+
+        filter->position_variance += 2 * dt * filter->covariance +
+                                     dt * dt * filter->velocity_variance +
+                                     noise * dt * dt * dt / 3;
+        filter->covariance += dt * filter->velocity_variance +
+                              noise * dt * dt / 2;
+        filter->velocity_variance += noise * dt;
+}
+
+/* Returns FALSE if @location is an outlier */
+static gboolean
+correct (GClueLocationFilter *filter,
+         GClueLocation       *location)
+{
+        gdouble accuracy, variance, position_gain, velocity_gain;
+        gdouble east, north;
+
+        north = (gclue_location_get_latitude (location) - filter->latitude) *
+                EARTH_RADIUS * M_PI / 180.0;
+        east = normalize_longitude (gclue_location_get_longitude (location) -
+                                    filter->longitude) *
+               get_meters_per_degree_longitude (filter);
+
+        accuracy = get_accuracy (location);
+        variance = filter->position_variance + accuracy * accuracy;
+        if ((east * east + north * north) / variance > OUTLIER_GATE)
+                return FALSE;
+
+        position_gain = filter->position_variance / variance;
+        velocity_gain = filter->covariance / variance;
+
+        move (filter, position_gain * east, position_gain * north);
+        filter->velocity_east += velocity_gain * east;
+        filter->velocity_north += velocity_gain * north;
+
+        filter->velocity_variance -= velocity_gain * filter->covariance;
+        filter->covariance *= 1 - position_gain;
+        filter->position_variance *= 1 - position_gain;
+
+        return TRUE;
+}
+
+/**
+ * gclue_location_filter_new:
+ *
+ * Returns: a new #GClueLocationFilter, knowing nothing yet. Free with
+ * gclue_location_filter_free().
+ **/
+GClueLocationFilter *
+gclue_location_filter_new (void)
+{
+        return g_slice_new0 (GClueLocationFilter);
+}
+
+void
+gclue_location_filter_free (GClueLocationFilter *filter)
+{
+        g_slice_free (GClueLocationFilter, filter);
+}
+
+/**
+ * gclue_location_filter_reset:
+ * @filter: a #GClueLocationFilter
+ *
+ * Forgets all about the fixes so far.
+ **/
+void
+gclue_location_filter_reset (GClueLocationFilter *filter)
+{
+        guint i;
+
+        filter->initialized = FALSE;
+        for (i = 0; i < GCLUE_LOCATION_FILTER_MAX_SOURCES; i++)
+                filter->last_fixes[i].known = FALSE;
+}
+
+/**
+ * gclue_location_filter_update:
+ * @filter: a #GClueLocationFilter
+ * @location: a new fix
+ * @source: index of the source of @location, below
+ * %GCLUE_LOCATION_FILTER_MAX_SOURCES
+ *
+ * Takes @location into account.
+ *
+ * Returns: (transfer full) (nullable): the location as it stands now, with
+ * the speed, heading, altitude and description of @location, or %NULL if
+ * @location doesn't change it, as it's older than what we have, a repeat
+ * of the last fix of @source, or an outlier. Fixes of unknown accuracy can't be weighed
+ * against the others, so they are only passed on as they are while we know
+ * nothing better.
+ **/
+GClueLocation *
+gclue_location_filter_update (GClueLocationFilter *filter,
+                              GClueLocation       *location,
+                              guint                source)
+{
+        guint64 timestamp = gclue_location_get_timestamp (location);
+        gdouble accuracy = get_accuracy (location);
+        LastFix *last_fix;
+
+        g_return_val_if_fail (source < GCLUE_LOCATION_FILTER_MAX_SOURCES,
+                              NULL);
+        last_fix = &filter->last_fixes[source];
+
+        if (gclue_location_get_accuracy (location) < 0) {
+                if (filter->initialized)
+                        return NULL;
+
+                g_debug ("New location of unknown accuracy, passing it on.");
+                return g_object_ref (location);
+        }
+
+        if (!filter->initialized || timestamp > filter->timestamp + MAX_GAP) {
+                start_over (filter, location);
+        } else if (timestamp < filter->timestamp) {
+                g_debug ("New location older than current, ignoring.");
+                return NULL;
+        } else if (is_repeat (last_fix, location)) {
+                /* Nothing we didn't know, and taking it in again would make
+                 * us overconfident */
+                g_debug ("New location same as last one, ignoring.");
+                return NULL;
+        } else {
+                GClueLocationFilter predicted = *filter;
+
+                predict (&predicted, timestamp - filter->timestamp);
+                if (correct (&predicted, location)) {
+                        *filter = predicted;
+                        filter->timestamp = timestamp;
+                        filter->n_outliers = 0;
+                } else if (accuracy * accuracy < predicted.position_variance ||
+                           ++filter->n_outliers >= MAX_OUTLIERS) {
+                        /* Either it knows better, or we're the ones off */
+                        g_debug ("New location far off, starting over.");
+                        start_over (filter, location);
+                } else {
+                        g_debug ("New location too far off, ignoring.");
+                        return NULL;
+                }
+        }
+
+        last_fix->known = TRUE;
+        last_fix->latitude = gclue_location_get_latitude (location);
+        last_fix->longitude = gclue_location_get_longitude (location);
+        last_fix->accuracy = accuracy;
+
+        return gclue_location_new_full
+                (filter->latitude,
+                 filter->longitude,
+                 sqrt (filter->position_variance),
+                 gclue_location_get_speed (location),
+                 gclue_location_get_heading (location),
+                 gclue_location_get_altitude (location),
+                 timestamp,
+                 gclue_location_get_description (location));
+}
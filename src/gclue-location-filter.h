@@ -0,0 +1,46 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_LOCATION_FILTER_H
+#define GCLUE_LOCATION_FILTER_H
+
+#include <glib.h>
+#include "gclue-location.h"
+
+G_BEGIN_DECLS
+
+/* Number of sources whose fixes we tell apart */
+#define GCLUE_LOCATION_FILTER_MAX_SOURCES 8
+
+typedef struct _GClueLocationFilter GClueLocationFilter;
+
+GClueLocationFilter *
+gclue_location_filter_new    (void);
+void
+gclue_location_filter_free   (GClueLocationFilter *filter);
+void
+gclue_location_filter_reset  (GClueLocationFilter *filter);
+GClueLocation *
+gclue_location_filter_update (GClueLocationFilter *filter,
+                              GClueLocation       *location,
+                              guint                source);
+
+G_END_DECLS
+
+#endif /* GCLUE_LOCATION_FILTER_H */
@@ -414,7 +414,7 @@ gclue_location_source_set_location (GClueLocationSource *source,
                         latitude += distance * LATITUDE_IN_KM;
                 else
                         latitude -= distance * LATITUDE_IN_KM;
-                accuracy += 3000;
+                accuracy += GCLUE_LOCATION_SOURCE_SCRAMBLE_ACCURACY;
 
                 g_object_set (G_OBJECT (priv->location),
                               "latitude", latitude,
@@ -482,6 +482,21 @@ gclue_location_source_get_available_accuracy_level (GClueLocationSource *source)
         return source->priv->avail_accuracy_level;
 }
 
+/**
+ * gclue_location_source_get_scramble_location
+ * @source: a #GClueLocationSource
+ *
+ * Returns: %TRUE if the locations of @source are randomly offset so they
+ * only give away the city, %FALSE otherwise.
+ **/
+gboolean
+gclue_location_source_get_scramble_location (GClueLocationSource *source)
+{
+        g_return_val_if_fail (GCLUE_IS_LOCATION_SOURCE (source), FALSE);
+
+        return source->priv->scramble_location;
+}
+
 /**
  * gclue_location_source_get_compute_movement
  * @source: a #GClueLocationSource
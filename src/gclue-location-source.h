@@ -30,6 +30,9 @@
 
 G_BEGIN_DECLS
 
+/* Added to the accuracy of scrambled locations, in meters */
+#define GCLUE_LOCATION_SOURCE_SCRAMBLE_ACCURACY 3000
+
 #define GCLUE_TYPE_LOCATION_SOURCE            (gclue_location_source_get_type())
 #define GCLUE_LOCATION_SOURCE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_LOCATION_SOURCE, GClueLocationSource))
 #define GCLUE_LOCATION_SOURCE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_LOCATION_SOURCE, GClueLocationSource const))
@@ -76,6 +79,9 @@ GClueMinUINT     *gclue_location_source_get_time_threshold
                                               (GClueLocationSource *source);
 
 gboolean
+gclue_location_source_get_scramble_location
+                                 (GClueLocationSource *source);
+gboolean
 gclue_location_source_get_compute_movement (GClueLocationSource *source);
 void
 gclue_location_source_set_compute_movement (GClueLocationSource *source,
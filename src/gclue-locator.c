@@ -25,6 +25,7 @@
 #include <glib/gi18n.h>
 
 #include "gclue-locator.h"
+#include "gclue-location-filter.h"
 
 #include "gclue-wifi.h"
 #include "gclue-config.h"
@@ -53,6 +54,19 @@
  * location sources from rest of the code
  */
 
+/* Enough for all the sources we can have, as a bitmask */
+#define MAX_SOURCES 8
+#define N_ACCURACY_LEVELS (GCLUE_ACCURACY_LEVEL_EXACT + 1)
+G_STATIC_ASSERT (MAX_SOURCES <= GCLUE_LOCATION_FILTER_MAX_SOURCES);
+
+typedef struct
+{
+        GClueLocator *locator;
+        GClueLocationSource *source;
+        guint index;
+        GClueAccuracyLevel level; /* Available, as of the last notify */
+} SourceSlot;
+
 static gboolean
 gclue_locator_start (GClueLocationSource *source);
 static gboolean
@@ -60,8 +74,12 @@ gclue_locator_stop (GClueLocationSource *source);
 
 struct _GClueLocatorPrivate
 {
-        GList *sources;
-        GList *active_sources;
+        SourceSlot sources[MAX_SOURCES];
+        guint n_sources;
+        guint active_sources;                   /* Bitmask of sources */
+        guint level_sources[N_ACCURACY_LEVELS]; /* Same, by level */
+
+        GClueLocationFilter *filter; /* Fuses the fixes of all of them */
 
         GClueAccuracyLevel accuracy_level;
 
@@ -83,51 +101,49 @@ enum
 static GParamSpec *gParamSpecs[LAST_PROP];
 
 static void
-set_location (GClueLocator  *locator,
+set_location (SourceSlot    *slot,
               GClueLocation *location)
 {
-        GClueLocation *cur_location;
-
-        cur_location = gclue_location_source_get_location
-                        (GCLUE_LOCATION_SOURCE (locator));
+        GClueLocator *locator = slot->locator;
+        GClueLocation *published;
 
         g_debug ("New location available");
 
-        if (cur_location != NULL) {
-            if (gclue_location_get_timestamp (location) <
-                gclue_location_get_timestamp (cur_location)) {
-                    g_debug ("New location older than current, ignoring.");
-                    return;
-            }
-
-            if (gclue_location_get_distance_from (location, cur_location)
-                * 1000 <
-                gclue_location_get_accuracy (location) &&
-                gclue_location_get_accuracy (location) >
-                gclue_location_get_accuracy (cur_location)) {
-                    /* We only take the new location if either the previous one
-                     * lies outside its accuracy circle or its more or as
-                     * accurate as previous one.
-                     */
-                    g_debug ("Ignoring less accurate new location");
-                    return;
-            }
+        if (gclue_location_source_get_scramble_location (slot->source)) {
+                /* Fusing scrambled fixes would average their random offsets
+                 * away, so pass them on as they are, and never as more
+                 * accurate than the scrambling. */
+                published = gclue_location_duplicate (location);
+                if (gclue_location_get_accuracy (published) <
+                    GCLUE_LOCATION_SOURCE_SCRAMBLE_ACCURACY)
+                        g_object_set (G_OBJECT (published),
+                                      "accuracy",
+                                      (gdouble) GCLUE_LOCATION_SOURCE_SCRAMBLE_ACCURACY,
+                                      NULL);
+        } else {
+                published = gclue_location_filter_update
+                        (locator->priv->filter, location, slot->index);
+                if (published == NULL)
+                        return;
         }
 
         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (locator),
-                                            location);
+                                            published);
+        g_object_unref (published);
 }
 
-static gint
-compare_accuracy_level (GClueLocationSource *src_a,
-                        GClueLocationSource *src_b)
+static GClueAccuracyLevel
+get_highest_level (GClueLocator *locator)
 {
-        GClueAccuracyLevel level_a, level_b;
+        gint level;
 
-        level_a = gclue_location_source_get_available_accuracy_level (src_a);
-        level_b = gclue_location_source_get_available_accuracy_level (src_b);
+        for (level = GCLUE_ACCURACY_LEVEL_EXACT;
+             level > GCLUE_ACCURACY_LEVEL_NONE;
+             level--)
+                if (locator->priv->level_sources[level] != 0)
+                        return level;
 
-        return (level_b - level_a);
+        return GCLUE_ACCURACY_LEVEL_NONE;
 }
 
 static void
@@ -135,17 +151,7 @@ refresh_available_accuracy_level (GClueLocator *locator)
 {
         GClueAccuracyLevel new, existing;
 
-        /* Sort the sources according to their accuracy level so that the head
-         * of the list will have the highest level. The goal is to start the
-         * most accurate source first and when all sources are already active
-         * for an app, a second app to get the most accurate location only.
-         */
-        locator->priv->sources = g_list_sort
-                        (locator->priv->sources,
-                         (GCompareFunc) compare_accuracy_level);
-
-        new = gclue_location_source_get_available_accuracy_level
-                        (GCLUE_LOCATION_SOURCE (locator->priv->sources->data));
+        new = get_highest_level (locator);
 
         existing = gclue_location_source_get_available_accuracy_level
                         (GCLUE_LOCATION_SOURCE (locator));
@@ -161,50 +167,72 @@ on_location_changed (GObject    *gobject,
                      GParamSpec *pspec,
                      gpointer    user_data)
 {
-        GClueLocator *locator = GCLUE_LOCATOR (user_data);
-        GClueLocationSource *source = GCLUE_LOCATION_SOURCE (gobject);
+        SourceSlot *slot = user_data;
         GClueLocation *location;
 
-        location = gclue_location_source_get_location (source);
-        set_location (locator, location);
+        location = gclue_location_source_get_location (slot->source);
+        set_location (slot, location);
 }
 
 static gboolean
-is_source_active (GClueLocator        *locator,
-                  GClueLocationSource *src)
+is_source_active (SourceSlot *slot)
 {
-        return (g_list_find (locator->priv->active_sources, src) != NULL);
+        return (slot->locator->priv->active_sources & (1u << slot->index)) != 0;
 }
 
 static void
-start_source (GClueLocator        *locator,
-              GClueLocationSource *src)
+start_source (SourceSlot *slot)
 {
+        GClueLocationSource *src = slot->source;
         GClueLocation *location;
 
+        slot->locator->priv->active_sources |= 1u << slot->index;
         g_signal_connect (G_OBJECT (src),
                           "notify::location",
                           G_CALLBACK (on_location_changed),
-                          locator);
+                          slot);
 
         location = gclue_location_source_get_location (src);
         if (gclue_location_source_get_active (src) && location != NULL)
-                set_location (locator, location);
+                set_location (slot, location);
 
         gclue_location_source_start (src);
 }
 
+static void
+stop_source (SourceSlot *slot)
+{
+        slot->locator->priv->active_sources &= ~(1u << slot->index);
+        g_signal_handlers_disconnect_by_func (G_OBJECT (slot->source),
+                                              G_CALLBACK (on_location_changed),
+                                              slot);
+        gclue_location_source_stop (slot->source);
+}
+
+/* Files @slot under the accuracy level its source has to offer now */
+static void
+update_source_level (SourceSlot *slot)
+{
+        GClueLocatorPrivate *priv = slot->locator->priv;
+
+        priv->level_sources[slot->level] &= ~(1u << slot->index);
+        slot->level = gclue_location_source_get_available_accuracy_level
+                        (slot->source);
+        priv->level_sources[slot->level] |= 1u << slot->index;
+}
+
 static void
 on_avail_accuracy_level_changed (GObject    *gobject,
                                  GParamSpec *pspec,
                                  gpointer    user_data)
 {
-        GClueLocationSource *src = GCLUE_LOCATION_SOURCE (gobject);
-        GClueLocator *locator = GCLUE_LOCATOR (user_data);
+        SourceSlot *slot = user_data;
+        GClueLocator *locator = slot->locator;
         GClueLocatorPrivate *priv = locator->priv;
         GClueAccuracyLevel level;
         gboolean active;
 
+        update_source_level (slot);
         refresh_available_accuracy_level (locator);
 
         active = gclue_location_source_get_active
@@ -212,23 +240,15 @@ on_avail_accuracy_level_changed (GObject    *gobject,
         if (!active)
                 return;
 
-        level = gclue_location_source_get_available_accuracy_level (src);
+        level = slot->level;
         if (level != GCLUE_ACCURACY_LEVEL_NONE &&
             priv->accuracy_level >= level &&
-            !is_source_active (locator, src)) {
-                start_source (locator, src);
-
-                priv->active_sources =
-                        g_list_append (locator->priv->active_sources, src);
+            !is_source_active (slot)) {
+                start_source (slot);
         } else if ((level == GCLUE_ACCURACY_LEVEL_NONE ||
                     priv->accuracy_level < level) &&
-                   is_source_active (locator, src)) {
-                g_signal_handlers_disconnect_by_func (G_OBJECT (src),
-                                                      G_CALLBACK (on_location_changed),
-                                                      locator);
-                gclue_location_source_stop (src);
-                priv->active_sources = g_list_remove (priv->active_sources,
-                                                      src);
+                   is_source_active (slot)) {
+                stop_source (slot);
         }
 }
 
@@ -252,13 +272,12 @@ on_time_threshold_changed (GObject    *gobject,
         GClueMinUINT *threshold = GCLUE_MIN_UINT (gobject);
         GClueLocator *locator = GCLUE_LOCATOR (user_data);
         guint value = gclue_min_uint_get_value (threshold);
-        GList *node;
+        guint i;
 
-        for (node = locator->priv->sources; node != NULL; node = node->next) {
+        for (i = 0; i < locator->priv->n_sources; i++)
                 reset_time_threshold (locator,
-                                      GCLUE_LOCATION_SOURCE (node->data),
+                                      locator->priv->sources[i].source,
                                       value);
-        }
 }
 
 static void
@@ -302,8 +321,8 @@ gclue_locator_finalize (GObject *gsource)
 {
         GClueLocator *locator = GCLUE_LOCATOR (gsource);
         GClueLocatorPrivate *priv = locator->priv;
-        GList *node;
         GClueMinUINT *threshold;
+        guint i;
 
         G_OBJECT_CLASS (gclue_locator_parent_class)->finalize (gsource);
 
@@ -314,22 +333,37 @@ gclue_locator_finalize (GObject *gsource)
                  G_CALLBACK (on_time_threshold_changed),
                  locator);
 
-        for (node = locator->priv->sources; node != NULL; node = node->next) {
+        for (i = 0; i < priv->n_sources; i++) {
+                SourceSlot *slot = &priv->sources[i];
+
                 g_signal_handlers_disconnect_by_func
-                        (G_OBJECT (node->data),
+                        (G_OBJECT (slot->source),
                          G_CALLBACK (on_avail_accuracy_level_changed),
-                         locator);
-        }
-        for (node = locator->priv->active_sources; node != NULL; node = node->next) {
-                g_signal_handlers_disconnect_by_func
-                        (G_OBJECT (node->data),
-                         G_CALLBACK (on_location_changed),
-                         locator);
-                gclue_location_source_stop (GCLUE_LOCATION_SOURCE (node->data));
+                         slot);
+                if (is_source_active (slot))
+                        stop_source (slot);
+                g_clear_object (&slot->source);
         }
-        g_list_free_full (priv->sources, g_object_unref);
-        priv->sources = NULL;
-        priv->active_sources = NULL;
+        priv->n_sources = 0;
+        g_clear_pointer (&priv->filter, gclue_location_filter_free);
+}
+
+/* Takes over the ref to @source */
+static void
+add_source (GClueLocator        *locator,
+            GClueLocationSource *source)
+{
+        GClueLocatorPrivate *priv = locator->priv;
+        SourceSlot *slot;
+
+        g_assert (priv->n_sources < MAX_SOURCES);
+
+        slot = &priv->sources[priv->n_sources];
+        slot->locator = locator;
+        slot->source = source;
+        slot->index = priv->n_sources++;
+        slot->level = GCLUE_ACCURACY_LEVEL_NONE;
+        update_source_level (slot);
 }
 
 static void
@@ -339,23 +373,21 @@ gclue_locator_constructed (GObject *object)
         GClueLocationSource *submit_source = NULL;
         GClueConfig *gconfig = gclue_config_get_singleton ();
         GClueWifi *wifi;
-        GList *node;
         GClueMinUINT *threshold;
+        guint i;
 
         G_OBJECT_CLASS (gclue_locator_parent_class)->constructed (object);
 
 #if GCLUE_USE_3G_SOURCE
         if (gclue_config_get_enable_3g_source (gconfig)) {
                 GClue3G *source = gclue_3g_get_singleton ();
-                locator->priv->sources = g_list_append (locator->priv->sources,
-                                                        source);
+                add_source (locator, GCLUE_LOCATION_SOURCE (source));
         }
 #endif
 #if GCLUE_USE_CDMA_SOURCE
         if (gclue_config_get_enable_cdma_source (gconfig)) {
                 GClueCDMA *cdma = gclue_cdma_get_singleton ();
-                locator->priv->sources = g_list_append (locator->priv->sources,
-                                                        cdma);
+                add_source (locator, GCLUE_LOCATION_SOURCE (cdma));
         }
 #endif
         if (gclue_config_get_enable_wifi_source (gconfig))
@@ -363,39 +395,38 @@ gclue_locator_constructed (GObject *object)
         else
                 /* City-level accuracy will give us GeoIP-only source */
                 wifi = gclue_wifi_get_singleton (GCLUE_ACCURACY_LEVEL_CITY);
-        locator->priv->sources = g_list_append (locator->priv->sources, wifi);
+        add_source (locator, GCLUE_LOCATION_SOURCE (wifi));
 #if GCLUE_USE_MODEM_GPS_SOURCE
         if (gclue_config_get_enable_modem_gps_source (gconfig)) {
                 GClueModemGPS *gps = gclue_modem_gps_get_singleton ();
-                locator->priv->sources = g_list_append (locator->priv->sources,
-                                                        gps);
+                add_source (locator, GCLUE_LOCATION_SOURCE (gps));
                 submit_source = GCLUE_LOCATION_SOURCE (gps);
         }
 #endif
 #if GCLUE_USE_NMEA_SOURCE
         if (gclue_config_get_enable_nmea_source (gconfig)) {
                 GClueNMEASource *nmea = gclue_nmea_source_get_singleton ();
-                locator->priv->sources = g_list_append (locator->priv->sources,
-                                                        nmea);
+                add_source (locator, GCLUE_LOCATION_SOURCE (nmea));
         }
 #endif
 #if GCLUE_USE_HYBRIS_SOURCE
         if (gclue_config_get_enable_hybris_source (gconfig)) {
                 GClueHybrisSource *hybris = gclue_hybris_source_get_singleton ();
-                locator->priv->sources = g_list_append (locator->priv->sources,
-                                                        hybris);
+                add_source (locator, GCLUE_LOCATION_SOURCE (hybris));
         }
 #endif
 
-        for (node = locator->priv->sources; node != NULL; node = node->next) {
-                g_signal_connect (G_OBJECT (node->data),
+        for (i = 0; i < locator->priv->n_sources; i++) {
+                SourceSlot *slot = &locator->priv->sources[i];
+
+                g_signal_connect (G_OBJECT (slot->source),
                                   "notify::available-accuracy-level",
                                   G_CALLBACK (on_avail_accuracy_level_changed),
-                                  locator);
+                                  slot);
 
-                if (submit_source != NULL && GCLUE_IS_WEB_SOURCE (node->data))
+                if (submit_source != NULL && GCLUE_IS_WEB_SOURCE (slot->source))
                         gclue_web_source_set_submit_source
-                                (GCLUE_WEB_SOURCE (node->data), submit_source);
+                                (GCLUE_WEB_SOURCE (slot->source), submit_source);
         }
 
         threshold = gclue_location_source_get_time_threshold
@@ -441,6 +472,7 @@ gclue_locator_init (GClueLocator *locator)
                 G_TYPE_INSTANCE_GET_PRIVATE (locator,
                                             GCLUE_TYPE_LOCATOR,
                                             GClueLocatorPrivate);
+        locator->priv->filter = gclue_location_filter_new ();
 }
 
 static gboolean
@@ -448,34 +480,45 @@ gclue_locator_start (GClueLocationSource *source)
 {
         GClueLocationSourceClass *base_class;
         GClueLocator *locator;
-        GList *node;
+        GClueLocatorPrivate *priv;
+        gboolean already_active;
+        gint level, i;
 
         g_return_val_if_fail (GCLUE_IS_LOCATOR (source), FALSE);
         locator = GCLUE_LOCATOR (source);
+        priv = locator->priv;
 
+        already_active = gclue_location_source_get_active (source);
         base_class = GCLUE_LOCATION_SOURCE_CLASS (gclue_locator_parent_class);
         if (!base_class->start (source))
                 return FALSE;
 
-        for (node = locator->priv->sources; node != NULL; node = node->next) {
-                GClueLocationSource *src = GCLUE_LOCATION_SOURCE (node->data);
-                GClueAccuracyLevel level;
-
-                level = gclue_location_source_get_available_accuracy_level (src);
-                if (level > locator->priv->accuracy_level ||
-                    level == GCLUE_ACCURACY_LEVEL_NONE) {
-                        g_debug ("Not starting %s (accuracy level: %u). "
-                                 "Requested accuracy level: %u.",
-                                 G_OBJECT_TYPE_NAME (src),
-                                 level,
-                                 locator->priv->accuracy_level);
-                        continue;
+        /* Another client of a shared locator got the sources going */
+        if (already_active)
+                return TRUE;
+
+        /* The most accurate sources first, so that when all sources are
+         * already active for an app, a second app gets the most accurate
+         * location only. */
+        for (level = GCLUE_ACCURACY_LEVEL_EXACT;
+             level >= GCLUE_ACCURACY_LEVEL_NONE;
+             level--) {
+                i = -1;
+                while ((i = g_bit_nth_lsf (priv->level_sources[level], i)) >= 0) {
+                        SourceSlot *slot = &priv->sources[i];
+
+                        if (level > priv->accuracy_level ||
+                            level == GCLUE_ACCURACY_LEVEL_NONE) {
+                                g_debug ("Not starting %s (accuracy level: %u). "
+                                         "Requested accuracy level: %u.",
+                                         G_OBJECT_TYPE_NAME (slot->source),
+                                         level,
+                                         priv->accuracy_level);
+                                continue;
+                        }
+
+                        start_source (slot);
                 }
-
-                locator->priv->active_sources = g_list_append (locator->priv->active_sources,
-                                                               src);
-
-                start_source (locator, src);
         }
 
         return TRUE;
@@ -486,7 +529,7 @@ gclue_locator_stop (GClueLocationSource *source)
 {
         GClueLocationSourceClass *base_class;
         GClueLocator *locator;
-        GList *node;
+        gint i;
 
         g_return_val_if_fail (GCLUE_IS_LOCATOR (source), FALSE);
         locator = GCLUE_LOCATOR (source);
@@ -495,41 +538,80 @@ gclue_locator_stop (GClueLocationSource *source)
         if (!base_class->stop (source))
                 return FALSE;
 
-        for (node = locator->priv->active_sources; node != NULL; node = node->next) {
-                GClueLocationSource *src = GCLUE_LOCATION_SOURCE (node->data);
+        while ((i = g_bit_nth_lsf (locator->priv->active_sources, -1)) >= 0) {
+                SourceSlot *slot = &locator->priv->sources[i];
 
-                g_signal_handlers_disconnect_by_func (G_OBJECT (src),
-                                                      G_CALLBACK (on_location_changed),
-                                                      locator);
-                gclue_location_source_stop (src);
-                g_debug ("Requested %s to stop", G_OBJECT_TYPE_NAME (src));
+                stop_source (slot);
+                g_debug ("Requested %s to stop",
+                         G_OBJECT_TYPE_NAME (slot->source));
         }
 
-        g_list_free (locator->priv->active_sources);
-        locator->priv->active_sources = NULL;
+        gclue_location_filter_reset (locator->priv->filter);
         return TRUE;
 }
 
-GClueLocator *
-gclue_locator_new (GClueAccuracyLevel level)
+static GClueAccuracyLevel
+map_accuracy_level (GClueAccuracyLevel level)
 {
-        GClueAccuracyLevel accuracy_level = level;
-
-        if (accuracy_level == GCLUE_ACCURACY_LEVEL_COUNTRY)
+        if (level == GCLUE_ACCURACY_LEVEL_COUNTRY)
                 /* There is no source that provides country-level accuracy.
                  * Since Wifi (as geoip) source is the best we can do, accuracy
                  * really is country-level many times from this source and its
                  * doubtful app (or user) will mind being given slighly more
                  * accurate location, lets just map this to city-level accuracy.
                  */
-                accuracy_level = GCLUE_ACCURACY_LEVEL_CITY;
+                return GCLUE_ACCURACY_LEVEL_CITY;
+
+        return level;
+}
 
+GClueLocator *
+gclue_locator_new (GClueAccuracyLevel level)
+{
         return g_object_new (GCLUE_TYPE_LOCATOR,
-                             "accuracy-level", accuracy_level,
+                             "accuracy-level", map_accuracy_level (level),
                              "compute-movement", FALSE,
                              NULL);
 }
 
+static void
+on_locator_destroyed (gpointer data,
+                      GObject *where_the_object_was)
+{
+        GClueLocator **locator = (GClueLocator **) data;
+
+        *locator = NULL;
+}
+
+/**
+ * gclue_locator_get_shared
+ * @level: The accuracy level requested
+ *
+ * Gets the locator that all clients asking for @level share, so that the
+ * sources are followed and their fixes fused once per accuracy level, no
+ * matter how many clients there are.
+ *
+ * Returns: (transfer full): A #GClueLocator.
+ **/
+GClueLocator *
+gclue_locator_get_shared (GClueAccuracyLevel level)
+{
+        static GClueLocator *locators[N_ACCURACY_LEVELS] = { NULL };
+        GClueAccuracyLevel accuracy_level = map_accuracy_level (level);
+
+        g_return_val_if_fail (level < N_ACCURACY_LEVELS, NULL);
+
+        if (locators[accuracy_level] == NULL) {
+                locators[accuracy_level] = gclue_locator_new (accuracy_level);
+                g_object_weak_ref (G_OBJECT (locators[accuracy_level]),
+                                   on_locator_destroyed,
+                                   &locators[accuracy_level]);
+        } else
+                g_object_ref (locators[accuracy_level]);
+
+        return locators[accuracy_level];
+}
+
 GClueAccuracyLevel
 gclue_locator_get_accuracy_level (GClueLocator *locator)
 {
@@ -562,21 +644,42 @@ gclue_locator_get_time_threshold (GClueLocator *locator)
  * gclue_locator_set_time_threshold
  * @locator: a #GClueLocator
  * @value: The new threshold value
+ * @owner: The client asking for @value
  *
- * Sets the time-threshold to @value.
- *
- * Unlike other (real) location sources, Locator instances are unique for each
- * client application. Which means we only need just one time-threshold value
- * and hence the reason we have these getter and setters, instead of making use
- * of the #GClueLocationSource:time-threshold property.
+ * Sets the time-threshold of @owner to @value. Locators are shared between
+ * clients, so like real location sources, they go by the smallest
+ * time-threshold any of their clients asked for.
  **/
 void
 gclue_locator_set_time_threshold (GClueLocator *locator,
-                                  guint         value)
+                                  guint         value,
+                                  GObject      *owner)
 {
+        GClueMinUINT *threshold;
+
         g_return_if_fail (GCLUE_IS_LOCATOR (locator));
 
-        reset_time_threshold (locator,
-                              GCLUE_LOCATION_SOURCE (locator),
-                              value);
+        threshold = gclue_location_source_get_time_threshold
+                        (GCLUE_LOCATION_SOURCE (locator));
+        gclue_min_uint_add_value (threshold, value, owner);
+}
+
+/**
+ * gclue_locator_drop_time_threshold
+ * @locator: a #GClueLocator
+ * @owner: The client that set a time-threshold previously
+ *
+ * Drops the time-threshold @owner set, when it stops using @locator.
+ **/
+void
+gclue_locator_drop_time_threshold (GClueLocator *locator,
+                                   GObject      *owner)
+{
+        GClueMinUINT *threshold;
+
+        g_return_if_fail (GCLUE_IS_LOCATOR (locator));
+
+        threshold = gclue_location_source_get_time_threshold
+                        (GCLUE_LOCATION_SOURCE (locator));
+        gclue_min_uint_drop_value (threshold, owner);
 }
@@ -57,11 +57,15 @@ struct _GClueLocatorClass
 
 GType gclue_locator_get_type (void) G_GNUC_CONST;
 
-GClueLocator *      gclue_locator_new                (GClueAccuracyLevel level);
-GClueAccuracyLevel  gclue_locator_get_accuracy_level (GClueLocator *locator);
-guint               gclue_locator_get_time_threshold (GClueLocator *locator);
-void                gclue_locator_set_time_threshold (GClueLocator *locator,
-                                                      guint         threshold);
+GClueLocator *      gclue_locator_new                 (GClueAccuracyLevel level);
+GClueLocator *      gclue_locator_get_shared          (GClueAccuracyLevel level);
+GClueAccuracyLevel  gclue_locator_get_accuracy_level  (GClueLocator *locator);
+guint               gclue_locator_get_time_threshold  (GClueLocator *locator);
+void                gclue_locator_set_time_threshold  (GClueLocator *locator,
+                                                       guint         threshold,
+                                                       GObject      *owner);
+void                gclue_locator_drop_time_threshold (GClueLocator *locator,
+                                                       GObject      *owner);
 
 G_END_DECLS
 
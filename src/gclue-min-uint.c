@@ -60,10 +60,22 @@ typedef struct
         GObject *owner;
 } OwnerData;
 
+static gboolean
+remove_value (GClueMinUINT *muint,
+              GObject      *owner)
+{
+        if (!g_hash_table_remove (muint->priv->all_values, owner))
+                return FALSE;
+
+        g_object_notify_by_pspec (G_OBJECT (muint), gParamSpecs[PROP_VALUE]);
+
+        return TRUE;
+}
+
 static gboolean
 on_owner_weak_ref_notify_defered (OwnerData *data)
 {
-        gclue_min_uint_drop_value (data->muint, data->owner);
+        remove_value (data->muint, data->owner);
         g_object_unref (data->muint);
         g_slice_free (OwnerData, data);
 
@@ -202,10 +214,12 @@ gclue_min_uint_add_value (GClueMinUINT *muint,
 {
         g_return_if_fail (GCLUE_IS_MIN_UINT(muint));
 
-        g_hash_table_replace (muint->priv->all_values,
-                              owner,
-                              GUINT_TO_POINTER (value));
-        g_object_weak_ref (owner, on_owner_weak_ref_notify, muint);
+        /* Owners updating their value, as often as they may, only need
+         * watching once */
+        if (g_hash_table_replace (muint->priv->all_values,
+                                  owner,
+                                  GUINT_TO_POINTER (value)))
+                g_object_weak_ref (owner, on_owner_weak_ref_notify, muint);
 
         g_object_notify_by_pspec (G_OBJECT (muint), gParamSpecs[PROP_VALUE]);
 }
@@ -221,9 +235,7 @@ gclue_min_uint_drop_value (GClueMinUINT *muint,
 {
         g_return_if_fail (GCLUE_IS_MIN_UINT(muint));
 
-        if (!g_hash_table_remove (muint->priv->all_values, owner)) {
-                return;
-        }
-
-        g_object_notify_by_pspec (G_OBJECT (muint), gParamSpecs[PROP_VALUE]);
+        /* So that owners outliving @muint don't notify it once gone */
+        if (remove_value (muint, owner))
+                g_object_weak_unref (owner, on_owner_weak_ref_notify, muint);
 }
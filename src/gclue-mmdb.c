@@ -0,0 +1,550 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "gclue-mmdb.h"
+
+/**
+ * SECTION:gclue-mmdb
+ * @short_description: Local GeoIP database in MaxMind DB format
+ *
+ * Read-only access to the locations in a MaxMind DB file, such as the
+ * GeoLite2 City database, for offline GeoIP. Like the location database, the
+ * file is memory-mapped rather than loaded: a lookup walks the binary search
+ * tree of the file down to its data section and decodes only the fields it
+ * needs in place.
+ *
+ * See https://maxmind.github.io/MaxMind-DB/ for the format.
+ **/
+
+#define METADATA_MARKER "\xab\xcd\xefMaxMind.com"
+#define METADATA_MARKER_LEN (sizeof (METADATA_MARKER) - 1)
+#define METADATA_MAX_SIZE (128 * 1024)
+/* Between the search tree and the data section */
+#define DATA_SECTION_SEPARATOR 16
+
+/* Nesting of maps and arrays we are prepared to skip over */
+#define MAX_DEPTH 32
+
+/* Used when the database has no radius for a location */
+#define DEFAULT_ACCURACY 100000 /* meters */
+
+typedef enum {
+        TYPE_EXTENDED = 0,
+        TYPE_POINTER = 1,
+        TYPE_STRING = 2,
+        TYPE_DOUBLE = 3,
+        TYPE_BYTES = 4,
+        TYPE_UINT16 = 5,
+        TYPE_UINT32 = 6,
+        TYPE_MAP = 7,
+        TYPE_INT32 = 8,
+        TYPE_UINT64 = 9,
+        TYPE_UINT128 = 10,
+        TYPE_ARRAY = 11,
+        TYPE_CONTAINER = 12,
+        TYPE_END_MARKER = 13,
+        TYPE_BOOLEAN = 14,
+        TYPE_FLOAT = 15,
+} FieldType;
+
+/* Pointers in data are relative to the start of their section */
+typedef struct
+{
+        const guint8 *data;
+        gsize length;
+} Section;
+
+struct _GClueMMDB
+{
+        GMappedFile *file;
+
+        const guint8 *tree;
+        guint32 node_count;
+        guint record_size; /* In bits, per branch */
+        guint ip_version;
+        guint32 ipv4_start; /* Node of ::/96 in an IPv6 tree */
+
+        Section data;
+};
+
+static guint32
+read_be (const guint8 *bytes,
+         guint         n)
+{
+        guint32 value = 0;
+        guint i;
+
+        for (i = 0; i < n; i++)
+                value = (value << 8) | bytes[i];
+
+        return value;
+}
+
+/* Decodes the control bytes of the field at @pos. For a pointer, @size is
+ * where it points to. */
+static gboolean
+read_header (const Section *section,
+             gsize         *pos,
+             FieldType     *type,
+             guint32       *size)
+{
+        guint8 control;
+        guint n;
+
+        if (*pos >= section->length)
+                return FALSE;
+        control = section->data[(*pos)++];
+        *type = control >> 5;
+
+        if (*type == TYPE_POINTER) {
+                static const guint32 bias[] = { 0, 2048, 526336, 0 };
+                guint ss = (control >> 3) & 0x3;
+
+                n = ss + 1;
+                if (section->length - *pos < n)
+                        return FALSE;
+
+                *size = read_be (section->data + *pos, n);
+                if (ss < 3)
+                        *size |= (guint32) (control & 0x7) << (8 * n);
+                *size += bias[ss];
+                *pos += n;
+
+                return TRUE;
+        }
+
+        if (*type == TYPE_EXTENDED) {
+                if (*pos >= section->length)
+                        return FALSE;
+                *type = 7 + section->data[(*pos)++];
+                if (*type <= TYPE_MAP || *type > TYPE_FLOAT)
+                        return FALSE;
+        }
+
+        *size = control & 0x1f;
+        if (*size >= 29) {
+                static const guint32 bias[] = { 29, 285, 65821 };
+
+                n = *size - 28;
+                if (section->length - *pos < n)
+                        return FALSE;
+
+                *size = bias[n - 1] + read_be (section->data + *pos, n);
+                *pos += n;
+        }
+
+        return TRUE;
+}
+
+/* Decodes the field at @pos, following it if it is a pointer. On return
+ * @pos is past the field if it was a pointer and at @payload otherwise. */
+static gboolean
+read_field (const Section *section,
+            gsize         *pos,
+            FieldType     *type,
+            guint32       *size,
+            gsize         *payload)
+{
+        gsize target;
+
+        if (!read_header (section, pos, type, size))
+                return FALSE;
+
+        if (*type != TYPE_POINTER) {
+                *payload = *pos;
+                return TRUE;
+        }
+
+        target = *size;
+        if (!read_header (section, &target, type, size) ||
+            *type == TYPE_POINTER)
+                return FALSE;
+        *payload = target;
+
+        return TRUE;
+}
+
+static gboolean
+skip_field (const Section *section,
+            gsize         *pos,
+            guint          depth)
+{
+        FieldType type;
+        guint32 size, i;
+
+        if (depth > MAX_DEPTH || !read_header (section, pos, &type, &size))
+                return FALSE;
+
+        switch (type) {
+        case TYPE_POINTER:
+        case TYPE_BOOLEAN:
+                return TRUE;
+        case TYPE_MAP:
+                size *= 2;
+                /* fall-through */
+        case TYPE_ARRAY:
+                for (i = 0; i < size; i++)
+                        if (!skip_field (section, pos, depth + 1))
+                                return FALSE;
+                return TRUE;
+        default:
+                if (section->length - *pos < size)
+                        return FALSE;
+                *pos += size;
+                return TRUE;
+        }
+}
+
+/* Finds @key in the map at @pos, and sets @pos to its value */
+static gboolean
+find_in_map (const Section *section,
+             gsize         *pos,
+             const char    *key)
+{
+        gsize key_len = strlen (key);
+        FieldType type;
+        guint32 n_pairs, size, i;
+        gsize cursor, payload;
+
+        cursor = *pos;
+        if (!read_field (section, &cursor, &type, &n_pairs, &payload) ||
+            type != TYPE_MAP)
+                return FALSE;
+
+        cursor = payload;
+        for (i = 0; i < n_pairs; i++) {
+                gboolean is_pointer;
+
+                is_pointer = (cursor < section->length &&
+                              section->data[cursor] >> 5 == TYPE_POINTER);
+                if (!read_field (section, &cursor, &type, &size, &payload) ||
+                    type != TYPE_STRING ||
+                    section->length - payload < size)
+                        return FALSE;
+
+                /* Unless the key was a pointer, its value follows it */
+                if (!is_pointer)
+                        cursor = payload + size;
+
+                if (size == key_len &&
+                    memcmp (section->data + payload, key, key_len) == 0) {
+                        *pos = cursor;
+                        return TRUE;
+                }
+
+                if (!skip_field (section, &cursor, 0))
+                        return FALSE;
+        }
+
+        return FALSE;
+}
+
+static gboolean
+read_uint (const Section *section,
+           gsize          pos,
+           guint64       *value)
+{
+        FieldType type;
+        guint32 size, i;
+        gsize payload;
+
+        if (!read_field (section, &pos, &type, &size, &payload) ||
+            (type != TYPE_UINT16 &&
+             type != TYPE_UINT32 &&
+             type != TYPE_UINT64) ||
+            size > sizeof (guint64) ||
+            section->length - payload < size)
+                return FALSE;
+
+        *value = 0;
+        for (i = 0; i < size; i++)
+                *value = (*value << 8) | section->data[payload + i];
+
+        return TRUE;
+}
+
+static gboolean
+read_double (const Section *section,
+             gsize          pos,
+             gdouble       *value)
+{
+        FieldType type;
+        guint32 size;
+        gsize payload;
+
+        if (!read_field (section, &pos, &type, &size, &payload) ||
+            section->length - payload < size)
+                return FALSE;
+
+        if (type == TYPE_DOUBLE && size == 8) {
+                guint64 bits;
+
+                bits = ((guint64) read_be (section->data + payload, 4) << 32) |
+                       read_be (section->data + payload + 4, 4);
+                memcpy (value, &bits, sizeof (*value));
+        } else if (type == TYPE_FLOAT && size == 4) {
+                guint32 bits;
+                gfloat f;
+
+                bits = read_be (section->data + payload, 4);
+                memcpy (&f, &bits, sizeof (f));
+                *value = f;
+        } else {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static guint32
+read_record (GClueMMDB *db,
+             guint32    node,
+             guint      bit)
+{
+        const guint8 *p = db->tree + (gsize) node * db->record_size / 4;
+
+        switch (db->record_size) {
+        case 24:
+                return read_be (p + 3 * bit, 3);
+        case 28:
+                if (bit == 0)
+                        return ((guint32) (p[3] & 0xf0) << 20) |
+                               read_be (p, 3);
+                else
+                        return ((guint32) (p[3] & 0x0f) << 24) |
+                               read_be (p + 4, 3);
+        default:
+                return read_be (p + 4 * bit, 4);
+        }
+}
+
+static const guint8 *
+find_metadata (const guint8 *contents,
+               gsize         length)
+{
+        gsize start, i;
+
+        start = length > METADATA_MAX_SIZE ? length - METADATA_MAX_SIZE : 0;
+        if (length < METADATA_MARKER_LEN)
+                return NULL;
+
+        /* The last occurrence is the marker, earlier ones could be data */
+        for (i = length - METADATA_MARKER_LEN + 1; i > start; i--)
+                if (memcmp (contents + i - 1,
+                            METADATA_MARKER,
+                            METADATA_MARKER_LEN) == 0)
+                        return contents + i - 1;
+
+        return NULL;
+}
+
+static gboolean
+load_metadata (GClueMMDB    *db,
+               const Section *metadata)
+{
+        guint64 node_count, record_size, ip_version;
+        gsize pos;
+
+        pos = 0;
+        if (!find_in_map (metadata, &pos, "node_count") ||
+            !read_uint (metadata, pos, &node_count))
+                return FALSE;
+        pos = 0;
+        if (!find_in_map (metadata, &pos, "record_size") ||
+            !read_uint (metadata, pos, &record_size))
+                return FALSE;
+        pos = 0;
+        if (!find_in_map (metadata, &pos, "ip_version") ||
+            !read_uint (metadata, pos, &ip_version))
+                return FALSE;
+
+        if (node_count == 0 || node_count > G_MAXUINT32 ||
+            (record_size != 24 && record_size != 28 && record_size != 32) ||
+            (ip_version != 4 && ip_version != 6))
+                return FALSE;
+
+        db->node_count = node_count;
+        db->record_size = record_size;
+        db->ip_version = ip_version;
+
+        return TRUE;
+}
+
+/**
+ * gclue_mmdb_new:
+ * @path: path to the database file
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: (transfer full): A new #GClueMMDB, or %NULL on error. Free with
+ * gclue_mmdb_free().
+ **/
+GClueMMDB *
+gclue_mmdb_new (const char *path,
+                GError    **error)
+{
+        GClueMMDB *db;
+        GMappedFile *file;
+        const guint8 *contents, *marker;
+        gsize length, tree_size;
+        Section metadata;
+        guint i;
+
+        file = g_mapped_file_new (path, FALSE, error);
+        if (file == NULL)
+                return NULL;
+
+        db = g_slice_new0 (GClueMMDB);
+        db->file = file;
+
+        contents = (const guint8 *) g_mapped_file_get_contents (file);
+        length = g_mapped_file_get_length (file);
+
+        marker = find_metadata (contents, length);
+        if (marker == NULL) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "'%s' is not a MaxMind DB file",
+                             path);
+                goto error_out;
+        }
+
+        metadata.data = marker + METADATA_MARKER_LEN;
+        metadata.length = length - (metadata.data - contents);
+        if (!load_metadata (db, &metadata)) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "Invalid or unsupported metadata in '%s'",
+                             path);
+                goto error_out;
+        }
+
+        tree_size = (gsize) db->node_count * db->record_size / 4;
+        if ((gsize) (marker - contents) < tree_size + DATA_SECTION_SEPARATOR) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "MaxMind DB file '%s' is truncated",
+                             path);
+                goto error_out;
+        }
+        db->tree = contents;
+        db->data.data = contents + tree_size + DATA_SECTION_SEPARATOR;
+        db->data.length = marker - db->data.data;
+
+        /* IPv4 addresses live at ::a.b.c.d in IPv6 trees */
+        db->ipv4_start = 0;
+        if (db->ip_version == 6)
+                for (i = 0; i < 96 && db->ipv4_start < db->node_count; i++)
+                        db->ipv4_start = read_record (db, db->ipv4_start, 0);
+
+        return db;
+
+error_out:
+        gclue_mmdb_free (db);
+
+        return NULL;
+}
+
+/**
+ * gclue_mmdb_free:
+ * @db: a #GClueMMDB
+ **/
+void
+gclue_mmdb_free (GClueMMDB *db)
+{
+        if (db == NULL)
+                return;
+
+        g_mapped_file_unref (db->file);
+        g_slice_free (GClueMMDB, db);
+}
+
+/**
+ * gclue_mmdb_lookup:
+ * @db: a #GClueMMDB
+ * @address: an IPv4 or IPv6 address
+ * @latitude: (out): return location for the latitude
+ * @longitude: (out): return location for the longitude
+ * @accuracy: (out): return location for the accuracy radius in meters
+ *
+ * Returns: %TRUE if the database has a location for @address.
+ **/
+gboolean
+gclue_mmdb_lookup (GClueMMDB    *db,
+                   GInetAddress *address,
+                   gdouble      *latitude,
+                   gdouble      *longitude,
+                   gdouble      *accuracy)
+{
+        const guint8 *bytes;
+        guint32 node;
+        guint n_bits, i;
+        guint64 radius;
+        gsize pos, location;
+
+        g_return_val_if_fail (db != NULL, FALSE);
+        g_return_val_if_fail (G_IS_INET_ADDRESS (address), FALSE);
+
+        bytes = g_inet_address_to_bytes (address);
+        n_bits = g_inet_address_get_native_size (address) * 8;
+        if (n_bits == 32)
+                node = db->ipv4_start;
+        else if (db->ip_version == 6)
+                node = 0;
+        else
+                return FALSE;
+
+        for (i = 0; i < n_bits && node < db->node_count; i++)
+                node = read_record (db,
+                                    node,
+                                    (bytes[i / 8] >> (7 - i % 8)) & 1);
+
+        /* node_count itself means there is no data */
+        if (node <= db->node_count)
+                return FALSE;
+        location = node - db->node_count - DATA_SECTION_SEPARATOR;
+        if (location >= db->data.length)
+                return FALSE;
+
+        if (!find_in_map (&db->data, &location, "location"))
+                return FALSE;
+
+        pos = location;
+        if (!find_in_map (&db->data, &pos, "latitude") ||
+            !read_double (&db->data, pos, latitude))
+                return FALSE;
+        pos = location;
+        if (!find_in_map (&db->data, &pos, "longitude") ||
+            !read_double (&db->data, pos, longitude))
+                return FALSE;
+
+        pos = location;
+        if (find_in_map (&db->data, &pos, "accuracy_radius") &&
+            read_uint (&db->data, pos, &radius))
+                *accuracy = radius * 1000.0; /* kilometers */
+        else
+                *accuracy = DEFAULT_ACCURACY;
+
+        return TRUE;
+}
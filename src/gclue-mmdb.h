@@ -0,0 +1,44 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_MMDB_H
+#define GCLUE_MMDB_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GClueMMDB GClueMMDB;
+
+GClueMMDB *
+gclue_mmdb_new    (const char    *path,
+                   GError       **error);
+void
+gclue_mmdb_free   (GClueMMDB     *db);
+gboolean
+gclue_mmdb_lookup (GClueMMDB     *db,
+                   GInetAddress  *address,
+                   gdouble       *latitude,
+                   gdouble       *longitude,
+                   gdouble       *accuracy);
+
+G_END_DECLS
+
+#endif /* GCLUE_MMDB_H */
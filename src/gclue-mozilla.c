@@ -21,12 +21,12 @@
 
 #include <stdlib.h>
 #include <glib.h>
-#include <json-glib/json-glib.h>
 #include <string.h>
 #include <config.h>
 #include "gclue-mozilla.h"
 #include "gclue-config.h"
 #include "gclue-error.h"
+#include "gclue-json-writer.h"
 
 /**
  * SECTION:gclue-mozilla
@@ -40,157 +40,201 @@
  * its easy to switch to Google's API.
  **/
 
-#define BSSID_LEN 7
-#define BSSID_STR_LEN 18
-#define MAX_SSID_LEN 32
+/* Rough upper bounds of the JSON written per query and per AP, so that
+ * bodies are written into a single allocation */
+#define QUERY_SIZE_HINT 256
+#define QUERY_AP_SIZE_HINT 64
 
-static guint
-variant_to_string (GVariant *variant, guint max_len, char *ret)
+/* The preferred service, GClueWebSource points the query to another one
+ * if that one is down or slow */
+static const char *
+get_url (void)
 {
-        guint i;
-        guint len;
-
-        len = g_variant_n_children (variant);
-        if (len == 0)
-                return 0;
-        g_return_val_if_fail(len < max_len, 0);
-        ret[len] = '\0';
+        GClueConfig *config;
 
-        for (i = 0; i < len; i++)
-                g_variant_get_child (variant,
-                                     i,
-                                     "y",
-                                     &ret[i]);
+        config = gclue_config_get_singleton ();
 
-        return len;
+        return gclue_config_get_wifi_url (config);
 }
 
-static guint
-get_ssid_from_bss (WPABSS *bss, char *ssid)
+typedef struct {
+        const GClueBSSRecord *record;
+        guint rank; /* Among the APs of its group, strongest first */
+} Candidate;
+
+static gint
+compare_signals (gconstpointer a,
+                 gconstpointer b)
 {
-        GVariant *variant = wpa_bss_get_ssid (bss);
-        if (variant == NULL)
-                return 0;
+        const Candidate *ca = a, *cb = b;
 
-        return variant_to_string (variant, MAX_SSID_LEN, ssid);
+        return cb->record->signal - ca->record->signal;
 }
 
-static gboolean
-get_bssid_from_bss (WPABSS *bss, char *bssid)
+static gint
+compare_ranks (gconstpointer a,
+               gconstpointer b)
 {
-        GVariant *variant;
-        char raw_bssid[BSSID_LEN] = { 0 };
-        guint raw_len, i;
-
-        variant = wpa_bss_get_bssid (bss);
-        if (variant == NULL)
-                return FALSE;
+        const Candidate *ca = a, *cb = b;
 
-        raw_len = variant_to_string (variant, BSSID_LEN, raw_bssid);
-        g_return_val_if_fail (raw_len == BSSID_LEN - 1, FALSE);
+        if (ca->rank != cb->rank)
+                return (ca->rank > cb->rank) - (ca->rank < cb->rank);
 
-        for (i = 0; i < BSSID_LEN - 1; i++) {
-                unsigned char c = (unsigned char) raw_bssid[i];
-
-                if (i == BSSID_LEN - 2) {
-                        g_snprintf (bssid + (i * 3), 3, "%02x", c);
-                } else {
-                        g_snprintf (bssid + (i * 3), 4, "%02x:", c);
-                }
-        }
+        return compare_signals (a, b);
+}
 
-        return TRUE;
+/* APs of the same band and vendor are often the same physical device, or
+ * are at least close to each other, so they say less about where we are
+ * than as many APs from different groups */
+static guint
+get_ap_group (const GClueBSSRecord *record)
+{
+        guint band;
+
+        if (record->frequency < 3000)
+                band = 0; /* 2.4 GHz */
+        else if (record->frequency < 5925)
+                band = 1; /* 5 GHz */
+        else
+                band = 2; /* 6 GHz */
+
+        /* Ignore the locally administered bit, which vendors set to derive
+         * the BSSIDs of virtual APs from the one of the radio */
+        return band << 24 |
+               (record->bssid[0] & ~0x02) << 16 |
+               record->bssid[1] << 8 |
+               record->bssid[2];
 }
 
-static const char *
-get_url (void)
+/* Picks at most @max_aps of the APs in @bss_records to send, going round
+ * the groups of APs (see get_ap_group()) and taking the strongest AP left in
+ * each, so that we send as diverse a set of APs as we can */
+static GArray *
+select_bss_records (GArray *bss_records,
+                    guint   max_aps)
 {
-        GClueConfig *config;
+        GArray *candidates;
+        GHashTable *group_sizes;
+        guint i;
 
-        config = gclue_config_get_singleton ();
+        candidates = g_array_sized_new (FALSE,
+                                        FALSE,
+                                        sizeof (Candidate),
+                                        bss_records->len);
+        for (i = 0; i < bss_records->len; i++) {
+                Candidate candidate = { 0 };
+
+                candidate.record =
+                        &g_array_index (bss_records, GClueBSSRecord, i);
+                if (!candidate.record->ignore)
+                        g_array_append_val (candidates, candidate);
+        }
 
-        return gclue_config_get_wifi_url (config);
+        if (max_aps == 0 || candidates->len <= max_aps)
+                return candidates;
+
+        g_array_sort (candidates, compare_signals);
+        group_sizes = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (i = 0; i < candidates->len; i++) {
+                Candidate *candidate = &g_array_index (candidates, Candidate, i);
+                gpointer group;
+
+                group = GUINT_TO_POINTER (get_ap_group (candidate->record));
+                candidate->rank =
+                        GPOINTER_TO_UINT (g_hash_table_lookup (group_sizes,
+                                                               group));
+                g_hash_table_insert (group_sizes,
+                                     group,
+                                     GUINT_TO_POINTER (candidate->rank + 1));
+        }
+        g_hash_table_unref (group_sizes);
+
+        g_array_sort (candidates, compare_ranks);
+        g_debug ("Sending %u of %u WiFi APs", max_aps, candidates->len);
+        g_array_set_size (candidates, max_aps);
+
+        return candidates;
 }
 
 SoupMessage *
-gclue_mozilla_create_query (GList        *bss_list, /* As in Access Points */
+gclue_mozilla_create_query (GArray       *bss_records, /* As in Access Points */
                             GClue3GTower *tower,
                             GError      **error)
 {
         SoupMessage *ret = NULL;
-        JsonBuilder *builder;
-        JsonGenerator *generator;
-        JsonNode *root_node;
+        GClueJsonWriter writer;
+        GClueConfig *config;
+        GArray *candidates = NULL;
         char *data;
         gsize data_len;
         const char *uri;
 
-        builder = json_builder_new ();
-        json_builder_begin_object (builder);
+        config = gclue_config_get_singleton ();
+        if (bss_records != NULL) {
+                candidates = select_bss_records
+                        (bss_records,
+                         gclue_config_get_wifi_query_max_aps (config));
+
+                /* All ignored, so no WiFi data to send */
+                if (candidates->len == 0)
+                        g_clear_pointer (&candidates, g_array_unref);
+        }
+
+        gclue_json_writer_init (&writer,
+                                QUERY_SIZE_HINT +
+                                QUERY_AP_SIZE_HINT *
+                                (candidates != NULL ? candidates->len : 0));
+        gclue_json_writer_begin_object (&writer, NULL);
 
-        /* We send pure geoip query using empty object if both bss_list and
+        /* We send pure geoip query using empty object if both bss_records and
          * tower are NULL.
          */
 
         if (tower != NULL) {
-                json_builder_set_member_name (builder, "radioType");
-                json_builder_add_string_value (builder, "gsm");
-
-                json_builder_set_member_name (builder, "cellTowers");
-                json_builder_begin_array (builder);
-
-                json_builder_begin_object (builder);
-
-                json_builder_set_member_name (builder, "cellId");
-                json_builder_add_int_value (builder, tower->cell_id);
-                json_builder_set_member_name (builder, "mobileCountryCode");
-                json_builder_add_int_value (builder, tower->mcc);
-                json_builder_set_member_name (builder, "mobileNetworkCode");
-                json_builder_add_int_value (builder, tower->mnc);
-                json_builder_set_member_name (builder, "locationAreaCode");
-                json_builder_add_int_value (builder, tower->lac);
-
-                json_builder_end_object (builder);
-
-                json_builder_end_array (builder);
+                gclue_json_writer_add_string (&writer, "radioType", "gsm");
+
+                gclue_json_writer_begin_array (&writer, "cellTowers");
+                gclue_json_writer_begin_object (&writer, NULL);
+
+                gclue_json_writer_add_int (&writer, "cellId", tower->cell_id);
+                gclue_json_writer_add_int (&writer,
+                                           "mobileCountryCode",
+                                           tower->mcc);
+                gclue_json_writer_add_int (&writer,
+                                           "mobileNetworkCode",
+                                           tower->mnc);
+                gclue_json_writer_add_int (&writer,
+                                           "locationAreaCode",
+                                           tower->lac);
+
+                gclue_json_writer_end_object (&writer);
+                gclue_json_writer_end_array (&writer);
         }
 
-        if (bss_list != NULL) {
-                GList *iter;
-
-                json_builder_set_member_name (builder, "wifiAccessPoints");
-                json_builder_begin_array (builder);
+        if (candidates != NULL) {
+                guint i;
 
-                for (iter = bss_list; iter != NULL; iter = iter->next) {
-                        WPABSS *bss = WPA_BSS (iter->data);
-                        char mac[BSSID_STR_LEN] = { 0 };
-                        gint16 strength_dbm;
+                gclue_json_writer_begin_array (&writer, "wifiAccessPoints");
 
-                        if (gclue_mozilla_should_ignore_bss (bss))
-                                continue;
+                for (i = 0; i < candidates->len; i++) {
+                        const GClueBSSRecord *record =
+                                g_array_index (candidates, Candidate, i).record;
 
-                        json_builder_begin_object (builder);
-                        json_builder_set_member_name (builder, "macAddress");
-                        get_bssid_from_bss (bss, mac);
-                        json_builder_add_string_value (builder, mac);
-
-                        json_builder_set_member_name (builder, "signalStrength");
-                        strength_dbm = wpa_bss_get_signal (bss);
-                        json_builder_add_int_value (builder, strength_dbm);
-                        json_builder_end_object (builder);
+                        gclue_json_writer_begin_object (&writer, NULL);
+                        gclue_json_writer_add_string (&writer,
+                                                      "macAddress",
+                                                      record->mac);
+                        gclue_json_writer_add_int (&writer,
+                                                   "signalStrength",
+                                                   record->signal);
+                        gclue_json_writer_end_object (&writer);
                 }
-                json_builder_end_array (builder);
+                gclue_json_writer_end_array (&writer);
+                g_array_unref (candidates);
         }
-        json_builder_end_object (builder);
-
-        generator = json_generator_new ();
-        root_node = json_builder_get_root (builder);
-        json_generator_set_root (generator, root_node);
-        data = json_generator_to_data (generator, &data_len);
+        gclue_json_writer_end_object (&writer);
 
-        json_node_free (root_node);
-        g_object_unref (builder);
-        g_object_unref (generator);
+        data = gclue_json_writer_steal (&writer, &data_len);
 
         uri = get_url ();
         ret = soup_message_new ("POST", uri);
@@ -204,228 +248,404 @@ gclue_mozilla_create_query (GList        *bss_list, /* As in Access Points */
         return ret;
 }
 
+/* Responses are read with a minimal pull parser that walks the body in place
+ * and only decodes the members we need, so that a successful parse allocates
+ * nothing but the resulting location. */
+
+#define MAX_JSON_DEPTH 32
+#define MAX_NUMBER_LEN 32
+
+typedef struct {
+        const char *start;
+        const char *pos;
+        const char *end;
+} JsonReader;
+
+enum {
+        FOUND_LATITUDE = 1 << 0,
+        FOUND_LONGITUDE = 1 << 1,
+        FOUND_ACCURACY = 1 << 2,
+        FOUND_ALL = FOUND_LATITUDE | FOUND_LONGITUDE | FOUND_ACCURACY
+};
+
 static gboolean
-parse_server_error (JsonObject *object, GError **error)
+consume (JsonReader *reader, char c)
 {
-        JsonObject *error_obj;
-        int code;
-        const char *message;
+        while (reader->pos < reader->end && g_ascii_isspace (*reader->pos))
+                reader->pos++;
 
-        if (!json_object_has_member (object, "error"))
-            return FALSE;
+        if (reader->pos == reader->end || *reader->pos != c)
+                return FALSE;
+        reader->pos++;
 
-        error_obj = json_object_get_object_member (object, "error");
-        code = json_object_get_int_member (error_obj, "code");
-        message = json_object_get_string_member (error_obj, "message");
+        return TRUE;
+}
 
-        g_set_error_literal (error, G_IO_ERROR, code, message);
+/* Returns the raw contents between the quotes, escapes left as they are */
+static gboolean
+read_string (JsonReader  *reader,
+             const char **str,
+             gsize       *len)
+{
+        if (!consume (reader, '"'))
+                return FALSE;
+
+        *str = reader->pos;
+        while (reader->pos < reader->end) {
+                if (*reader->pos == '"') {
+                        *len = reader->pos - *str;
+                        reader->pos++;
+
+                        return TRUE;
+                }
+
+                reader->pos += (*reader->pos == '\\') ? 2 : 1;
+        }
+
+        return FALSE;
+}
+
+static gboolean
+read_number (JsonReader *reader, gdouble *value)
+{
+        char buf[MAX_NUMBER_LEN];
+        const char *start;
+        char *end;
+        gsize len;
+
+        while (reader->pos < reader->end && g_ascii_isspace (*reader->pos))
+                reader->pos++;
+
+        start = reader->pos;
+        while (reader->pos < reader->end &&
+               (g_ascii_isdigit (*reader->pos) ||
+                *reader->pos == '-' || *reader->pos == '+' ||
+                *reader->pos == '.' ||
+                *reader->pos == 'e' || *reader->pos == 'E'))
+                reader->pos++;
+
+        /* The body isn't necessarily nul-terminated */
+        len = reader->pos - start;
+        if (len == 0 || len >= sizeof (buf))
+                return FALSE;
+        memcpy (buf, start, len);
+        buf[len] = '\0';
+
+        *value = g_ascii_strtod (buf, &end);
+
+        return end == buf + len;
+}
+
+static gboolean
+read_literal (JsonReader *reader, const char *literal)
+{
+        gsize len = strlen (literal);
+
+        if ((gsize) (reader->end - reader->pos) < len ||
+            memcmp (reader->pos, literal, len) != 0)
+                return FALSE;
+        reader->pos += len;
 
         return TRUE;
 }
 
-GClueLocation *
-gclue_mozilla_parse_response (const char *json,
-                              GError    **error)
+/* Moves to the value of the next member of the current object. Returns
+ * FALSE at the end of the object or on error, as told by @failed. */
+static gboolean
+next_member (JsonReader  *reader,
+             gboolean    *first,
+             const char **key,
+             gsize       *key_len,
+             gboolean    *failed)
 {
-        JsonParser *parser;
-        JsonNode *node;
-        JsonObject *object, *loc_object;
-        GClueLocation *location;
-        gdouble latitude, longitude, accuracy;
+        if (consume (reader, '}'))
+                return FALSE;
 
-        parser = json_parser_new ();
+        if ((!*first && !consume (reader, ',')) ||
+            !read_string (reader, key, key_len) ||
+            !consume (reader, ':')) {
+                *failed = TRUE;
+                return FALSE;
+        }
+        *first = FALSE;
 
-        if (!json_parser_load_from_data (parser, json, -1, error))
-                return NULL;
+        return TRUE;
+}
 
-        node = json_parser_get_root (parser);
-        object = json_node_get_object (node);
+static gboolean
+key_equals (const char *key, gsize key_len, const char *name)
+{
+        return strlen (name) == key_len && memcmp (key, name, key_len) == 0;
+}
 
-        if (parse_server_error (object, error))
-                return NULL;
+static gboolean
+skip_value (JsonReader *reader, guint depth)
+{
+        const char *key;
+        gsize len;
+        gdouble number;
+        gboolean first = TRUE, failed = FALSE;
+
+        if (depth > MAX_JSON_DEPTH)
+                return FALSE;
+
+        if (consume (reader, '{')) {
+                while (next_member (reader, &first, &key, &len, &failed))
+                        if (!skip_value (reader, depth + 1))
+                                return FALSE;
+
+                return !failed;
+        }
 
-        loc_object = json_object_get_object_member (object, "location");
-        latitude = json_object_get_double_member (loc_object, "lat");
-        longitude = json_object_get_double_member (loc_object, "lng");
+        if (consume (reader, '[')) {
+                if (consume (reader, ']'))
+                        return TRUE;
 
-        accuracy = json_object_get_double_member (object, "accuracy");
+                do {
+                        if (!skip_value (reader, depth + 1))
+                                return FALSE;
+                } while (consume (reader, ','));
 
-        location = gclue_location_new (latitude, longitude, accuracy);
+                return consume (reader, ']');
+        }
+
+        if (reader->pos < reader->end && *reader->pos == '"')
+                return read_string (reader, &key, &len);
 
-        g_object_unref (parser);
+        if (read_literal (reader, "true") ||
+            read_literal (reader, "false") ||
+            read_literal (reader, "null"))
+                return TRUE;
 
-        return location;
+        return read_number (reader, &number);
 }
 
-static const char *
-get_submit_config (const char **nick)
+static gboolean
+parse_location_member (JsonReader *reader,
+                       gdouble    *latitude,
+                       gdouble    *longitude,
+                       guint      *found)
 {
-        GClueConfig *config;
+        const char *key;
+        gsize len;
+        gboolean first = TRUE, failed = FALSE;
 
-        config = gclue_config_get_singleton ();
-        if (!gclue_config_get_wifi_submit_data (config))
-                return NULL;
+        if (!consume (reader, '{'))
+                return FALSE;
 
-        *nick = gclue_config_get_wifi_submit_nick (config);
+        while (next_member (reader, &first, &key, &len, &failed)) {
+                if (key_equals (key, len, "lat")) {
+                        if (!read_number (reader, latitude))
+                                return FALSE;
+                        *found |= FOUND_LATITUDE;
+                } else if (key_equals (key, len, "lng")) {
+                        if (!read_number (reader, longitude))
+                                return FALSE;
+                        *found |= FOUND_LONGITUDE;
+                } else if (!skip_value (reader, 1)) {
+                        return FALSE;
+                }
+        }
 
-        return gclue_config_get_wifi_submit_url (config);
+        return !failed;
 }
 
-SoupMessage *
-gclue_mozilla_create_submit_query (GClueLocation   *location,
-                                   GList           *bss_list, /* As in Access Points */
-                                   GClue3GTower    *tower,
-                                   GError         **error)
+/* Always sets @error, to the server's error if it could be parsed */
+static void
+parse_server_error (JsonReader *reader, GError **error)
 {
-        SoupMessage *ret = NULL;
-        JsonBuilder *builder;
-        JsonGenerator *generator;
-        JsonNode *root_node;
-        char *data, *timestamp;
-        const char *url, *nick;
-        gsize data_len;
-        GList *iter;
-        gdouble lat, lon, accuracy, altitude;
-        GTimeVal tv;
+        const char *key, *message = NULL;
+        gsize len, message_len = 0;
+        gdouble code = G_IO_ERROR_FAILED;
+        gboolean first = TRUE, failed = FALSE;
+
+        if (!consume (reader, '{'))
+                goto malformed;
+
+        while (next_member (reader, &first, &key, &len, &failed)) {
+                if (key_equals (key, len, "code")) {
+                        if (!read_number (reader, &code))
+                                goto malformed;
+                } else if (key_equals (key, len, "message")) {
+                        if (!read_string (reader, &message, &message_len))
+                                goto malformed;
+                } else if (!skip_value (reader, 1)) {
+                        goto malformed;
+                }
+        }
+        if (failed)
+                goto malformed;
+
+        g_set_error (error,
+                     G_IO_ERROR,
+                     (gint) code,
+                     "%.*s",
+                     (int) message_len,
+                     message != NULL ? message : "");
+        return;
+
+malformed:
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "Malformed error in response");
+}
 
-        url = get_submit_config (&nick);
-        if (url == NULL)
-                goto out;
+GClueLocation *
+gclue_mozilla_parse_response (const char *json,
+                              gsize       length,
+                              GError    **error)
+{
+        JsonReader reader = { json, json, json + length };
+        const char *key;
+        gsize len;
+        gdouble latitude = 0, longitude = 0, accuracy = 0;
+        guint found = 0;
+        gboolean first = TRUE, failed = FALSE;
+
+        if (!consume (&reader, '{'))
+                goto malformed;
+
+        while (next_member (&reader, &first, &key, &len, &failed)) {
+                if (key_equals (key, len, "location")) {
+                        if (!parse_location_member (&reader,
+                                                    &latitude,
+                                                    &longitude,
+                                                    &found))
+                                goto malformed;
+                } else if (key_equals (key, len, "accuracy")) {
+                        if (!read_number (&reader, &accuracy))
+                                goto malformed;
+                        found |= FOUND_ACCURACY;
+                } else if (key_equals (key, len, "error")) {
+                        parse_server_error (&reader, error);
+
+                        return NULL;
+                } else if (!skip_value (&reader, 0)) {
+                        goto malformed;
+                }
+        }
+        if (failed)
+                goto malformed;
+
+        if (found != FOUND_ALL) {
+                g_set_error_literal (error,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_INVALID_DATA,
+                                     "Response lacks location or accuracy");
+                return NULL;
+        }
 
-        builder = json_builder_new ();
-        json_builder_begin_object (builder);
+        return gclue_location_new (latitude, longitude, accuracy);
 
-        json_builder_set_member_name (builder, "items");
-        json_builder_begin_array (builder);
+malformed:
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVALID_DATA,
+                     "Malformed response at offset %u",
+                     (guint) (reader.pos - reader.start));
 
-        json_builder_begin_object (builder);
+        return NULL;
+}
 
-        lat = gclue_location_get_latitude (location);
-        json_builder_set_member_name (builder, "lat");
-        json_builder_add_double_value (builder, lat);
+/* Writes a single item for the submission API, to be batched with others */
+char *
+gclue_mozilla_create_submit_item (GClueLocation   *location,
+                                  GArray          *bss_records, /* As in Access Points */
+                                  GClue3GTower    *tower,
+                                  GError         **error)
+{
+        GClueConfig *config;
+        GClueJsonWriter writer;
+        char *timestamp;
+        guint i;
+        gdouble accuracy, altitude;
+        GTimeVal tv;
 
-        lon = gclue_location_get_longitude (location);
-        json_builder_set_member_name (builder, "lon");
-        json_builder_add_double_value (builder, lon);
+        config = gclue_config_get_singleton ();
+        if (!gclue_config_get_wifi_submit_data (config))
+                return NULL;
+
+        gclue_json_writer_init (&writer,
+                                QUERY_SIZE_HINT +
+                                QUERY_AP_SIZE_HINT *
+                                (bss_records != NULL ? bss_records->len : 0));
+        gclue_json_writer_begin_object (&writer, NULL);
+
+        gclue_json_writer_add_double (&writer,
+                                      "lat",
+                                      gclue_location_get_latitude (location));
+        gclue_json_writer_add_double (&writer,
+                                      "lon",
+                                      gclue_location_get_longitude (location));
 
         accuracy = gclue_location_get_accuracy (location);
-        if (accuracy != GCLUE_LOCATION_ACCURACY_UNKNOWN) {
-                json_builder_set_member_name (builder, "accuracy");
-                json_builder_add_double_value (builder, accuracy);
-        }
+        if (accuracy != GCLUE_LOCATION_ACCURACY_UNKNOWN)
+                gclue_json_writer_add_double (&writer, "accuracy", accuracy);
 
         altitude = gclue_location_get_altitude (location);
-        if (altitude != GCLUE_LOCATION_ALTITUDE_UNKNOWN) {
-                json_builder_set_member_name (builder, "altitude");
-                json_builder_add_double_value (builder, altitude);
-        }
+        if (altitude != GCLUE_LOCATION_ALTITUDE_UNKNOWN)
+                gclue_json_writer_add_double (&writer, "altitude", altitude);
 
         tv.tv_sec = gclue_location_get_timestamp (location);
         tv.tv_usec = 0;
         timestamp = g_time_val_to_iso8601 (&tv);
-        json_builder_set_member_name (builder, "time");
-        json_builder_add_string_value (builder, timestamp);
+        gclue_json_writer_add_string (&writer, "time", timestamp);
         g_free (timestamp);
 
-        json_builder_set_member_name (builder, "radioType");
-        json_builder_add_string_value (builder, "gsm");
+        gclue_json_writer_add_string (&writer, "radioType", "gsm");
 
-        if (bss_list != NULL) {
-                json_builder_set_member_name (builder, "wifi");
-                json_builder_begin_array (builder);
+        if (bss_records != NULL) {
+                gclue_json_writer_begin_array (&writer, "wifi");
 
-                for (iter = bss_list; iter != NULL; iter = iter->next) {
-                        WPABSS *bss = WPA_BSS (iter->data);
-                        char mac[BSSID_STR_LEN] = { 0 };
-                        gint16 strength_dbm;
-                        guint16 frequency;
+                for (i = 0; i < bss_records->len; i++) {
+                        const GClueBSSRecord *record =
+                                &g_array_index (bss_records, GClueBSSRecord, i);
 
-                        if (gclue_mozilla_should_ignore_bss (bss))
+                        if (record->ignore)
                                 continue;
 
-                        json_builder_begin_object (builder);
-                        json_builder_set_member_name (builder, "key");
-                        get_bssid_from_bss (bss, mac);
-                        json_builder_add_string_value (builder, mac);
-
-                        json_builder_set_member_name (builder, "signal");
-                        strength_dbm = wpa_bss_get_signal (bss);
-                        json_builder_add_int_value (builder, strength_dbm);
-
-                        json_builder_set_member_name (builder, "frequency");
-                        frequency = wpa_bss_get_frequency (bss);
-                        json_builder_add_int_value (builder, frequency);
-                        json_builder_end_object (builder);
+                        gclue_json_writer_begin_object (&writer, NULL);
+                        gclue_json_writer_add_string (&writer,
+                                                      "key",
+                                                      record->mac);
+                        gclue_json_writer_add_int (&writer,
+                                                   "signal",
+                                                   record->signal);
+                        gclue_json_writer_add_int (&writer,
+                                                   "frequency",
+                                                   record->frequency);
+                        gclue_json_writer_end_object (&writer);
                 }
 
-                json_builder_end_array (builder); /* wifi */
+                gclue_json_writer_end_array (&writer); /* wifi */
         }
 
         if (tower != NULL) {
-                json_builder_set_member_name (builder, "cell");
-                json_builder_begin_array (builder);
-
-                json_builder_begin_object (builder);
-
-                json_builder_set_member_name (builder, "radio");
-                json_builder_add_string_value (builder, "gsm");
-                json_builder_set_member_name (builder, "cid");
-                json_builder_add_int_value (builder, tower->cell_id);
-                json_builder_set_member_name (builder, "mcc");
-                json_builder_add_int_value (builder, tower->mcc);
-                json_builder_set_member_name (builder, "mnc");
-                json_builder_add_int_value (builder, tower->mnc);
-                json_builder_set_member_name (builder, "lac");
-                json_builder_add_int_value (builder, tower->lac);
+                gclue_json_writer_begin_array (&writer, "cell");
+                gclue_json_writer_begin_object (&writer, NULL);
 
-                json_builder_end_object (builder);
+                gclue_json_writer_add_string (&writer, "radio", "gsm");
+                gclue_json_writer_add_int (&writer, "cid", tower->cell_id);
+                gclue_json_writer_add_int (&writer, "mcc", tower->mcc);
+                gclue_json_writer_add_int (&writer, "mnc", tower->mnc);
+                gclue_json_writer_add_int (&writer, "lac", tower->lac);
 
-                json_builder_end_array (builder); /* cell */
+                gclue_json_writer_end_object (&writer);
+                gclue_json_writer_end_array (&writer); /* cell */
         }
 
-        json_builder_end_object (builder);
-        json_builder_end_array (builder); /* items */
-        json_builder_end_object (builder);
-
-        generator = json_generator_new ();
-        root_node = json_builder_get_root (builder);
-        json_generator_set_root (generator, root_node);
-        data = json_generator_to_data (generator, &data_len);
-
-        json_node_free (root_node);
-        g_object_unref (builder);
-        g_object_unref (generator);
-
-        ret = soup_message_new ("POST", url);
-        if (nick != NULL && nick[0] != '\0')
-                soup_message_headers_append (ret->request_headers,
-                                             "X-Nickname",
-                                             nick);
-        soup_message_set_request (ret,
-                                  "application/json",
-                                  SOUP_MEMORY_TAKE,
-                                  data,
-                                  data_len);
-        g_debug ("Sending following request to '%s':\n%s", url, data);
+        gclue_json_writer_end_object (&writer);
 
-out:
-        return ret;
+        return gclue_json_writer_steal (&writer, NULL);
 }
 
 gboolean
-gclue_mozilla_should_ignore_bss (WPABSS *bss)
+gclue_mozilla_should_ignore_bss (const char *bssid,
+                                 const char *ssid)
 {
-        char ssid[MAX_SSID_LEN] = { 0 };
-        char bssid[BSSID_STR_LEN] = { 0 };
-        guint len;
-
-        if (!get_bssid_from_bss (bss, bssid)) {
-                g_debug ("Ignoring WiFi AP with unknown BSSID..");
-                return TRUE;
-        }
-
-        len = get_ssid_from_bss (bss, ssid);
-        if (len == 0 || g_str_has_suffix (ssid, "_nomap")) {
+        if (ssid == NULL || *ssid == '\0' ||
+            g_str_has_suffix (ssid, "_nomap")) {
                 g_debug ("SSID for WiFi AP '%s' missing or has '_nomap' suffix."
                          ", Ignoring..",
                          bssid);
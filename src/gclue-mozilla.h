@@ -24,26 +24,28 @@
 
 #include <glib.h>
 #include <libsoup/soup.h>
-#include "wpa_supplicant-interface.h"
 #include "gclue-location.h"
 #include "gclue-3g-tower.h"
+#include "gclue-bss-record.h"
 
 G_BEGIN_DECLS
 
 SoupMessage *
-gclue_mozilla_create_query (GList        *bss_list, /* As in Access Points */
+gclue_mozilla_create_query (GArray       *bss_records, /* As in Access Points */
                             GClue3GTower *tower,
                             GError      **error);
 GClueLocation *
 gclue_mozilla_parse_response (const char *json,
+                              gsize       length,
                               GError    **error);
-SoupMessage *
-gclue_mozilla_create_submit_query (GClueLocation   *location,
-                                   GList           *bss_list, /* As in Access Points */
-                                   GClue3GTower    *tower,
-                                   GError         **error);
+char *
+gclue_mozilla_create_submit_item (GClueLocation   *location,
+                                  GArray          *bss_records, /* As in Access Points */
+                                  GClue3GTower    *tower,
+                                  GError         **error);
 gboolean
-gclue_mozilla_should_ignore_bss (WPABSS *bss);
+gclue_mozilla_should_ignore_bss (const char *bssid,
+                                 const char *ssid);
 
 G_END_DECLS
 
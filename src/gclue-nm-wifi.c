@@ -0,0 +1,1023 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <time.h>
+#include <gio/gio.h>
+#include "gclue-nm-wifi.h"
+#include "gclue-bss-record.h"
+#include "gclue-marshal.h"
+
+/**
+ * SECTION:gclue-nm-wifi
+ * @short_description: WiFi access points as seen by NetworkManager
+ * @include: gclue-glib/gclue-nm-wifi.h
+ *
+ * Watches the access points NetworkManager keeps for a WiFi device, for
+ * systems where we can't talk to wpa_supplicant directly (e.g. with iwd).
+ * Their properties are handed out in the format of wpa_supplicant's BSS
+ * properties, so that the same code can ingest both. NetworkManager scans
+ * on its own every so often, so we only ask it to when its last scan is
+ * older than what we can live with.
+ **/
+
+#define NM_SERVICE            "org.freedesktop.NetworkManager"
+#define NM_PATH               "/org/freedesktop/NetworkManager"
+#define NM_DEVICE_INTERFACE   NM_SERVICE ".Device"
+#define NM_WIRELESS_INTERFACE NM_SERVICE ".Device.Wireless"
+#define NM_AP_INTERFACE       NM_SERVICE ".AccessPoint"
+
+#define NM_DEVICE_TYPE_WIFI 2
+
+/* Seconds to wait for a scan we asked for before giving up on it */
+#define SCAN_TIMEOUT 30
+
+struct _GClueNMWifiPrivate {
+        GDBusConnection *connection;
+        GCancellable *cancellable;
+        guint device_added_id;
+        guint device_removed_id;
+        char *device_path; /* Of the WiFi device we use, if any */
+
+        gboolean started;
+        GCancellable *ap_cancellable; /* Of our queries while started */
+        guint ap_added_id;
+        guint ap_removed_id;
+        guint ap_changed_id;
+        guint device_changed_id;
+
+        guint num_pending;  /* Queries for the APs we don't have yet */
+        gboolean device_ready; /* Whether we got its properties */
+        gint64 last_scan;   /* Boot time in ms, -1 if unknown */
+        gboolean scan_requested;
+        guint scan_max_age; /* Of the results we asked for, in seconds */
+        gboolean scanning;  /* Waiting for NetworkManager to finish one */
+        guint scan_source;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueNMWifi,
+                         gclue_nm_wifi,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueNMWifi))
+
+enum {
+        DEVICE_CHANGED,
+        BSS_ADDED,
+        BSS_CHANGED,
+        BSS_REMOVED,
+        SCAN_DONE,
+        LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+typedef struct {
+        GClueNMWifi *nm_wifi;
+        GCancellable *cancellable;
+        char *path;
+} CallData;
+
+static CallData *
+call_data_new (GClueNMWifi  *nm_wifi,
+               GCancellable *cancellable,
+               const char   *path)
+{
+        CallData *data = g_slice_new (CallData);
+
+        data->nm_wifi = nm_wifi;
+        data->cancellable = g_object_ref (cancellable);
+        data->path = g_strdup (path);
+
+        return data;
+}
+
+static void
+call_data_free (CallData *data)
+{
+        g_object_unref (data->cancellable);
+        g_free (data->path);
+        g_slice_free (CallData, data);
+}
+
+/* Returns the reply to a call made with a CallData, or NULL if the call
+ * failed or got cancelled, in which case data->nm_wifi may be gone */
+static GVariant *
+call_data_finish (CallData     *data,
+                  GObject      *source_object,
+                  GAsyncResult *res)
+{
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                                res,
+                                                &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_debug ("Failed to query '%s': %s",
+                                 data->path,
+                                 error->message);
+                g_error_free (error);
+
+                return NULL;
+        }
+
+        /* The reply may have made it even if we cancelled in between */
+        if (g_cancellable_is_cancelled (data->cancellable)) {
+                g_variant_unref (result);
+
+                return NULL;
+        }
+
+        return result;
+}
+
+static void
+call (GClueNMWifi         *nm_wifi,
+      const char          *path,
+      const char          *interface,
+      const char          *method,
+      GVariant            *parameters,
+      const GVariantType  *reply_type,
+      GCancellable        *cancellable,
+      GAsyncReadyCallback  callback)
+{
+        g_dbus_connection_call (nm_wifi->priv->connection,
+                                NM_SERVICE,
+                                path,
+                                interface,
+                                method,
+                                parameters,
+                                reply_type,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                cancellable,
+                                callback,
+                                call_data_new (nm_wifi, cancellable, path));
+}
+
+static gint64
+get_boot_time (void)
+{
+        struct timespec ts;
+
+        if (clock_gettime (CLOCK_BOOTTIME, &ts) != 0)
+                return -1;
+
+        return (gint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static gboolean
+parse_hw_address (const char *address,
+                  guint8     *bssid)
+{
+        guint i;
+
+        for (i = 0; i < GCLUE_BSSID_LEN; i++) {
+                const char *octet = address + i * 3;
+                char separator = (i == GCLUE_BSSID_LEN - 1) ? '\0' : ':';
+                gint high, low;
+
+                /* Each check stops us before we'd read past the end */
+                high = g_ascii_xdigit_value (octet[0]);
+                if (high < 0)
+                        return FALSE;
+                low = g_ascii_xdigit_value (octet[1]);
+                if (low < 0 || octet[2] != separator)
+                        return FALSE;
+
+                bssid[i] = (high << 4) | low;
+        }
+
+        return TRUE;
+}
+
+/* Translates the AccessPoint properties we care about into the matching
+ * wpa_supplicant BSS ones */
+static GVariant *
+translate_ap_properties (GVariant *properties)
+{
+        GVariantBuilder builder;
+        GVariant *ssid;
+        const char *address;
+        guint8 bssid[GCLUE_BSSID_LEN];
+        guint32 frequency;
+        guint8 strength;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+        if (g_variant_lookup (properties, "HwAddress", "&s", &address) &&
+            parse_hw_address (address, bssid))
+                g_variant_builder_add (&builder,
+                                       "{sv}",
+                                       "BSSID",
+                                       g_variant_new_fixed_array
+                                                (G_VARIANT_TYPE_BYTE,
+                                                 bssid,
+                                                 GCLUE_BSSID_LEN,
+                                                 sizeof (guint8)));
+
+        ssid = g_variant_lookup_value (properties,
+                                       "Ssid",
+                                       G_VARIANT_TYPE_BYTESTRING);
+        if (ssid != NULL)
+                g_variant_builder_add (&builder, "{sv}", "SSID", ssid);
+
+        /* NetworkManager maps -100 to -40 dBm linearly onto 0 to 100% */
+        if (g_variant_lookup (properties, "Strength", "y", &strength)) {
+                gint16 signal = -100 + MIN (strength, 100) * 60 / 100;
+
+                g_variant_builder_add (&builder,
+                                       "{sv}",
+                                       "Signal",
+                                       g_variant_new_int16 (signal));
+        }
+
+        if (g_variant_lookup (properties, "Frequency", "u", &frequency))
+                g_variant_builder_add (&builder,
+                                       "{sv}",
+                                       "Frequency",
+                                       g_variant_new_uint16 (frequency));
+
+        if (ssid != NULL)
+                g_variant_unref (ssid);
+
+        return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+emit_bss_signal (GClueNMWifi *nm_wifi,
+                 guint        signal,
+                 const char  *path,
+                 GVariant    *properties)
+{
+        GVariant *translated;
+
+        translated = translate_ap_properties (properties);
+        if (g_variant_n_children (translated) > 0)
+                g_signal_emit (nm_wifi, signals[signal], 0, path, translated);
+        g_variant_unref (translated);
+}
+
+/* A scan is done once NetworkManager is, and we know about all the APs
+ * it found */
+static void
+maybe_finish_scan (GClueNMWifi *nm_wifi)
+{
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+
+        if (!priv->scan_requested || priv->scanning || priv->num_pending > 0)
+                return;
+
+        if (priv->scan_source != 0) {
+                g_source_remove (priv->scan_source);
+                priv->scan_source = 0;
+        }
+        priv->scan_requested = FALSE;
+
+        g_signal_emit (nm_wifi, signals[SCAN_DONE], 0);
+}
+
+static gboolean
+on_scan_source (gpointer user_data)
+{
+        GClueNMWifi *nm_wifi = GCLUE_NM_WIFI (user_data);
+
+        if (nm_wifi->priv->scanning)
+                g_debug ("NetworkManager didn't scan in time, "
+                         "making do with what it has");
+        nm_wifi->priv->scan_source = 0;
+        nm_wifi->priv->scanning = FALSE;
+        maybe_finish_scan (nm_wifi);
+
+        return FALSE;
+}
+
+static void
+ap_query_done (CallData *data)
+{
+        GClueNMWifiPrivate *priv;
+
+        if (!g_cancellable_is_cancelled (data->cancellable)) {
+                priv = data->nm_wifi->priv;
+                priv->num_pending--;
+                maybe_finish_scan (data->nm_wifi);
+        }
+        call_data_free (data);
+}
+
+static void
+on_ap_get_all_ready (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        CallData *data = user_data;
+        GVariant *result, *properties;
+
+        result = call_data_finish (data, source_object, res);
+        if (result != NULL) {
+                properties = g_variant_get_child_value (result, 0);
+                emit_bss_signal (data->nm_wifi,
+                                 BSS_ADDED,
+                                 data->path,
+                                 properties);
+                g_variant_unref (properties);
+                g_variant_unref (result);
+        }
+
+        ap_query_done (data);
+}
+
+static void
+add_ap (GClueNMWifi *nm_wifi,
+        const char  *path)
+{
+        /* These all go out at once, so this costs one round-trip overall */
+        nm_wifi->priv->num_pending++;
+        call (nm_wifi,
+              path,
+              "org.freedesktop.DBus.Properties",
+              "GetAll",
+              g_variant_new ("(s)", NM_AP_INTERFACE),
+              G_VARIANT_TYPE ("(a{sv})"),
+              nm_wifi->priv->ap_cancellable,
+              on_ap_get_all_ready);
+}
+
+static void
+on_ap_added (GDBusConnection *connection,
+             const char      *sender_name,
+             const char      *object_path,
+             const char      *interface_name,
+             const char      *signal_name,
+             GVariant        *parameters,
+             gpointer         user_data)
+{
+        const char *path;
+
+        g_variant_get (parameters, "(&o)", &path);
+        add_ap (GCLUE_NM_WIFI (user_data), path);
+}
+
+static void
+on_ap_removed (GDBusConnection *connection,
+               const char      *sender_name,
+               const char      *object_path,
+               const char      *interface_name,
+               const char      *signal_name,
+               GVariant        *parameters,
+               gpointer         user_data)
+{
+        const char *path;
+
+        g_variant_get (parameters, "(&o)", &path);
+        g_signal_emit (GCLUE_NM_WIFI (user_data),
+                       signals[BSS_REMOVED],
+                       0,
+                       path);
+}
+
+static void
+on_ap_properties_changed (GDBusConnection *connection,
+                          const char      *sender_name,
+                          const char      *object_path,
+                          const char      *interface_name,
+                          const char      *signal_name,
+                          GVariant        *parameters,
+                          gpointer         user_data)
+{
+        GVariant *changed;
+
+        changed = g_variant_get_child_value (parameters, 1);
+        emit_bss_signal (GCLUE_NM_WIFI (user_data),
+                         BSS_CHANGED,
+                         object_path,
+                         changed);
+        g_variant_unref (changed);
+}
+
+static void
+on_request_scan_ready (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+        CallData *data = user_data;
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                                res,
+                                                &error);
+        if (result != NULL) {
+                g_variant_unref (result);
+        } else if (!g_cancellable_is_cancelled (data->cancellable)) {
+                /* e.g. as it only just scanned on its own */
+                g_debug ("NetworkManager didn't scan: %s", error->message);
+                data->nm_wifi->priv->scanning = FALSE;
+                maybe_finish_scan (data->nm_wifi);
+        }
+        g_clear_error (&error);
+
+        call_data_free (data);
+}
+
+/* Only to be called once we know when NetworkManager last scanned */
+static void
+request_scan (GClueNMWifi *nm_wifi)
+{
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+        gint64 now;
+
+        now = get_boot_time ();
+        if (priv->last_scan >= 0 && now >= 0 &&
+            now - priv->last_scan < (gint64) priv->scan_max_age * 1000) {
+                g_debug ("NetworkManager scanned %" G_GINT64_FORMAT
+                         " ms ago, using its results",
+                         now - priv->last_scan);
+                /* Don't call back before we return */
+                priv->scan_source = g_idle_add (on_scan_source, nm_wifi);
+
+                return;
+        }
+
+        g_debug ("Asking NetworkManager to scan");
+        priv->scanning = TRUE;
+        priv->scan_source = g_timeout_add_seconds (SCAN_TIMEOUT,
+                                                   on_scan_source,
+                                                   nm_wifi);
+        call (nm_wifi,
+              priv->device_path,
+              NM_WIRELESS_INTERFACE,
+              "RequestScan",
+              g_variant_new ("(a{sv})", NULL),
+              NULL,
+              priv->ap_cancellable,
+              on_request_scan_ready);
+}
+
+static void
+on_device_properties_changed (GDBusConnection *connection,
+                              const char      *sender_name,
+                              const char      *object_path,
+                              const char      *interface_name,
+                              const char      *signal_name,
+                              GVariant        *parameters,
+                              gpointer         user_data)
+{
+        GClueNMWifi *nm_wifi = GCLUE_NM_WIFI (user_data);
+        GVariant *changed;
+        gboolean scanned;
+
+        changed = g_variant_get_child_value (parameters, 1);
+        scanned = g_variant_lookup (changed,
+                                    "LastScan",
+                                    "x",
+                                    &nm_wifi->priv->last_scan);
+        g_variant_unref (changed);
+
+        /* It announces the APs it found before that, so all that may be
+         * left to wait for are our queries about them */
+        if (scanned && nm_wifi->priv->scanning) {
+                g_debug ("NetworkManager scan completed");
+                nm_wifi->priv->scanning = FALSE;
+                maybe_finish_scan (nm_wifi);
+        }
+}
+
+static void
+on_device_get_all_ready (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+        CallData *data = user_data;
+        GVariant *result, *properties;
+        const char *path;
+        GVariantIter *iter;
+
+        result = call_data_finish (data, source_object, res);
+        if (result == NULL)
+                goto out;
+
+        properties = g_variant_get_child_value (result, 0);
+        g_variant_lookup (properties,
+                          "LastScan",
+                          "x",
+                          &data->nm_wifi->priv->last_scan);
+        if (g_variant_lookup (properties, "AccessPoints", "ao", &iter)) {
+                while (g_variant_iter_loop (iter, "&o", &path))
+                        add_ap (data->nm_wifi, path);
+                g_variant_iter_free (iter);
+        }
+        g_variant_unref (properties);
+        g_variant_unref (result);
+out:
+        /* Scans asked for before now were waiting for LastScan */
+        if (!g_cancellable_is_cancelled (data->cancellable)) {
+                data->nm_wifi->priv->device_ready = TRUE;
+                if (data->nm_wifi->priv->scan_requested)
+                        request_scan (data->nm_wifi);
+        }
+        ap_query_done (data);
+}
+
+static guint
+subscribe (GClueNMWifi         *nm_wifi,
+           const char          *interface,
+           const char          *member,
+           const char          *path,
+           const char          *arg0,
+           GDBusSignalCallback  callback)
+{
+        return g_dbus_connection_signal_subscribe (nm_wifi->priv->connection,
+                                                   NM_SERVICE,
+                                                   interface,
+                                                   member,
+                                                   path,
+                                                   arg0,
+                                                   G_DBUS_SIGNAL_FLAGS_NONE,
+                                                   callback,
+                                                   nm_wifi,
+                                                   NULL);
+}
+
+static void
+unsubscribe (GClueNMWifi *nm_wifi,
+             guint       *id)
+{
+        if (*id == 0)
+                return;
+
+        g_dbus_connection_signal_unsubscribe (nm_wifi->priv->connection, *id);
+        *id = 0;
+}
+
+static void
+watch_device (GClueNMWifi *nm_wifi)
+{
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+
+        if (priv->ap_cancellable != NULL || priv->device_path == NULL)
+                return;
+
+        priv->ap_cancellable = g_cancellable_new ();
+        priv->num_pending = 1;
+        priv->ap_added_id = subscribe (nm_wifi,
+                                       NM_WIRELESS_INTERFACE,
+                                       "AccessPointAdded",
+                                       priv->device_path,
+                                       NULL,
+                                       on_ap_added);
+        priv->ap_removed_id = subscribe (nm_wifi,
+                                         NM_WIRELESS_INTERFACE,
+                                         "AccessPointRemoved",
+                                         priv->device_path,
+                                         NULL,
+                                         on_ap_removed);
+        /* One subscription for the changes of all the APs */
+        priv->ap_changed_id = subscribe (nm_wifi,
+                                         "org.freedesktop.DBus.Properties",
+                                         "PropertiesChanged",
+                                         NULL,
+                                         NM_AP_INTERFACE,
+                                         on_ap_properties_changed);
+        priv->device_changed_id = subscribe (nm_wifi,
+                                             "org.freedesktop.DBus.Properties",
+                                             "PropertiesChanged",
+                                             priv->device_path,
+                                             NM_WIRELESS_INTERFACE,
+                                             on_device_properties_changed);
+
+        call (nm_wifi,
+              priv->device_path,
+              "org.freedesktop.DBus.Properties",
+              "GetAll",
+              g_variant_new ("(s)", NM_WIRELESS_INTERFACE),
+              G_VARIANT_TYPE ("(a{sv})"),
+              priv->ap_cancellable,
+              on_device_get_all_ready);
+}
+
+static void
+unwatch_device (GClueNMWifi *nm_wifi)
+{
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+
+        if (priv->ap_cancellable == NULL)
+                return;
+
+        g_cancellable_cancel (priv->ap_cancellable);
+        g_clear_object (&priv->ap_cancellable);
+        unsubscribe (nm_wifi, &priv->ap_added_id);
+        unsubscribe (nm_wifi, &priv->ap_removed_id);
+        unsubscribe (nm_wifi, &priv->ap_changed_id);
+        unsubscribe (nm_wifi, &priv->device_changed_id);
+
+        if (priv->scan_source != 0) {
+                g_source_remove (priv->scan_source);
+                priv->scan_source = 0;
+        }
+        priv->num_pending = 0;
+        priv->device_ready = FALSE;
+        priv->scan_requested = FALSE;
+        priv->scanning = FALSE;
+        priv->last_scan = -1;
+}
+
+static void
+on_device_type_ready (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        CallData *data = user_data;
+        GClueNMWifiPrivate *priv;
+        GVariant *result, *type;
+
+        result = call_data_finish (data, source_object, res);
+        if (result == NULL)
+                goto out;
+
+        priv = data->nm_wifi->priv;
+        g_variant_get (result, "(v)", &type);
+        if (priv->device_path == NULL &&
+            g_variant_is_of_type (type, G_VARIANT_TYPE_UINT32) &&
+            g_variant_get_uint32 (type) == NM_DEVICE_TYPE_WIFI) {
+                priv->device_path = g_strdup (data->path);
+                g_debug ("NetworkManager WiFi device '%s' added.",
+                         priv->device_path);
+
+                if (priv->started)
+                        watch_device (data->nm_wifi);
+                g_signal_emit (data->nm_wifi, signals[DEVICE_CHANGED], 0);
+        }
+        g_variant_unref (type);
+        g_variant_unref (result);
+out:
+        call_data_free (data);
+}
+
+static void
+probe_device (GClueNMWifi *nm_wifi,
+              const char  *path)
+{
+        call (nm_wifi,
+              path,
+              "org.freedesktop.DBus.Properties",
+              "Get",
+              g_variant_new ("(ss)", NM_DEVICE_INTERFACE, "DeviceType"),
+              G_VARIANT_TYPE ("(v)"),
+              nm_wifi->priv->cancellable,
+              on_device_type_ready);
+}
+
+static void
+on_get_devices_ready (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        CallData *data = user_data;
+        GVariant *result;
+        GVariantIter *iter;
+        const char *path;
+
+        result = call_data_finish (data, source_object, res);
+        if (result == NULL)
+                goto out;
+
+        g_variant_get (result, "(ao)", &iter);
+        while (g_variant_iter_loop (iter, "&o", &path))
+                probe_device (data->nm_wifi, path);
+        g_variant_iter_free (iter);
+        g_variant_unref (result);
+out:
+        call_data_free (data);
+}
+
+static void
+find_device (GClueNMWifi *nm_wifi)
+{
+        call (nm_wifi,
+              NM_PATH,
+              NM_SERVICE,
+              "GetDevices",
+              NULL,
+              G_VARIANT_TYPE ("(ao)"),
+              nm_wifi->priv->cancellable,
+              on_get_devices_ready);
+}
+
+static void
+on_device_added (GDBusConnection *connection,
+                 const char      *sender_name,
+                 const char      *object_path,
+                 const char      *interface_name,
+                 const char      *signal_name,
+                 GVariant        *parameters,
+                 gpointer         user_data)
+{
+        GClueNMWifi *nm_wifi = GCLUE_NM_WIFI (user_data);
+        const char *path;
+
+        if (nm_wifi->priv->device_path != NULL)
+                return;
+
+        g_variant_get (parameters, "(&o)", &path);
+        probe_device (nm_wifi, path);
+}
+
+static void
+on_device_removed (GDBusConnection *connection,
+                   const char      *sender_name,
+                   const char      *object_path,
+                   const char      *interface_name,
+                   const char      *signal_name,
+                   GVariant        *parameters,
+                   gpointer         user_data)
+{
+        GClueNMWifi *nm_wifi = GCLUE_NM_WIFI (user_data);
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+        const char *path;
+
+        g_variant_get (parameters, "(&o)", &path);
+        if (g_strcmp0 (path, priv->device_path) != 0)
+                return;
+
+        g_debug ("NetworkManager WiFi device '%s' removed.", path);
+        unwatch_device (nm_wifi);
+        g_clear_pointer (&priv->device_path, g_free);
+        g_signal_emit (nm_wifi, signals[DEVICE_CHANGED], 0);
+
+        /* Maybe there is another one */
+        find_device (nm_wifi);
+}
+
+static void
+gclue_nm_wifi_finalize (GObject *object)
+{
+        GClueNMWifi *nm_wifi = GCLUE_NM_WIFI (object);
+        GClueNMWifiPrivate *priv = nm_wifi->priv;
+
+        if (priv->connection != NULL) {
+                unwatch_device (nm_wifi);
+                unsubscribe (nm_wifi, &priv->device_added_id);
+                unsubscribe (nm_wifi, &priv->device_removed_id);
+        }
+        g_cancellable_cancel (priv->cancellable);
+        g_clear_object (&priv->cancellable);
+        g_clear_object (&priv->connection);
+        g_clear_pointer (&priv->device_path, g_free);
+
+        G_OBJECT_CLASS (gclue_nm_wifi_parent_class)->finalize (object);
+}
+
+static void
+on_bus_get_ready (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        GClueNMWifi *nm_wifi;
+        GDBusConnection *connection;
+        GError *error = NULL;
+
+        connection = g_bus_get_finish (res, &error);
+        if (connection == NULL) {
+                /* If cancelled, nm_wifi is gone */
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to connect to system bus: %s",
+                                   error->message);
+                g_error_free (error);
+
+                return;
+        }
+
+        nm_wifi = GCLUE_NM_WIFI (user_data);
+        nm_wifi->priv->connection = connection;
+        nm_wifi->priv->device_added_id = subscribe (nm_wifi,
+                                                    NM_SERVICE,
+                                                    "DeviceAdded",
+                                                    NM_PATH,
+                                                    NULL,
+                                                    on_device_added);
+        nm_wifi->priv->device_removed_id = subscribe (nm_wifi,
+                                                      NM_SERVICE,
+                                                      "DeviceRemoved",
+                                                      NM_PATH,
+                                                      NULL,
+                                                      on_device_removed);
+        find_device (nm_wifi);
+}
+
+static void
+gclue_nm_wifi_constructed (GObject *object)
+{
+        G_OBJECT_CLASS (gclue_nm_wifi_parent_class)->constructed (object);
+
+        g_bus_get (G_BUS_TYPE_SYSTEM,
+                   GCLUE_NM_WIFI (object)->priv->cancellable,
+                   on_bus_get_ready,
+                   object);
+}
+
+static void
+gclue_nm_wifi_class_init (GClueNMWifiClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_nm_wifi_finalize;
+        object_class->constructed = gclue_nm_wifi_constructed;
+
+        /**
+         * GClueNMWifi::device-changed:
+         * @nm_wifi: a #GClueNMWifi
+         *
+         * Emitted when a WiFi device appears or goes away.
+         **/
+        signals[DEVICE_CHANGED] = g_signal_new ("device-changed",
+                                                GCLUE_TYPE_NM_WIFI,
+                                                G_SIGNAL_RUN_LAST,
+                                                0,
+                                                NULL,
+                                                NULL,
+                                                g_cclosure_marshal_VOID__VOID,
+                                                G_TYPE_NONE,
+                                                0);
+
+        /**
+         * GClueNMWifi::bss-added:
+         * @nm_wifi: a #GClueNMWifi
+         * @path: the object path of the access point
+         * @properties: its properties, as wpa_supplicant names them
+         **/
+        signals[BSS_ADDED] = g_signal_new ("bss-added",
+                                           GCLUE_TYPE_NM_WIFI,
+                                           G_SIGNAL_RUN_LAST,
+                                           0,
+                                           NULL,
+                                           NULL,
+                                           gclue_marshal_VOID__STRING_VARIANT,
+                                           G_TYPE_NONE,
+                                           2,
+                                           G_TYPE_STRING,
+                                           G_TYPE_VARIANT);
+
+        /**
+         * GClueNMWifi::bss-changed:
+         * @nm_wifi: a #GClueNMWifi
+         * @path: the object path of the access point
+         * @properties: those of its properties that changed, as
+         * wpa_supplicant names them
+         **/
+        signals[BSS_CHANGED] = g_signal_new ("bss-changed",
+                                             GCLUE_TYPE_NM_WIFI,
+                                             G_SIGNAL_RUN_LAST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             gclue_marshal_VOID__STRING_VARIANT,
+                                             G_TYPE_NONE,
+                                             2,
+                                             G_TYPE_STRING,
+                                             G_TYPE_VARIANT);
+
+        /**
+         * GClueNMWifi::bss-removed:
+         * @nm_wifi: a #GClueNMWifi
+         * @path: the object path of the access point
+         **/
+        signals[BSS_REMOVED] = g_signal_new ("bss-removed",
+                                             GCLUE_TYPE_NM_WIFI,
+                                             G_SIGNAL_RUN_LAST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_VOID__STRING,
+                                             G_TYPE_NONE,
+                                             1,
+                                             G_TYPE_STRING);
+
+        /**
+         * GClueNMWifi::scan-done:
+         * @nm_wifi: a #GClueNMWifi
+         *
+         * Emitted after each gclue_nm_wifi_scan(), once the access points
+         * are up to date.
+         **/
+        signals[SCAN_DONE] = g_signal_new ("scan-done",
+                                           GCLUE_TYPE_NM_WIFI,
+                                           G_SIGNAL_RUN_LAST,
+                                           0,
+                                           NULL,
+                                           NULL,
+                                           g_cclosure_marshal_VOID__VOID,
+                                           G_TYPE_NONE,
+                                           0);
+}
+
+static void
+gclue_nm_wifi_init (GClueNMWifi *nm_wifi)
+{
+        nm_wifi->priv = G_TYPE_INSTANCE_GET_PRIVATE (nm_wifi,
+                                                     GCLUE_TYPE_NM_WIFI,
+                                                     GClueNMWifiPrivate);
+        nm_wifi->priv->cancellable = g_cancellable_new ();
+        nm_wifi->priv->last_scan = -1;
+}
+
+/**
+ * gclue_nm_wifi_new:
+ *
+ * Returns: (transfer full): a new #GClueNMWifi.
+ **/
+GClueNMWifi *
+gclue_nm_wifi_new (void)
+{
+        return g_object_new (GCLUE_TYPE_NM_WIFI, NULL);
+}
+
+/**
+ * gclue_nm_wifi_has_device:
+ * @nm_wifi: a #GClueNMWifi
+ *
+ * Returns: %TRUE if NetworkManager has a WiFi device for us.
+ **/
+gboolean
+gclue_nm_wifi_has_device (GClueNMWifi *nm_wifi)
+{
+        g_return_val_if_fail (GCLUE_IS_NM_WIFI (nm_wifi), FALSE);
+
+        return nm_wifi->priv->device_path != NULL;
+}
+
+/**
+ * gclue_nm_wifi_start:
+ * @nm_wifi: a #GClueNMWifi
+ *
+ * Starts watching the access points of the WiFi device, emitting
+ * #GClueNMWifi::bss-added for those NetworkManager already knows about.
+ **/
+void
+gclue_nm_wifi_start (GClueNMWifi *nm_wifi)
+{
+        g_return_if_fail (GCLUE_IS_NM_WIFI (nm_wifi));
+
+        nm_wifi->priv->started = TRUE;
+        watch_device (nm_wifi);
+}
+
+/**
+ * gclue_nm_wifi_stop:
+ * @nm_wifi: a #GClueNMWifi
+ *
+ * Stops watching the access points of the WiFi device.
+ **/
+void
+gclue_nm_wifi_stop (GClueNMWifi *nm_wifi)
+{
+        g_return_if_fail (GCLUE_IS_NM_WIFI (nm_wifi));
+
+        nm_wifi->priv->started = FALSE;
+        unwatch_device (nm_wifi);
+}
+
+/**
+ * gclue_nm_wifi_scan:
+ * @nm_wifi: a #GClueNMWifi
+ * @max_age: seconds since NetworkManager's last scan we can live with
+ *
+ * Asks NetworkManager to scan, unless it did so in the last @max_age
+ * seconds, and emits #GClueNMWifi::scan-done once its access points are
+ * up to date either way.
+ **/
+void
+gclue_nm_wifi_scan (GClueNMWifi *nm_wifi,
+                    guint        max_age)
+{
+        GClueNMWifiPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_NM_WIFI (nm_wifi));
+        priv = nm_wifi->priv;
+
+        if (priv->ap_cancellable == NULL || priv->scan_requested)
+                return;
+        priv->scan_requested = TRUE;
+        priv->scan_max_age = max_age;
+
+        /* Right after gclue_nm_wifi_start(), we don't know LastScan yet */
+        if (priv->device_ready)
+                request_scan (nm_wifi);
+}
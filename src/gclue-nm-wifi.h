@@ -0,0 +1,63 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_NM_WIFI_H
+#define GCLUE_NM_WIFI_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_NM_WIFI            (gclue_nm_wifi_get_type())
+#define GCLUE_NM_WIFI(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_NM_WIFI, GClueNMWifi))
+#define GCLUE_NM_WIFI_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_NM_WIFI, GClueNMWifi const))
+#define GCLUE_NM_WIFI_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_NM_WIFI, GClueNMWifiClass))
+#define GCLUE_IS_NM_WIFI(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_NM_WIFI))
+#define GCLUE_IS_NM_WIFI_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_NM_WIFI))
+#define GCLUE_NM_WIFI_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_NM_WIFI, GClueNMWifiClass))
+
+typedef struct _GClueNMWifi        GClueNMWifi;
+typedef struct _GClueNMWifiClass   GClueNMWifiClass;
+typedef struct _GClueNMWifiPrivate GClueNMWifiPrivate;
+
+struct _GClueNMWifi
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueNMWifiPrivate *priv;
+};
+
+struct _GClueNMWifiClass
+{
+        GObjectClass parent_class;
+};
+
+GType             gclue_nm_wifi_get_type   (void) G_GNUC_CONST;
+
+GClueNMWifi *     gclue_nm_wifi_new        (void);
+gboolean          gclue_nm_wifi_has_device (GClueNMWifi *nm_wifi);
+void              gclue_nm_wifi_start      (GClueNMWifi *nm_wifi);
+void              gclue_nm_wifi_stop       (GClueNMWifi *nm_wifi);
+void              gclue_nm_wifi_scan       (GClueNMWifi *nm_wifi,
+                                            guint        max_age);
+
+G_END_DECLS
+
+#endif /* GCLUE_NM_WIFI_H */
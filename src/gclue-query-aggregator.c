@@ -0,0 +1,430 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "gclue-query-aggregator.h"
+#include "gclue-mozilla.h"
+
+/**
+ * SECTION:gclue-query-aggregator
+ * @short_description: Combined network location queries
+ * @include: gclue-glib/gclue-query-aggregator.h
+ *
+ * The WiFi and 3GPP sources publish their latest network data here and build
+ * their queries from all of it, so that a query carries the visible access
+ * points and the serving cell tower together. Whichever source refreshes
+ * first sends the combined query; a source whose data is already part of a
+ * query in flight doesn't send one of its own but gets the result through the
+ * #GClueQueryAggregator::query-answered signal.
+ *
+ * A query only carries the data that can't locate the sender any better than
+ * the accuracy level it is allowed, so that e.g. the cell tower source never
+ * gets a WiFi-grade location for an app only allowed neighborhood-level
+ * accuracy. The answer to a combined query therefore only serves the WiFi
+ * source: while both sources need locating, the cell tower source still
+ * sends a tower-only query of its own, unless its tower is cached.
+ **/
+
+/* Network data that went into a query */
+typedef struct
+{
+        GClueQueryAggregator *aggregator;
+        SoupMessage *query; /* Weak, gone once the query is over */
+        GObject *origin;    /* Weak, the source that sent the query */
+
+        guint wifi_serial;
+        guint tower_serial;
+
+        GArray *bssids;     /* Sorted, NULL if none */
+        GClue3GTower tower;
+        gboolean has_tower;
+} QueryInputs;
+
+/* How well each kind of network data locates us */
+#define WIFI_ACCURACY_LEVEL GCLUE_ACCURACY_LEVEL_STREET
+#define TOWER_ACCURACY_LEVEL GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD
+
+struct _GClueQueryAggregatorPrivate
+{
+        GArray *bss_records; /* Copy of the GClueBSSRecords last published */
+        GArray *bssids;
+        guint wifi_serial;
+
+        GClue3GTower tower;
+        gboolean has_tower;
+        guint tower_serial;
+
+        GList *queries; /* QueryInputs of queries in flight */
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueQueryAggregator,
+                         gclue_query_aggregator,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueQueryAggregator))
+
+enum {
+        QUERY_ANSWERED,
+        LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+static void
+on_query_destroyed (gpointer data,
+                    GObject *where_the_object_was);
+
+static void
+query_inputs_free (QueryInputs *inputs)
+{
+        g_clear_pointer (&inputs->bssids, g_array_unref);
+        g_slice_free (QueryInputs, inputs);
+}
+
+static void
+forget_query (QueryInputs *inputs)
+{
+        GClueQueryAggregatorPrivate *priv = inputs->aggregator->priv;
+
+        priv->queries = g_list_remove (priv->queries, inputs);
+        query_inputs_free (inputs);
+}
+
+static void
+on_query_destroyed (gpointer data,
+                    GObject *where_the_object_was)
+{
+        forget_query ((QueryInputs *) data);
+}
+
+static QueryInputs *
+find_query (GClueQueryAggregator *aggregator,
+            GObject              *origin)
+{
+        GList *l;
+
+        /* A source never has more than one query in flight */
+        for (l = aggregator->priv->queries; l != NULL; l = l->next) {
+                QueryInputs *inputs = l->data;
+
+                if (inputs->origin == origin)
+                        return inputs;
+        }
+
+        return NULL;
+}
+
+static gboolean
+bssids_equal (GArray *a,
+              GArray *b)
+{
+        if (a == NULL || b == NULL)
+                return a == b;
+
+        return a->len == b->len &&
+               memcmp (a->data, b->data, a->len * sizeof (guint64)) == 0;
+}
+
+static void
+gclue_query_aggregator_finalize (GObject *object)
+{
+        GClueQueryAggregatorPrivate *priv =
+                GCLUE_QUERY_AGGREGATOR (object)->priv;
+
+        while (priv->queries != NULL) {
+                QueryInputs *inputs = priv->queries->data;
+
+                g_object_weak_unref (G_OBJECT (inputs->query),
+                                     on_query_destroyed,
+                                     inputs);
+                forget_query (inputs);
+        }
+        g_clear_pointer (&priv->bss_records, g_array_unref);
+        g_clear_pointer (&priv->bssids, g_array_unref);
+
+        G_OBJECT_CLASS (gclue_query_aggregator_parent_class)->finalize (object);
+}
+
+static void
+gclue_query_aggregator_class_init (GClueQueryAggregatorClass *klass)
+{
+        GObjectClass *object_class;
+
+        object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gclue_query_aggregator_finalize;
+
+        /**
+         * GClueQueryAggregator::query-answered:
+         * @aggregator: a #GClueQueryAggregator
+         * @location: the #GClueLocation found
+         * @origin: the source that sent the query
+         * @bssids: (nullable): sorted #GArray of the BSSIDs in the query
+         * @tower: (nullable): the #GClue3GTower in the query
+         *
+         * Emitted for every successful query, so that each source can cache
+         * the result for its part of the query and pick it up. The location
+         * is only as good as the best data in the query, so sources must not
+         * pick up locations better than the accuracy level they offer.
+         **/
+        signals[QUERY_ANSWERED] =
+                g_signal_new ("query-answered",
+                              GCLUE_TYPE_QUERY_AGGREGATOR,
+                              G_SIGNAL_RUN_LAST,
+                              0,
+                              NULL,
+                              NULL,
+                              NULL,
+                              G_TYPE_NONE,
+                              4,
+                              GCLUE_TYPE_LOCATION,
+                              G_TYPE_OBJECT,
+                              G_TYPE_POINTER,
+                              G_TYPE_POINTER);
+}
+
+static void
+gclue_query_aggregator_init (GClueQueryAggregator *aggregator)
+{
+        aggregator->priv = G_TYPE_INSTANCE_GET_PRIVATE
+                                (aggregator,
+                                 GCLUE_TYPE_QUERY_AGGREGATOR,
+                                 GClueQueryAggregatorPrivate);
+}
+
+static void
+on_aggregator_destroyed (gpointer data,
+                         GObject *where_the_object_was)
+{
+        GClueQueryAggregator **aggregator = (GClueQueryAggregator **) data;
+
+        *aggregator = NULL;
+}
+
+/**
+ * gclue_query_aggregator_get_singleton:
+ *
+ * Get the #GClueQueryAggregator singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClueQueryAggregator. Use
+ * g_object_unref() when done.
+ **/
+GClueQueryAggregator *
+gclue_query_aggregator_get_singleton (void)
+{
+        static GClueQueryAggregator *aggregator = NULL;
+
+        if (aggregator == NULL) {
+                aggregator = g_object_new (GCLUE_TYPE_QUERY_AGGREGATOR, NULL);
+                g_object_weak_ref (G_OBJECT (aggregator),
+                                   on_aggregator_destroyed,
+                                   &aggregator);
+        } else
+                g_object_ref (aggregator);
+
+        return aggregator;
+}
+
+/**
+ * gclue_query_aggregator_set_wifi:
+ * @aggregator: a #GClueQueryAggregator
+ * @bss_records: (element-type GClueBSSRecord): visible access points
+ * @bssids: (nullable): sorted BSSIDs of @bss_records, or %NULL if there is no
+ * WiFi data to share anymore
+ *
+ * Publishes the access points to include in queries.
+ **/
+void
+gclue_query_aggregator_set_wifi (GClueQueryAggregator *aggregator,
+                                 GArray               *bss_records,
+                                 GArray               *bssids)
+{
+        GClueQueryAggregatorPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_QUERY_AGGREGATOR (aggregator));
+        priv = aggregator->priv;
+
+        /* Keep the newest records in any case, they carry the signal
+         * strengths, but only new access points make for a new query. The
+         * records are copied since the publisher keeps updating its own. */
+        g_clear_pointer (&priv->bss_records, g_array_unref);
+        if (bssids != NULL && bss_records != NULL) {
+                priv->bss_records = g_array_sized_new (FALSE,
+                                                       FALSE,
+                                                       sizeof (GClueBSSRecord),
+                                                       bss_records->len);
+                g_array_append_vals (priv->bss_records,
+                                     bss_records->data,
+                                     bss_records->len);
+        }
+        if (bssids_equal (priv->bssids, bssids))
+                return;
+
+        g_clear_pointer (&priv->bssids, g_array_unref);
+        if (bssids != NULL)
+                priv->bssids = g_array_ref (bssids);
+        priv->wifi_serial++;
+}
+
+/**
+ * gclue_query_aggregator_set_tower:
+ * @aggregator: a #GClueQueryAggregator
+ * @tower: (nullable): the serving cell tower, or %NULL if unknown
+ *
+ * Publishes the cell tower to include in queries.
+ **/
+void
+gclue_query_aggregator_set_tower (GClueQueryAggregator *aggregator,
+                                  GClue3GTower         *tower)
+{
+        GClueQueryAggregatorPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_QUERY_AGGREGATOR (aggregator));
+        priv = aggregator->priv;
+
+        if (tower == NULL) {
+                if (!priv->has_tower)
+                        return;
+                priv->has_tower = FALSE;
+        } else {
+                if (priv->has_tower && gclue_3g_tower_equal (&priv->tower, tower))
+                        return;
+                priv->tower = *tower;
+                priv->has_tower = TRUE;
+        }
+        priv->tower_serial++;
+}
+
+/**
+ * gclue_query_aggregator_create_query:
+ * @aggregator: a #GClueQueryAggregator
+ * @origin: the source that is going to send the query
+ * @max_level: the best accuracy level @origin may locate us with
+ * @error: Place-holder for errors.
+ *
+ * Creates a query with the network data published so far that doesn't
+ * locate us better than @max_level.
+ *
+ * Returns: (transfer full): a new #SoupMessage, or %NULL. If @error is not
+ * set either, all the data is part of a query in flight already and @origin
+ * should wait for #GClueQueryAggregator::query-answered instead.
+ **/
+SoupMessage *
+gclue_query_aggregator_create_query (GClueQueryAggregator *aggregator,
+                                     GObject              *origin,
+                                     GClueAccuracyLevel    max_level,
+                                     GError              **error)
+{
+        GClueQueryAggregatorPrivate *priv;
+        QueryInputs *inputs;
+        SoupMessage *query;
+        gboolean with_wifi, with_tower;
+        GList *l;
+
+        g_return_val_if_fail (GCLUE_IS_QUERY_AGGREGATOR (aggregator), NULL);
+        priv = aggregator->priv;
+
+        with_wifi = priv->bssids != NULL && max_level >= WIFI_ACCURACY_LEVEL;
+        with_tower = priv->has_tower && max_level >= TOWER_ACCURACY_LEVEL;
+
+        for (l = priv->queries; l != NULL; l = l->next) {
+                inputs = l->data;
+
+                if ((inputs->bssids != NULL) == with_wifi &&
+                    inputs->has_tower == with_tower &&
+                    (!with_wifi || inputs->wifi_serial == priv->wifi_serial) &&
+                    (!with_tower || inputs->tower_serial == priv->tower_serial)) {
+                        g_debug ("Network data already being queried");
+                        return NULL;
+                }
+        }
+
+        query = gclue_mozilla_create_query (with_wifi ?
+                                            priv->bss_records : NULL,
+                                            with_tower ?
+                                            &priv->tower : NULL,
+                                            error);
+        if (query == NULL)
+                return NULL;
+
+        /* Supersedes any earlier query of @origin, which is over anyway */
+        inputs = find_query (aggregator, origin);
+        if (inputs != NULL) {
+                g_object_weak_unref (G_OBJECT (inputs->query),
+                                     on_query_destroyed,
+                                     inputs);
+                forget_query (inputs);
+        }
+
+        inputs = g_slice_new0 (QueryInputs);
+        inputs->aggregator = aggregator;
+        inputs->query = query;
+        inputs->origin = origin;
+        inputs->wifi_serial = priv->wifi_serial;
+        inputs->tower_serial = priv->tower_serial;
+        if (with_wifi)
+                inputs->bssids = g_array_ref (priv->bssids);
+        inputs->tower = priv->tower;
+        inputs->has_tower = with_tower;
+        g_object_weak_ref (G_OBJECT (query), on_query_destroyed, inputs);
+        priv->queries = g_list_prepend (priv->queries, inputs);
+
+        return query;
+}
+
+/**
+ * gclue_query_aggregator_parse_response:
+ * @aggregator: a #GClueQueryAggregator
+ * @origin: the source that sent the query
+ * @json: the response body, not necessarily nul-terminated
+ * @length: the length of @json in bytes
+ * @error: Place-holder for errors.
+ *
+ * Parses the response to the query @origin created and hands the location out
+ * to every source whose data went into the query.
+ *
+ * Returns: (transfer full): the #GClueLocation found, or %NULL on error.
+ **/
+GClueLocation *
+gclue_query_aggregator_parse_response (GClueQueryAggregator *aggregator,
+                                       GObject              *origin,
+                                       const char           *json,
+                                       gsize                 length,
+                                       GError              **error)
+{
+        GClueLocation *location;
+        QueryInputs *inputs;
+
+        g_return_val_if_fail (GCLUE_IS_QUERY_AGGREGATOR (aggregator), NULL);
+
+        location = gclue_mozilla_parse_response (json, length, error);
+        if (location == NULL)
+                return NULL;
+
+        inputs = find_query (aggregator, origin);
+        if (inputs != NULL)
+                g_signal_emit (aggregator,
+                               signals[QUERY_ANSWERED],
+                               0,
+                               location,
+                               origin,
+                               inputs->bssids,
+                               inputs->has_tower ? &inputs->tower : NULL);
+
+        return location;
+}
@@ -0,0 +1,77 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_QUERY_AGGREGATOR_H
+#define GCLUE_QUERY_AGGREGATOR_H
+
+#include <glib-object.h>
+#include <libsoup/soup.h>
+#include "gclue-location.h"
+#include "gclue-enum-types.h"
+#include "gclue-3g-tower.h"
+#include "gclue-bss-record.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_QUERY_AGGREGATOR            (gclue_query_aggregator_get_type())
+#define GCLUE_QUERY_AGGREGATOR(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_QUERY_AGGREGATOR, GClueQueryAggregator))
+#define GCLUE_QUERY_AGGREGATOR_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_QUERY_AGGREGATOR, GClueQueryAggregator const))
+#define GCLUE_QUERY_AGGREGATOR_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_QUERY_AGGREGATOR, GClueQueryAggregatorClass))
+#define GCLUE_IS_QUERY_AGGREGATOR(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_QUERY_AGGREGATOR))
+#define GCLUE_IS_QUERY_AGGREGATOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_QUERY_AGGREGATOR))
+#define GCLUE_QUERY_AGGREGATOR_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_QUERY_AGGREGATOR, GClueQueryAggregatorClass))
+
+typedef struct _GClueQueryAggregator        GClueQueryAggregator;
+typedef struct _GClueQueryAggregatorClass   GClueQueryAggregatorClass;
+typedef struct _GClueQueryAggregatorPrivate GClueQueryAggregatorPrivate;
+
+struct _GClueQueryAggregator
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueQueryAggregatorPrivate *priv;
+};
+
+struct _GClueQueryAggregatorClass
+{
+        GObjectClass parent_class;
+};
+
+GType                  gclue_query_aggregator_get_type       (void) G_GNUC_CONST;
+
+GClueQueryAggregator * gclue_query_aggregator_get_singleton  (void);
+void                   gclue_query_aggregator_set_wifi       (GClueQueryAggregator *aggregator,
+                                                              GArray               *bss_records,
+                                                              GArray               *bssids);
+void                   gclue_query_aggregator_set_tower      (GClueQueryAggregator *aggregator,
+                                                              GClue3GTower         *tower);
+SoupMessage *          gclue_query_aggregator_create_query   (GClueQueryAggregator *aggregator,
+                                                              GObject              *origin,
+                                                              GClueAccuracyLevel    max_level,
+                                                              GError              **error);
+GClueLocation *        gclue_query_aggregator_parse_response (GClueQueryAggregator *aggregator,
+                                                              GObject              *origin,
+                                                              const char           *json,
+                                                              gsize                 length,
+                                                              GError              **error);
+
+G_END_DECLS
+
+#endif /* GCLUE_QUERY_AGGREGATOR_H */
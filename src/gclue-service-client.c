@@ -56,6 +56,8 @@ struct _GClueServiceClientPrivate
 
         /* Number of times location has been updated */
         guint locations_updated;
+        /* Monotonic time of Start(), until the first location is sent */
+        gint64 start_time;
 
         gboolean agent_stopped; /* Agent stopped client, not the app */
 };
@@ -246,6 +248,14 @@ on_locator_location_changed (GObject    *gobject,
 
         if (!emit_location_updated (client, prev_path, path, &error))
                 goto error_out;
+
+        if (priv->start_time != 0) {
+                g_debug ("Time to first fix for '%s': %.3f seconds",
+                         priv->path,
+                         (g_get_monotonic_time () - priv->start_time) /
+                         (gdouble) G_USEC_PER_SEC);
+                priv->start_time = 0;
+        }
         goto out;
 
 error_out:
@@ -261,20 +271,49 @@ start_client (GClueServiceClient *client, GClueAccuracyLevel accuracy_level)
         GClueServiceClientPrivate *priv = client->priv;
 
         gclue_dbus_client_set_active (GCLUE_DBUS_CLIENT (client), TRUE);
-        priv->locator = gclue_locator_new (accuracy_level);
-        gclue_locator_set_time_threshold (priv->locator, 0);
+        priv->start_time = g_get_monotonic_time ();
+        priv->locator = gclue_locator_get_shared (accuracy_level);
+        gclue_locator_set_time_threshold (priv->locator,
+                                          priv->time_threshold,
+                                          G_OBJECT (client));
         g_signal_connect (priv->locator,
                           "notify::location",
                           G_CALLBACK (on_locator_location_changed),
                           client);
 
+        /* A locator already running for other clients won't notify us of
+         * the location it has, so pick that up ourselves */
+        if (gclue_location_source_get_active
+                (GCLUE_LOCATION_SOURCE (priv->locator)))
+                on_locator_location_changed (G_OBJECT (priv->locator),
+                                             NULL,
+                                             client);
+
         gclue_location_source_start (GCLUE_LOCATION_SOURCE (priv->locator));
 }
 
+static void
+release_locator (GClueServiceClient *client)
+{
+        GClueServiceClientPrivate *priv = client->priv;
+
+        if (priv->locator == NULL)
+                return;
+
+        g_signal_handlers_disconnect_by_func (priv->locator,
+                                              G_CALLBACK (on_locator_location_changed),
+                                              client);
+        gclue_location_source_stop (GCLUE_LOCATION_SOURCE (priv->locator));
+        g_clear_object (&priv->locator);
+}
+
 static void
 stop_client (GClueServiceClient *client)
 {
-        g_clear_object (&client->priv->locator);
+        if (client->priv->locator != NULL)
+                gclue_locator_drop_time_threshold (client->priv->locator,
+                                                   G_OBJECT (client));
+        release_locator (client);
         gclue_dbus_client_set_active (GCLUE_DBUS_CLIENT (client), FALSE);
 }
 
@@ -660,7 +699,8 @@ gclue_service_client_finalize (GObject *object)
                                  G_CALLBACK (on_agent_props_changed),
                                  object);
         g_clear_object (&priv->agent_proxy);
-        g_clear_object (&priv->locator);
+        /* Our time-threshold goes away along with our weak reference */
+        release_locator (GCLUE_SERVICE_CLIENT (object));
         g_clear_object (&priv->location);
         g_clear_object (&priv->prev_location);
         g_clear_object (&priv->client_info);
@@ -843,8 +883,11 @@ gclue_service_client_handle_set_property (GDBusConnection *connection,
         } else if (ret && strcmp (property_name, "TimeThreshold") == 0) {
                 priv->time_threshold = gclue_dbus_client_get_time_threshold
                         (client);
-                gclue_locator_set_time_threshold (priv->locator,
-                                                  priv->time_threshold);
+                if (priv->locator != NULL)
+                        gclue_locator_set_time_threshold
+                                (priv->locator,
+                                 priv->time_threshold,
+                                 G_OBJECT (client));
                 g_debug ("%s: New time-threshold:  %u",
                          G_OBJECT_TYPE_NAME (client),
                          priv->time_threshold);
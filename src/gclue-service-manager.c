@@ -40,6 +40,10 @@ static void
 gclue_service_manager_manager_iface_init (GClueDBusManagerIface *iface);
 static void
 gclue_service_manager_initable_iface_init (GInitableIface *iface);
+static void
+on_avail_accuracy_level_changed (GObject    *object,
+                                 GParamSpec *pspec,
+                                 gpointer    user_data);
 
 struct _GClueServiceManagerPrivate
 {
@@ -526,6 +530,11 @@ gclue_service_manager_finalize (GObject *object)
 {
         GClueServiceManagerPrivate *priv = GCLUE_SERVICE_MANAGER (object)->priv;
 
+        if (priv->locator != NULL)
+                g_signal_handlers_disconnect_by_func
+                        (priv->locator,
+                         G_CALLBACK (on_avail_accuracy_level_changed),
+                         object);
         g_clear_object (&priv->locator);
         g_clear_object (&priv->connection);
         if (priv->clients != NULL) {
@@ -599,7 +608,7 @@ gclue_service_manager_constructed (GObject *object)
 
         G_OBJECT_CLASS (gclue_service_manager_parent_class)->constructed (object);
 
-        priv->locator = gclue_locator_new (GCLUE_ACCURACY_LEVEL_EXACT);
+        priv->locator = gclue_locator_get_shared (GCLUE_ACCURACY_LEVEL_EXACT);
         g_signal_connect (G_OBJECT (priv->locator),
                           "notify::available-accuracy-level",
                           G_CALLBACK (on_avail_accuracy_level_changed),
@@ -0,0 +1,561 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+#include "gclue-submission-journal.h"
+#include "gclue-cache-file.h"
+#include "gclue-config.h"
+
+/**
+ * SECTION:gclue-submission-journal
+ * @short_description: Durable queue of location data submissions
+ * @include: gclue-glib/gclue-submission-journal.h
+ *
+ * Collects items of network data to submit to Mozilla Location Service and
+ * uploads them in batches, each as a single gzip-compressed request, instead
+ * of one request per item. Items are appended to a journal on disk as they
+ * come, so those gathered while offline survive until connectivity returns,
+ * within the size and age limits below.
+ *
+ * The journal has one line per item: the time it was added, in seconds since
+ * the epoch, a space and the item as JSON.
+ **/
+
+#define JOURNAL_FILE_NAME "submissions"
+
+#define JOURNAL_MAX_ITEMS 2000
+#define JOURNAL_MAX_AGE   (7 * 24 * 60 * 60) /* seconds */
+
+/* While online, items are held back until there are this many of them or
+ * the oldest has waited this long */
+#define BATCH_MIN_ITEMS 20
+#define BATCH_MAX_DELAY (60 * 60) /* seconds */
+#define BATCH_MAX_ITEMS 100
+
+typedef struct
+{
+        gint64 time; /* Seconds since epoch */
+        char *json;
+} JournalItem;
+
+struct _GClueSubmissionJournalPrivate
+{
+        GQueue *items; /* Oldest first */
+
+        SoupSession *soup_session;
+        SoupMessage *query;
+        guint n_submitting; /* Items at the head of the queue in query */
+        guint submit_timeout_id; /* For when the oldest item is due */
+
+        gulong connectivity_changed_id;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueSubmissionJournal,
+                         gclue_submission_journal,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueSubmissionJournal))
+
+static void
+journal_item_free (JournalItem *item)
+{
+        g_free (item->json);
+        g_slice_free (JournalItem, item);
+}
+
+static gint64
+get_now (void)
+{
+        return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static void
+append_item_line (GString *str, JournalItem *item)
+{
+        g_string_append_printf (str,
+                                "%" G_GINT64_FORMAT " %s\n",
+                                item->time,
+                                item->json);
+}
+
+static void
+save_journal (GClueSubmissionJournal *journal)
+{
+        GString *str;
+        GList *l;
+
+        str = g_string_new (NULL);
+        for (l = journal->priv->items->head; l != NULL; l = l->next)
+                append_item_line (str, l->data);
+
+        gclue_cache_file_save_contents (JOURNAL_FILE_NAME, str->str, str->len);
+        g_string_free (str, TRUE);
+}
+
+/* Returns TRUE if items were dropped */
+static gboolean
+drop_old_items (GClueSubmissionJournal *journal)
+{
+        GQueue *items = journal->priv->items;
+        gint64 now = get_now ();
+        gboolean dropped = FALSE;
+
+        /* Never drop what's being submitted, it's dropped once done anyway */
+        while (g_queue_get_length (items) > journal->priv->n_submitting) {
+                JournalItem *item = g_queue_peek_nth (items,
+                                                      journal->priv->n_submitting);
+
+                if (g_queue_get_length (items) <= JOURNAL_MAX_ITEMS &&
+                    now - item->time <= JOURNAL_MAX_AGE)
+                        break;
+
+                g_queue_pop_nth (items, journal->priv->n_submitting);
+                journal_item_free (item);
+                dropped = TRUE;
+        }
+
+        return dropped;
+}
+
+static void
+load_journal (GClueSubmissionJournal *journal)
+{
+        char *contents, *line, *next;
+        gsize length;
+
+        contents = gclue_cache_file_load_contents (JOURNAL_FILE_NAME, &length);
+        if (contents == NULL)
+                return;
+
+        for (line = contents; *line != '\0'; line = next) {
+                JournalItem *item;
+                char *end;
+                gint64 time;
+
+                next = strchr (line, '\n');
+                if (next == NULL)
+                        break; /* Incomplete last line, lost on write */
+                *next++ = '\0';
+
+                time = g_ascii_strtoll (line, &end, 10);
+                if (end == line || *end != ' ' || end[1] == '\0')
+                        continue;
+
+                item = g_slice_new (JournalItem);
+                item->time = time;
+                item->json = g_strdup (end + 1);
+                g_queue_push_tail (journal->priv->items, item);
+        }
+        g_free (contents);
+
+        /* Rewritten in any case, for journals from before it was private
+         * to keep our appends from leaving it readable to all */
+        drop_old_items (journal);
+        save_journal (journal);
+        g_debug ("Loaded %u pending submissions",
+                 g_queue_get_length (journal->priv->items));
+}
+
+static gboolean
+get_internet_available (void)
+{
+        GNetworkMonitor *monitor = g_network_monitor_get_default ();
+
+        return (g_network_monitor_get_connectivity (monitor) ==
+                G_NETWORK_CONNECTIVITY_FULL);
+}
+
+static char *
+compress (const char *data,
+          gsize       length,
+          gsize      *compressed_length,
+          GError    **error)
+{
+        GConverter *compressor;
+        GByteArray *out;
+        GConverterResult result;
+        gsize in_pos = 0;
+
+        compressor = G_CONVERTER (g_zlib_compressor_new
+                                        (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+        out = g_byte_array_sized_new (length / 4 + 64);
+
+        do {
+                guint8 buf[4096];
+                gsize bytes_read, bytes_written;
+
+                result = g_converter_convert (compressor,
+                                              data + in_pos,
+                                              length - in_pos,
+                                              buf,
+                                              sizeof (buf),
+                                              G_CONVERTER_INPUT_AT_END,
+                                              &bytes_read,
+                                              &bytes_written,
+                                              error);
+                if (result == G_CONVERTER_ERROR) {
+                        g_byte_array_free (out, TRUE);
+                        g_object_unref (compressor);
+
+                        return NULL;
+                }
+
+                in_pos += bytes_read;
+                g_byte_array_append (out, buf, bytes_written);
+        } while (result != G_CONVERTER_FINISHED);
+
+        g_object_unref (compressor);
+        *compressed_length = out->len;
+
+        return (char *) g_byte_array_free (out, FALSE);
+}
+
+static void
+submit (GClueSubmissionJournal *journal,
+        gboolean                force);
+
+static gboolean
+on_submit_timeout (gpointer user_data);
+
+/* Makes sure items don't wait past BATCH_MAX_DELAY for more to come */
+static void
+schedule_submit (GClueSubmissionJournal *journal)
+{
+        GClueSubmissionJournalPrivate *priv = journal->priv;
+        JournalItem *oldest;
+        gint64 delay;
+
+        if (priv->submit_timeout_id != 0) {
+                g_source_remove (priv->submit_timeout_id);
+                priv->submit_timeout_id = 0;
+        }
+
+        if (priv->query != NULL || g_queue_is_empty (priv->items))
+                return; /* Rescheduled once the query is done */
+
+        oldest = g_queue_peek_head (priv->items);
+        delay = oldest->time + BATCH_MAX_DELAY - get_now ();
+        if (delay <= 0)
+                /* Due already but offline or failing, try again later */
+                delay = BATCH_MAX_DELAY;
+
+        priv->submit_timeout_id = g_timeout_add_seconds (delay,
+                                                         on_submit_timeout,
+                                                         journal);
+}
+
+static gboolean
+on_submit_timeout (gpointer user_data)
+{
+        GClueSubmissionJournal *journal = GCLUE_SUBMISSION_JOURNAL (user_data);
+
+        journal->priv->submit_timeout_id = 0;
+        submit (journal, FALSE);
+        schedule_submit (journal);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+submit_callback (SoupSession *session,
+                 SoupMessage *query,
+                 gpointer     user_data)
+{
+        GClueSubmissionJournal *journal;
+        GClueSubmissionJournalPrivate *priv;
+        gboolean done;
+        guint i;
+
+        if (query->status_code == SOUP_STATUS_CANCELLED)
+                return;
+
+        journal = GCLUE_SUBMISSION_JOURNAL (user_data);
+        priv = journal->priv;
+        priv->query = NULL;
+
+        /* The server won't take a batch it rejected any better next time */
+        done = SOUP_STATUS_IS_SUCCESSFUL (query->status_code) ||
+               (SOUP_STATUS_IS_CLIENT_ERROR (query->status_code) &&
+                query->status_code != SOUP_STATUS_REQUEST_TIMEOUT &&
+                query->status_code != 429 /* Too Many Requests */);
+        if (!done) {
+                g_warning ("Failed to submit location data: %s",
+                           query->reason_phrase);
+                priv->n_submitting = 0;
+                schedule_submit (journal);
+
+                return;
+        }
+
+        if (SOUP_STATUS_IS_SUCCESSFUL (query->status_code))
+                g_debug ("Successfully submitted %u items of location data",
+                         priv->n_submitting);
+        else
+                g_warning ("Location data rejected, dropping %u items: %s",
+                           priv->n_submitting,
+                           query->reason_phrase);
+
+        for (i = 0; i < priv->n_submitting; i++)
+                journal_item_free (g_queue_pop_head (priv->items));
+        priv->n_submitting = 0;
+        save_journal (journal);
+
+        /* Drain whatever is left while we are at it */
+        submit (journal, TRUE);
+        schedule_submit (journal);
+}
+
+/* Submits the oldest items in a single request, unless @force is FALSE and
+ * too few items have been waiting for too short a time to bother yet */
+static void
+submit (GClueSubmissionJournal *journal,
+        gboolean                force)
+{
+        GClueSubmissionJournalPrivate *priv = journal->priv;
+        GClueConfig *config = gclue_config_get_singleton ();
+        JournalItem *oldest;
+        GString *body;
+        GError *error = NULL;
+        const char *url, *nick;
+        char *data;
+        gsize data_len;
+        GList *l;
+
+        if (priv->query != NULL || g_queue_is_empty (priv->items))
+                return;
+
+        oldest = g_queue_peek_head (priv->items);
+        if (!force &&
+            g_queue_get_length (priv->items) < BATCH_MIN_ITEMS &&
+            get_now () - oldest->time < BATCH_MAX_DELAY)
+                return;
+
+        if (!gclue_config_get_wifi_submit_data (config) ||
+            !get_internet_available ())
+                return;
+
+        body = g_string_new ("{\"items\":[");
+        for (l = priv->items->head;
+             l != NULL && priv->n_submitting < BATCH_MAX_ITEMS;
+             l = l->next) {
+                JournalItem *item = l->data;
+
+                if (priv->n_submitting++ > 0)
+                        g_string_append_c (body, ',');
+                g_string_append (body, item->json);
+        }
+        g_string_append (body, "]}");
+
+        data = compress (body->str, body->len, &data_len, &error);
+        g_string_free (body, TRUE);
+        if (data == NULL) {
+                g_warning ("Failed to compress location data: %s",
+                           error->message);
+                g_error_free (error);
+                priv->n_submitting = 0;
+
+                return;
+        }
+
+        url = gclue_config_get_wifi_submit_url (config);
+        nick = gclue_config_get_wifi_submit_nick (config);
+        priv->query = soup_message_new ("POST", url);
+        if (priv->query == NULL) {
+                g_warning ("Invalid submission URL '%s'", url);
+                g_free (data);
+                priv->n_submitting = 0;
+
+                return;
+        }
+        if (nick != NULL && nick[0] != '\0')
+                soup_message_headers_append (priv->query->request_headers,
+                                             "X-Nickname",
+                                             nick);
+        soup_message_headers_append (priv->query->request_headers,
+                                     "Content-Encoding",
+                                     "gzip");
+        soup_message_set_request (priv->query,
+                                  "application/json",
+                                  SOUP_MEMORY_TAKE,
+                                  data,
+                                  data_len);
+        g_debug ("Submitting %u items of location data to '%s'",
+                 priv->n_submitting,
+                 url);
+
+        soup_session_queue_message (priv->soup_session,
+                                    priv->query,
+                                    submit_callback,
+                                    journal);
+}
+
+static void
+on_connectivity_changed (GObject    *gobject,
+                         GParamSpec *pspec,
+                         gpointer    user_data)
+{
+        GClueSubmissionJournal *journal = GCLUE_SUBMISSION_JOURNAL (user_data);
+
+        /* Submit everything we gathered while offline */
+        submit (journal, TRUE);
+        schedule_submit (journal);
+}
+
+static void
+gclue_submission_journal_finalize (GObject *object)
+{
+        GClueSubmissionJournalPrivate *priv =
+                GCLUE_SUBMISSION_JOURNAL (object)->priv;
+
+        if (priv->connectivity_changed_id != 0) {
+                g_signal_handler_disconnect (g_network_monitor_get_default (),
+                                             priv->connectivity_changed_id);
+                priv->connectivity_changed_id = 0;
+        }
+        if (priv->submit_timeout_id != 0) {
+                g_source_remove (priv->submit_timeout_id);
+                priv->submit_timeout_id = 0;
+        }
+
+        /* Items being submitted are still in the journal, so nothing is
+         * lost if the request doesn't complete */
+        if (priv->query != NULL) {
+                soup_session_cancel_message (priv->soup_session,
+                                             priv->query,
+                                             SOUP_STATUS_CANCELLED);
+                priv->query = NULL;
+        }
+
+        g_clear_object (&priv->soup_session);
+        g_queue_free_full (priv->items, (GDestroyNotify) journal_item_free);
+
+        G_OBJECT_CLASS (gclue_submission_journal_parent_class)->finalize (object);
+}
+
+static void
+gclue_submission_journal_class_init (GClueSubmissionJournalClass *klass)
+{
+        GObjectClass *object_class;
+
+        object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gclue_submission_journal_finalize;
+}
+
+static void
+gclue_submission_journal_init (GClueSubmissionJournal *journal)
+{
+        GClueSubmissionJournalPrivate *priv;
+
+        journal->priv = G_TYPE_INSTANCE_GET_PRIVATE
+                                (journal,
+                                 GCLUE_TYPE_SUBMISSION_JOURNAL,
+                                 GClueSubmissionJournalPrivate);
+        priv = journal->priv;
+
+        priv->items = g_queue_new ();
+        priv->soup_session = soup_session_new_with_options
+                        (SOUP_SESSION_REMOVE_FEATURE_BY_TYPE,
+                         SOUP_TYPE_PROXY_RESOLVER_DEFAULT,
+                         NULL);
+        priv->connectivity_changed_id =
+                g_signal_connect (g_network_monitor_get_default (),
+                                  "notify::connectivity",
+                                  G_CALLBACK (on_connectivity_changed),
+                                  journal);
+
+        load_journal (journal);
+        schedule_submit (journal);
+}
+
+static void
+on_journal_destroyed (gpointer data,
+                      GObject *where_the_object_was)
+{
+        GClueSubmissionJournal **journal = (GClueSubmissionJournal **) data;
+
+        *journal = NULL;
+}
+
+/**
+ * gclue_submission_journal_get_singleton:
+ *
+ * Get the #GClueSubmissionJournal singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClueSubmissionJournal. Use
+ * g_object_unref() when done.
+ **/
+GClueSubmissionJournal *
+gclue_submission_journal_get_singleton (void)
+{
+        static GClueSubmissionJournal *journal = NULL;
+
+        if (journal == NULL) {
+                journal = g_object_new (GCLUE_TYPE_SUBMISSION_JOURNAL, NULL);
+                g_object_weak_ref (G_OBJECT (journal),
+                                   on_journal_destroyed,
+                                   &journal);
+        } else
+                g_object_ref (journal);
+
+        return journal;
+}
+
+/**
+ * gclue_submission_journal_add:
+ * @journal: a #GClueSubmissionJournal
+ * @item: JSON object of a single submission item, without newlines
+ *
+ * Queues @item for submission. It is written to disk right away and sent
+ * with the next batch.
+ **/
+void
+gclue_submission_journal_add (GClueSubmissionJournal *journal,
+                              const char             *item)
+{
+        GClueSubmissionJournalPrivate *priv;
+        JournalItem *journal_item;
+        GString *line;
+
+        g_return_if_fail (GCLUE_IS_SUBMISSION_JOURNAL (journal));
+        g_return_if_fail (item != NULL && strchr (item, '\n') == NULL);
+
+        priv = journal->priv;
+        journal_item = g_slice_new (JournalItem);
+        journal_item->time = get_now ();
+        journal_item->json = g_strdup (item);
+        g_queue_push_tail (priv->items, journal_item);
+
+        if (drop_old_items (journal)) {
+                save_journal (journal);
+        } else {
+                line = g_string_new (NULL);
+                append_item_line (line, journal_item);
+                gclue_cache_file_append (JOURNAL_FILE_NAME,
+                                         line->str,
+                                         line->len);
+                g_string_free (line, TRUE);
+        }
+
+        submit (journal, FALSE);
+        if (priv->submit_timeout_id == 0 || priv->query != NULL)
+                schedule_submit (journal);
+}
@@ -0,0 +1,60 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_SUBMISSION_JOURNAL_H
+#define GCLUE_SUBMISSION_JOURNAL_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_SUBMISSION_JOURNAL            (gclue_submission_journal_get_type())
+#define GCLUE_SUBMISSION_JOURNAL(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_SUBMISSION_JOURNAL, GClueSubmissionJournal))
+#define GCLUE_SUBMISSION_JOURNAL_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_SUBMISSION_JOURNAL, GClueSubmissionJournal const))
+#define GCLUE_SUBMISSION_JOURNAL_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_SUBMISSION_JOURNAL, GClueSubmissionJournalClass))
+#define GCLUE_IS_SUBMISSION_JOURNAL(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_SUBMISSION_JOURNAL))
+#define GCLUE_IS_SUBMISSION_JOURNAL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_SUBMISSION_JOURNAL))
+#define GCLUE_SUBMISSION_JOURNAL_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_SUBMISSION_JOURNAL, GClueSubmissionJournalClass))
+
+typedef struct _GClueSubmissionJournal        GClueSubmissionJournal;
+typedef struct _GClueSubmissionJournalClass   GClueSubmissionJournalClass;
+typedef struct _GClueSubmissionJournalPrivate GClueSubmissionJournalPrivate;
+
+struct _GClueSubmissionJournal
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueSubmissionJournalPrivate *priv;
+};
+
+struct _GClueSubmissionJournalClass
+{
+        GObjectClass parent_class;
+};
+
+GType                    gclue_submission_journal_get_type      (void) G_GNUC_CONST;
+
+GClueSubmissionJournal * gclue_submission_journal_get_singleton (void);
+void                     gclue_submission_journal_add           (GClueSubmissionJournal *journal,
+                                                                 const char             *item);
+
+G_END_DECLS
+
+#endif /* GCLUE_SUBMISSION_JOURNAL_H */
@@ -22,11 +22,12 @@
 #include <stdlib.h>
 #include <glib.h>
 #include <libsoup/soup.h>
-#include <json-glib/json-glib.h>
 #include <string.h>
 #include "gclue-web-source.h"
 #include "gclue-error.h"
 #include "gclue-location.h"
+#include "gclue-submission-journal.h"
+#include "gclue-config.h"
 
 /**
  * SECTION:gclue-web-source
@@ -38,16 +39,80 @@
 
 static gboolean
 gclue_web_source_start (GClueLocationSource *source);
+static void
+refresh_location (GClueWebSource *web);
+static void
+refresh_accuracy_level (GClueWebSource *web);
+
+/* Minimum time between the starts of two queries */
+#define MIN_QUERY_INTERVAL 10 /* seconds */
+
+/* Failed queries are retried after BACKOFF_INITIAL, doubling with each
+ * consecutive failure up to BACKOFF_MAX. After BREAKER_THRESHOLD consecutive
+ * failures the endpoint is considered down: its sources report no available
+ * accuracy until the backoff delay has passed, and the next query then
+ * decides whether it is back up. */
+#define BACKOFF_INITIAL   15      /* seconds */
+#define BACKOFF_MAX       (30 * 60) /* seconds */
+#define BREAKER_THRESHOLD 4
+
+/* A query that the provider hasn't answered by the 95th percentile of its
+ * recent response times is sent to the next provider as well, and the first
+ * valid answer wins. Until enough responses have been timed,
+ * HEDGE_DEFAULT_DELAY is used instead. */
+#define LATENCY_SAMPLES      32
+#define LATENCY_MIN_SAMPLES  8
+#define HEDGE_PERCENTILE     95
+#define HEDGE_DEFAULT_DELAY  3000  /* milliseconds */
+#define HEDGE_MIN_DELAY      250   /* milliseconds */
+#define HEDGE_MAX_DELAY      10000 /* milliseconds */
+
+/* Backoff state shared by all sources querying the same host */
+typedef struct {
+        char *host;
+        GList *sources; /* GClueWebSource */
+
+        guint n_failures; /* Consecutive */
+        gint64 retry_time; /* Monotonic, in microseconds */
+        gboolean breaker_open;
+        guint breaker_timeout_id;
+
+        gint64 latencies[LATENCY_SAMPLES]; /* Ring, in microseconds */
+        guint n_latencies; /* Ever recorded */
+} Endpoint;
+
+static GHashTable *endpoints = NULL;
+
+/* A configured geolocation service */
+typedef struct {
+        SoupURI *uri;
+        Endpoint *endpoint;
+} Provider;
 
 struct _GClueWebSourcePrivate {
         SoupSession *soup_session;
 
+        GPtrArray *providers; /* Provider, in order of preference */
+
+        /* The query, and its copy to the next provider if hedged */
+        SoupMessage *sent_query; /* Ref, until neither is in flight */
         SoupMessage *query;
+        Provider *query_provider;
+        gint64 query_start; /* Monotonic, in microseconds */
+        SoupMessage *hedge_query;
+        Provider *hedge_provider;
+        gint64 hedge_start;
+        guint hedge_timeout_id;
+
+        gboolean query_dirty; /* Inputs changed while query was in flight */
+        gint64 last_query_time; /* Monotonic, in microseconds */
+        guint query_timeout_id;
 
         gulong network_changed_id;
         gulong connectivity_changed_id;
 
         guint64 last_submitted;
+        GClueSubmissionJournal *journal;
 
         gboolean internet_available;
 };
@@ -57,50 +122,391 @@ G_DEFINE_ABSTRACT_TYPE_WITH_CODE (GClueWebSource,
                                   GCLUE_TYPE_LOCATION_SOURCE,
                                   G_ADD_PRIVATE (GClueWebSource))
 
+static void
+endpoint_free (Endpoint *endpoint)
+{
+        if (endpoint->breaker_timeout_id != 0)
+                g_source_remove (endpoint->breaker_timeout_id);
+        g_free (endpoint->host);
+        g_slice_free (Endpoint, endpoint);
+}
+
+static Endpoint *
+attach_endpoint (GClueWebSource *web,
+                 const char     *host)
+{
+        Endpoint *endpoint;
+
+        if (host == NULL)
+                host = "";
+
+        if (endpoints == NULL)
+                endpoints = g_hash_table_new (g_str_hash, g_str_equal);
+
+        endpoint = g_hash_table_lookup (endpoints, host);
+        if (endpoint == NULL) {
+                endpoint = g_slice_new0 (Endpoint);
+                endpoint->host = g_strdup (host);
+                g_hash_table_insert (endpoints, endpoint->host, endpoint);
+        }
+
+        /* Providers may share a host */
+        if (g_list_find (endpoint->sources, web) == NULL)
+                endpoint->sources = g_list_prepend (endpoint->sources, web);
+
+        return endpoint;
+}
+
+static void
+detach_endpoint (GClueWebSource *web,
+                 Endpoint       *endpoint)
+{
+        endpoint->sources = g_list_remove (endpoint->sources, web);
+        if (endpoint->sources == NULL) {
+                g_hash_table_remove (endpoints, endpoint->host);
+                endpoint_free (endpoint);
+        }
+}
+
+static void
+refresh_endpoint_sources (Endpoint *endpoint)
+{
+        GList *l, *sources;
+
+        sources = g_list_copy (endpoint->sources);
+        for (l = sources; l != NULL; l = l->next) {
+                refresh_accuracy_level (l->data);
+                refresh_location (l->data);
+        }
+        g_list_free (sources);
+}
+
+static gboolean
+on_breaker_timeout (gpointer user_data)
+{
+        Endpoint *endpoint = user_data;
+
+        /* Let the next query find out if it's back */
+        g_debug ("Retrying '%s'", endpoint->host);
+        endpoint->breaker_timeout_id = 0;
+        endpoint->breaker_open = FALSE;
+        refresh_endpoint_sources (endpoint);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+endpoint_failed (Endpoint *endpoint)
+{
+        guint delay;
+
+        endpoint->n_failures++;
+        delay = BACKOFF_INITIAL << MIN (endpoint->n_failures - 1, 16);
+        delay = MIN (delay, BACKOFF_MAX);
+        /* Spread out the retries of clients of a server that just failed */
+        delay = g_random_int_range (delay / 2, delay + 1);
+        endpoint->retry_time = g_get_monotonic_time () +
+                               (gint64) delay * G_USEC_PER_SEC;
+
+        if (endpoint->n_failures < BREAKER_THRESHOLD ||
+            endpoint->breaker_open)
+                return;
+
+        g_warning ("'%s' failed %u times in a row, not using it for %u seconds",
+                   endpoint->host,
+                   endpoint->n_failures,
+                   delay);
+        endpoint->breaker_open = TRUE;
+        endpoint->breaker_timeout_id = g_timeout_add_seconds (delay,
+                                                              on_breaker_timeout,
+                                                              endpoint);
+        refresh_endpoint_sources (endpoint);
+}
+
+static void
+endpoint_succeeded (Endpoint *endpoint)
+{
+        if (endpoint->n_failures >= BREAKER_THRESHOLD)
+                g_debug ("'%s' is back", endpoint->host);
+
+        endpoint->n_failures = 0;
+        endpoint->retry_time = 0;
+}
+
+static void
+endpoint_add_latency (Endpoint *endpoint,
+                      gint64    latency)
+{
+        endpoint->latencies[endpoint->n_latencies % LATENCY_SAMPLES] = latency;
+        endpoint->n_latencies++;
+}
+
+static gint
+compare_latencies (gconstpointer a,
+                   gconstpointer b)
+{
+        gint64 latency_a = *(const gint64 *) a;
+        gint64 latency_b = *(const gint64 *) b;
+
+        return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+/* In milliseconds */
+static guint
+endpoint_get_hedge_delay (Endpoint *endpoint)
+{
+        gint64 latencies[LATENCY_SAMPLES];
+        guint n, delay;
+
+        n = MIN (endpoint->n_latencies, LATENCY_SAMPLES);
+        if (n < LATENCY_MIN_SAMPLES)
+                return HEDGE_DEFAULT_DELAY;
+
+        memcpy (latencies, endpoint->latencies, n * sizeof (gint64));
+        qsort (latencies, n, sizeof (gint64), compare_latencies);
+        delay = latencies[(n * HEDGE_PERCENTILE + 99) / 100 - 1] / 1000;
+
+        return CLAMP (delay, HEDGE_MIN_DELAY, HEDGE_MAX_DELAY);
+}
+
+static void
+provider_free (Provider *provider)
+{
+        soup_uri_free (provider->uri);
+        g_slice_free (Provider, provider);
+}
+
+/* Whether @provider can be queried right now */
+static gboolean
+provider_is_ready (Provider *provider,
+                   gint64    now)
+{
+        return !provider->endpoint->breaker_open &&
+               provider->endpoint->retry_time <= now;
+}
+
+/* The most preferred provider after @after that can be queried right now */
+static Provider *
+get_ready_provider (GClueWebSource *web,
+                    Provider       *after)
+{
+        GPtrArray *providers = web->priv->providers;
+        gint64 now = g_get_monotonic_time ();
+        guint i = 0;
+
+        if (after != NULL) {
+                while (g_ptr_array_index (providers, i) != after)
+                        i++;
+                i++;
+        }
+
+        for (; i < providers->len; i++) {
+                Provider *provider = g_ptr_array_index (providers, i);
+
+                if (provider_is_ready (provider, now))
+                        return provider;
+        }
+
+        return NULL;
+}
+
+static void
+load_providers (GClueWebSource *web)
+{
+        GClueConfig *config = gclue_config_get_singleton ();
+        const char *const *urls;
+        guint i;
+
+        web->priv->providers = g_ptr_array_new_with_free_func
+                        ((GDestroyNotify) provider_free);
+
+        urls = gclue_config_get_wifi_urls (config);
+        for (i = 0; urls[i] != NULL; i++) {
+                Provider *provider;
+                SoupURI *uri;
+
+                uri = soup_uri_new (urls[i]);
+                if (uri == NULL) {
+                        g_warning ("Ignoring invalid URL '%s'", urls[i]);
+                        continue;
+                }
+
+                provider = g_slice_new0 (Provider);
+                provider->uri = uri;
+                provider->endpoint = attach_endpoint (web,
+                                                      soup_uri_get_host (uri));
+                g_ptr_array_add (web->priv->providers, provider);
+        }
+}
+
+static void
+unload_providers (GClueWebSource *web)
+{
+        GPtrArray *providers = web->priv->providers;
+        guint i;
+
+        if (providers == NULL)
+                return;
+
+        for (i = 0; i < providers->len; i++) {
+                Endpoint *endpoint;
+                guint j;
+
+                endpoint = ((Provider *) g_ptr_array_index (providers, i))->endpoint;
+                for (j = 0; j < i; j++)
+                        if (((Provider *) g_ptr_array_index (providers, j))->endpoint == endpoint)
+                                break;
+                if (j == i) /* Not detached along with an earlier provider */
+                        detach_endpoint (web, endpoint);
+        }
+        g_clear_pointer (&web->priv->providers, g_ptr_array_unref);
+}
+
+/* Whether the status tells anything about the health of the endpoint. A
+ * client error such as Mozilla Location Service's 404 for unknown networks
+ * means it's up and running. */
+static gboolean
+is_endpoint_failure (guint status_code)
+{
+        return SOUP_STATUS_IS_TRANSPORT_ERROR (status_code) ||
+               SOUP_STATUS_IS_SERVER_ERROR (status_code) ||
+               status_code == 429; /* Too Many Requests */
+}
+
+static void
+send_hedge (GClueWebSource *web);
+
+/* Calls off the queries still in flight, if any, e.g. once the other
+ * answered */
+static void
+end_race (GClueWebSource *web)
+{
+        GClueWebSourcePrivate *priv = web->priv;
+        SoupMessage *query, *hedge_query;
+
+        if (priv->hedge_timeout_id != 0) {
+                g_source_remove (priv->hedge_timeout_id);
+                priv->hedge_timeout_id = 0;
+        }
+
+        query = priv->query;
+        hedge_query = priv->hedge_query;
+        priv->query = priv->hedge_query = NULL;
+        if (query != NULL)
+                soup_session_cancel_message (priv->soup_session,
+                                             query,
+                                             SOUP_STATUS_CANCELLED);
+        if (hedge_query != NULL)
+                soup_session_cancel_message (priv->soup_session,
+                                             hedge_query,
+                                             SOUP_STATUS_CANCELLED);
+}
+
 static void
 query_callback (SoupSession *session,
                 SoupMessage *query,
                 gpointer     user_data)
 {
         GClueWebSource *web;
+        GClueWebSourcePrivate *priv;
         GError *error = NULL;
-        char *contents;
+        SoupMessageBody *body;
         char *str;
-        GClueLocation *location;
+        GClueLocation *location = NULL;
         SoupURI *uri;
+        Provider *provider;
+        gint64 start;
+        gboolean failed;
 
         if (query->status_code == SOUP_STATUS_CANCELLED)
                 return;
 
         web = GCLUE_WEB_SOURCE (user_data);
-        web->priv->query = NULL;
+        priv = web->priv;
+        if (query == priv->query) {
+                provider = priv->query_provider;
+                start = priv->query_start;
+                priv->query = NULL;
+        } else {
+                provider = priv->hedge_provider;
+                start = priv->hedge_start;
+                priv->hedge_query = NULL;
+        }
+        uri = soup_message_get_uri (query);
+
+        failed = is_endpoint_failure (query->status_code);
+        if (failed) {
+                g_warning ("Failed to query location from '%s': %s",
+                           uri->host,
+                           query->reason_phrase);
+                endpoint_failed (provider->endpoint);
+                goto no_location;
+        }
+        endpoint_succeeded (provider->endpoint);
+        endpoint_add_latency (provider->endpoint,
+                              g_get_monotonic_time () - start);
 
         if (query->status_code != SOUP_STATUS_OK) {
-                g_warning ("Failed to query location: %s", query->reason_phrase);
-		return;
-	}
+                g_warning ("Failed to query location from '%s': %s",
+                           uri->host,
+                           query->reason_phrase);
+                goto no_location;
+        }
 
-        contents = g_strndup (query->response_body->data, query->response_body->length);
-        uri = soup_message_get_uri (query);
+        /* Parsed in place, the body is neither copied nor nul-terminated */
+        body = query->response_body;
         str = soup_uri_to_string (uri, FALSE);
-        g_debug ("Got following response from '%s':\n%s",
+        g_debug ("Got following response from '%s':\n%.*s",
                  str,
-                 contents);
+                 (int) body->length,
+                 body->data);
         g_free (str);
         location = GCLUE_WEB_SOURCE_GET_CLASS (web)->parse_response (web,
-                                                                     contents,
+                                                                     body->data,
+                                                                     body->length,
                                                                      &error);
-        g_free (contents);
-        if (error != NULL) {
-                g_warning ("Failed to parse following response: %s\n%s",
-                           error->message,
-                           contents);
-                return;
+        if (location == NULL) {
+                g_warning ("Failed to parse following response: %s\n%.*s",
+                           error != NULL ? error->message : "Unknown error",
+                           (int) body->length,
+                           body->data);
+                g_clear_error (&error);
+                goto no_location;
         }
 
+        end_race (web);
         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (web),
                                             location);
         g_object_unref (location);
+        goto out;
+
+no_location:
+        /* The other provider may still come up with an answer */
+        if (priv->query != NULL || priv->hedge_query != NULL)
+                return;
+
+        /* Don't wait for the hedging deadline to ask the next provider */
+        if (priv->hedge_timeout_id != 0) {
+                g_source_remove (priv->hedge_timeout_id);
+                priv->hedge_timeout_id = 0;
+
+                send_hedge (web);
+                if (priv->hedge_query != NULL)
+                        return;
+        }
+
+        /* Try again once the backoff delay has passed */
+        if (failed)
+                priv->query_dirty = TRUE;
+
+out:
+        g_clear_object (&priv->sent_query);
+
+        /* Whatever changed while we were waiting hasn't been queried yet */
+        if (priv->query_dirty) {
+                priv->query_dirty = FALSE;
+                refresh_location (web);
+        }
 }
 
 static gboolean
@@ -115,6 +521,45 @@ get_internet_available (void)
         return available;
 }
 
+/* Whether we can make queries, as far as we know */
+static gboolean
+get_web_available (GClueWebSource *web)
+{
+        GPtrArray *providers = web->priv->providers;
+        guint i;
+
+        if (!web->priv->internet_available)
+                return FALSE;
+
+        for (i = 0; i < providers->len; i++) {
+                Provider *provider = g_ptr_array_index (providers, i);
+
+                if (!provider->endpoint->breaker_open)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+/* When the earliest provider that isn't down can be queried again */
+static gint64
+get_retry_time (GClueWebSource *web)
+{
+        GPtrArray *providers = web->priv->providers;
+        gint64 retry_time = G_MAXINT64;
+        guint i;
+
+        for (i = 0; i < providers->len; i++) {
+                Provider *provider = g_ptr_array_index (providers, i);
+
+                if (!provider->endpoint->breaker_open)
+                        retry_time = MIN (retry_time,
+                                          provider->endpoint->retry_time);
+        }
+
+        return retry_time;
+}
+
 static void
 refresh_accuracy_level (GClueWebSource *web)
 {
@@ -123,7 +568,7 @@ refresh_accuracy_level (GClueWebSource *web)
         existing = gclue_location_source_get_available_accuracy_level
                         (GCLUE_LOCATION_SOURCE (web));
         new = GCLUE_WEB_SOURCE_GET_CLASS (web)->get_available_accuracy_level
-                        (web, web->priv->internet_available);
+                        (web, get_web_available (web));
         if (new != existing) {
                 g_debug ("Available accuracy level from %s: %u",
                          G_OBJECT_TYPE_NAME (web), new);
@@ -133,47 +578,219 @@ refresh_accuracy_level (GClueWebSource *web)
         }
 }
 
+/* Returns TRUE if subclass could provide the location without a query */
+static gboolean
+set_cached_location (GClueWebSource *web)
+{
+        GClueLocation *location;
+
+        /* Not implemented by subclass */
+        if (GCLUE_WEB_SOURCE_GET_CLASS (web)->get_cached_location == NULL)
+                return FALSE;
+
+        location = GCLUE_WEB_SOURCE_GET_CLASS (web)->get_cached_location (web);
+        if (location == NULL)
+                return FALSE;
+
+        g_debug ("Using cached location for %s", G_OBJECT_TYPE_NAME (web));
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (web),
+                                            location);
+        g_object_unref (location);
+
+        return TRUE;
+}
+
 static void
-on_network_changed (GNetworkMonitor *monitor G_GNUC_UNUSED,
-                    gboolean         available G_GNUC_UNUSED,
-                    gpointer         user_data)
+copy_header (const char *name,
+             const char *value,
+             gpointer    user_data)
+{
+        soup_message_headers_append ((SoupMessageHeaders *) user_data,
+                                     name,
+                                     value);
+}
+
+/* The copy is answered for the network data of the sent query, which the
+ * subclass only knows about as long as the sent query is around: we hold on
+ * to it until the race is over, whichever query wins. */
+static void
+send_hedge (GClueWebSource *web)
+{
+        GClueWebSourcePrivate *priv = web->priv;
+        SoupMessage *query = priv->sent_query;
+        Provider *provider;
+        SoupBuffer *body;
+
+        provider = get_ready_provider (web, priv->query_provider);
+        if (provider == NULL || query == NULL)
+                return;
+
+        g_debug ("No answer from '%s', asking '%s'",
+                 priv->query_provider->uri->host,
+                 provider->uri->host);
+        priv->hedge_query = soup_message_new_from_uri (query->method,
+                                                       provider->uri);
+        soup_message_headers_foreach (query->request_headers,
+                                      copy_header,
+                                      priv->hedge_query->request_headers);
+        body = soup_message_body_flatten (query->request_body);
+        soup_message_body_append_buffer (priv->hedge_query->request_body,
+                                         body);
+        soup_buffer_free (body);
+
+        priv->hedge_provider = provider;
+        priv->hedge_start = g_get_monotonic_time ();
+        soup_session_queue_message (priv->soup_session,
+                                    priv->hedge_query,
+                                    query_callback,
+                                    web);
+}
+
+static gboolean
+on_hedge_timeout (gpointer user_data)
 {
         GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
-        GError *error = NULL;
-        gboolean last_available = web->priv->internet_available;
 
-        web->priv->internet_available = get_internet_available ();
-        if (last_available == web->priv->internet_available)
-                return; /* We already reacted to network change */
+        web->priv->hedge_timeout_id = 0;
+        send_hedge (web);
 
-        refresh_accuracy_level (web);
+        return G_SOURCE_REMOVE;
+}
 
-        if (!gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (user_data)))
-                return;
+static void
+schedule_query (GClueWebSource *web);
 
-        if (!web->priv->internet_available) {
-                g_debug ("Network unavailable");
-                return;
-        }
-        g_debug ("Network available");
+static void
+send_query (GClueWebSource *web)
+{
+        GClueWebSourcePrivate *priv = web->priv;
+        Provider *provider;
+        GError *error = NULL;
 
-        if (web->priv->query != NULL)
+        provider = get_ready_provider (web, NULL);
+        if (provider == NULL) {
+                /* All backing off since the query was scheduled */
+                schedule_query (web);
                 return;
+        }
 
-        web->priv->query = GCLUE_WEB_SOURCE_GET_CLASS (web)->create_query
+        priv->query = GCLUE_WEB_SOURCE_GET_CLASS (web)->create_query
                                         (web,
                                          &error);
 
-        if (web->priv->query == NULL) {
-                g_warning ("Failed to create query: %s", error->message);
-                g_error_free (error);
+        if (priv->query == NULL) {
+                /* No error means nothing new to ask for: the inputs are
+                 * part of a query in flight already */
+                if (error != NULL) {
+                        g_warning ("Failed to create query: %s",
+                                   error->message);
+                        g_error_free (error);
+                }
                 return;
         }
 
-        soup_session_queue_message (web->priv->soup_session,
-                                    web->priv->query,
+        soup_message_set_uri (priv->query, provider->uri);
+        priv->sent_query = g_object_ref (priv->query);
+        priv->query_provider = provider;
+        priv->query_start = g_get_monotonic_time ();
+        priv->last_query_time = priv->query_start;
+        soup_session_queue_message (priv->soup_session,
+                                    priv->query,
                                     query_callback,
                                     web);
+
+        if (get_ready_provider (web, provider) != NULL)
+                priv->hedge_timeout_id = g_timeout_add
+                        (endpoint_get_hedge_delay (provider->endpoint),
+                         on_hedge_timeout,
+                         web);
+}
+
+static gboolean
+on_query_timeout (gpointer user_data)
+{
+        GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
+
+        web->priv->query_timeout_id = 0;
+        refresh_location (web);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Queries are never issued concurrently nor more often than once every
+ * MIN_QUERY_INTERVAL. A refresh requested in the meantime isn't dropped but
+ * coalesced with any others into a single query, created only once it can
+ * be sent so that it carries the newest inputs. */
+static void
+schedule_query (GClueWebSource *web)
+{
+        GClueWebSourcePrivate *priv = web->priv;
+        gint64 next_query_time;
+
+        if (priv->query_timeout_id != 0)
+                return;
+
+        if (priv->query != NULL || priv->hedge_query != NULL) {
+                priv->query_dirty = TRUE;
+                return;
+        }
+
+        next_query_time = 0;
+        if (priv->last_query_time != 0)
+                next_query_time = priv->last_query_time +
+                                  MIN_QUERY_INTERVAL * G_USEC_PER_SEC;
+        next_query_time = MAX (next_query_time, get_retry_time (web));
+        if (next_query_time == G_MAXINT64)
+                return; /* All down, until the breaker timeout */
+
+        if (next_query_time > g_get_monotonic_time ()) {
+                guint delay;
+
+                delay = (next_query_time - g_get_monotonic_time ()) / 1000;
+                priv->query_timeout_id = g_timeout_add (delay + 1,
+                                                        on_query_timeout,
+                                                        web);
+                return;
+        }
+
+        send_query (web);
+}
+
+static void
+refresh_location (GClueWebSource *web)
+{
+        if (!gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (web)))
+                return;
+
+        if (set_cached_location (web))
+                return;
+
+        if (!web->priv->internet_available) {
+                g_debug ("Network unavailable");
+                return;
+        }
+        g_debug ("Network available");
+
+        if (!get_web_available (web))
+                return; /* Until the breaker timeout */
+
+        schedule_query (web);
+}
+
+static void
+on_network_changed (GNetworkMonitor *monitor G_GNUC_UNUSED,
+                    gboolean         available G_GNUC_UNUSED,
+                    gpointer         user_data)
+{
+        GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
+        gboolean last_available = web->priv->internet_available;
+
+        web->priv->internet_available = get_internet_available ();
+        if (last_available == web->priv->internet_available)
+                return; /* We already reacted to network change */
+
+        refresh_accuracy_level (web);
+        refresh_location (web);
 }
 
 static void
@@ -201,15 +818,19 @@ gclue_web_source_finalize (GObject *gsource)
                 priv->connectivity_changed_id = 0;
         }
 
-        if (priv->query != NULL) {
-                g_debug ("Cancelling query");
-                soup_session_cancel_message (priv->soup_session,
-                                             priv->query,
-                                             SOUP_STATUS_CANCELLED);
-                priv->query = NULL;
+        if (priv->query_timeout_id != 0) {
+                g_source_remove (priv->query_timeout_id);
+                priv->query_timeout_id = 0;
         }
 
+        if (priv->query != NULL || priv->hedge_query != NULL)
+                g_debug ("Cancelling query");
+        end_race (GCLUE_WEB_SOURCE (gsource));
+        g_clear_object (&priv->sent_query);
+
         g_clear_object (&priv->soup_session);
+        g_clear_object (&priv->journal);
+        unload_providers (GCLUE_WEB_SOURCE (gsource));
 
         G_OBJECT_CLASS (gclue_web_source_parent_class)->finalize (gsource);
 }
@@ -222,6 +843,7 @@ gclue_web_source_constructed (GObject *object)
 
         G_OBJECT_CLASS (gclue_web_source_parent_class)->constructed (object);
 
+        load_providers (GCLUE_WEB_SOURCE (object));
         priv->soup_session = soup_session_new_with_options
                         (SOUP_SESSION_REMOVE_FEATURE_BY_TYPE,
                          SOUP_TYPE_PROXY_RESOLVER_DEFAULT,
@@ -274,10 +896,11 @@ gclue_web_source_refresh (GClueWebSource *source)
 {
         g_return_if_fail (GCLUE_IS_WEB_SOURCE (source));
 
-        /* Make sure ->internet_available is different from
-         * the real availability of internet access */
-        source->priv->internet_available = FALSE;
-        on_network_changed (NULL, TRUE, source);
+        /* Unlike a network change, a refresh must go ahead even when we are
+         * offline, since subclasses may be able to resolve it locally. */
+        source->priv->internet_available = get_internet_available ();
+        refresh_accuracy_level (source);
+        refresh_location (source);
 }
 
 static gboolean
@@ -292,26 +915,6 @@ gclue_web_source_start (GClueLocationSource *source)
         return TRUE;
 }
 
-static void
-submit_query_callback (SoupSession *session,
-                       SoupMessage *query,
-                       gpointer     user_data)
-{
-        SoupURI *uri;
-
-        uri = soup_message_get_uri (query);
-        if (query->status_code != SOUP_STATUS_OK &&
-            query->status_code != SOUP_STATUS_NO_CONTENT) {
-                g_warning ("Failed to submit location data to '%s': %s",
-                           soup_uri_to_string (uri, FALSE),
-                           query->reason_phrase);
-		return;
-	}
-
-        g_debug ("Successfully submitted location data to '%s'",
-                 soup_uri_to_string (uri, FALSE));
-}
-
 #define SUBMISSION_ACCURACY_THRESHOLD 100
 #define SUBMISSION_TIME_THRESHOLD     60  /* seconds */
 
@@ -323,8 +926,8 @@ on_submit_source_location_notify (GObject    *source_object,
         GClueLocationSource *source = GCLUE_LOCATION_SOURCE (source_object);
         GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
         GClueLocation *location;
-        SoupMessage *query;
         GError *error = NULL;
+        char *item;
 
         location = gclue_location_source_get_location (source);
         if (location == NULL ||
@@ -336,16 +939,13 @@ on_submit_source_location_notify (GObject    *source_object,
 
         web->priv->last_submitted = gclue_location_get_timestamp (location);
 
-        if (!get_internet_available ())
-                return;
-
-        query = GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_query
+        item = GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_item
                                         (web,
                                          location,
                                          &error);
-        if (query == NULL) {
+        if (item == NULL) {
                 if (error != NULL) {
-                        g_warning ("Failed to create submission query: %s",
+                        g_warning ("Failed to create submission: %s",
                                    error->message);
                         g_error_free (error);
                 }
@@ -353,10 +953,9 @@ on_submit_source_location_notify (GObject    *source_object,
                 return;
         }
 
-        soup_session_queue_message (web->priv->soup_session,
-                                    query,
-                                    submit_query_callback,
-                                    web);
+        /* Journaled even while offline, and sent in batches */
+        gclue_submission_journal_add (web->priv->journal, item);
+        g_free (item);
 }
 
 /**
@@ -373,9 +972,12 @@ gclue_web_source_set_submit_source (GClueWebSource      *web,
                                     GClueLocationSource *submit_source)
 {
         /* Not implemented by subclass */
-        if (GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_query == NULL)
+        if (GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_item == NULL)
                 return;
 
+        if (web->priv->journal == NULL)
+                web->priv->journal = gclue_submission_journal_get_singleton ();
+
         g_signal_connect_object (G_OBJECT (submit_source),
                                  "notify::location",
                                  G_CALLBACK (on_submit_source_location_notify),
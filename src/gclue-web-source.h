@@ -64,15 +64,17 @@ struct _GClueWebSourceClass {
 
         SoupMessage *     (*create_query)        (GClueWebSource *source,
                                                   GError        **error);
-        SoupMessage *     (*create_submit_query) (GClueWebSource  *source,
+        char *            (*create_submit_item)  (GClueWebSource  *source,
                                                   GClueLocation   *location,
                                                   GError         **error);
         GClueLocation * (*parse_response)        (GClueWebSource *source,
                                                   const char     *response,
+                                                  gsize           length,
                                                   GError        **error);
         GClueAccuracyLevel (*get_available_accuracy_level)
                                                  (GClueWebSource *source,
                                                   gboolean        network_available);
+        GClueLocation * (*get_cached_location)   (GClueWebSource *source);
 };
 
 void gclue_web_source_refresh           (GClueWebSource      *source);
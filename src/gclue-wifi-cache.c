@@ -0,0 +1,467 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "gclue-wifi-cache.h"
+#include "gclue-cache-file.h"
+
+/**
+ * SECTION:gclue-wifi-cache
+ * @short_description: Persistent cache of WiFi fingerprint locations
+ * @include: gclue-glib/gclue-wifi-cache.h
+ *
+ * Maps sets of nearby BSSIDs to the location the web service returned for
+ * them, so that a place we have already been to can be resolved without a
+ * network round-trip. Sets are matched by similarity (Jaccard index) rather
+ * than exactly, since the list of visible access points is rarely identical
+ * between two scans at the same place. The cache is kept on disk across
+ * restarts.
+ **/
+
+#define CACHE_FILE_NAME "wifi-cache"
+
+/* Bump this whenever the serialized format below changes */
+#define CACHE_VERSION 2
+#define CACHE_VARIANT_TYPE "(ua(atdddtt))"
+
+#define CACHE_MAX_ENTRIES 512
+/* Since the web service located the BSSIDs, as the APs may have moved */
+#define CACHE_MAX_AGE     (30 * 24 * 60 * 60) /* seconds */
+#define CACHE_MIN_SIMILARITY 0.6
+#define CACHE_SAVE_TIMEOUT 60 /* seconds */
+/* Hits only change what gets evicted first, so they can wait longer */
+#define CACHE_HIT_SAVE_INTERVAL (60 * 60) /* seconds */
+
+typedef struct
+{
+        guint64 *bssids; /* Sorted */
+        guint n_bssids;
+
+        gdouble latitude;
+        gdouble longitude;
+        gdouble accuracy;
+
+        /* Seconds since epoch */
+        guint64 located; /* For expiry */
+        guint64 last_used; /* For eviction */
+} CacheEntry;
+
+struct _GClueWifiCachePrivate
+{
+        GPtrArray *entries;
+
+        guint save_timeout;
+        gboolean dirty;     /* Hits since the last save */
+        gint64 last_saved;  /* Monotonic time */
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueWifiCache,
+                         gclue_wifi_cache,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueWifiCache))
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+        g_free (entry->bssids);
+        g_slice_free (CacheEntry, entry);
+}
+
+static guint64
+get_now (void)
+{
+        return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static gint
+compare_bssids (gconstpointer a,
+                gconstpointer b)
+{
+        guint64 bssid_a = *(const guint64 *) a;
+        guint64 bssid_b = *(const guint64 *) b;
+
+        return (bssid_a > bssid_b) - (bssid_a < bssid_b);
+}
+
+/* Jaccard index of two sorted BSSID sets */
+static gdouble
+get_similarity (const guint64 *a,
+                guint          n_a,
+                const guint64 *b,
+                guint          n_b)
+{
+        guint i = 0, j = 0, common = 0;
+
+        if (n_a == 0 || n_b == 0)
+                return 0.0;
+
+        while (i < n_a && j < n_b) {
+                if (a[i] == b[j]) {
+                        common++;
+                        i++;
+                        j++;
+                } else if (a[i] < b[j]) {
+                        i++;
+                } else {
+                        j++;
+                }
+        }
+
+        return (gdouble) common / (n_a + n_b - common);
+}
+
+static void
+load_cache (GClueWifiCache *cache)
+{
+        GClueWifiCachePrivate *priv = cache->priv;
+        GVariant *variant, *entries, *child;
+        GVariantIter iter;
+        guint32 version;
+        guint64 now;
+
+        variant = gclue_cache_file_load (CACHE_FILE_NAME,
+                                         G_VARIANT_TYPE (CACHE_VARIANT_TYPE));
+        if (variant == NULL)
+                return;
+
+        g_variant_get (variant, "(u@a(atdddtt))", &version, &entries);
+        if (version != CACHE_VERSION) {
+                g_debug ("Ignoring WiFi location cache of version %u",
+                         version);
+                goto out;
+        }
+
+        now = get_now ();
+        g_variant_iter_init (&iter, entries);
+        while ((child = g_variant_iter_next_value (&iter)) != NULL) {
+                CacheEntry *entry;
+                GVariant *bssids;
+                const guint64 *data;
+                gsize n_bssids;
+
+                entry = g_slice_new0 (CacheEntry);
+                g_variant_get (child,
+                               "(@atdddtt)",
+                               &bssids,
+                               &entry->latitude,
+                               &entry->longitude,
+                               &entry->accuracy,
+                               &entry->located,
+                               &entry->last_used);
+                data = g_variant_get_fixed_array (bssids,
+                                                  &n_bssids,
+                                                  sizeof (guint64));
+                if (n_bssids > 0 &&
+                    entry->located + CACHE_MAX_AGE > now &&
+                    priv->entries->len < CACHE_MAX_ENTRIES) {
+                        entry->n_bssids = n_bssids;
+                        entry->bssids = g_new (guint64, n_bssids);
+                        memcpy (entry->bssids, data, n_bssids * sizeof (guint64));
+                        qsort (entry->bssids,
+                               n_bssids,
+                               sizeof (guint64),
+                               compare_bssids);
+
+                        g_ptr_array_add (priv->entries, entry);
+                } else {
+                        cache_entry_free (entry);
+                }
+
+                g_variant_unref (bssids);
+                g_variant_unref (child);
+        }
+
+        g_debug ("Loaded %u entries from WiFi location cache",
+                 priv->entries->len);
+out:
+        g_variant_unref (entries);
+        g_variant_unref (variant);
+}
+
+static void
+save_cache (GClueWifiCache *cache)
+{
+        GClueWifiCachePrivate *priv = cache->priv;
+        GVariantBuilder builder;
+        GVariant *variant;
+        guint i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(atdddtt)"));
+        for (i = 0; i < priv->entries->len; i++) {
+                CacheEntry *entry = g_ptr_array_index (priv->entries, i);
+                GVariant *bssids;
+
+                bssids = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                    entry->bssids,
+                                                    entry->n_bssids,
+                                                    sizeof (guint64));
+                g_variant_builder_add (&builder,
+                                       "(@atdddtt)",
+                                       bssids,
+                                       entry->latitude,
+                                       entry->longitude,
+                                       entry->accuracy,
+                                       entry->located,
+                                       entry->last_used);
+        }
+        variant = g_variant_new ("(u@a(atdddtt))",
+                                 CACHE_VERSION,
+                                 g_variant_builder_end (&builder));
+
+        if (gclue_cache_file_save (CACHE_FILE_NAME, variant))
+                g_debug ("Saved %u entries to WiFi location cache",
+                         priv->entries->len);
+        priv->dirty = FALSE;
+        priv->last_saved = g_get_monotonic_time ();
+}
+
+static gboolean
+on_save_timeout (gpointer user_data)
+{
+        GClueWifiCache *cache = GCLUE_WIFI_CACHE (user_data);
+
+        cache->priv->save_timeout = 0;
+        save_cache (cache);
+
+        return FALSE;
+}
+
+static void
+schedule_save (GClueWifiCache *cache)
+{
+        GClueWifiCachePrivate *priv = cache->priv;
+
+        /* Batch up changes instead of writing on each query */
+        if (priv->save_timeout != 0)
+                return;
+
+        priv->save_timeout = g_timeout_add_seconds (CACHE_SAVE_TIMEOUT,
+                                                    on_save_timeout,
+                                                    cache);
+}
+
+static void
+gclue_wifi_cache_finalize (GObject *object)
+{
+        GClueWifiCachePrivate *priv = GCLUE_WIFI_CACHE (object)->priv;
+
+        if (priv->save_timeout != 0) {
+                g_source_remove (priv->save_timeout);
+                priv->save_timeout = 0;
+
+                save_cache (GCLUE_WIFI_CACHE (object));
+        } else if (priv->dirty) {
+                /* Hits that didn't warrant a save of their own */
+                save_cache (GCLUE_WIFI_CACHE (object));
+        }
+
+        g_clear_pointer (&priv->entries, g_ptr_array_unref);
+
+        G_OBJECT_CLASS (gclue_wifi_cache_parent_class)->finalize (object);
+}
+
+static void
+gclue_wifi_cache_class_init (GClueWifiCacheClass *klass)
+{
+        GObjectClass *object_class;
+
+        object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gclue_wifi_cache_finalize;
+}
+
+static void
+gclue_wifi_cache_init (GClueWifiCache *cache)
+{
+        cache->priv = G_TYPE_INSTANCE_GET_PRIVATE (cache,
+                                                   GCLUE_TYPE_WIFI_CACHE,
+                                                   GClueWifiCachePrivate);
+        cache->priv->entries = g_ptr_array_new_with_free_func
+                        ((GDestroyNotify) cache_entry_free);
+
+        load_cache (cache);
+        cache->priv->last_saved = g_get_monotonic_time ();
+}
+
+static void
+on_cache_destroyed (gpointer data,
+                    GObject *where_the_object_was)
+{
+        GClueWifiCache **cache = (GClueWifiCache **) data;
+
+        *cache = NULL;
+}
+
+/**
+ * gclue_wifi_cache_get_singleton:
+ *
+ * Get the #GClueWifiCache singleton.
+ *
+ * Returns: (transfer full): a new ref to #GClueWifiCache. Use g_object_unref()
+ * when done.
+ **/
+GClueWifiCache *
+gclue_wifi_cache_get_singleton (void)
+{
+        static GClueWifiCache *cache = NULL;
+
+        if (cache == NULL) {
+                cache = g_object_new (GCLUE_TYPE_WIFI_CACHE, NULL);
+                g_object_weak_ref (G_OBJECT (cache),
+                                   on_cache_destroyed,
+                                   &cache);
+        } else
+                g_object_ref (cache);
+
+        return cache;
+}
+
+/**
+ * gclue_wifi_cache_lookup:
+ * @cache: a #GClueWifiCache
+ * @bssids: sorted array of #guint64 BSSIDs currently visible
+ *
+ * Looks for the cached fingerprint most similar to @bssids.
+ *
+ * Returns: (transfer full): A new #GClueLocation, or %NULL if no cached
+ * fingerprint is similar enough to @bssids.
+ **/
+GClueLocation *
+gclue_wifi_cache_lookup (GClueWifiCache *cache,
+                         GArray         *bssids)
+{
+        GClueWifiCachePrivate *priv;
+        CacheEntry *best = NULL;
+        gdouble best_similarity = 0.0;
+        guint64 now;
+        guint i;
+
+        g_return_val_if_fail (GCLUE_IS_WIFI_CACHE (cache), NULL);
+        priv = cache->priv;
+
+        if (bssids == NULL || bssids->len == 0)
+                return NULL;
+
+        now = get_now ();
+        for (i = 0; i < priv->entries->len; i++) {
+                CacheEntry *entry = g_ptr_array_index (priv->entries, i);
+                gdouble similarity;
+
+                if (entry->located + CACHE_MAX_AGE <= now)
+                        continue;
+
+                similarity = get_similarity ((guint64 *) bssids->data,
+                                             bssids->len,
+                                             entry->bssids,
+                                             entry->n_bssids);
+                if (similarity > best_similarity) {
+                        best = entry;
+                        best_similarity = similarity;
+                }
+        }
+
+        if (best == NULL || best_similarity < CACHE_MIN_SIMILARITY) {
+                g_debug ("WiFi location cache miss (best similarity %f)",
+                         best_similarity);
+                return NULL;
+        }
+
+        g_debug ("WiFi location cache hit (similarity %f)", best_similarity);
+        best->last_used = now;
+        priv->dirty = TRUE;
+        if (g_get_monotonic_time () - priv->last_saved >=
+            (gint64) CACHE_HIT_SAVE_INTERVAL * G_USEC_PER_SEC)
+                schedule_save (cache);
+
+        return gclue_location_new (best->latitude,
+                                   best->longitude,
+                                   best->accuracy);
+}
+
+/**
+ * gclue_wifi_cache_insert:
+ * @cache: a #GClueWifiCache
+ * @bssids: sorted array of #guint64 BSSIDs @location was resolved from
+ * @location: the location returned for @bssids
+ *
+ * Remembers @location for @bssids, evicting the least recently used entry if
+ * the cache is full.
+ **/
+void
+gclue_wifi_cache_insert (GClueWifiCache *cache,
+                         GArray         *bssids,
+                         GClueLocation  *location)
+{
+        GClueWifiCachePrivate *priv;
+        CacheEntry *entry = NULL;
+        guint i;
+
+        g_return_if_fail (GCLUE_IS_WIFI_CACHE (cache));
+        g_return_if_fail (GCLUE_IS_LOCATION (location));
+        priv = cache->priv;
+
+        if (bssids == NULL || bssids->len == 0)
+                return;
+
+        for (i = 0; i < priv->entries->len; i++) {
+                CacheEntry *e = g_ptr_array_index (priv->entries, i);
+
+                if (e->n_bssids == bssids->len &&
+                    memcmp (e->bssids,
+                            bssids->data,
+                            bssids->len * sizeof (guint64)) == 0) {
+                        entry = e;
+                        break;
+                }
+        }
+
+        if (entry == NULL) {
+                if (priv->entries->len >= CACHE_MAX_ENTRIES) {
+                        guint oldest = 0;
+
+                        for (i = 1; i < priv->entries->len; i++) {
+                                CacheEntry *e = g_ptr_array_index
+                                        (priv->entries, i);
+                                CacheEntry *o = g_ptr_array_index
+                                        (priv->entries, oldest);
+
+                                if (e->last_used < o->last_used)
+                                        oldest = i;
+                        }
+                        g_ptr_array_remove_index_fast (priv->entries, oldest);
+                }
+
+                entry = g_slice_new0 (CacheEntry);
+                entry->n_bssids = bssids->len;
+                entry->bssids = g_new (guint64, bssids->len);
+                memcpy (entry->bssids,
+                        bssids->data,
+                        bssids->len * sizeof (guint64));
+                g_ptr_array_add (priv->entries, entry);
+        }
+
+        entry->latitude = gclue_location_get_latitude (location);
+        entry->longitude = gclue_location_get_longitude (location);
+        entry->accuracy = gclue_location_get_accuracy (location);
+        entry->located = get_now ();
+        entry->last_used = entry->located;
+
+        schedule_save (cache);
+}
@@ -20,23 +20,42 @@
  */
 
 #include <stdlib.h>
+#include <math.h>
 #include <glib.h>
 #include <string.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
 #include <config.h>
 #include "gclue-wifi.h"
 #include "gclue-config.h"
 #include "gclue-error.h"
 #include "gclue-mozilla.h"
-
-#define WIFI_SCAN_TIMEOUT_HIGH_ACCURACY 10
-/* Since this is only used for city-level accuracy, 5 minutes betweeen each
- * scan is more than enough.
+#include "gclue-bss-tracker.h"
+#include "gclue-wifi-cache.h"
+#include "gclue-geoip-cache.h"
+#include "gclue-query-aggregator.h"
+#include "gclue-location-db.h"
+#include "gclue-mmdb.h"
+
+/* Bounds of the interval between scans. It starts at the lower bound and
+ * doubles up to the upper one for as long as we seem to be standing still.
+ * With high-enough accuracy requests, we need to scan more often since
+ * user's location can change quickly. With low accuracy, we don't since
+ * we wouldn't want to drain power unnecessarily.
  */
-#define WIFI_SCAN_TIMEOUT_LOW_ACCURACY  300
+#define WIFI_SCAN_INTERVAL_MIN_HIGH_ACCURACY 10
+#define WIFI_SCAN_INTERVAL_MAX_HIGH_ACCURACY 300
+#define WIFI_SCAN_INTERVAL_MIN_LOW_ACCURACY  300
+#define WIFI_SCAN_INTERVAL_MAX_LOW_ACCURACY  1800
+
+/* Share of the visible APs that changed since the last scan, and speed of
+ * the last fix in m/s, from which on we take ourselves to be moving */
+#define WIFI_SCAN_MOVING_CHURN 0.3
+#define WIFI_SCAN_MOVING_SPEED 1.0
+/* Fixes older than this, in seconds, say nothing about our speed anymore */
+#define WIFI_SCAN_MAX_FIX_AGE  600
 
-#define BSSID_LEN 7
-#define BSSID_STR_LEN 18
-#define MAX_SSID_LEN 32
 
 /**
  * SECTION:gclue-wifi
@@ -52,19 +71,26 @@ static gboolean
 gclue_wifi_stop (GClueLocationSource *source);
 
 struct _GClueWifiPrivate {
-        WPASupplicant *supplicant;
-        WPAInterface *interface;
-        GHashTable *bss_proxies;
-        GHashTable *ignored_bss_proxies;
-        gboolean bss_list_changed;
-
-        gulong bss_added_id;
-        gulong bss_removed_id;
+        GClueBSSTracker *tracker; /* NULL if we don't use WiFi */
+        gboolean tracking;
+        gulong device_changed_id;
         gulong scan_done_id;
 
-        guint scan_timeout;
+        guint scan_interval;      /* Seconds we want between scans */
+        GArray *last_scan_bssids; /* Fingerprint as of the last scan */
+        GArray *refresh_aps;      /* APSignal as of the last refresh, sorted */
 
         GClueAccuracyLevel accuracy_level;
+
+        GClueWifiCache *cache;
+        GClueGeoipCache *geoip_cache;
+        char *query_network_id; /* Network of the last GeoIP query */
+        GClueQueryAggregator *aggregator;
+        gulong query_answered_id;
+
+        GClueLocationDB *location_db;
+        GClueMMDB *geoip_db;
+        gulong network_changed_id;
 };
 
 enum
@@ -78,17 +104,20 @@ static GParamSpec *gParamSpecs[LAST_PROP];
 static SoupMessage *
 gclue_wifi_create_query (GClueWebSource *source,
                          GError        **error);
-static SoupMessage *
-gclue_wifi_create_submit_query (GClueWebSource  *source,
-                                GClueLocation   *location,
-                                GError         **error);
+static char *
+gclue_wifi_create_submit_item (GClueWebSource  *source,
+                               GClueLocation   *location,
+                               GError         **error);
 static GClueLocation *
 gclue_wifi_parse_response (GClueWebSource *source,
                            const char     *json,
+                           gsize           length,
                            GError        **error);
 static GClueAccuracyLevel
 gclue_wifi_get_available_accuracy_level (GClueWebSource *source,
                                          gboolean        net_available);
+static GClueLocation *
+gclue_wifi_get_cached_location (GClueWebSource *source);
 
 G_DEFINE_TYPE_WITH_CODE (GClueWifi,
                          gclue_wifi,
@@ -96,15 +125,18 @@ G_DEFINE_TYPE_WITH_CODE (GClueWifi,
                          G_ADD_PRIVATE (GClueWifi))
 
 static void
-disconnect_bss_signals (GClueWifi *wifi);
+stop_tracking (GClueWifi *wifi);
 static void
-on_scan_call_done (GObject      *source_object,
-                   GAsyncResult *res,
-                   gpointer      user_data);
+publish_bss_list (GClueWifi *wifi);
+static GArray *
+get_bssid_fingerprint (GClueWifi *wifi);
 static void
-on_scan_done (WPAInterface *object,
-              gboolean      success,
-              gpointer      user_data);
+on_query_answered (GClueQueryAggregator *aggregator,
+                   GClueLocation        *location,
+                   GObject              *origin,
+                   GArray               *bssids,
+                   GClue3GTower         *tower,
+                   gpointer              user_data);
 
 static void
 gclue_wifi_finalize (GObject *gwifi)
@@ -113,11 +145,32 @@ gclue_wifi_finalize (GObject *gwifi)
 
         G_OBJECT_CLASS (gclue_wifi_parent_class)->finalize (gwifi);
 
-        disconnect_bss_signals (wifi);
-        g_clear_object (&wifi->priv->supplicant);
-        g_clear_object (&wifi->priv->interface);
-        g_clear_pointer (&wifi->priv->bss_proxies, g_hash_table_unref);
-        g_clear_pointer (&wifi->priv->ignored_bss_proxies, g_hash_table_unref);
+        stop_tracking (wifi);
+        if (wifi->priv->tracker != NULL) {
+                g_signal_handler_disconnect (wifi->priv->tracker,
+                                             wifi->priv->device_changed_id);
+                g_signal_handler_disconnect (wifi->priv->tracker,
+                                             wifi->priv->scan_done_id);
+                g_clear_object (&wifi->priv->tracker);
+        }
+        g_clear_pointer (&wifi->priv->last_scan_bssids, g_array_unref);
+        g_clear_pointer (&wifi->priv->refresh_aps, g_array_unref);
+        g_clear_object (&wifi->priv->cache);
+        g_clear_object (&wifi->priv->geoip_cache);
+        g_clear_pointer (&wifi->priv->query_network_id, g_free);
+        if (wifi->priv->query_answered_id != 0) {
+                g_signal_handler_disconnect (wifi->priv->aggregator,
+                                             wifi->priv->query_answered_id);
+                wifi->priv->query_answered_id = 0;
+        }
+        g_clear_object (&wifi->priv->aggregator);
+        g_clear_pointer (&wifi->priv->location_db, gclue_location_db_free);
+        if (wifi->priv->network_changed_id != 0) {
+                g_signal_handler_disconnect (g_network_monitor_get_default (),
+                                             wifi->priv->network_changed_id);
+                wifi->priv->network_changed_id = 0;
+        }
+        g_clear_pointer (&wifi->priv->geoip_db, gclue_mmdb_free);
 }
 
 static void
@@ -168,11 +221,12 @@ gclue_wifi_class_init (GClueWifiClass *klass)
 
         source_class->start = gclue_wifi_start;
         source_class->stop = gclue_wifi_stop;
-        web_class->create_submit_query = gclue_wifi_create_submit_query;
+        web_class->create_submit_item = gclue_wifi_create_submit_item;
         web_class->create_query = gclue_wifi_create_query;
         web_class->parse_response = gclue_wifi_parse_response;
         web_class->get_available_accuracy_level =
                 gclue_wifi_get_available_accuracy_level;
+        web_class->get_cached_location = gclue_wifi_get_cached_location;
         gwifi_class->get_property = gclue_wifi_get_property;
         gwifi_class->set_property = gclue_wifi_set_property;
         gwifi_class->finalize = gclue_wifi_finalize;
@@ -190,381 +244,342 @@ gclue_wifi_class_init (GClueWifiClass *klass)
                                          gParamSpecs[PROP_ACCURACY_LEVEL]);
 }
 
-static void
-on_bss_added (WPAInterface *object,
-              const gchar  *path,
-              GVariant     *properties,
-              gpointer      user_data);
+static gboolean
+has_device (GClueWifi *wifi)
+{
+        return wifi->priv->tracker != NULL &&
+               gclue_bss_tracker_has_device (wifi->priv->tracker);
+}
 
-static guint
-variant_to_string (GVariant *variant, guint max_len, char *ret)
+static GArray *
+get_bss_records (GClueWifi *wifi,
+                 GError   **error)
 {
-        guint i;
-        guint len;
+        if (!has_device (wifi)) {
+                g_set_error_literal (error,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_FAILED,
+                                     "No WiFi devices available");
+                return NULL;
+        }
 
-        len = g_variant_n_children (variant);
-        if (len == 0)
-                return 0;
-        g_return_val_if_fail(len < max_len, 0);
-        ret[len] = '\0';
+        return gclue_bss_tracker_get_records (wifi->priv->tracker);
+}
 
-        for (i = 0; i < len; i++)
-                g_variant_get_child (variant,
-                                     i,
-                                     "y",
-                                     &ret[i]);
+static guint64
+bssid_to_uint64 (const guint8 *raw_bssid)
+{
+        guint64 bssid = 0;
+        guint i;
+
+        for (i = 0; i < GCLUE_BSSID_LEN; i++)
+                bssid = (bssid << 8) | raw_bssid[i];
 
-        return len;
+        return bssid;
 }
 
-static guint
-get_ssid_from_bss (WPABSS *bss, char *ssid)
+/* Change in signal strength of an AP, in dB, that is put down to noise */
+#define SIGNAL_HYSTERESIS 6
+/* Mean change in signal strength, in dB, that counts as much as if all the
+ * APs were replaced, times SIGNAL_WEIGHT */
+#define SIGNAL_FULL_SCALE 20.0
+#define SIGNAL_WEIGHT     0.5
+
+typedef struct {
+        guint64 bssid;
+        gint16 signal;
+} APSignal;
+
+static gint
+compare_ap_signals (gconstpointer a,
+                    gconstpointer b)
 {
-        GVariant *variant = wpa_bss_get_ssid (bss);
+        guint64 bssid_a = ((const APSignal *) a)->bssid;
+        guint64 bssid_b = ((const APSignal *) b)->bssid;
 
-        return variant_to_string (variant, MAX_SSID_LEN, ssid);
+        return (bssid_a > bssid_b) - (bssid_a < bssid_b);
 }
 
-static gboolean
-get_bssid_from_bss (WPABSS *bss, char *bssid)
+/* Signal strengths of all the APs that would be sent in a query, sorted
+ * by BSSID */
+static GArray *
+get_ap_signals (GClueWifi *wifi)
 {
-        GVariant *variant;
-        char raw_bssid[BSSID_LEN] = { 0 };
-        guint raw_len, i;
+        GArray *records = get_bss_records (wifi, NULL);
+        GArray *aps;
+        guint i;
 
-        variant = wpa_bss_get_bssid (bss);
-        if (variant == NULL)
-                return FALSE;
+        if (records == NULL)
+                return g_array_new (FALSE, FALSE, sizeof (APSignal));
 
-        raw_len = variant_to_string (variant, BSSID_LEN, raw_bssid);
-        g_return_val_if_fail (raw_len == BSSID_LEN - 1, FALSE);
+        aps = g_array_sized_new (FALSE,
+                                 FALSE,
+                                 sizeof (APSignal),
+                                 records->len);
+        for (i = 0; i < records->len; i++) {
+                const GClueBSSRecord *record =
+                        &g_array_index (records, GClueBSSRecord, i);
+                APSignal ap;
 
-        for (i = 0; i < BSSID_LEN - 1; i++) {
-                unsigned char c = (unsigned char) raw_bssid[i];
+                if (record->ignore)
+                        continue;
 
-                if (i == BSSID_LEN - 2) {
-                        g_snprintf (bssid + (i * 3), 3, "%02x", c);
-                } else {
-                        g_snprintf (bssid + (i * 3), 4, "%02x:", c);
-                }
+                ap.bssid = bssid_to_uint64 (record->bssid);
+                ap.signal = record->signal;
+                g_array_append_val (aps, ap);
         }
+        g_array_sort (aps, compare_ap_signals);
 
-        return TRUE;
+        return aps;
 }
 
-static void
-add_bss_proxy (GClueWifi *wifi,
-               WPABSS    *bss)
+/* How different two sets of APs look: the Jaccard distance of their BSSIDs,
+ * plus the mean change in signal strength of the APs in both, where changes
+ * within the hysteresis band count as none */
+static gdouble
+get_significance (GArray *old_aps,
+                  GArray *new_aps)
 {
-        const char *path;
-
-        path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-        if (g_hash_table_replace (wifi->priv->bss_proxies,
-                                  g_strdup (path),
-                                  bss)) {
-                char ssid[MAX_SSID_LEN] = { 0 };
-
-                wifi->priv->bss_list_changed = TRUE;
-                get_ssid_from_bss (bss, ssid);
-                g_debug ("WiFi AP '%s' added.", ssid);
+        guint i = 0, j = 0, common = 0, total;
+        gdouble signal_delta = 0, score;
+
+        total = old_aps->len + new_aps->len;
+        if (total == 0)
+                return 0.0;
+
+        while (i < old_aps->len && j < new_aps->len) {
+                const APSignal *a = &g_array_index (old_aps, APSignal, i);
+                const APSignal *b = &g_array_index (new_aps, APSignal, j);
+
+                if (a->bssid == b->bssid) {
+                        guint delta = ABS (a->signal - b->signal);
+
+                        if (delta >= SIGNAL_HYSTERESIS)
+                                signal_delta += delta;
+                        common++;
+                        i++;
+                        j++;
+                } else if (a->bssid < b->bssid) {
+                        i++;
+                } else {
+                        j++;
+                }
         }
-}
 
-static void
-on_bss_signal_notify (GObject    *gobject,
-                      GParamSpec *pspec,
-                      gpointer    user_data)
-{
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
-        WPABSS *bss = WPA_BSS (gobject);
-        const char *path;
-
-        if (wpa_bss_get_signal (bss) <= -90) {
-                char bssid[BSSID_STR_LEN] = { 0 };
-
-                get_bssid_from_bss (bss, bssid);
-                g_debug ("WiFi AP '%s' still has very low strength (%u dBm)"
-                         ", ignoring again..",
-                         bssid,
-                         wpa_bss_get_signal (bss));
-                return;
-        }
+        score = 1.0 - (gdouble) common / (total - common);
+        if (common > 0)
+                score += SIGNAL_WEIGHT *
+                         MIN (signal_delta / (common * SIGNAL_FULL_SCALE), 1.0);
 
-        g_signal_handlers_disconnect_by_func (G_OBJECT (bss),
-                                              on_bss_signal_notify,
-                                              user_data);
-        add_bss_proxy (wifi, g_object_ref (bss));
-        path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-        g_hash_table_remove (wifi->priv->ignored_bss_proxies, path);
+        return score;
 }
 
-static void
-on_bss_proxy_ready (GObject      *source_object,
-                    GAsyncResult *res,
-                    gpointer      user_data)
+/* Whether the APs around us changed enough since the last refresh for a
+ * new query to be worth it. Most of the time they don't, and the answer
+ * would be the location we have already. */
+static gboolean
+is_change_significant (GClueWifi *wifi)
 {
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
-        WPABSS *bss;
-        GError *error = NULL;
-        char ssid[MAX_SSID_LEN] = { 0 };
-
-        bss = wpa_bss_proxy_new_for_bus_finish (res, &error);
-        if (bss == NULL) {
-                g_debug ("%s", error->message);
-                g_error_free (error);
-
-                return;
+        GClueWifiPrivate *priv = wifi->priv;
+        GClueConfig *config = gclue_config_get_singleton ();
+        GArray *aps;
+        gdouble score, threshold;
+
+        aps = get_ap_signals (wifi);
+        if (priv->refresh_aps == NULL) {
+                priv->refresh_aps = aps;
+                return TRUE;
         }
 
-        if (gclue_mozilla_should_ignore_bss (bss)) {
-                g_object_unref (bss);
-
-                return;
+        score = get_significance (priv->refresh_aps, aps);
+        threshold = gclue_config_get_wifi_refresh_threshold (config);
+        if (score < threshold) {
+                g_debug ("WiFi APs barely changed (%.2f < %.2f)",
+                         score,
+                         threshold);
+                g_array_unref (aps);
+                return FALSE;
         }
 
-        get_ssid_from_bss (bss, ssid);
-        g_debug ("WiFi AP '%s' added.", ssid);
-
-        if (wpa_bss_get_signal (bss) <= -90) {
-                const char *path;
-                char bssid[BSSID_STR_LEN] = { 0 };
-
-                get_bssid_from_bss (bss, bssid);
-                g_debug ("WiFi AP '%s' has very low strength (%u dBm)"
-                         ", ignoring for now..",
-                         bssid,
-                         wpa_bss_get_signal (bss));
-                g_signal_connect (G_OBJECT (bss),
-                                  "notify::signal",
-                                  G_CALLBACK (on_bss_signal_notify),
-                                  user_data);
-                path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-                g_hash_table_replace (wifi->priv->ignored_bss_proxies,
-                                      g_strdup (path),
-                                      bss);
-                return;
-        }
+        g_array_unref (priv->refresh_aps);
+        priv->refresh_aps = aps;
 
-        add_bss_proxy (wifi, bss);
+        return TRUE;
 }
 
-static void
-on_bss_added (WPAInterface *object,
-              const gchar  *path,
-              GVariant     *properties,
-              gpointer      user_data)
+/* Jaccard distance of two sorted BSSID fingerprints: 0 if the same APs
+ * are visible, 1 if none of them are */
+static gdouble
+get_bssid_churn (GArray *old_bssids,
+                 GArray *new_bssids)
 {
-        wpa_bss_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
-                                   G_DBUS_PROXY_FLAGS_NONE,
-                                   "fi.w1.wpa_supplicant1",
-                                   path,
-                                   NULL,
-                                   on_bss_proxy_ready,
-                                   user_data);
+        guint i = 0, j = 0, common = 0, total;
+
+        total = old_bssids->len + new_bssids->len;
+        if (total == 0)
+                return 0.0;
+
+        while (i < old_bssids->len && j < new_bssids->len) {
+                guint64 a = g_array_index (old_bssids, guint64, i);
+                guint64 b = g_array_index (new_bssids, guint64, j);
+
+                if (a == b) {
+                        common++;
+                        i++;
+                        j++;
+                } else if (a < b) {
+                        i++;
+                } else {
+                        j++;
+                }
+        }
+
+        return 1.0 - (gdouble) common / (total - common);
 }
 
-static gboolean
-remove_bss_from_hashtable (const gchar *path, GHashTable *hash_table)
+/* Speed of our last fix in m/s, or GCLUE_LOCATION_SPEED_UNKNOWN if there is
+ * none recent enough */
+static gdouble
+get_recent_speed (GClueWifi *wifi)
 {
-        char ssid[MAX_SSID_LEN] = { 0 };
-        WPABSS *bss = NULL;
-
-        bss = g_hash_table_lookup (hash_table, path);
-        if (bss == NULL)
-                return FALSE;
+        GClueLocation *location;
+        guint64 now;
 
-        get_ssid_from_bss (bss, ssid);
-        g_debug ("WiFi AP '%s' removed.", ssid);
+        location = gclue_location_source_get_location
+                (GCLUE_LOCATION_SOURCE (wifi));
+        if (location == NULL)
+                return GCLUE_LOCATION_SPEED_UNKNOWN;
 
-        g_hash_table_remove (hash_table, path);
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        if (now > gclue_location_get_timestamp (location) +
+                  WIFI_SCAN_MAX_FIX_AGE)
+                return GCLUE_LOCATION_SPEED_UNKNOWN;
 
-        return TRUE;
+        return gclue_location_get_speed (location);
 }
 
+/* Clients asking for updates only every so often never need us to scan
+ * more often than that */
 static void
-on_bss_removed (WPAInterface *object,
-                const gchar  *path,
-                gpointer      user_data)
+get_scan_interval_bounds (GClueWifi *wifi,
+                          guint     *min_interval,
+                          guint     *max_interval)
 {
-        GClueWifiPrivate *priv = GCLUE_WIFI (user_data)->priv;
-
-        if (remove_bss_from_hashtable (path, priv->bss_proxies))
-                priv->bss_list_changed = TRUE;
-        remove_bss_from_hashtable (path, priv->ignored_bss_proxies);
-}
-
-static void
-cancel_wifi_scan (GClueWifi *wifi)
-{
-        GClueWifiPrivate *priv = wifi->priv;
+        GClueMinUINT *threshold;
 
-        if (priv->scan_timeout != 0) {
-                g_source_remove (priv->scan_timeout);
-                priv->scan_timeout = 0;
+        if (wifi->priv->accuracy_level >= GCLUE_ACCURACY_LEVEL_STREET) {
+                *min_interval = WIFI_SCAN_INTERVAL_MIN_HIGH_ACCURACY;
+                *max_interval = WIFI_SCAN_INTERVAL_MAX_HIGH_ACCURACY;
+        } else {
+                *min_interval = WIFI_SCAN_INTERVAL_MIN_LOW_ACCURACY;
+                *max_interval = WIFI_SCAN_INTERVAL_MAX_LOW_ACCURACY;
         }
 
-        if (priv->scan_done_id != 0) {
-                g_signal_handler_disconnect (priv->interface,
-                                             priv->scan_done_id);
-                priv->scan_done_id = 0;
-        }
+        threshold = gclue_location_source_get_time_threshold
+                (GCLUE_LOCATION_SOURCE (wifi));
+        *min_interval = MAX (*min_interval,
+                             gclue_min_uint_get_value (threshold));
+        *max_interval = MAX (*max_interval, *min_interval);
 }
 
-static gboolean
-on_scan_timeout (gpointer user_data)
+/* Adapts the interval until the next scan to how much we seem to be moving:
+ * back to the shortest one as soon as the APs around us change or our fixes
+ * say we're on the move, and twice as long after each scan that saw the
+ * same APs. */
+static guint
+update_scan_interval (GClueWifi *wifi)
 {
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
         GClueWifiPrivate *priv = wifi->priv;
-        GVariantBuilder builder;
-        GVariant *args;
-
-        if (priv->interface == NULL)
-                return FALSE;
+        GArray *bssids;
+        guint min_interval, max_interval;
+        gdouble churn = 0.0, speed;
 
-        g_debug ("WiFi scan timeout. Restarting-scan..");
-        priv->scan_timeout = 0;
+        get_scan_interval_bounds (wifi, &min_interval, &max_interval);
 
-        if (priv->scan_done_id == 0)
-                priv->scan_done_id = g_signal_connect
-                                        (priv->interface,
-                                         "scan-done",
-                                         G_CALLBACK (on_scan_done),
-                                         wifi);
-
-        g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
-        g_variant_builder_add (&builder,
-                               "{sv}",
-                               "Type", g_variant_new ("s", "passive"));
-        args = g_variant_builder_end (&builder);
-
-        wpa_interface_call_scan (WPA_INTERFACE (priv->interface),
-                                 args,
-                                 NULL,
-                                 on_scan_call_done,
-                                 wifi);
+        bssids = get_bssid_fingerprint (wifi);
+        if (priv->last_scan_bssids != NULL) {
+                churn = get_bssid_churn (priv->last_scan_bssids, bssids);
+                g_array_unref (priv->last_scan_bssids);
+        }
+        priv->last_scan_bssids = bssids;
+        speed = get_recent_speed (wifi);
+
+        if (churn >= WIFI_SCAN_MOVING_CHURN ||
+            (speed != GCLUE_LOCATION_SPEED_UNKNOWN &&
+             speed >= WIFI_SCAN_MOVING_SPEED)) {
+                g_debug ("Moving (AP churn %.2f, speed %.1f m/s)",
+                         churn,
+                         speed);
+                priv->scan_interval = min_interval;
+        } else if (churn == 0.0) {
+                priv->scan_interval = 2 * MAX (priv->scan_interval,
+                                               min_interval / 2);
+        }
+        priv->scan_interval = CLAMP (priv->scan_interval,
+                                     min_interval,
+                                     max_interval);
 
-        return FALSE;
+        return priv->scan_interval;
 }
 
 static void
-on_scan_done (WPAInterface *object,
-              gboolean      success,
-              gpointer      user_data)
+on_scan_done (GClueBSSTracker *tracker,
+              gpointer         user_data)
 {
         GClueWifi *wifi = GCLUE_WIFI (user_data);
-        GClueWifiPrivate *priv = wifi->priv;
-        guint timeout;
-
-        if (!success) {
-                g_warning ("WiFi scan failed");
-
-                return;
-        }
-        g_debug ("WiFi scan completed");
 
-        if (priv->interface == NULL)
+        if (!wifi->priv->tracking)
                 return;
 
-        if (priv->bss_list_changed) {
-                priv->bss_list_changed = FALSE;
+        if (is_change_significant (wifi)) {
+                publish_bss_list (wifi);
                 g_debug ("Refreshing location..");
                 gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
         }
 
-        /* With high-enough accuracy requests, we need to scan more often since
-         * user's location can change quickly. With low accuracy, we don't since
-         * we wouldn't want to drain power unnecessarily.
-         */
-        if (priv->accuracy_level >= GCLUE_ACCURACY_LEVEL_STREET)
-                timeout = WIFI_SCAN_TIMEOUT_HIGH_ACCURACY;
-        else
-                timeout = WIFI_SCAN_TIMEOUT_LOW_ACCURACY;
-        priv->scan_timeout = g_timeout_add_seconds (timeout,
-                                                    on_scan_timeout,
-                                                    wifi);
-        g_debug ("Next scan scheduled in %u seconds", timeout);
+        gclue_bss_tracker_set_scan_interval (tracker,
+                                             G_OBJECT (wifi),
+                                             update_scan_interval (wifi));
 }
 
+/* Forgets all about the APs we saw so far */
 static void
-on_scan_call_done (GObject      *source_object,
-                   GAsyncResult *res,
-                   gpointer      user_data)
+reset_scan_state (GClueWifi *wifi)
 {
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
-        GError *error = NULL;
-
-        if (!wpa_interface_call_scan_finish
-                (WPA_INTERFACE (source_object),
-                 res,
-                 &error)) {
-                g_warning ("Scanning of WiFi networks failed: %s",
-                           error->message);
-                g_error_free (error);
-
-                cancel_wifi_scan (wifi);
+        GClueWifiPrivate *priv = wifi->priv;
 
-                return;
-        }
+        /* No idea whether we're moving yet, and the first scan always
+         * makes for a refresh */
+        priv->scan_interval = 0;
+        g_clear_pointer (&priv->last_scan_bssids, g_array_unref);
+        g_clear_pointer (&priv->refresh_aps, g_array_unref);
 }
 
 static void
-connect_bss_signals (GClueWifi *wifi)
+start_tracking (GClueWifi *wifi)
 {
         GClueWifiPrivate *priv = wifi->priv;
-        const gchar *const *bss_list;
-        guint i;
+        guint min_interval, max_interval;
 
-        if (priv->bss_added_id != 0)
+        if (priv->tracking || priv->tracker == NULL)
                 return;
-        if (priv->interface == NULL) {
-                gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
-
-                return;
-        }
 
-        on_scan_timeout (wifi);
-
-        priv->bss_list_changed = TRUE;
-        priv->bss_added_id = g_signal_connect (priv->interface,
-                                               "bss-added",
-                                               G_CALLBACK (on_bss_added),
-                                               wifi);
-        priv->bss_removed_id = g_signal_connect (priv->interface,
-                                                "bss-removed",
-                                                G_CALLBACK (on_bss_removed),
-                                                wifi);
-
-        bss_list = wpa_interface_get_bsss (WPA_INTERFACE (priv->interface));
-        if (bss_list == NULL)
-                return;
-
-        for (i = 0; bss_list[i] != NULL; i++)
-                on_bss_added (WPA_INTERFACE (priv->interface),
-                              bss_list[i],
-                              NULL,
-                              wifi);
+        reset_scan_state (wifi);
+        get_scan_interval_bounds (wifi, &min_interval, &max_interval);
+        priv->tracking = TRUE;
+        gclue_bss_tracker_start (priv->tracker, G_OBJECT (wifi), min_interval);
 }
 
 static void
-disconnect_bss_signals (GClueWifi *wifi)
+stop_tracking (GClueWifi *wifi)
 {
         GClueWifiPrivate *priv = wifi->priv;
 
-        cancel_wifi_scan (wifi);
-
-        if (priv->bss_added_id != 0) {
-                g_signal_handler_disconnect (priv->interface,
-                                             priv->bss_added_id);
-                priv->bss_added_id = 0;
-        }
-        if (priv->bss_removed_id != 0) {
-                g_signal_handler_disconnect (priv->interface,
-                                             priv->bss_removed_id);
-                priv->bss_removed_id = 0;
-        }
+        if (!priv->tracking)
+                return;
 
-        g_hash_table_remove_all (priv->bss_proxies);
-        g_hash_table_remove_all (priv->ignored_bss_proxies);
+        priv->tracking = FALSE;
+        gclue_bss_tracker_stop (priv->tracker, G_OBJECT (wifi));
 }
 
 static gboolean
@@ -578,7 +593,9 @@ gclue_wifi_start (GClueLocationSource *source)
         if (!base_class->start (source))
                 return FALSE;
 
-        connect_bss_signals (GCLUE_WIFI (source));
+        start_tracking (GCLUE_WIFI (source));
+        if (!has_device (GCLUE_WIFI (source)))
+                gclue_web_source_refresh (GCLUE_WEB_SOURCE (source));
         return TRUE;
 }
 
@@ -593,7 +610,10 @@ gclue_wifi_stop (GClueLocationSource *source)
         if (!base_class->stop (source))
                 return FALSE;
 
-        disconnect_bss_signals (GCLUE_WIFI (source));
+        stop_tracking (GCLUE_WIFI (source));
+        if (has_device (GCLUE_WIFI (source)))
+                gclue_query_aggregator_set_wifi
+                        (GCLUE_WIFI (source)->priv->aggregator, NULL, NULL);
         return TRUE;
 }
 
@@ -601,11 +621,17 @@ static GClueAccuracyLevel
 gclue_wifi_get_available_accuracy_level (GClueWebSource *source,
                                          gboolean        net_available)
 {
-        GClueWifiPrivate *priv = GCLUE_WIFI (source)->priv;
+        GClueWifi *wifi = GCLUE_WIFI (source);
+        GClueWifiPrivate *priv = wifi->priv;
 
-        if (!net_available)
+        /* With a local AP database we can still locate ourselves offline,
+         * as long as there is a WiFi device to scan with, and with a local
+         * GeoIP database as long as there isn't. */
+        if (!net_available &&
+            (has_device (wifi) ?
+             priv->location_db == NULL : priv->geoip_db == NULL))
                 return GCLUE_ACCURACY_LEVEL_NONE;
-        else if (priv->interface != NULL &&
+        else if (has_device (wifi) &&
                  priv->accuracy_level != GCLUE_ACCURACY_LEVEL_CITY)
                 return GCLUE_ACCURACY_LEVEL_STREET;
         else
@@ -613,96 +639,49 @@ gclue_wifi_get_available_accuracy_level (GClueWebSource *source,
 }
 
 static void
-on_interface_proxy_ready (GObject      *source_object,
-                          GAsyncResult *res,
-                          gpointer      user_data)
+on_device_changed (GClueBSSTracker *tracker,
+                   gpointer         user_data)
 {
         GClueWifi *wifi = GCLUE_WIFI (user_data);
-        WPAInterface *interface;
-        GError *error = NULL;
-
-        interface = wpa_interface_proxy_new_for_bus_finish (res, &error);
-        if (interface == NULL) {
-                g_debug ("%s", error->message);
-                g_error_free (error);
-
-                return;
-        }
 
-        if (wifi->priv->interface != NULL) {
-                g_object_unref (interface);
+        if (!gclue_bss_tracker_has_device (tracker)) {
+                gclue_query_aggregator_set_wifi (wifi->priv->aggregator,
+                                                 NULL,
+                                                 NULL);
+        } else if (wifi->priv->tracking) {
+                /* The first scan with the new device makes for a refresh */
+                reset_scan_state (wifi);
                 return;
         }
 
-        wifi->priv->interface = interface;
-        g_debug ("WiFi device '%s' added.",
-                 wpa_interface_get_ifname (interface));
-
-        if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (wifi)))
-                connect_bss_signals (wifi);
-        else
-                gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
+        gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
 }
 
 static void
-on_interface_added (WPASupplicant *supplicant,
-                    const gchar   *path,
-                    GVariant      *properties,
-                    gpointer       user_data)
+gclue_wifi_init (GClueWifi *wifi)
 {
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
-
-        if (wifi->priv->interface != NULL)
-                return;
+        wifi->priv = G_TYPE_INSTANCE_GET_PRIVATE ((wifi), GCLUE_TYPE_WIFI, GClueWifiPrivate);
 
-        wpa_interface_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
-                                         G_DBUS_PROXY_FLAGS_NONE,
-                                         "fi.w1.wpa_supplicant1",
-                                         path,
-                                         NULL,
-                                         on_interface_proxy_ready,
-                                         wifi);
+        wifi->priv->cache = gclue_wifi_cache_get_singleton ();
+        wifi->priv->geoip_cache = gclue_geoip_cache_get_singleton ();
+        wifi->priv->aggregator = gclue_query_aggregator_get_singleton ();
+        wifi->priv->query_answered_id =
+                g_signal_connect (wifi->priv->aggregator,
+                                  "query-answered",
+                                  G_CALLBACK (on_query_answered),
+                                  wifi);
 }
 
+/* Our addresses, and so the GeoIP location, may have changed */
 static void
-on_interface_removed (WPASupplicant *supplicant,
-                      const gchar   *path,
-                      gpointer       user_data)
+on_network_changed (GNetworkMonitor *monitor,
+                    gboolean         available,
+                    gpointer         user_data)
 {
         GClueWifi *wifi = GCLUE_WIFI (user_data);
-        GClueWifiPrivate *priv = wifi->priv;
-        const char *object_path;
-
-        if (priv->interface == NULL)
-                return;
 
-        object_path = g_dbus_proxy_get_object_path
-                        (G_DBUS_PROXY (priv->interface));
-        if (g_strcmp0 (object_path, path) != 0)
-                return;
-
-        g_debug ("WiFi device '%s' removed.",
-                 wpa_interface_get_ifname (priv->interface));
-
-        disconnect_bss_signals (wifi);
-        g_clear_object (&wifi->priv->interface);
-
-        gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
-}
-
-static void
-gclue_wifi_init (GClueWifi *wifi)
-{
-        wifi->priv = G_TYPE_INSTANCE_GET_PRIVATE ((wifi), GCLUE_TYPE_WIFI, GClueWifiPrivate);
-
-        wifi->priv->bss_proxies = g_hash_table_new_full (g_str_hash,
-                                                         g_str_equal,
-                                                         g_free,
-                                                         g_object_unref);
-        wifi->priv->ignored_bss_proxies = g_hash_table_new_full (g_str_hash,
-                                                                 g_str_equal,
-                                                                 g_free,
-                                                                 g_object_unref);
+        if (!has_device (wifi))
+                gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
 }
 
 static void
@@ -710,48 +689,55 @@ gclue_wifi_constructed (GObject *object)
 {
         GClueWifi *wifi = GCLUE_WIFI (object);
         GClueWifiPrivate *priv = wifi->priv;
-        const gchar *const *interfaces;
+        GClueConfig *config = gclue_config_get_singleton ();
+        const char *db_path;
         GError *error = NULL;
 
         G_OBJECT_CLASS (gclue_wifi_parent_class)->constructed (object);
 
-        if (wifi->priv->accuracy_level == GCLUE_ACCURACY_LEVEL_CITY) {
-                GClueConfig *config = gclue_config_get_singleton ();
-
-                if (!gclue_config_get_enable_wifi_source (config))
-                        goto refresh_n_exit;
+        db_path = gclue_config_get_geoip_database (config);
+        if (db_path != NULL) {
+                priv->geoip_db = gclue_mmdb_new (db_path, &error);
+                if (priv->geoip_db == NULL) {
+                        g_warning ("Failed to open GeoIP database '%s': %s",
+                                   db_path,
+                                   error->message);
+                        g_clear_error (&error);
+                } else {
+                        priv->network_changed_id =
+                                g_signal_connect (g_network_monitor_get_default (),
+                                                  "network-changed",
+                                                  G_CALLBACK (on_network_changed),
+                                                  wifi);
+                }
         }
 
-        /* FIXME: We should be using async variant */
-        priv->supplicant = wpa_supplicant_proxy_new_for_bus_sync
-                        (G_BUS_TYPE_SYSTEM,
-                         G_DBUS_PROXY_FLAGS_NONE,
-                         "fi.w1.wpa_supplicant1",
-                         "/fi/w1/wpa_supplicant1",
-                         NULL,
-                         &error);
-        if (priv->supplicant == NULL) {
-                g_warning ("Failed to connect to wpa_supplicant service: %s",
-                           error->message);
-                g_error_free (error);
+        if (wifi->priv->accuracy_level == GCLUE_ACCURACY_LEVEL_CITY &&
+            !gclue_config_get_enable_wifi_source (config))
                 goto refresh_n_exit;
+
+        db_path = gclue_config_get_location_database (config);
+        if (db_path != NULL) {
+                priv->location_db = gclue_location_db_new (db_path, &error);
+                if (priv->location_db == NULL) {
+                        g_warning ("Failed to open location database '%s': %s",
+                                   db_path,
+                                   error->message);
+                        g_clear_error (&error);
+                }
         }
 
-        g_signal_connect (priv->supplicant,
-                          "interface-added",
-                          G_CALLBACK (on_interface_added),
-                          wifi);
-        g_signal_connect (priv->supplicant,
-                          "interface-removed",
-                          G_CALLBACK (on_interface_removed),
-                          wifi);
-
-        interfaces = wpa_supplicant_get_interfaces (priv->supplicant);
-        if (interfaces != NULL && interfaces[0] != NULL)
-                on_interface_added (priv->supplicant,
-                                    interfaces[0],
-                                    NULL,
-                                    wifi);
+        /* Shared with the other accuracy level */
+        priv->tracker = gclue_bss_tracker_get_singleton ();
+        priv->device_changed_id =
+                g_signal_connect (priv->tracker,
+                                  "device-changed",
+                                  G_CALLBACK (on_device_changed),
+                                  wifi);
+        priv->scan_done_id = g_signal_connect (priv->tracker,
+                                               "scan-done",
+                                               G_CALLBACK (on_scan_done),
+                                               wifi);
 
 refresh_n_exit:
         gclue_web_source_refresh (GCLUE_WEB_SOURCE (object));
@@ -818,59 +804,337 @@ gclue_wifi_get_accuracy_level (GClueWifi *wifi)
         return wifi->priv->accuracy_level;
 }
 
-static GList *
-get_bss_list (GClueWifi *wifi,
-              GError   **error)
+static gint
+compare_bssids (gconstpointer a,
+                gconstpointer b)
 {
-        if (wifi->priv->interface == NULL) {
-                g_set_error_literal (error,
-                                     G_IO_ERROR,
-                                     G_IO_ERROR_FAILED,
-                                     "No WiFi devices available");
+        guint64 bssid_a = *(const guint64 *) a;
+        guint64 bssid_b = *(const guint64 *) b;
+
+        return (bssid_a > bssid_b) - (bssid_a < bssid_b);
+}
+
+/* Sorted BSSIDs of all the APs that would be sent in a query */
+static GArray *
+get_bssid_fingerprint (GClueWifi *wifi)
+{
+        GArray *records = get_bss_records (wifi, NULL);
+        GArray *bssids;
+        guint i;
+
+        if (records == NULL)
+                return g_array_new (FALSE, FALSE, sizeof (guint64));
+
+        bssids = g_array_sized_new (FALSE,
+                                    FALSE,
+                                    sizeof (guint64),
+                                    records->len);
+
+        for (i = 0; i < records->len; i++) {
+                const GClueBSSRecord *record =
+                        &g_array_index (records, GClueBSSRecord, i);
+                guint64 bssid;
+
+                if (record->ignore)
+                        continue;
+
+                bssid = bssid_to_uint64 (record->bssid);
+                g_array_append_val (bssids, bssid);
+        }
+        g_array_sort (bssids, compare_bssids);
+
+        return bssids;
+}
+
+/* Shares the visible APs with other sources, for their queries to carry */
+static void
+publish_bss_list (GClueWifi *wifi)
+{
+        GArray *bssids;
+
+        if (!has_device (wifi))
+                return;
+
+        bssids = get_bssid_fingerprint (wifi);
+        gclue_query_aggregator_set_wifi (wifi->priv->aggregator,
+                                         get_bss_records (wifi, NULL),
+                                         bssids);
+        g_array_unref (bssids);
+}
+
+static void
+on_query_answered (GClueQueryAggregator *aggregator,
+                   GClueLocation        *location,
+                   GObject              *origin,
+                   GArray               *bssids,
+                   GClue3GTower         *tower,
+                   gpointer              user_data)
+{
+        GClueWifi *wifi = GCLUE_WIFI (user_data);
+        GClueWifiPrivate *priv = wifi->priv;
+
+        if (has_device (wifi)) {
+                if (bssids == NULL)
+                        return;
+                gclue_wifi_cache_insert (priv->cache, bssids, location);
+        } else if (bssids == NULL && tower == NULL) {
+                /* Only the IP address went into the query */
+                if (priv->query_network_id == NULL)
+                        priv->query_network_id =
+                                gclue_geoip_cache_get_network_id ();
+                if (priv->query_network_id != NULL)
+                        gclue_geoip_cache_insert (priv->geoip_cache,
+                                                  priv->query_network_id,
+                                                  location);
+        }
+
+        /* The source that sent the query sets the location itself. Without
+         * a device we are GeoIP, so only take what the IP address got. */
+        if (origin == G_OBJECT (wifi) ||
+            !gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (wifi)) ||
+            (!has_device (wifi) && (bssids != NULL || tower != NULL)))
+                return;
+
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (wifi),
+                                            location);
+}
+
+static gboolean
+is_public_address (GInetAddress *address)
+{
+        const guint8 *bytes = g_inet_address_to_bytes (address);
+
+        if (g_inet_address_get_is_any (address) ||
+            g_inet_address_get_is_loopback (address) ||
+            g_inet_address_get_is_link_local (address) ||
+            g_inet_address_get_is_site_local (address) ||
+            g_inet_address_get_is_multicast (address))
+                return FALSE;
+
+        if (g_inet_address_get_family (address) == G_SOCKET_FAMILY_IPV4)
+                /* Carrier-grade NAT, 100.64.0.0/10 */
+                return !(bytes[0] == 100 && (bytes[1] & 0xc0) == 64);
+        else
+                /* Unique local, fc00::/7 */
+                return (bytes[0] & 0xfe) != 0xfc;
+}
+
+/* Looks up our own public addresses in the local GeoIP database. Behind NAT
+ * there are none, only the web service gets to see the public one. */
+static GClueLocation *
+get_location_from_geoip_db (GClueWifi *wifi)
+{
+        struct ifaddrs *ifaddrs, *ifa;
+        GClueLocation *location = NULL;
+
+        if (wifi->priv->geoip_db == NULL || getifaddrs (&ifaddrs) != 0)
+                return NULL;
+
+        for (ifa = ifaddrs; ifa != NULL && location == NULL; ifa = ifa->ifa_next) {
+                GInetAddress *address;
+                gdouble latitude, longitude, accuracy;
+
+                if (ifa->ifa_addr == NULL || !(ifa->ifa_flags & IFF_UP))
+                        continue;
+
+                if (ifa->ifa_addr->sa_family == AF_INET)
+                        address = g_inet_address_new_from_bytes
+                                ((guint8 *) &((struct sockaddr_in *) ifa->ifa_addr)->sin_addr,
+                                 G_SOCKET_FAMILY_IPV4);
+                else if (ifa->ifa_addr->sa_family == AF_INET6)
+                        address = g_inet_address_new_from_bytes
+                                ((guint8 *) &((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr,
+                                 G_SOCKET_FAMILY_IPV6);
+                else
+                        continue;
+
+                if (is_public_address (address) &&
+                    gclue_mmdb_lookup (wifi->priv->geoip_db,
+                                       address,
+                                       &latitude,
+                                       &longitude,
+                                       &accuracy)) {
+                        g_debug ("Found %s in GeoIP database",
+                                 ifa->ifa_name);
+                        location = gclue_location_new (latitude,
+                                                       longitude,
+                                                       accuracy);
+                }
+                g_object_unref (address);
+        }
+        freeifaddrs (ifaddrs);
+
+        return location;
+}
+
+/* Minimum number of APs known to the local database for a local fix */
+#define LOCAL_MIN_APS 2
+/* Lower bound on the accuracy claimed for a local fix, in meters */
+#define LOCAL_MIN_ACCURACY 20.0
+/* Length of a degree of latitude, in meters */
+#define METERS_PER_DEGREE 111320.0
+
+typedef struct {
+        gdouble latitude;
+        gdouble longitude;
+        gdouble range;
+        gdouble weight;
+} KnownAP;
+
+/* Weighted centroid of the visible APs that the local database knows
+ * about. Stronger signals and APs with a smaller range pull the estimate
+ * closer, and the accuracy is the weighted RMS distance of the APs from
+ * the estimate, each widened by its own range. */
+static GClueLocation *
+get_location_from_db (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        GArray *aps;
+        gdouble latitude = 0, longitude = 0, total_weight = 0;
+        gdouble spread = 0, lon_scale, accuracy;
+        GClueLocation *location = NULL;
+        GArray *records;
+        guint i;
+
+        records = get_bss_records (wifi, NULL);
+        if (priv->location_db == NULL || records == NULL)
                 return NULL;
+
+        aps = g_array_new (FALSE, FALSE, sizeof (KnownAP));
+        for (i = 0; i < records->len; i++) {
+                const GClueBSSRecord *record =
+                        &g_array_index (records, GClueBSSRecord, i);
+                KnownAP ap;
+
+                if (record->ignore ||
+                    !gclue_location_db_lookup_bssid (priv->location_db,
+                                                     bssid_to_uint64 (record->bssid),
+                                                     &ap.latitude,
+                                                     &ap.longitude,
+                                                     &ap.range))
+                        continue;
+
+                ap.range = MAX (ap.range, 1.0);
+                ap.weight = pow (10, record->signal / 20.0) / ap.range;
+                g_array_append_val (aps, ap);
+
+                latitude += ap.weight * ap.latitude;
+                longitude += ap.weight * ap.longitude;
+                total_weight += ap.weight;
         }
 
-        return g_hash_table_get_values (wifi->priv->bss_proxies);
+        if (aps->len < LOCAL_MIN_APS || total_weight <= 0)
+                goto out;
+
+        latitude /= total_weight;
+        longitude /= total_weight;
+        lon_scale = cos (latitude * G_PI / 180.0);
+
+        for (i = 0; i < aps->len; i++) {
+                KnownAP *ap = &g_array_index (aps, KnownAP, i);
+                gdouble dy, dx;
+
+                dy = (ap->latitude - latitude) * METERS_PER_DEGREE;
+                dx = (ap->longitude - longitude) *
+                     METERS_PER_DEGREE * lon_scale;
+                spread += ap->weight * (dx * dx + dy * dy +
+                                        ap->range * ap->range);
+        }
+        accuracy = MAX (sqrt (spread / total_weight), LOCAL_MIN_ACCURACY);
+
+        g_debug ("Located from %u APs in local database", aps->len);
+        location = gclue_location_new (latitude, longitude, accuracy);
+out:
+        g_array_unref (aps);
+
+        return location;
+}
+
+static GClueLocation *
+gclue_wifi_get_cached_location (GClueWebSource *source)
+{
+        GClueWifi *wifi = GCLUE_WIFI (source);
+        GClueLocation *location;
+        GArray *bssids;
+
+        if (!has_device (wifi)) {
+                char *network_id;
+
+                location = get_location_from_geoip_db (wifi);
+                if (location != NULL)
+                        return location;
+
+                /* GeoIP, so a known network is as good as a known IP */
+                network_id = gclue_geoip_cache_get_network_id ();
+                location = gclue_geoip_cache_lookup (wifi->priv->geoip_cache,
+                                                     network_id);
+                g_free (network_id);
+
+                return location;
+        }
+
+        location = get_location_from_db (wifi);
+        if (location != NULL)
+                return location;
+
+        bssids = get_bssid_fingerprint (wifi);
+        location = gclue_wifi_cache_lookup (wifi->priv->cache, bssids);
+        g_array_unref (bssids);
+
+        return location;
 }
 
 static SoupMessage *
 gclue_wifi_create_query (GClueWebSource *source,
                          GError        **error)
 {
-        GList *bss_list; /* As in Access Points */
-        SoupMessage *msg;
+        GClueWifi *wifi = GCLUE_WIFI (source);
 
-        bss_list = get_bss_list (GCLUE_WIFI (source), NULL);
+        publish_bss_list (wifi);
+        if (!has_device (wifi)) {
+                g_free (wifi->priv->query_network_id);
+                wifi->priv->query_network_id =
+                        gclue_geoip_cache_get_network_id ();
+        }
 
-        msg = gclue_mozilla_create_query (bss_list, NULL, error);
-        g_list_free (bss_list);
-        return msg;
+        /* City-level instances with a device scramble what they get */
+        return gclue_query_aggregator_create_query
+                (wifi->priv->aggregator,
+                 G_OBJECT (source),
+                 has_device (wifi) ?
+                 GCLUE_ACCURACY_LEVEL_STREET : GCLUE_ACCURACY_LEVEL_CITY,
+                 error);
 }
 
 static GClueLocation *
 gclue_wifi_parse_response (GClueWebSource *source,
                            const char     *json,
+                           gsize           length,
                            GError        **error)
 {
-        return gclue_mozilla_parse_response (json, error);
+        GClueWifiPrivate *priv = GCLUE_WIFI (source)->priv;
+
+        /* Caching happens in on_query_answered() */
+        return gclue_query_aggregator_parse_response (priv->aggregator,
+                                                      G_OBJECT (source),
+                                                      json,
+                                                      length,
+                                                      error);
 }
 
-static SoupMessage *
-gclue_wifi_create_submit_query (GClueWebSource  *source,
-                                GClueLocation   *location,
-                                GError         **error)
+static char *
+gclue_wifi_create_submit_item (GClueWebSource  *source,
+                               GClueLocation   *location,
+                               GError         **error)
 {
-        GList *bss_list; /* As in Access Points */
-        SoupMessage * msg;
+        GArray *bss_records; /* As in Access Points */
 
-        bss_list = get_bss_list (GCLUE_WIFI (source), error);
-        if (bss_list == NULL)
+        bss_records = get_bss_records (GCLUE_WIFI (source), error);
+        if (bss_records == NULL || bss_records->len == 0)
                 return NULL;
 
-        msg = gclue_mozilla_create_submit_query (location,
-                                                 bss_list,
+        return gclue_mozilla_create_submit_item (location,
+                                                 bss_records,
                                                  NULL,
                                                  error);
-        g_list_free (bss_list);
-        return msg;
 }
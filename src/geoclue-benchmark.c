@@ -0,0 +1,702 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * geoclue-benchmark: measure the time from a client's Start() to its first
+ * LocationUpdated signal, end to end.
+ *
+ * The service runs in-process on a private bus, against a local stand-in
+ * for the Mozilla geolocate and submit APIs with configurable latency and
+ * error rate. Each sample gets a fresh GClueServiceManager and so fresh
+ * sources. The on-disk caches are emptied before each sample unless
+ * --keep-cache is given, in which case all but the first sample measure a
+ * warm start.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include "gclue-service-manager.h"
+
+#if !defined (CONFIG_FILE_PATH) || !defined (CACHE_DIR)
+#error "The benchmark needs a configuration file and cache directory of its own"
+#endif
+
+#define MANAGER_PATH "/org/freedesktop/GeoClue2/Manager"
+#define MANAGER_INTERFACE "org.freedesktop.GeoClue2.Manager"
+#define CLIENT_INTERFACE "org.freedesktop.GeoClue2.Client"
+#define DESKTOP_ID "geoclue-benchmark"
+
+#define GEOLOCATE_RESPONSE \
+        "{\"location\": {\"lat\": 51.5074, \"lng\": -0.1278}, " \
+        "\"accuracy\": 5000.0}"
+#define SUBMIT_RESPONSE "{}"
+
+/* Commandline options */
+static int n_samples = 20;
+static int latency = 100;
+static int jitter = 0;
+static double error_rate = 0.0;
+static int sample_timeout = 30;
+static gboolean keep_cache = FALSE;
+static int seed = 0;
+
+static GOptionEntry entries[] =
+{
+        { "samples",
+          'n',
+          0,
+          G_OPTION_ARG_INT,
+          &n_samples,
+          "Number of samples to take. Default: 20",
+          "N" },
+        { "latency",
+          'l',
+          0,
+          G_OPTION_ARG_INT,
+          &latency,
+          "Mean response time of the stand-in server in milliseconds. "
+          "Default: 100",
+          "MS" },
+        { "jitter",
+          'j',
+          0,
+          G_OPTION_ARG_INT,
+          &jitter,
+          "Spread the response time evenly by up to MS either way. Default: 0",
+          "MS" },
+        { "error-rate",
+          'e',
+          0,
+          G_OPTION_ARG_DOUBLE,
+          &error_rate,
+          "Fraction of requests answered with 503 Service Unavailable. "
+          "Default: 0",
+          "RATE" },
+        { "timeout",
+          't',
+          0,
+          G_OPTION_ARG_INT,
+          &sample_timeout,
+          "Give up on a sample after T seconds. Default: 30",
+          "T" },
+        { "keep-cache",
+          'k',
+          0,
+          G_OPTION_ARG_NONE,
+          &keep_cache,
+          "Keep the on-disk caches between samples",
+          NULL },
+        { "seed",
+          's',
+          0,
+          G_OPTION_ARG_INT,
+          &seed,
+          "Seed for response times and errors. Default: 0",
+          "SEED" },
+        { NULL }
+};
+
+typedef struct
+{
+        GRand *rand;
+        guint n_queries;
+        guint n_submissions;
+        guint n_errors;
+} MockServer;
+
+typedef struct
+{
+        SoupServer *server;
+        SoupMessage *msg;
+        MockServer *mock;
+        const char *response;
+        gulong finished_id;
+        gboolean finished;
+} PendingReply;
+
+typedef struct
+{
+        GMainLoop *main_loop;
+        GDBusConnection *service_connection;
+        GDBusConnection *client_connection;
+
+        /* Per sample */
+        GClueServiceManager *manager;
+        GCancellable *cancellable;
+        char *client_path;
+        guint signal_id;
+        guint timeout_id;
+        gint64 start_time;
+
+        GArray *samples; /* gdouble, milliseconds */
+        guint n_timeouts;
+} Benchmark;
+
+static void
+die (const char *format, ...) G_GNUC_PRINTF (1, 2) G_GNUC_NORETURN;
+
+static void
+die (const char *format, ...)
+{
+        va_list args;
+
+        va_start (args, format);
+        vfprintf (stderr, format, args);
+        va_end (args);
+        fputc ('\n', stderr);
+
+        exit (EXIT_FAILURE);
+}
+
+static void
+on_reply_finished (SoupMessage *msg,
+                   gpointer     user_data)
+{
+        /* The client went away, e.g. the service cancelled the query */
+        ((PendingReply *) user_data)->finished = TRUE;
+}
+
+static gboolean
+on_reply_timeout (gpointer user_data)
+{
+        PendingReply *reply = (PendingReply *) user_data;
+
+        g_signal_handler_disconnect (reply->msg, reply->finished_id);
+        if (!reply->finished) {
+                if (g_rand_double (reply->mock->rand) < error_rate) {
+                        soup_message_set_status
+                                (reply->msg,
+                                 SOUP_STATUS_SERVICE_UNAVAILABLE);
+                        reply->mock->n_errors++;
+                } else {
+                        soup_message_set_status (reply->msg, SOUP_STATUS_OK);
+                        soup_message_set_response (reply->msg,
+                                                   "application/json",
+                                                   SOUP_MEMORY_STATIC,
+                                                   reply->response,
+                                                   strlen (reply->response));
+                }
+                soup_server_unpause_message (reply->server, reply->msg);
+        }
+
+        g_object_unref (reply->msg);
+        g_slice_free (PendingReply, reply);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+reply_later (SoupServer  *server,
+             SoupMessage *msg,
+             MockServer  *mock,
+             const char  *response)
+{
+        PendingReply *reply;
+        int delay;
+
+        delay = latency;
+        if (jitter > 0)
+                delay += g_rand_int_range (mock->rand, -jitter, jitter + 1);
+
+        reply = g_slice_new0 (PendingReply);
+        reply->server = server;
+        reply->msg = g_object_ref (msg);
+        reply->mock = mock;
+        reply->response = response;
+        reply->finished_id = g_signal_connect (msg,
+                                               "finished",
+                                               G_CALLBACK (on_reply_finished),
+                                               reply);
+
+        soup_server_pause_message (server, msg);
+        g_timeout_add (MAX (delay, 0), on_reply_timeout, reply);
+}
+
+static void
+on_geolocate (SoupServer        *server,
+              SoupMessage       *msg,
+              const char        *path,
+              GHashTable        *query,
+              SoupClientContext *client,
+              gpointer           user_data)
+{
+        MockServer *mock = (MockServer *) user_data;
+
+        if (msg->method != SOUP_METHOD_POST) {
+                soup_message_set_status (msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+
+                return;
+        }
+
+        mock->n_queries++;
+        reply_later (server, msg, mock, GEOLOCATE_RESPONSE);
+}
+
+static void
+on_submit (SoupServer        *server,
+           SoupMessage       *msg,
+           const char        *path,
+           GHashTable        *query,
+           SoupClientContext *client,
+           gpointer           user_data)
+{
+        MockServer *mock = (MockServer *) user_data;
+
+        if (msg->method != SOUP_METHOD_POST) {
+                soup_message_set_status (msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+
+                return;
+        }
+
+        mock->n_submissions++;
+        reply_later (server, msg, mock, SUBMIT_RESPONSE);
+}
+
+static SoupServer *
+start_mock_server (MockServer *mock,
+                   guint      *port)
+{
+        SoupServer *server;
+        GSList *uris;
+        GError *error = NULL;
+
+        server = soup_server_new (SOUP_SERVER_SERVER_HEADER,
+                                  "geoclue-benchmark",
+                                  NULL);
+        soup_server_add_handler (server, "/v1/geolocate", on_geolocate, mock, NULL);
+        soup_server_add_handler (server, "/v1/submit", on_submit, mock, NULL);
+        if (!soup_server_listen_local (server,
+                                       0,
+                                       SOUP_SERVER_LISTEN_IPV4_ONLY,
+                                       &error))
+                die ("Failed to start the mock server: %s", error->message);
+
+        uris = soup_server_get_uris (server);
+        *port = soup_uri_get_port (uris->data);
+        g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+
+        return server;
+}
+
+static void
+write_config (guint port)
+{
+        const char *disabled_sources[] = { "3g", "cdma", "modem-gps",
+                                           "network-nmea", "hybris", NULL };
+        GKeyFile *key_file;
+        GError *error = NULL;
+        char *url;
+        guint i;
+
+        key_file = g_key_file_new ();
+        g_key_file_set_string (key_file, "agent", "whitelist", "");
+
+        g_key_file_set_boolean (key_file, "wifi", "enable", TRUE);
+        url = g_strdup_printf ("http://127.0.0.1:%u/v1/geolocate?key=geoclue",
+                               port);
+        g_key_file_set_string (key_file, "wifi", "url", url);
+        g_free (url);
+        url = g_strdup_printf ("http://127.0.0.1:%u/v1/submit?key=geoclue",
+                               port);
+        g_key_file_set_string (key_file, "wifi", "submission-url", url);
+        g_free (url);
+
+        /* Only the web sources can be served by the stand-in */
+        for (i = 0; disabled_sources[i] != NULL; i++)
+                g_key_file_set_boolean (key_file,
+                                        disabled_sources[i],
+                                        "enable",
+                                        FALSE);
+
+        if (!g_key_file_save_to_file (key_file, CONFIG_FILE_PATH, &error))
+                die ("Failed to write '%s': %s",
+                     CONFIG_FILE_PATH,
+                     error->message);
+        g_key_file_unref (key_file);
+}
+
+static void
+clear_cache_dir (void)
+{
+        GDir *dir;
+        const char *name;
+
+        dir = g_dir_open (CACHE_DIR, 0, NULL);
+        if (dir == NULL)
+                return;
+
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                char *path = g_build_filename (CACHE_DIR, name, NULL);
+
+                g_unlink (path);
+                g_free (path);
+        }
+        g_dir_close (dir);
+}
+
+static GDBusConnection *
+connect_to_bus (const char *address)
+{
+        GDBusConnection *connection;
+        GError *error = NULL;
+
+        connection = g_dbus_connection_new_for_address_sync
+                (address,
+                 G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                 G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                 NULL,
+                 NULL,
+                 &error);
+        if (connection == NULL)
+                die ("Failed to connect to the private bus: %s",
+                     error->message);
+
+        return connection;
+}
+
+static gboolean start_sample (gpointer user_data);
+
+static void
+end_sample (Benchmark *benchmark)
+{
+        if (benchmark->signal_id != 0) {
+                g_dbus_connection_signal_unsubscribe
+                        (benchmark->client_connection,
+                         benchmark->signal_id);
+                benchmark->signal_id = 0;
+        }
+        if (benchmark->timeout_id != 0) {
+                g_source_remove (benchmark->timeout_id);
+                benchmark->timeout_id = 0;
+        }
+        g_cancellable_cancel (benchmark->cancellable);
+        g_clear_object (&benchmark->cancellable);
+        g_clear_pointer (&benchmark->client_path, g_free);
+
+        /* Takes the clients, locator and sources down with it */
+        g_clear_object (&benchmark->manager);
+
+        g_idle_add (start_sample, benchmark);
+}
+
+static void
+on_location_updated (GDBusConnection *connection,
+                     const char      *sender_name,
+                     const char      *object_path,
+                     const char      *interface_name,
+                     const char      *signal_name,
+                     GVariant        *parameters,
+                     gpointer         user_data)
+{
+        Benchmark *benchmark = (Benchmark *) user_data;
+        gdouble elapsed;
+
+        elapsed = (g_get_monotonic_time () - benchmark->start_time) / 1000.0;
+        g_array_append_val (benchmark->samples, elapsed);
+
+        end_sample (benchmark);
+}
+
+static gboolean
+on_sample_timeout (gpointer user_data)
+{
+        Benchmark *benchmark = (Benchmark *) user_data;
+
+        g_printerr ("No location after %d seconds\n", sample_timeout);
+        benchmark->n_timeouts++;
+        benchmark->timeout_id = 0;
+        end_sample (benchmark);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Returns the reply, or NULL if the sample has ended meanwhile */
+static GVariant *
+finish_call (GObject      *source_object,
+             GAsyncResult *res,
+             const char   *method)
+{
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                                res,
+                                                &error);
+        if (result != NULL)
+                return result;
+
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                die ("%s() failed: %s", method, error->message);
+        g_error_free (error);
+
+        return NULL;
+}
+
+static void
+on_start_ready (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+        GVariant *result;
+
+        result = finish_call (source_object, res, "Start");
+        if (result != NULL)
+                g_variant_unref (result);
+}
+
+static void
+on_desktop_id_set (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        Benchmark *benchmark = (Benchmark *) user_data;
+        GVariant *result;
+
+        result = finish_call (source_object, res, "Set");
+        if (result == NULL)
+                return;
+        g_variant_unref (result);
+
+        benchmark->signal_id = g_dbus_connection_signal_subscribe
+                (benchmark->client_connection,
+                 g_dbus_connection_get_unique_name
+                        (benchmark->service_connection),
+                 CLIENT_INTERFACE,
+                 "LocationUpdated",
+                 benchmark->client_path,
+                 NULL,
+                 G_DBUS_SIGNAL_FLAGS_NONE,
+                 on_location_updated,
+                 benchmark,
+                 NULL);
+        benchmark->timeout_id = g_timeout_add_seconds (sample_timeout,
+                                                       on_sample_timeout,
+                                                       benchmark);
+
+        benchmark->start_time = g_get_monotonic_time ();
+        g_dbus_connection_call (benchmark->client_connection,
+                                g_dbus_connection_get_unique_name
+                                        (benchmark->service_connection),
+                                benchmark->client_path,
+                                CLIENT_INTERFACE,
+                                "Start",
+                                NULL,
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                benchmark->cancellable,
+                                on_start_ready,
+                                benchmark);
+}
+
+static void
+on_create_client_ready (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+        Benchmark *benchmark = (Benchmark *) user_data;
+        GVariant *result;
+
+        result = finish_call (source_object, res, "CreateClient");
+        if (result == NULL)
+                return;
+        g_variant_get (result, "(o)", &benchmark->client_path);
+        g_variant_unref (result);
+
+        g_dbus_connection_call (benchmark->client_connection,
+                                g_dbus_connection_get_unique_name
+                                        (benchmark->service_connection),
+                                benchmark->client_path,
+                                "org.freedesktop.DBus.Properties",
+                                "Set",
+                                g_variant_new ("(ssv)",
+                                               CLIENT_INTERFACE,
+                                               "DesktopId",
+                                               g_variant_new_string
+                                                        (DESKTOP_ID)),
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                benchmark->cancellable,
+                                on_desktop_id_set,
+                                benchmark);
+}
+
+static gboolean
+start_sample (gpointer user_data)
+{
+        Benchmark *benchmark = (Benchmark *) user_data;
+        GError *error = NULL;
+
+        if (benchmark->samples->len + benchmark->n_timeouts >=
+            (guint) n_samples) {
+                g_main_loop_quit (benchmark->main_loop);
+
+                return G_SOURCE_REMOVE;
+        }
+
+        if (!keep_cache)
+                clear_cache_dir ();
+
+        benchmark->manager = gclue_service_manager_new
+                (benchmark->service_connection, &error);
+        if (benchmark->manager == NULL)
+                die ("Failed to create the manager: %s", error->message);
+
+        benchmark->cancellable = g_cancellable_new ();
+        g_dbus_connection_call (benchmark->client_connection,
+                                g_dbus_connection_get_unique_name
+                                        (benchmark->service_connection),
+                                MANAGER_PATH,
+                                MANAGER_INTERFACE,
+                                "CreateClient",
+                                NULL,
+                                G_VARIANT_TYPE ("(o)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                benchmark->cancellable,
+                                on_create_client_ready,
+                                benchmark);
+
+        return G_SOURCE_REMOVE;
+}
+
+static int
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+        gdouble x = *(const gdouble *) a;
+        gdouble y = *(const gdouble *) b;
+
+        return (x > y) - (x < y);
+}
+
+/* Nearest rank, @samples sorted and non-empty */
+static gdouble
+percentile (GArray *samples,
+            gdouble p)
+{
+        guint rank;
+
+        rank = (guint) ceil (p / 100.0 * samples->len);
+
+        return g_array_index (samples, gdouble, MAX (rank, 1) - 1);
+}
+
+static void
+print_report (Benchmark  *benchmark,
+              MockServer *mock)
+{
+        GArray *samples = benchmark->samples;
+
+        g_print ("Time to first fix, %u samples, %u timed out%s:\n",
+                 samples->len + benchmark->n_timeouts,
+                 benchmark->n_timeouts,
+                 keep_cache ? ", caches kept" : "");
+        if (samples->len > 0) {
+                g_array_sort (samples, compare_doubles);
+                g_print ("  min %9.1f ms\n", percentile (samples, 0));
+                g_print ("  p50 %9.1f ms\n", percentile (samples, 50));
+                g_print ("  p90 %9.1f ms\n", percentile (samples, 90));
+                g_print ("  p99 %9.1f ms\n", percentile (samples, 99));
+                g_print ("  max %9.1f ms\n", percentile (samples, 100));
+        }
+        g_print ("Server: %u queries, %u submissions, %u answered with an "
+                 "error\n",
+                 mock->n_queries,
+                 mock->n_submissions,
+                 mock->n_errors);
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext *context;
+        GError *error = NULL;
+        GTestDBus *bus;
+        SoupServer *server;
+        MockServer mock = { NULL, 0, 0, 0 };
+        Benchmark benchmark = { NULL };
+        const char *address;
+        guint port;
+        gboolean success;
+
+        context = g_option_context_new (NULL);
+        g_option_context_set_summary
+                (context,
+                 "Measure the time from Start() to the first LocationUpdated "
+                 "signal against a local stand-in for the location service.");
+        g_option_context_add_main_entries (context, entries, NULL);
+        if (!g_option_context_parse (context, &argc, &argv, &error))
+                die ("%s", error->message);
+        if (n_samples <= 0 || sample_timeout <= 0 || jitter < 0)
+                die ("Invalid sample count, timeout or jitter, see --help");
+        if (error_rate < 0.0 || error_rate > 1.0)
+                die ("Invalid error rate: %g", error_rate);
+        g_option_context_free (context);
+
+        /* Assume full connectivity and reach the stand-in directly, whatever
+         * the machine we run on. */
+        g_setenv ("GIO_USE_NETWORK_MONITOR", "base", TRUE);
+        g_setenv ("GIO_USE_PROXY_RESOLVER", "dummy", TRUE);
+
+        mock.rand = g_rand_new_with_seed (seed);
+        server = start_mock_server (&mock, &port);
+        write_config (port);
+
+        /* Keep the sources from finding, and talking to, the real WiFi
+         * devices and modems on the system bus */
+        bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+        g_test_dbus_up (bus);
+        address = g_test_dbus_get_bus_address (bus);
+        g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", address, TRUE);
+
+        benchmark.main_loop = g_main_loop_new (NULL, FALSE);
+        benchmark.service_connection = connect_to_bus (address);
+        benchmark.client_connection = connect_to_bus (address);
+        benchmark.samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+        /* Even with --keep-cache, the first sample is a cold start */
+        clear_cache_dir ();
+        g_idle_add (start_sample, &benchmark);
+        g_main_loop_run (benchmark.main_loop);
+
+        print_report (&benchmark, &mock);
+        success = benchmark.samples->len > 0;
+
+        g_array_unref (benchmark.samples);
+        g_object_unref (benchmark.client_connection);
+        g_object_unref (benchmark.service_connection);
+        g_main_loop_unref (benchmark.main_loop);
+        g_test_dbus_down (bus);
+        g_object_unref (bus);
+        g_object_unref (server);
+        g_rand_free (mock.rand);
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
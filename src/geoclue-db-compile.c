@@ -0,0 +1,656 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * geoclue-db-compile: build a location database for the "location-database"
+ * option from CSV dumps of WiFi access points and cell towers.
+ *
+ * Input is sorted with an external merge sort: records are buffered up to
+ * the memory limit, sorted and spilled to temporary files, which are then
+ * merged straight into the output. Memory use is bounded by the sort buffer
+ * plus the page index (16 bytes per 170 records), whatever the input size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "gclue-location-db-format.h"
+
+#define DEFAULT_MEMORY_MB 256
+#define MAX_FIELDS 16
+
+typedef struct
+{
+        FILE *file;
+        DBRecord current;
+} Run;
+
+typedef struct
+{
+        DBRecord *buffer;
+        gsize n_buffered;
+        gsize max_buffered;
+        gsize position;
+
+        GPtrArray *runs; /* Run*, a min-heap on the current key once merging */
+
+        DBRecord pending;
+        gboolean has_pending;
+
+        guint64 n_duplicates;
+} Sorter;
+
+static char **wifi_files = NULL;
+static char **cell_files = NULL;
+static int memory_mb = DEFAULT_MEMORY_MB;
+
+static GOptionEntry entries[] =
+{
+        { "wifi",
+          'w',
+          0,
+          G_OPTION_ARG_FILENAME_ARRAY,
+          &wifi_files,
+          "CSV of WiFi access points: bssid,latitude,longitude[,range]",
+          "FILE" },
+        { "cell",
+          'c',
+          0,
+          G_OPTION_ARG_FILENAME_ARRAY,
+          &cell_files,
+          "CSV of cell towers in Mozilla Location Service export format",
+          "FILE" },
+        { "memory",
+          'm',
+          0,
+          G_OPTION_ARG_INT,
+          &memory_mb,
+          "Megabytes of memory to sort with (default: 256)",
+          "MB" },
+        { NULL }
+};
+
+static void
+die (const char *format, ...) G_GNUC_PRINTF (1, 2) G_GNUC_NORETURN;
+
+static void
+die (const char *format, ...)
+{
+        va_list args;
+
+        va_start (args, format);
+        vfprintf (stderr, format, args);
+        va_end (args);
+        fputc ('\n', stderr);
+
+        exit (EXIT_FAILURE);
+}
+
+static void
+write_or_die (FILE *file, const void *data, gsize size)
+{
+        if (fwrite (data, 1, size, file) != size)
+                die ("Failed to write: %s", g_strerror (errno));
+}
+
+static gint
+compare_records (gconstpointer a,
+                 gconstpointer b)
+{
+        guint64 key_a = ((const DBRecord *) a)->key;
+        guint64 key_b = ((const DBRecord *) b)->key;
+
+        return (key_a > key_b) - (key_a < key_b);
+}
+
+static Sorter *
+sorter_new (gsize memory)
+{
+        Sorter *sorter = g_new0 (Sorter, 1);
+
+        sorter->max_buffered = MAX (memory / sizeof (DBRecord), 1);
+        sorter->buffer = g_new (DBRecord, sorter->max_buffered);
+        sorter->runs = g_ptr_array_new ();
+
+        return sorter;
+}
+
+static void
+sorter_free (Sorter *sorter)
+{
+        guint i;
+
+        for (i = 0; i < sorter->runs->len; i++) {
+                Run *run = g_ptr_array_index (sorter->runs, i);
+
+                fclose (run->file);
+                g_free (run);
+        }
+        g_ptr_array_unref (sorter->runs);
+        g_free (sorter->buffer);
+        g_free (sorter);
+}
+
+static void
+sorter_spill (Sorter *sorter)
+{
+        Run *run;
+
+        qsort (sorter->buffer,
+               sorter->n_buffered,
+               sizeof (DBRecord),
+               compare_records);
+
+        run = g_new0 (Run, 1);
+        run->file = tmpfile ();
+        if (run->file == NULL)
+                die ("Failed to create temporary file: %s",
+                     g_strerror (errno));
+        write_or_die (run->file,
+                      sorter->buffer,
+                      sorter->n_buffered * sizeof (DBRecord));
+        g_ptr_array_add (sorter->runs, run);
+
+        sorter->n_buffered = 0;
+}
+
+static void
+sorter_add (Sorter *sorter, const DBRecord *record)
+{
+        if (sorter->n_buffered == sorter->max_buffered)
+                sorter_spill (sorter);
+
+        sorter->buffer[sorter->n_buffered++] = *record;
+}
+
+static gboolean
+run_read (Run *run)
+{
+        return fread (&run->current, sizeof (DBRecord), 1, run->file) == 1;
+}
+
+static void
+heap_sift_down (GPtrArray *heap, guint i)
+{
+        while (TRUE) {
+                guint smallest = i, child;
+                gpointer tmp;
+
+                for (child = 2 * i + 1; child <= 2 * i + 2; child++) {
+                        Run *a, *b;
+
+                        if (child >= heap->len)
+                                break;
+                        a = g_ptr_array_index (heap, child);
+                        b = g_ptr_array_index (heap, smallest);
+                        if (a->current.key < b->current.key)
+                                smallest = child;
+                }
+                if (smallest == i)
+                        return;
+
+                tmp = heap->pdata[i];
+                heap->pdata[i] = heap->pdata[smallest];
+                heap->pdata[smallest] = tmp;
+                i = smallest;
+        }
+}
+
+static gboolean
+sorter_pop (Sorter *sorter, DBRecord *record)
+{
+        GPtrArray *heap = sorter->runs;
+        Run *run;
+
+        if (heap->len == 0) {
+                if (sorter->position == sorter->n_buffered)
+                        return FALSE;
+
+                *record = sorter->buffer[sorter->position++];
+                return TRUE;
+        }
+
+        run = g_ptr_array_index (heap, 0);
+        *record = run->current;
+        if (!run_read (run)) {
+                fclose (run->file);
+                g_free (run);
+                heap->pdata[0] = g_ptr_array_index (heap, heap->len - 1);
+                g_ptr_array_set_size (heap, heap->len - 1);
+        }
+        if (heap->len > 0)
+                heap_sift_down (heap, 0);
+
+        return TRUE;
+}
+
+static void
+sorter_finish (Sorter *sorter)
+{
+        guint i;
+
+        if (sorter->runs->len == 0) {
+                /* Everything fit in memory, no need to merge */
+                qsort (sorter->buffer,
+                       sorter->n_buffered,
+                       sizeof (DBRecord),
+                       compare_records);
+                goto out;
+        }
+
+        if (sorter->n_buffered > 0)
+                sorter_spill (sorter);
+        g_clear_pointer (&sorter->buffer, g_free);
+
+        for (i = 0; i < sorter->runs->len; ) {
+                Run *run = g_ptr_array_index (sorter->runs, i);
+
+                rewind (run->file);
+                if (run_read (run)) {
+                        i++;
+                } else {
+                        fclose (run->file);
+                        g_free (run);
+                        g_ptr_array_remove_index_fast (sorter->runs, i);
+                }
+        }
+        for (i = sorter->runs->len / 2; i > 0; i--)
+                heap_sift_down (sorter->runs, i - 1);
+
+out:
+        sorter->has_pending = sorter_pop (sorter, &sorter->pending);
+}
+
+/* Next record in key order. Of duplicate keys, the one with the smallest
+ * known range wins. */
+static gboolean
+sorter_next (Sorter *sorter, DBRecord *record)
+{
+        if (!sorter->has_pending)
+                return FALSE;
+
+        *record = sorter->pending;
+        while ((sorter->has_pending = sorter_pop (sorter, &sorter->pending)) &&
+               sorter->pending.key == record->key) {
+                if (sorter->pending.range != 0 &&
+                    (record->range == 0 ||
+                     sorter->pending.range < record->range))
+                        *record = sorter->pending;
+                sorter->n_duplicates++;
+        }
+
+        return TRUE;
+}
+
+static guint
+split_fields (char *line, char **fields)
+{
+        guint n_fields = 0;
+
+        g_strchomp (line);
+        while (n_fields < MAX_FIELDS) {
+                char *comma = strchr (line, ',');
+
+                fields[n_fields++] = line;
+                if (comma == NULL)
+                        break;
+                *comma = '\0';
+                line = comma + 1;
+        }
+
+        return n_fields;
+}
+
+static gboolean
+parse_coordinate (const char *str, gdouble max, gint32 *value)
+{
+        char *end;
+        gdouble coordinate;
+
+        coordinate = g_ascii_strtod (str, &end);
+        if (end == str || *end != '\0' || coordinate < -max || coordinate > max)
+                return FALSE;
+
+        *value = (gint32) (coordinate * 1e7 + (coordinate < 0 ? -0.5 : 0.5));
+
+        return TRUE;
+}
+
+static gboolean
+parse_uint (const char *str, guint64 max, guint64 *value)
+{
+        char *end;
+
+        errno = 0;
+        *value = g_ascii_strtoull (str, &end, 10);
+
+        return end != str && *end == '\0' && errno == 0 && *value <= max;
+}
+
+static gboolean
+parse_range (const char *str, guint32 *range)
+{
+        guint64 value;
+
+        if (*str == '\0') {
+                *range = 0;
+                return TRUE;
+        }
+
+        if (!parse_uint (str, G_MAXUINT64, &value))
+                return FALSE;
+        *range = MIN (value, G_MAXUINT32);
+
+        return TRUE;
+}
+
+/* Same representation as the WiFi source uses: first octet most significant */
+static gboolean
+parse_bssid (const char *str, guint64 *bssid)
+{
+        guint i;
+
+        *bssid = 0;
+        for (i = 0; i < 6; i++) {
+                gint high, low;
+
+                high = g_ascii_xdigit_value (str[0]);
+                low = g_ascii_xdigit_value (str[1]);
+                if (high < 0 || low < 0)
+                        return FALSE;
+                *bssid = (*bssid << 8) | (high << 4) | low;
+                str += 2;
+
+                if (i < 5) {
+                        if (*str != ':' && *str != '-')
+                                return FALSE;
+                        str++;
+                }
+        }
+
+        return *str == '\0';
+}
+
+/* bssid,latitude,longitude[,range] */
+static gboolean
+parse_wifi_line (char **fields, guint n_fields, DBRecord *record)
+{
+        if (n_fields < 3)
+                return FALSE;
+
+        return parse_bssid (fields[0], &record->key) &&
+               parse_coordinate (fields[1], 90, &record->latitude) &&
+               parse_coordinate (fields[2], 180, &record->longitude) &&
+               parse_range (n_fields > 3 ? fields[3] : "", &record->range);
+}
+
+/* radio,mcc,net,area,cell,unit,lon,lat,range,... */
+static gboolean
+parse_cell_line (char **fields, guint n_fields, DBRecord *record)
+{
+        guint64 mcc, mnc, lac, cell_id;
+
+        if (n_fields < 9)
+                return FALSE;
+
+        return parse_uint (fields[1], G_MAXUINT, &mcc) &&
+               parse_uint (fields[2], G_MAXUINT, &mnc) &&
+               parse_uint (fields[3], G_MAXULONG, &lac) &&
+               parse_uint (fields[4], G_MAXULONG, &cell_id) &&
+               db_cell_key (mcc, mnc, lac, cell_id, &record->key) &&
+               parse_coordinate (fields[7], 90, &record->latitude) &&
+               parse_coordinate (fields[6], 180, &record->longitude) &&
+               parse_range (fields[8], &record->range);
+}
+
+typedef gboolean (*ParseLineFunc) (char **fields,
+                                   guint  n_fields,
+                                   DBRecord *record);
+
+static void
+read_csv (const char   *path,
+          ParseLineFunc parse_line,
+          Sorter       *sorter)
+{
+        FILE *file;
+        char *line = NULL;
+        size_t line_size = 0;
+        guint64 n_lines = 0, n_skipped = 0;
+
+        if (strcmp (path, "-") == 0)
+                file = stdin;
+        else
+                file = fopen (path, "r");
+        if (file == NULL)
+                die ("Failed to open '%s': %s", path, g_strerror (errno));
+
+        while (getline (&line, &line_size, file) != -1) {
+                char *fields[MAX_FIELDS];
+                guint n_fields;
+                DBRecord record = { 0 };
+
+                n_lines++;
+                n_fields = split_fields (line, fields);
+                if (parse_line (fields, n_fields, &record))
+                        sorter_add (sorter, &record);
+                else
+                        n_skipped++;
+        }
+        if (ferror (file))
+                die ("Failed to read '%s': %s", path, g_strerror (errno));
+
+        /* Headers and cells that can't be keyed end up here */
+        g_print ("%s: %" G_GUINT64_FORMAT " lines, %" G_GUINT64_FORMAT
+                 " skipped\n",
+                 path,
+                 n_lines,
+                 n_skipped);
+
+        free (line);
+        if (file != stdin)
+                fclose (file);
+}
+
+static void
+pad_to_page (FILE *file)
+{
+        static const char zeros[DB_PAGE_SIZE] = { 0 };
+        off_t offset = ftello (file);
+
+        if (offset % DB_PAGE_SIZE != 0)
+                write_or_die (file, zeros, DB_PAGE_SIZE - offset % DB_PAGE_SIZE);
+}
+
+/* Lay @sorted out in Eytzinger order, starting at @out[@k] */
+static guint64
+eytzinger_fill (const DBIndexEntry *sorted,
+                DBIndexEntry       *out,
+                guint64             i,
+                guint64             k,
+                guint64             n)
+{
+        if (k <= n) {
+                i = eytzinger_fill (sorted, out, i, 2 * k, n);
+                out[k].last_key = GUINT64_TO_LE (sorted[i].last_key);
+                out[k].page = GUINT64_TO_LE (sorted[i].page);
+                i++;
+                i = eytzinger_fill (sorted, out, i, 2 * k + 1, n);
+        }
+
+        return i;
+}
+
+static void
+write_section (FILE      *file,
+               Sorter    *sorter,
+               DBSection *section)
+{
+        char page[DB_PAGE_SIZE];
+        DBRecord *page_records = (DBRecord *) page;
+        GArray *index;
+        DBIndexEntry *eytzinger;
+        DBRecord record;
+        guint64 n_records = 0;
+        guint n_in_page = 0;
+
+        sorter_finish (sorter);
+        index = g_array_new (FALSE, FALSE, sizeof (DBIndexEntry));
+        memset (page, 0, sizeof (page));
+
+        section->records_offset = GUINT64_TO_LE (ftello (file));
+        while (sorter_next (sorter, &record)) {
+                DBRecord *out = &page_records[n_in_page++];
+
+                out->key = GUINT64_TO_LE (record.key);
+                out->latitude = GINT32_TO_LE (record.latitude);
+                out->longitude = GINT32_TO_LE (record.longitude);
+                out->range = GUINT32_TO_LE (record.range);
+                n_records++;
+
+                if (n_in_page == DB_RECORDS_PER_PAGE) {
+                        DBIndexEntry entry = { record.key, index->len };
+
+                        write_or_die (file, page, sizeof (page));
+                        g_array_append_val (index, entry);
+                        memset (page, 0, sizeof (page));
+                        n_in_page = 0;
+                }
+        }
+        if (n_in_page > 0) {
+                DBIndexEntry entry = { record.key, index->len };
+
+                write_or_die (file, page, sizeof (page));
+                g_array_append_val (index, entry);
+        }
+
+        if (n_records > G_MAXUINT32)
+                die ("Too many records: %" G_GUINT64_FORMAT, n_records);
+
+        section->index_offset = GUINT64_TO_LE (ftello (file));
+        eytzinger = g_new0 (DBIndexEntry, index->len + 1);
+        eytzinger_fill ((DBIndexEntry *) index->data,
+                        eytzinger,
+                        0,
+                        1,
+                        index->len);
+        write_or_die (file,
+                      eytzinger,
+                      (index->len + 1) * sizeof (DBIndexEntry));
+        pad_to_page (file);
+
+        section->n_records = GUINT32_TO_LE (n_records);
+        section->n_pages = GUINT32_TO_LE (index->len);
+
+        g_print ("%" G_GUINT64_FORMAT " records in %u pages, %"
+                 G_GUINT64_FORMAT " duplicates dropped\n",
+                 n_records,
+                 index->len,
+                 sorter->n_duplicates);
+
+        g_free (eytzinger);
+        g_array_unref (index);
+}
+
+static void
+compile_table (FILE         *file,
+               char        **paths,
+               ParseLineFunc parse_line,
+               DBSection    *section)
+{
+        Sorter *sorter;
+        guint i;
+
+        sorter = sorter_new ((gsize) memory_mb * 1024 * 1024);
+        for (i = 0; paths != NULL && paths[i] != NULL; i++)
+                read_csv (paths[i], parse_line, sorter);
+        write_section (file, sorter, section);
+        sorter_free (sorter);
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext *context;
+        GError *error = NULL;
+        DBHeader header;
+        char *tmp_path;
+        FILE *file;
+
+        context = g_option_context_new ("OUTPUT");
+        g_option_context_set_summary
+                (context,
+                 "Compile CSV dumps of WiFi access points and cell towers "
+                 "into a Geoclue location database.");
+        g_option_context_add_main_entries (context, entries, NULL);
+        if (!g_option_context_parse (context, &argc, &argv, &error))
+                die ("%s", error->message);
+        if (argc != 2)
+                die ("Expected exactly one output file, see --help");
+        if (memory_mb <= 0)
+                die ("Invalid memory limit: %d", memory_mb);
+        g_option_context_free (context);
+
+        tmp_path = g_strdup_printf ("%s.tmp", argv[1]);
+        file = fopen (tmp_path, "w");
+        if (file == NULL)
+                die ("Failed to create '%s': %s",
+                     tmp_path,
+                     g_strerror (errno));
+
+        memset (&header, 0, sizeof (header));
+        memcpy (header.magic, DB_MAGIC, sizeof (header.magic));
+        header.version = GUINT32_TO_LE (DB_VERSION);
+        header.page_size = GUINT32_TO_LE (DB_PAGE_SIZE);
+
+        /* Placeholder until the sections are known */
+        write_or_die (file, &header, sizeof (header));
+        pad_to_page (file);
+
+        compile_table (file,
+                       wifi_files,
+                       parse_wifi_line,
+                       &header.sections[DB_TABLE_WIFI]);
+        compile_table (file,
+                       cell_files,
+                       parse_cell_line,
+                       &header.sections[DB_TABLE_CELL]);
+
+        if (fseeko (file, 0, SEEK_SET) != 0)
+                die ("Failed to seek: %s", g_strerror (errno));
+        write_or_die (file, &header, sizeof (header));
+        if (fclose (file) != 0)
+                die ("Failed to write '%s': %s",
+                     tmp_path,
+                     g_strerror (errno));
+
+        if (g_rename (tmp_path, argv[1]) != 0)
+                die ("Failed to rename '%s' to '%s': %s",
+                     tmp_path,
+                     argv[1],
+                     g_strerror (errno));
+
+        g_free (tmp_path);
+        g_strfreev (wifi_files);
+        g_strfreev (cell_files);
+
+        return EXIT_SUCCESS;
+}
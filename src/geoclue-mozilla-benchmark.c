@@ -0,0 +1,516 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * geoclue-mozilla-benchmark: time the Mozilla Location Service helpers on
+ * their own.
+ *
+ * "query" builds geolocate queries from 50, 200 and 1000 visible APs, which
+ * covers picking the APs to send and writing the body. Built against
+ * json-glib, it also times the JsonBuilder code that used to write them,
+ * sending every AP as that code did.
+ *
+ * "parse" reads geolocate responses, server errors and malformed ones,
+ * among them one nested well past the depth the parser accepts. Each must
+ * parse, or fail to, as expected. Built against json-glib, it also times
+ * the JsonParser code that used to read the valid ones.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#ifdef HAVE_JSON_GLIB
+#include <json-glib/json-glib.h>
+#endif
+
+#include "gclue-mozilla.h"
+#include "gclue-config.h"
+
+#ifndef CONFIG_FILE_PATH
+#error "The benchmark needs a configuration file of its own"
+#endif
+
+static const char * const cases[] = { "query", "parse", NULL };
+
+static const guint ap_counts[] = { 50, 200, 1000 };
+
+/* A handful of vendors, so that APs fall into groups as they do for real */
+static const guint8 ouis[][3] = {
+        { 0x00, 0x1a, 0x2b },
+        { 0x3c, 0x84, 0x6a },
+        { 0x74, 0xda, 0x38 },
+        { 0xa0, 0x63, 0x91 },
+        { 0xc8, 0x3a, 0x35 },
+        { 0xf4, 0xf2, 0x6d },
+};
+
+/* Commandline options */
+static int iterations = 1000;
+static int max_aps = -1;
+static int seed = 0;
+
+static GOptionEntry entries[] =
+{
+        { "iterations",
+          'i',
+          0,
+          G_OPTION_ARG_INT,
+          &iterations,
+          "Number of times to repeat each case. Default: 1000",
+          "N" },
+        { "max-aps",
+          'm',
+          0,
+          G_OPTION_ARG_INT,
+          &max_aps,
+          "Send at most N APs per query, 0 for all. Default: as configured "
+          "by default",
+          "N" },
+        { "seed",
+          's',
+          0,
+          G_OPTION_ARG_INT,
+          &seed,
+          "Seed for the generated APs. Default: 0",
+          "SEED" },
+        { NULL }
+};
+
+/* Well past MAX_JSON_DEPTH in gclue-mozilla.c */
+#define TOO_DEEP 1000
+
+#define RESPONSE_LOCATION \
+        "\"location\": {\"lat\": 51.5074, \"lng\": -0.1278}"
+
+typedef SoupMessage * (*CreateQueryFunc) (GArray       *bss_records,
+                                          GClue3GTower *tower);
+typedef GClueLocation * (*ParseResponseFunc) (const char *json,
+                                              gsize       length,
+                                              GError    **error);
+
+typedef struct
+{
+        const char *name;
+        char *json;
+        gboolean valid;
+} Response;
+
+static void
+die (const char *format, ...) G_GNUC_PRINTF (1, 2) G_GNUC_NORETURN;
+
+static void
+die (const char *format, ...)
+{
+        va_list args;
+
+        va_start (args, format);
+        vfprintf (stderr, format, args);
+        va_end (args);
+        fputc ('\n', stderr);
+
+        exit (EXIT_FAILURE);
+}
+
+static void
+write_config (void)
+{
+        GKeyFile *key_file;
+        GError *error = NULL;
+
+        key_file = g_key_file_new ();
+        g_key_file_set_string (key_file, "agent", "whitelist", "");
+        if (max_aps >= 0)
+                g_key_file_set_integer (key_file,
+                                        "wifi",
+                                        "query-max-aps",
+                                        max_aps);
+
+        if (!g_key_file_save_to_file (key_file, CONFIG_FILE_PATH, &error))
+                die ("Failed to write '%s': %s",
+                     CONFIG_FILE_PATH,
+                     error->message);
+        g_key_file_unref (key_file);
+}
+
+static GArray *
+create_bss_records (GRand *rand,
+                    guint  n_aps)
+{
+        GArray *records;
+        guint i;
+
+        records = g_array_sized_new (FALSE, TRUE, sizeof (GClueBSSRecord), n_aps);
+        g_array_set_size (records, n_aps);
+        for (i = 0; i < n_aps; i++) {
+                GClueBSSRecord *record =
+                        &g_array_index (records, GClueBSSRecord, i);
+                const guint8 *oui =
+                        ouis[g_rand_int_range (rand, 0, G_N_ELEMENTS (ouis))];
+                guint j;
+
+                memcpy (record->bssid, oui, 3);
+                for (j = 3; j < GCLUE_BSSID_LEN; j++)
+                        record->bssid[j] = g_rand_int_range (rand, 0, 256);
+                g_snprintf (record->mac,
+                            sizeof (record->mac),
+                            "%02x:%02x:%02x:%02x:%02x:%02x",
+                            record->bssid[0], record->bssid[1],
+                            record->bssid[2], record->bssid[3],
+                            record->bssid[4], record->bssid[5]);
+
+                record->signal = g_rand_int_range (rand, -95, -30);
+                if (g_rand_boolean (rand))
+                        record->frequency =
+                                2412 + 5 * g_rand_int_range (rand, 0, 13);
+                else
+                        record->frequency =
+                                5180 + 20 * g_rand_int_range (rand, 0, 25);
+        }
+
+        return records;
+}
+
+static SoupMessage *
+create_query (GArray       *bss_records,
+              GClue3GTower *tower)
+{
+        SoupMessage *query;
+        GError *error = NULL;
+
+        query = gclue_mozilla_create_query (bss_records, tower, &error);
+        if (query == NULL)
+                die ("Failed to create query: %s", error->message);
+
+        return query;
+}
+
+#ifdef HAVE_JSON_GLIB
+/* How queries were written before GClueJsonWriter */
+static SoupMessage *
+create_query_json_glib (GArray       *bss_records,
+                        GClue3GTower *tower)
+{
+        SoupMessage *ret;
+        JsonBuilder *builder;
+        JsonGenerator *generator;
+        JsonNode *root_node;
+        char *data;
+        gsize data_len;
+        const char *uri;
+        guint i;
+
+        builder = json_builder_new ();
+        json_builder_begin_object (builder);
+
+        json_builder_set_member_name (builder, "radioType");
+        json_builder_add_string_value (builder, "gsm");
+
+        json_builder_set_member_name (builder, "cellTowers");
+        json_builder_begin_array (builder);
+        json_builder_begin_object (builder);
+        json_builder_set_member_name (builder, "cellId");
+        json_builder_add_int_value (builder, tower->cell_id);
+        json_builder_set_member_name (builder, "mobileCountryCode");
+        json_builder_add_int_value (builder, tower->mcc);
+        json_builder_set_member_name (builder, "mobileNetworkCode");
+        json_builder_add_int_value (builder, tower->mnc);
+        json_builder_set_member_name (builder, "locationAreaCode");
+        json_builder_add_int_value (builder, tower->lac);
+        json_builder_end_object (builder);
+        json_builder_end_array (builder);
+
+        json_builder_set_member_name (builder, "wifiAccessPoints");
+        json_builder_begin_array (builder);
+        for (i = 0; i < bss_records->len; i++) {
+                const GClueBSSRecord *record =
+                        &g_array_index (bss_records, GClueBSSRecord, i);
+
+                json_builder_begin_object (builder);
+                json_builder_set_member_name (builder, "macAddress");
+                json_builder_add_string_value (builder, record->mac);
+                json_builder_set_member_name (builder, "signalStrength");
+                json_builder_add_int_value (builder, record->signal);
+                json_builder_end_object (builder);
+        }
+        json_builder_end_array (builder);
+        json_builder_end_object (builder);
+
+        generator = json_generator_new ();
+        root_node = json_builder_get_root (builder);
+        json_generator_set_root (generator, root_node);
+        data = json_generator_to_data (generator, &data_len);
+
+        json_node_free (root_node);
+        g_object_unref (builder);
+        g_object_unref (generator);
+
+        uri = gclue_config_get_wifi_url (gclue_config_get_singleton ());
+        ret = soup_message_new ("POST", uri);
+        soup_message_set_request (ret,
+                                  "application/json",
+                                  SOUP_MEMORY_TAKE,
+                                  data,
+                                  data_len);
+        g_debug ("Sending following request to '%s':\n%s", uri, data);
+
+        return ret;
+}
+#endif
+
+static void
+time_queries (const char      *name,
+              CreateQueryFunc  func,
+              GArray          *bss_records,
+              GClue3GTower    *tower)
+{
+        SoupMessage *query;
+        gsize body_length;
+        gint64 start, elapsed;
+        int i;
+
+        query = func (bss_records, tower);
+        body_length = query->request_body->length;
+        g_object_unref (query);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < iterations; i++)
+                g_object_unref (func (bss_records, tower));
+        elapsed = g_get_monotonic_time () - start;
+
+        g_print ("  %-12s %9.2f us/query, %6" G_GSIZE_FORMAT " bytes\n",
+                 name,
+                 (gdouble) elapsed / iterations,
+                 body_length);
+}
+
+static void
+benchmark_queries (void)
+{
+        GClue3GTower tower = { 262, 1, 12345, 1234567 };
+        GRand *rand;
+        guint i;
+
+        rand = g_rand_new_with_seed (seed);
+        for (i = 0; i < G_N_ELEMENTS (ap_counts); i++) {
+                GArray *bss_records;
+
+                bss_records = create_bss_records (rand, ap_counts[i]);
+                g_print ("Query with %u APs:\n", ap_counts[i]);
+                time_queries ("writer", create_query, bss_records, &tower);
+#ifdef HAVE_JSON_GLIB
+                time_queries ("json-glib",
+                              create_query_json_glib,
+                              bss_records,
+                              &tower);
+#endif
+                g_array_unref (bss_records);
+        }
+        g_rand_free (rand);
+}
+
+static GClueLocation *
+parse_response (const char *json,
+                gsize       length,
+                GError    **error)
+{
+        return gclue_mozilla_parse_response (json, length, error);
+}
+
+#ifdef HAVE_JSON_GLIB
+/* How responses were read before the pull parser, copy of the body
+ * included. Only fit for valid responses. */
+static GClueLocation *
+parse_response_json_glib (const char *json,
+                          gsize       length,
+                          GError    **error)
+{
+        JsonParser *parser;
+        JsonObject *object, *loc_object;
+        GClueLocation *location = NULL;
+        char *contents;
+
+        contents = g_strndup (json, length);
+        parser = json_parser_new ();
+        if (json_parser_load_from_data (parser, contents, -1, error)) {
+                object = json_node_get_object (json_parser_get_root (parser));
+                loc_object = json_object_get_object_member (object,
+                                                            "location");
+                location = gclue_location_new
+                        (json_object_get_double_member (loc_object, "lat"),
+                         json_object_get_double_member (loc_object, "lng"),
+                         json_object_get_double_member (object, "accuracy"));
+        }
+        g_object_unref (parser);
+        g_free (contents);
+
+        return location;
+}
+#endif
+
+/* A valid response with a member of nested arrays, @depth deep */
+static char *
+create_nested_response (guint depth)
+{
+        GString *json;
+        guint i;
+
+        json = g_string_new ("{" RESPONSE_LOCATION ", \"accuracy\": 25.0, "
+                             "\"nested\": ");
+        for (i = 0; i < depth; i++)
+                g_string_append_c (json, '[');
+        for (i = 0; i < depth; i++)
+                g_string_append_c (json, ']');
+        g_string_append_c (json, '}');
+
+        return g_string_free (json, FALSE);
+}
+
+static void
+time_responses (const char        *name,
+                ParseResponseFunc  func,
+                const Response    *response)
+{
+        GClueLocation *location;
+        GError *error = NULL;
+        gsize length;
+        gint64 start, elapsed;
+        int i;
+
+        length = strlen (response->json);
+        location = func (response->json, length, &error);
+        if ((location != NULL) != response->valid)
+                die ("%s: '%s' response %s: %s",
+                     name,
+                     response->name,
+                     location != NULL ? "parsed" : "failed to parse",
+                     error != NULL ? error->message : "no error");
+        g_clear_object (&location);
+        g_clear_error (&error);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < iterations; i++) {
+                location = func (response->json, length, &error);
+                g_clear_object (&location);
+                g_clear_error (&error);
+        }
+        elapsed = g_get_monotonic_time () - start;
+
+        g_print ("  %-12s %9.2f us/response\n",
+                 name,
+                 (gdouble) elapsed / iterations);
+}
+
+static void
+benchmark_responses (void)
+{
+        Response responses[] = {
+                { "plain",
+                  g_strdup ("{" RESPONSE_LOCATION ", \"accuracy\": 25.0}"),
+                  TRUE },
+                { "fallback",
+                  g_strdup ("{" RESPONSE_LOCATION ", \"accuracy\": 5000.0, "
+                            "\"fallback\": \"ipf\"}"),
+                  TRUE },
+                { "nested",
+                  create_nested_response (16),
+                  TRUE },
+                { "server-error",
+                  g_strdup ("{\"error\": {\"errors\": [{\"domain\": "
+                            "\"geolocation\", \"reason\": \"notFound\", "
+                            "\"message\": \"Not found\"}], \"code\": 404, "
+                            "\"message\": \"Not found\"}}"),
+                  FALSE },
+                { "truncated",
+                  g_strdup ("{" RESPONSE_LOCATION ", \"accura"),
+                  FALSE },
+                { "no-accuracy",
+                  g_strdup ("{" RESPONSE_LOCATION "}"),
+                  FALSE },
+                { "too-deep",
+                  create_nested_response (TOO_DEEP),
+                  FALSE },
+        };
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (responses); i++) {
+                g_print ("Response '%s':\n", responses[i].name);
+                time_responses ("pull-parser", parse_response, &responses[i]);
+#ifdef HAVE_JSON_GLIB
+                if (responses[i].valid)
+                        time_responses ("json-glib",
+                                        parse_response_json_glib,
+                                        &responses[i]);
+#endif
+                g_free (responses[i].json);
+        }
+}
+
+/* All cases run if none are given */
+static gboolean
+should_run (int          argc,
+            char       **argv,
+            const char  *name)
+{
+        int i;
+
+        if (argc == 1)
+                return TRUE;
+
+        for (i = 1; i < argc; i++)
+                if (strcmp (argv[i], name) == 0)
+                        return TRUE;
+
+        return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext *context;
+        GError *error = NULL;
+        int i;
+
+        context = g_option_context_new ("[query] [parse]");
+        g_option_context_set_summary
+                (context,
+                 "Time building geolocate queries and reading the responses. "
+                 "Runs all cases unless some are given.");
+        g_option_context_add_main_entries (context, entries, NULL);
+        if (!g_option_context_parse (context, &argc, &argv, &error))
+                die ("%s", error->message);
+        if (iterations <= 0)
+                die ("Invalid number of iterations: %d", iterations);
+        g_option_context_free (context);
+
+        for (i = 1; i < argc; i++)
+                if (!g_strv_contains (cases, argv[i]))
+                        die ("Unknown case '%s', see --help", argv[i]);
+
+        write_config ();
+
+        if (should_run (argc, argv, "query"))
+                benchmark_queries ();
+        if (should_run (argc, argv, "parse"))
+                benchmark_responses ();
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,541 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Copyright 2026 The Droidian Project
+ *
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Runs the BSS tracker against a stand-in for NetworkManager on a private
+ * bus, without wpa_supplicant, to check the records it makes of the access
+ * points and when it asks for scans. */
+
+#include <string.h>
+#include <time.h>
+#include <gio/gio.h>
+#include "gclue-bss-tracker.h"
+
+#define NM_SERVICE            "org.freedesktop.NetworkManager"
+#define NM_PATH               "/org/freedesktop/NetworkManager"
+#define NM_DEVICE_INTERFACE   NM_SERVICE ".Device"
+#define NM_WIRELESS_INTERFACE NM_SERVICE ".Device.Wireless"
+#define NM_AP_INTERFACE       NM_SERVICE ".AccessPoint"
+
+#define DEVICE_PATH NM_PATH "/Devices/1"
+
+/* Seconds to wait for the tracker before failing */
+#define TIMEOUT 10
+
+static const char introspection_xml[] =
+        "<node>"
+        "  <interface name='org.freedesktop.NetworkManager'>"
+        "    <method name='GetDevices'>"
+        "      <arg name='devices' type='ao' direction='out'/>"
+        "    </method>"
+        "    <signal name='DeviceAdded'>"
+        "      <arg name='device_path' type='o'/>"
+        "    </signal>"
+        "    <signal name='DeviceRemoved'>"
+        "      <arg name='device_path' type='o'/>"
+        "    </signal>"
+        "  </interface>"
+        "  <interface name='org.freedesktop.NetworkManager.Device'>"
+        "    <property name='DeviceType' type='u' access='read'/>"
+        "  </interface>"
+        "  <interface name='org.freedesktop.NetworkManager.Device.Wireless'>"
+        "    <method name='RequestScan'>"
+        "      <arg name='options' type='a{sv}' direction='in'/>"
+        "    </method>"
+        "    <property name='AccessPoints' type='ao' access='read'/>"
+        "    <property name='LastScan' type='x' access='read'/>"
+        "    <signal name='AccessPointAdded'>"
+        "      <arg name='access_point' type='o'/>"
+        "    </signal>"
+        "    <signal name='AccessPointRemoved'>"
+        "      <arg name='access_point' type='o'/>"
+        "    </signal>"
+        "  </interface>"
+        "  <interface name='org.freedesktop.NetworkManager.AccessPoint'>"
+        "    <property name='HwAddress' type='s' access='read'/>"
+        "    <property name='Ssid' type='ay' access='read'/>"
+        "    <property name='Strength' type='y' access='read'/>"
+        "    <property name='Frequency' type='u' access='read'/>"
+        "  </interface>"
+        "</node>";
+
+typedef struct {
+        const char *hw_address;
+        const char *ssid;
+        guint8 strength; /* % */
+        guint32 frequency;
+} MockAP;
+
+/* What NetworkManager knows about before we ask it to scan */
+static const MockAP known_aps[] = {
+        { "00:1A:2B:3C:4D:01", "strong", 100, 2412 },
+        { "00:1A:2B:3C:4D:02", "middling", 50, 5180 },
+        { "00:1A:2B:3C:4D:03", "weak", 0, 2437 },
+        { "00:1A:2B:3C:4D:04", "private_nomap", 100, 2462 },
+};
+
+/* What it finds when we do */
+static const MockAP scanned_ap = { "0A:0B:0C:0D:0E:0F", "found", 80, 5745 };
+
+typedef struct {
+        GDBusConnection *connection;
+        GDBusNodeInfo *node;
+        GPtrArray *ap_paths;
+        GArray *ap_ids;      /* Registration of each of ap_paths */
+        gint64 last_scan;    /* Boot time in ms, -1 for never */
+        guint num_scans;     /* RequestScan calls */
+} MockNM;
+
+static MockNM mock;
+
+static gint64
+get_boot_time (void)
+{
+        struct timespec ts;
+
+        g_assert_cmpint (clock_gettime (CLOCK_BOOTTIME, &ts), ==, 0);
+
+        return (gint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static GVariant *
+get_ap_property (const MockAP *ap,
+                 const char   *property_name)
+{
+        if (g_strcmp0 (property_name, "HwAddress") == 0)
+                return g_variant_new_string (ap->hw_address);
+        if (g_strcmp0 (property_name, "Ssid") == 0)
+                return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                  ap->ssid,
+                                                  strlen (ap->ssid),
+                                                  sizeof (guint8));
+        if (g_strcmp0 (property_name, "Strength") == 0)
+                return g_variant_new_byte (ap->strength);
+        if (g_strcmp0 (property_name, "Frequency") == 0)
+                return g_variant_new_uint32 (ap->frequency);
+
+        return NULL;
+}
+
+static GVariant *
+get_access_points (void)
+{
+        return g_variant_new_objv ((const char * const *) mock.ap_paths->pdata,
+                                   mock.ap_paths->len);
+}
+
+static GVariant *
+handle_get_property (GDBusConnection *connection,
+                     const char      *sender,
+                     const char      *object_path,
+                     const char      *interface_name,
+                     const char      *property_name,
+                     GError         **error,
+                     gpointer         user_data)
+{
+        GVariant *value = NULL;
+
+        if (g_strcmp0 (interface_name, NM_AP_INTERFACE) == 0)
+                value = get_ap_property (user_data, property_name);
+        else if (g_strcmp0 (property_name, "DeviceType") == 0)
+                value = g_variant_new_uint32 (2); /* WiFi */
+        else if (g_strcmp0 (property_name, "AccessPoints") == 0)
+                value = get_access_points ();
+        else if (g_strcmp0 (property_name, "LastScan") == 0)
+                value = g_variant_new_int64 (mock.last_scan);
+
+        if (value == NULL)
+                g_set_error (error,
+                             G_DBUS_ERROR,
+                             G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                             "No property '%s'",
+                             property_name);
+
+        return value;
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char            *sender,
+                    const char            *object_path,
+                    const char            *interface_name,
+                    const char            *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data);
+
+static const GDBusInterfaceVTable vtable = {
+        handle_method_call,
+        handle_get_property,
+        NULL
+};
+
+static void
+emit_signal (const char *path,
+             const char *interface,
+             const char *signal,
+             GVariant   *parameters)
+{
+        GError *error = NULL;
+
+        if (!g_dbus_connection_emit_signal (mock.connection,
+                                            NULL,
+                                            path,
+                                            interface,
+                                            signal,
+                                            parameters,
+                                            &error))
+                g_error ("Failed to emit %s: %s", signal, error->message);
+}
+
+static guint
+register_object (const char *path,
+                 const char *interface,
+                 gpointer    user_data)
+{
+        GError *error = NULL;
+        guint id;
+
+        id = g_dbus_connection_register_object
+                (mock.connection,
+                 path,
+                 g_dbus_node_info_lookup_interface (mock.node, interface),
+                 &vtable,
+                 user_data,
+                 NULL,
+                 &error);
+        if (id == 0)
+                g_error ("Failed to export %s: %s", path, error->message);
+
+        return id;
+}
+
+static const char *
+add_ap (const MockAP *ap)
+{
+        char *path;
+        guint id;
+
+        path = g_strdup_printf (NM_PATH "/AccessPoint/%u",
+                                mock.ap_paths->len + 1);
+        id = register_object (path, NM_AP_INTERFACE, (gpointer) ap);
+        g_ptr_array_add (mock.ap_paths, path);
+        g_array_append_val (mock.ap_ids, id);
+
+        return path;
+}
+
+/* Finds the access point, reports LastScan as changed, the way
+ * NetworkManager does it */
+static void
+scan (void)
+{
+        GVariantBuilder changed;
+
+        mock.num_scans++;
+        emit_signal (DEVICE_PATH,
+                     NM_WIRELESS_INTERFACE,
+                     "AccessPointAdded",
+                     g_variant_new ("(o)", add_ap (&scanned_ap)));
+
+        mock.last_scan = get_boot_time ();
+        g_variant_builder_init (&changed, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&changed,
+                               "{sv}",
+                               "AccessPoints",
+                               get_access_points ());
+        g_variant_builder_add (&changed,
+                               "{sv}",
+                               "LastScan",
+                               g_variant_new_int64 (mock.last_scan));
+        emit_signal (DEVICE_PATH,
+                     "org.freedesktop.DBus.Properties",
+                     "PropertiesChanged",
+                     g_variant_new ("(sa{sv}as)",
+                                    NM_WIRELESS_INTERFACE,
+                                    &changed,
+                                    NULL));
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char            *sender,
+                    const char            *object_path,
+                    const char            *interface_name,
+                    const char            *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        if (g_strcmp0 (method_name, "GetDevices") == 0) {
+                const char *devices[] = { DEVICE_PATH };
+
+                g_dbus_method_invocation_return_value
+                        (invocation,
+                         g_variant_new ("(@ao)",
+                                        g_variant_new_objv (devices, 1)));
+        } else if (g_strcmp0 (method_name, "RequestScan") == 0) {
+                g_dbus_method_invocation_return_value (invocation, NULL);
+                scan ();
+        } else {
+                g_dbus_method_invocation_return_error
+                        (invocation,
+                         G_DBUS_ERROR,
+                         G_DBUS_ERROR_UNKNOWN_METHOD,
+                         "No method '%s'",
+                         method_name);
+        }
+}
+
+static void
+start_mock_nm (const char *address)
+{
+        GError *error = NULL;
+        GVariant *result;
+        guint32 reply;
+        guint i;
+
+        mock.connection = g_dbus_connection_new_for_address_sync
+                (address,
+                 G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                 G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                 NULL,
+                 NULL,
+                 &error);
+        if (mock.connection == NULL)
+                g_error ("Failed to connect to the private bus: %s",
+                         error->message);
+
+        mock.node = g_dbus_node_info_new_for_xml (introspection_xml, &error);
+        g_assert_no_error (error);
+        mock.ap_paths = g_ptr_array_new_with_free_func (g_free);
+        mock.ap_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+        mock.last_scan = -1;
+
+        register_object (NM_PATH, NM_SERVICE, NULL);
+        register_object (DEVICE_PATH, NM_DEVICE_INTERFACE, NULL);
+        register_object (DEVICE_PATH, NM_WIRELESS_INTERFACE, NULL);
+        for (i = 0; i < G_N_ELEMENTS (known_aps); i++)
+                add_ap (&known_aps[i]);
+
+        /* Take the name before anyone can look for it */
+        result = g_dbus_connection_call_sync (mock.connection,
+                                              "org.freedesktop.DBus",
+                                              "/org/freedesktop/DBus",
+                                              "org.freedesktop.DBus",
+                                              "RequestName",
+                                              g_variant_new ("(su)",
+                                                             NM_SERVICE,
+                                                             0),
+                                              G_VARIANT_TYPE ("(u)"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              NULL,
+                                              &error);
+        g_assert_no_error (error);
+        g_variant_get (result, "(u)", &reply);
+        g_assert_cmpuint (reply, ==, 1); /* Primary owner */
+        g_variant_unref (result);
+}
+
+/* Back to what NetworkManager knew before any test asked it to scan */
+static void
+reset_mock_nm (gint64 last_scan)
+{
+        while (mock.ap_paths->len > G_N_ELEMENTS (known_aps)) {
+                guint last = mock.ap_paths->len - 1;
+
+                g_dbus_connection_unregister_object
+                        (mock.connection,
+                         g_array_index (mock.ap_ids, guint, last));
+                g_ptr_array_remove_index (mock.ap_paths, last);
+                g_array_remove_index (mock.ap_ids, last);
+        }
+        mock.last_scan = last_scan;
+        mock.num_scans = 0;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+        g_error ("Timed out waiting for %s", (const char *) user_data);
+
+        return FALSE;
+}
+
+static void
+wait_for (GClueBSSTracker *tracker,
+          const char      *signal)
+{
+        GMainLoop *loop;
+        gulong handler;
+        guint timeout;
+
+        loop = g_main_loop_new (NULL, FALSE);
+        handler = g_signal_connect_swapped (tracker,
+                                            signal,
+                                            G_CALLBACK (g_main_loop_quit),
+                                            loop);
+        timeout = g_timeout_add_seconds (TIMEOUT,
+                                         on_timeout,
+                                         (gpointer) signal);
+        g_main_loop_run (loop);
+
+        g_source_remove (timeout);
+        g_signal_handler_disconnect (tracker, handler);
+        g_main_loop_unref (loop);
+}
+
+/* Runs one scan of the tracker, as its only user */
+static GArray *
+run_scan (GClueBSSTracker *tracker,
+          GObject         *owner,
+          guint            scan_interval)
+{
+        while (!gclue_bss_tracker_has_device (tracker))
+                wait_for (tracker, "device-changed");
+
+        gclue_bss_tracker_start (tracker, owner, scan_interval);
+        wait_for (tracker, "scan-done");
+
+        return gclue_bss_tracker_get_records (tracker);
+}
+
+static const GClueBSSRecord *
+find_record (GArray     *records,
+             const char *mac)
+{
+        guint i;
+
+        for (i = 0; i < records->len; i++) {
+                const GClueBSSRecord *record =
+                        &g_array_index (records, GClueBSSRecord, i);
+
+                if (g_strcmp0 (record->mac, mac) == 0)
+                        return record;
+        }
+
+        return NULL;
+}
+
+static void
+assert_record (GArray     *records,
+               const char *mac,
+               gint16      signal,
+               guint16     frequency,
+               gboolean    ignore)
+{
+        const GClueBSSRecord *record;
+        guint8 bssid[GCLUE_BSSID_LEN];
+        guint i;
+
+        record = find_record (records, mac);
+        g_assert_nonnull (record);
+
+        for (i = 0; i < GCLUE_BSSID_LEN; i++)
+                bssid[i] = g_ascii_xdigit_value (mac[i * 3]) << 4 |
+                           g_ascii_xdigit_value (mac[i * 3 + 1]);
+        g_assert_cmpmem (record->bssid, GCLUE_BSSID_LEN,
+                         bssid, GCLUE_BSSID_LEN);
+        g_assert_cmpint (record->signal, ==, signal);
+        g_assert_cmpuint (record->frequency, ==, frequency);
+        g_assert_cmpint (record->ignore, ==, ignore);
+}
+
+/* NetworkManager scanned a moment ago, so we take what it has */
+static void
+test_fresh_scan (void)
+{
+        GClueBSSTracker *tracker;
+        GObject *owner;
+        GArray *records;
+
+        reset_mock_nm (get_boot_time ());
+        tracker = gclue_bss_tracker_get_singleton ();
+        owner = g_object_new (G_TYPE_OBJECT, NULL);
+
+        records = run_scan (tracker, owner, 60);
+        g_assert_cmpuint (mock.num_scans, ==, 0);
+
+        /* Strength maps linearly from 0 to 100% onto -100 to -40 dBm, and
+         * MACs come out in lower case */
+        g_assert_cmpuint (records->len, ==, 3);
+        assert_record (records, "00:1a:2b:3c:4d:01", -40, 2412, FALSE);
+        assert_record (records, "00:1a:2b:3c:4d:02", -70, 5180, FALSE);
+        assert_record (records, "00:1a:2b:3c:4d:03", -100, 2437, TRUE);
+        g_assert_null (find_record (records, "00:1a:2b:3c:4d:04"));
+
+        gclue_bss_tracker_stop (tracker, owner);
+        g_object_unref (owner);
+        g_object_unref (tracker);
+}
+
+/* NetworkManager's last scan is older than we want, so we ask for one, and
+ * the scan is only done once we know about what it found */
+static void
+test_stale_scan (void)
+{
+        GClueBSSTracker *tracker;
+        GObject *owner;
+        GArray *records;
+
+        reset_mock_nm (get_boot_time () - 10 * 1000);
+        tracker = gclue_bss_tracker_get_singleton ();
+        owner = g_object_new (G_TYPE_OBJECT, NULL);
+
+        records = run_scan (tracker, owner, 5);
+        g_assert_cmpuint (mock.num_scans, ==, 1);
+
+        g_assert_cmpuint (records->len, ==, 4);
+        assert_record (records, "00:1a:2b:3c:4d:01", -40, 2412, FALSE);
+        assert_record (records, "0a:0b:0c:0d:0e:0f", -52, 5745, FALSE);
+
+        gclue_bss_tracker_stop (tracker, owner);
+        g_object_unref (owner);
+        g_object_unref (tracker);
+}
+
+int
+main (int argc, char **argv)
+{
+        GTestDBus *bus;
+        int ret;
+
+        g_test_init (&argc, &argv, NULL);
+
+        /* Both the tracker and GClueNMWifi talk to the system bus */
+        bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+        g_test_dbus_up (bus);
+        g_setenv ("DBUS_SYSTEM_BUS_ADDRESS",
+                  g_test_dbus_get_bus_address (bus),
+                  TRUE);
+        start_mock_nm (g_test_dbus_get_bus_address (bus));
+
+        g_test_add_func ("/nm-wifi/fresh-scan", test_fresh_scan);
+        g_test_add_func ("/nm-wifi/stale-scan", test_stale_scan);
+        ret = g_test_run ();
+
+        g_object_unref (mock.connection);
+        g_dbus_node_info_unref (mock.node);
+        g_ptr_array_unref (mock.ap_paths);
+        g_array_unref (mock.ap_ids);
+        g_test_dbus_down (bus);
+        g_object_unref (bus);
+
+        return ret;
+}